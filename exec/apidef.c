@@ -107,6 +107,7 @@ static struct corosync_api_v1 apidef_corosync_api_v1 = {
 	.ipc_dispatch_iov_send = cs_ipcs_dispatch_iov_send,
 	.ipc_refcnt_inc =  cs_ipc_refcnt_inc,
 	.ipc_refcnt_dec = cs_ipc_refcnt_dec,
+	.ipc_dispatch_batch_set = cs_ipcs_dispatch_batch_set,
 	.totem_nodeid_get = totempg_my_nodeid_get,
 	.totem_family_get = totempg_my_family_get,
 	.totem_mcast = main_mcast,
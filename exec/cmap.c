@@ -46,11 +46,14 @@
 #include <qb/qblist.h>
 #include <qb/qbipcs.h>
 #include <qb/qbipc_common.h>
+#include <qb/qbdefs.h>
+#include <qb/qbmap.h>
 
 #include <corosync/corotypes.h>
 #include <corosync/corodefs.h>
 #include <corosync/mar_gen.h>
 #include <corosync/ipc_cmap.h>
+#include <corosync/cmap.h>
 #include <corosync/logsys.h>
 #include <corosync/coroapi.h>
 #include <corosync/icmap.h>
@@ -64,6 +67,27 @@ LOGSYS_DECLARE_SUBSYS ("CMAP");
 #define MAX_REQ_EXEC_CMAP_MCAST_ITEMS		32
 #define ICMAP_VALUETYPE_NOT_EXIST		0
 
+/*
+ * Same as IPC_RESPONSE_SIZE of the libraries. Whole iter_bulk response has
+ * to fit into it.
+ */
+#ifdef HAVE_SMALL_MEMORY_FOOTPRINT
+#define CMAP_IPC_RESPONSE_SIZE			1024*64
+#else
+#define CMAP_IPC_RESPONSE_SIZE			8192*128
+#endif
+
+/*
+ * Largest coalescing window of a track in milliseconds
+ */
+#define CMAP_TRACK_COALESCE_WINDOW_MAX		60000
+
+/*
+ * Largest batch notification, which fits into the smallest dispatch buffer
+ * of libcmap
+ */
+#define CMAP_NOTIFY_BATCH_MAX_LEN		(64 * 1024)
+
 struct cmap_map {
 	cs_error_t (*map_get)(const char *key_name,
 			      void *value,
@@ -129,13 +153,41 @@ struct cmap_conn_info {
 	struct cmap_map map_fns;
 };
 
-typedef uint64_t cmap_iter_handle_t;
-typedef uint64_t cmap_track_handle_t;
+/*
+ * State behind an iterator handle. A key which didn't fit into a bulk
+ * response is kept in pending_key and returned first by the next call.
+ */
+struct cmap_iter {
+	icmap_iter_t iter;
+	int pending;
+	char pending_key[ICMAP_KEYNAME_MAXLEN + 1];
+};
+
+/*
+ * Change of one key collected by coalescing track. Values are copies.
+ */
+struct cmap_track_change {
+	int32_t event;
+	struct icmap_notify_value new_val;
+	struct icmap_notify_value old_val;
+	struct qb_list_head list;
+	char key_name[];
+};
 
 struct cmap_track_user_data {
 	void *conn;
 	cmap_track_handle_t track_handle;
 	uint64_t track_inst_handle;
+	/*
+	 * Coalescing tracks only (coalesce_window != 0). Changes are kept by
+	 * key name in changes and on change_list_head until the timer sends
+	 * them.
+	 */
+	uint32_t coalesce_window;
+	qb_map_t *changes;
+	struct qb_list_head change_list_head;
+	corosync_timer_handle_t timer;
+	int timer_running;
 };
 
 enum cmap_message_req_types {
@@ -154,6 +206,7 @@ static int cmap_exec_exit_fn(void);
 
 static int cmap_lib_init_fn (void *conn);
 static int cmap_lib_exit_fn (void *conn);
+static void cmap_track_user_data_free(struct cmap_track_user_data *cmap_track_user_data);
 
 static void message_handler_req_lib_cmap_set(void *conn, const void *message);
 static void message_handler_req_lib_cmap_delete(void *conn, const void *message);
@@ -162,6 +215,7 @@ static void message_handler_req_lib_cmap_adjust_int(void *conn, const void *mess
 static void message_handler_req_lib_cmap_iter_init(void *conn, const void *message);
 static void message_handler_req_lib_cmap_iter_next(void *conn, const void *message);
 static void message_handler_req_lib_cmap_iter_finalize(void *conn, const void *message);
+static void message_handler_req_lib_cmap_iter_bulk(void *conn, const void *message);
 static void message_handler_req_lib_cmap_track_add(void *conn, const void *message);
 static void message_handler_req_lib_cmap_track_delete(void *conn, const void *message);
 static void message_handler_req_lib_cmap_set_current_map(void *conn, const void *message);
@@ -250,6 +304,10 @@ static struct corosync_lib_handler cmap_lib_engine[] =
 		.lib_handler_fn				= message_handler_req_lib_cmap_set_current_map,
 		.flow_control				= CS_LIB_FLOW_CONTROL_NOT_REQUIRED
 	},
+	{ /* 10 */
+		.lib_handler_fn				= message_handler_req_lib_cmap_iter_bulk,
+		.flow_control				= CS_LIB_FLOW_CONTROL_NOT_REQUIRED
+	},
 };
 
 static struct corosync_exec_handler cmap_exec_engine[] =
@@ -278,7 +336,8 @@ struct corosync_service_engine cmap_service_engine = {
 	.sync_init				= cmap_sync_init,
 	.sync_process				= cmap_sync_process,
 	.sync_activate				= cmap_sync_activate,
-	.sync_abort				= cmap_sync_abort
+	.sync_abort				= cmap_sync_abort,
+	.sync_independent			= 1
 };
 
 struct corosync_service_engine *cmap_get_service_engine_ver0 (void)
@@ -386,7 +445,7 @@ static int cmap_lib_exit_fn (void *conn)
 {
 	struct cmap_conn_info *conn_info = (struct cmap_conn_info *)api->ipc_private_data_get (conn);
 	hdb_handle_t iter_handle = 0;
-	icmap_iter_t *iter;
+	struct cmap_iter *iter;
 	hdb_handle_t track_handle = 0;
 	icmap_track_t *track;
 
@@ -396,7 +455,7 @@ static int cmap_lib_exit_fn (void *conn)
         while (hdb_iterator_next(&conn_info->iter_db,
                 (void*)&iter, &iter_handle) == 0) {
 
-		conn_info->map_fns.map_iter_finalize(*iter);
+		conn_info->map_fns.map_iter_finalize(iter->iter);
 
 		(void)hdb_handle_put (&conn_info->iter_db, iter_handle);
         }
@@ -407,7 +466,7 @@ static int cmap_lib_exit_fn (void *conn)
         while (hdb_iterator_next(&conn_info->track_db,
                 (void*)&track, &track_handle) == 0) {
 
-		free(conn_info->map_fns.map_track_get_user_data(*track));
+		cmap_track_user_data_free(conn_info->map_fns.map_track_get_user_data(*track));
 
 		conn_info->map_fns.map_track_delete(*track);
 
@@ -611,13 +670,35 @@ static void message_handler_req_lib_cmap_adjust_int(void *conn, const void *mess
 	api->ipc_response_send(conn, &res_lib_cmap_adjust_int, sizeof(res_lib_cmap_adjust_int));
 }
 
+/*
+ * Next key of iteration, the pending one first. Pending key is looked up
+ * again because it may have been changed or deleted since it was returned.
+ */
+static const char *cmap_iter_next_key(
+	struct cmap_conn_info *conn_info,
+	struct cmap_iter *iter,
+	size_t *value_len,
+	icmap_value_types_t *type)
+{
+
+	if (iter->pending) {
+		iter->pending = 0;
+
+		if (conn_info->map_fns.map_get(iter->pending_key, NULL, value_len, type) == CS_OK) {
+			return (iter->pending_key);
+		}
+	}
+
+	return (conn_info->map_fns.map_iter_next(iter->iter, value_len, type));
+}
+
 static void message_handler_req_lib_cmap_iter_init(void *conn, const void *message)
 {
 	const struct req_lib_cmap_iter_init *req_lib_cmap_iter_init = message;
 	struct res_lib_cmap_iter_init res_lib_cmap_iter_init;
 	cs_error_t ret;
 	icmap_iter_t iter;
-	icmap_iter_t *hdb_iter;
+	struct cmap_iter *hdb_iter;
 	cmap_iter_handle_t handle = 0ULL;
 	const char *prefix;
 	struct cmap_conn_info *conn_info = (struct cmap_conn_info *)api->ipc_private_data_get (conn);
@@ -634,7 +715,7 @@ static void message_handler_req_lib_cmap_iter_init(void *conn, const void *messa
 		goto reply_send;
 	}
 
-	ret = hdb_error_to_cs(hdb_handle_create(&conn_info->iter_db, sizeof(iter), &handle));
+	ret = hdb_error_to_cs(hdb_handle_create(&conn_info->iter_db, sizeof(*hdb_iter), &handle));
 	if (ret != CS_OK) {
 		goto reply_send;
 	}
@@ -644,7 +725,8 @@ static void message_handler_req_lib_cmap_iter_init(void *conn, const void *messa
 		goto reply_send;
 	}
 
-	*hdb_iter = iter;
+	memset(hdb_iter, 0, sizeof(*hdb_iter));
+	hdb_iter->iter = iter;
 
 	(void)hdb_handle_put (&conn_info->iter_db, handle);
 
@@ -663,7 +745,7 @@ static void message_handler_req_lib_cmap_iter_next(void *conn, const void *messa
 	const struct req_lib_cmap_iter_next *req_lib_cmap_iter_next = message;
 	struct res_lib_cmap_iter_next res_lib_cmap_iter_next;
 	cs_error_t ret;
-	icmap_iter_t *iter;
+	struct cmap_iter *iter;
 	size_t value_len = 0;
 	icmap_value_types_t type = 0;
 	const char *res = NULL;
@@ -675,7 +757,7 @@ static void message_handler_req_lib_cmap_iter_next(void *conn, const void *messa
 		goto reply_send;
 	}
 
-	res = conn_info->map_fns.map_iter_next(*iter, &value_len, &type);
+	res = cmap_iter_next_key(conn_info, iter, &value_len, &type);
 	if (res == NULL) {
 		ret = CS_ERR_NO_SECTIONS;
 	}
@@ -706,7 +788,7 @@ static void message_handler_req_lib_cmap_iter_finalize(void *conn, const void *m
 	const struct req_lib_cmap_iter_finalize *req_lib_cmap_iter_finalize = message;
 	struct res_lib_cmap_iter_finalize res_lib_cmap_iter_finalize;
 	cs_error_t ret;
-	icmap_iter_t *iter;
+	struct cmap_iter *iter;
 	struct cmap_conn_info *conn_info = (struct cmap_conn_info *)api->ipc_private_data_get (conn);
 
 	ret = hdb_error_to_cs(hdb_handle_get(&conn_info->iter_db,
@@ -715,7 +797,7 @@ static void message_handler_req_lib_cmap_iter_finalize(void *conn, const void *m
 		goto reply_send;
 	}
 
-	conn_info->map_fns.map_iter_finalize(*iter);
+	conn_info->map_fns.map_iter_finalize(iter->iter);
 
 	(void)hdb_handle_destroy(&conn_info->iter_db, req_lib_cmap_iter_finalize->iter_handle);
 
@@ -730,13 +812,126 @@ reply_send:
 	api->ipc_response_send(conn, &res_lib_cmap_iter_finalize, sizeof(res_lib_cmap_iter_finalize));
 }
 
-static void cmap_notify_fn(int32_t event,
+static void message_handler_req_lib_cmap_iter_bulk(void *conn, const void *message)
+{
+	const struct req_lib_cmap_iter_bulk *req_lib_cmap_iter_bulk = message;
+	struct res_lib_cmap_iter_bulk *res_lib_cmap_iter_bulk;
+	struct res_lib_cmap_iter_bulk error_res_lib_cmap_iter_bulk;
+	struct cmap_bulk_item *item;
+	cs_error_t ret;
+	struct cmap_iter *iter;
+	size_t res_lib_cmap_iter_bulk_size;
+	size_t max_len;
+	size_t items_len;
+	size_t item_len;
+	size_t key_len;
+	size_t value_len;
+	uint64_t items;
+	icmap_value_types_t type;
+	const char *key_name;
+	struct cmap_conn_info *conn_info = (struct cmap_conn_info *)api->ipc_private_data_get (conn);
+
+	/*
+	 * max_len comes from client, don't trust it
+	 */
+	max_len = req_lib_cmap_iter_bulk->max_len;
+	if (max_len > CMAP_IPC_RESPONSE_SIZE - sizeof(*res_lib_cmap_iter_bulk)) {
+		max_len = CMAP_IPC_RESPONSE_SIZE - sizeof(*res_lib_cmap_iter_bulk);
+	}
+
+	res_lib_cmap_iter_bulk_size = sizeof(*res_lib_cmap_iter_bulk) + max_len;
+	res_lib_cmap_iter_bulk = malloc(res_lib_cmap_iter_bulk_size);
+	if (res_lib_cmap_iter_bulk == NULL) {
+		ret = CS_ERR_NO_MEMORY;
+		goto error_exit;
+	}
+
+	ret = hdb_error_to_cs(hdb_handle_get(&conn_info->iter_db,
+				req_lib_cmap_iter_bulk->iter_handle, (void *)&iter));
+	if (ret != CS_OK) {
+		free(res_lib_cmap_iter_bulk);
+		goto error_exit;
+	}
+
+	items = 0;
+	items_len = 0;
+
+	while ((key_name = cmap_iter_next_key(conn_info, iter, &value_len, &type)) != NULL) {
+		key_len = strlen(key_name);
+		item_len = CMAP_BULK_ITEM_LEN(key_len, value_len);
+
+		if (item_len > max_len - items_len) {
+			/*
+			 * Keep key for next call
+			 */
+			if (key_name != iter->pending_key) {
+				strcpy(iter->pending_key, key_name);
+			}
+			iter->pending = 1;
+
+			if (items == 0) {
+				ret = CS_ERR_TOO_BIG;
+			}
+			break;
+		}
+
+		item = (struct cmap_bulk_item *)(res_lib_cmap_iter_bulk->items_data + items_len);
+		memset(item, 0, item_len);
+		memcpy(item->key_name, key_name, key_len);
+
+		if (conn_info->map_fns.map_get(key_name, CMAP_BULK_ITEM_VALUE(item),
+		    &value_len, &type) != CS_OK) {
+			continue;
+		}
+
+		item->item_len = item_len;
+		item->key_len = key_len;
+		item->value_len = value_len;
+		item->type = type;
+
+		items++;
+		items_len += item_len;
+	}
+
+	if (key_name == NULL && items == 0) {
+		ret = CS_ERR_NO_SECTIONS;
+	}
+
+	(void)hdb_handle_put (&conn_info->iter_db, req_lib_cmap_iter_bulk->iter_handle);
+
+	if (ret != CS_OK) {
+		free(res_lib_cmap_iter_bulk);
+		goto error_exit;
+	}
+
+	res_lib_cmap_iter_bulk_size = sizeof(*res_lib_cmap_iter_bulk) + items_len;
+
+	res_lib_cmap_iter_bulk->header.size = res_lib_cmap_iter_bulk_size;
+	res_lib_cmap_iter_bulk->header.id = MESSAGE_RES_CMAP_ITER_BULK;
+	res_lib_cmap_iter_bulk->header.error = ret;
+	res_lib_cmap_iter_bulk->items = items;
+	res_lib_cmap_iter_bulk->items_len = items_len;
+
+	api->ipc_response_send(conn, res_lib_cmap_iter_bulk, res_lib_cmap_iter_bulk_size);
+	free(res_lib_cmap_iter_bulk);
+
+	return ;
+
+error_exit:
+	memset(&error_res_lib_cmap_iter_bulk, 0, sizeof(error_res_lib_cmap_iter_bulk));
+	error_res_lib_cmap_iter_bulk.header.size = sizeof(error_res_lib_cmap_iter_bulk);
+	error_res_lib_cmap_iter_bulk.header.id = MESSAGE_RES_CMAP_ITER_BULK;
+	error_res_lib_cmap_iter_bulk.header.error = ret;
+
+	api->ipc_response_send(conn, &error_res_lib_cmap_iter_bulk, sizeof(error_res_lib_cmap_iter_bulk));
+}
+
+static void cmap_notify_send(struct cmap_track_user_data *cmap_track_user_data,
+		int32_t event,
 		const char *key_name,
 		struct icmap_notify_value new_val,
-		struct icmap_notify_value old_val,
-		void *user_data)
+		struct icmap_notify_value old_val)
 {
-	struct cmap_track_user_data *cmap_track_user_data = (struct cmap_track_user_data *)user_data;
 	struct res_lib_cmap_notify_callback res_lib_cmap_notify_callback;
 	struct iovec iov[3];
 
@@ -768,6 +963,257 @@ static void cmap_notify_fn(int32_t event,
 	api->ipc_dispatch_iov_send(cmap_track_user_data->conn, iov, 3);
 }
 
+static int cmap_notify_value_copy(struct icmap_notify_value *dst, const struct icmap_notify_value *src)
+{
+	void *data = NULL;
+
+	if (src->len > 0) {
+		data = malloc(src->len);
+		if (data == NULL) {
+			return (-1);
+		}
+		memcpy(data, src->data, src->len);
+	}
+
+	dst->type = src->type;
+	dst->len = src->len;
+	dst->data = data;
+
+	return (0);
+}
+
+static void cmap_track_change_free(struct cmap_track_change *change)
+{
+
+	free((void *)change->new_val.data);
+	free((void *)change->old_val.data);
+	free(change);
+}
+
+static void cmap_track_changes_free(struct cmap_track_user_data *cmap_track_user_data)
+{
+	struct qb_list_head *iter, *tmp_iter;
+	struct cmap_track_change *change;
+
+	if (cmap_track_user_data->changes != NULL) {
+		qb_map_destroy(cmap_track_user_data->changes);
+		cmap_track_user_data->changes = NULL;
+	}
+
+	qb_list_for_each_safe(iter, tmp_iter, &cmap_track_user_data->change_list_head) {
+		change = qb_list_entry(iter, struct cmap_track_change, list);
+
+		qb_list_del(&change->list);
+		cmap_track_change_free(change);
+	}
+}
+
+static void cmap_track_user_data_free(struct cmap_track_user_data *cmap_track_user_data)
+{
+
+	if (cmap_track_user_data->timer_running) {
+		api->timer_delete(cmap_track_user_data->timer);
+	}
+
+	cmap_track_changes_free(cmap_track_user_data);
+
+	free(cmap_track_user_data);
+}
+
+/*
+ * Store change into batch buffer at offset. Returns length of the stored item.
+ */
+static size_t cmap_notify_batch_item_store(char *buf, const struct cmap_track_change *change)
+{
+	struct cmap_notify_batch_item *item = (struct cmap_notify_batch_item *)buf;
+	size_t key_len = strlen(change->key_name);
+	size_t item_len;
+	char *data;
+
+	item_len = CMAP_NOTIFY_BATCH_ITEM_LEN(key_len, change->new_val.len, change->old_val.len);
+	memset(buf, 0, item_len);
+	item->item_len = item_len;
+	item->event = change->event;
+	item->key_len = key_len;
+	item->new_value_type = change->new_val.type;
+	item->old_value_type = change->old_val.type;
+	item->new_value_len = change->new_val.len;
+	item->old_value_len = change->old_val.len;
+
+	memcpy(item->key_name, change->key_name, key_len);
+	data = item->key_name + CMAP_NOTIFY_BATCH_ALIGN(key_len + 1);
+	if (change->new_val.len > 0) {
+		memcpy(data, change->new_val.data, change->new_val.len);
+	}
+	data += CMAP_NOTIFY_BATCH_ALIGN(change->new_val.len);
+	if (change->old_val.len > 0) {
+		memcpy(data, change->old_val.data, change->old_val.len);
+	}
+
+	return (item_len);
+}
+
+static void cmap_notify_batch_send(struct cmap_track_user_data *cmap_track_user_data,
+		struct res_lib_cmap_notify_batch_callback *res)
+{
+
+	res->header.size = sizeof(*res) + res->items_len;
+	res->header.id = MESSAGE_RES_CMAP_NOTIFY_BATCH_CALLBACK;
+	res->header.error = CS_OK;
+	res->track_inst_handle = cmap_track_user_data->track_inst_handle;
+
+	api->ipc_dispatch_send(cmap_track_user_data->conn, res, res->header.size);
+
+	res->items = 0;
+	res->items_len = 0;
+}
+
+/*
+ * End of coalescing window. Send all collected changes, in as few batch
+ * notifications as possible, sorted by key name.
+ */
+static void cmap_track_flush_fn(void *data)
+{
+	struct cmap_track_user_data *cmap_track_user_data = (struct cmap_track_user_data *)data;
+	struct res_lib_cmap_notify_batch_callback *res;
+	struct cmap_track_change *change;
+	qb_map_iter_t *miter;
+	size_t item_len;
+
+	cmap_track_user_data->timer_running = 0;
+
+	res = malloc(CMAP_NOTIFY_BATCH_MAX_LEN);
+	if (res == NULL) {
+		log_printf(LOGSYS_LEVEL_ERROR, "Can't allocate cmap batch notification, changes dropped");
+		goto free_changes;
+	}
+	memset(res, 0, sizeof(*res));
+
+	miter = qb_map_iter_create(cmap_track_user_data->changes);
+	while (qb_map_iter_next(miter, (void **)&change)) {
+		item_len = CMAP_NOTIFY_BATCH_ITEM_LEN(strlen(change->key_name),
+		    change->new_val.len, change->old_val.len);
+
+		if (sizeof(*res) + res->items_len + item_len > CMAP_NOTIFY_BATCH_MAX_LEN) {
+			if (res->items > 0) {
+				cmap_notify_batch_send(cmap_track_user_data, res);
+			}
+
+			if (sizeof(*res) + item_len > CMAP_NOTIFY_BATCH_MAX_LEN) {
+				cmap_notify_send(cmap_track_user_data, change->event, change->key_name,
+				    change->new_val, change->old_val);
+				continue;
+			}
+		}
+
+		res->items_len += cmap_notify_batch_item_store((char *)res->items_data + res->items_len,
+		    change);
+		res->items++;
+	}
+	qb_map_iter_free(miter);
+
+	if (res->items > 0) {
+		cmap_notify_batch_send(cmap_track_user_data, res);
+	}
+	free(res);
+
+free_changes:
+	cmap_track_changes_free(cmap_track_user_data);
+}
+
+/*
+ * Merge change into the changes collected in current window. First old value
+ * and last new value of key are kept. Returns -1 if change can't be stored.
+ */
+static int cmap_track_change_add(struct cmap_track_user_data *cmap_track_user_data,
+		int32_t event,
+		const char *key_name,
+		const struct icmap_notify_value *new_val,
+		const struct icmap_notify_value *old_val)
+{
+	struct cmap_track_change *change;
+	struct icmap_notify_value val;
+
+	if (cmap_track_user_data->changes == NULL) {
+		cmap_track_user_data->changes = qb_skiplist_create();
+		if (cmap_track_user_data->changes == NULL) {
+			return (-1);
+		}
+	}
+
+	change = qb_map_get(cmap_track_user_data->changes, key_name);
+	if (change == NULL) {
+		change = malloc(sizeof(*change) + strlen(key_name) + 1);
+		if (change == NULL) {
+			return (-1);
+		}
+		memset(change, 0, sizeof(*change));
+		strcpy(change->key_name, key_name);
+
+		if (cmap_notify_value_copy(&change->new_val, new_val) != 0 ||
+		    cmap_notify_value_copy(&change->old_val, old_val) != 0) {
+			cmap_track_change_free(change);
+			return (-1);
+		}
+		change->event = event;
+
+		qb_map_put(cmap_track_user_data->changes, change->key_name, change);
+		qb_list_add_tail(&change->list, &cmap_track_user_data->change_list_head);
+	} else {
+		if (change->event == ICMAP_TRACK_ADD && event == ICMAP_TRACK_DELETE) {
+			/*
+			 * Key was created and deleted in the same window
+			 */
+			qb_map_rm(cmap_track_user_data->changes, change->key_name);
+			qb_list_del(&change->list);
+			cmap_track_change_free(change);
+
+			return (0);
+		}
+
+		if (cmap_notify_value_copy(&val, new_val) != 0) {
+			return (-1);
+		}
+		free((void *)change->new_val.data);
+		change->new_val = val;
+
+		if (change->event == ICMAP_TRACK_DELETE && event == ICMAP_TRACK_ADD) {
+			change->event = ICMAP_TRACK_MODIFY;
+		} else if (change->event != ICMAP_TRACK_ADD) {
+			change->event = event;
+		}
+	}
+
+	if (!cmap_track_user_data->timer_running) {
+		if (api->timer_add_duration(
+		    (unsigned long long)cmap_track_user_data->coalesce_window * QB_TIME_NS_IN_MSEC,
+		    cmap_track_user_data, cmap_track_flush_fn, &cmap_track_user_data->timer) != 0) {
+			log_printf(LOGSYS_LEVEL_ERROR, "Can't add cmap coalescing timer");
+			cmap_track_flush_fn(cmap_track_user_data);
+		} else {
+			cmap_track_user_data->timer_running = 1;
+		}
+	}
+
+	return (0);
+}
+
+static void cmap_notify_fn(int32_t event,
+		const char *key_name,
+		struct icmap_notify_value new_val,
+		struct icmap_notify_value old_val,
+		void *user_data)
+{
+	struct cmap_track_user_data *cmap_track_user_data = (struct cmap_track_user_data *)user_data;
+
+	if (cmap_track_user_data->coalesce_window != 0 &&
+	    cmap_track_change_add(cmap_track_user_data, event, key_name, &new_val, &old_val) == 0) {
+		return ;
+	}
+
+	cmap_notify_send(cmap_track_user_data, event, key_name, new_val, old_val);
+}
+
 static void message_handler_req_lib_cmap_track_add(void *conn, const void *message)
 {
 	const struct req_lib_cmap_track_add *req_lib_cmap_track_add = message;
@@ -788,6 +1234,17 @@ static void message_handler_req_lib_cmap_track_add(void *conn, const void *messa
 		goto reply_send;
 	}
 	memset(cmap_track_user_data, 0, sizeof(*cmap_track_user_data));
+	qb_list_init(&cmap_track_user_data->change_list_head);
+
+	if (req_lib_cmap_track_add->header.size >= sizeof(struct req_lib_cmap_track_add)) {
+		if (req_lib_cmap_track_add->coalesce_window > CMAP_TRACK_COALESCE_WINDOW_MAX) {
+			free(cmap_track_user_data);
+			ret = CS_ERR_INVALID_PARAM;
+
+			goto reply_send;
+		}
+		cmap_track_user_data->coalesce_window = req_lib_cmap_track_add->coalesce_window;
+	}
 
 	if (req_lib_cmap_track_add->key_name.length > 0) {
 		key_name = (char *)req_lib_cmap_track_add->key_name.value;
@@ -855,7 +1312,7 @@ static void message_handler_req_lib_cmap_track_delete(void *conn, const void *me
 	track_inst_handle = ((struct cmap_track_user_data *)
 	    conn_info->map_fns.map_track_get_user_data(*track))->track_inst_handle;
 
-	free(conn_info->map_fns.map_track_get_user_data(*track));
+	cmap_track_user_data_free(conn_info->map_fns.map_track_get_user_data(*track));
 
 	ret = conn_info->map_fns.map_track_delete(*track);
 
@@ -881,7 +1338,7 @@ static void message_handler_req_lib_cmap_set_current_map(void *conn, const void
 	struct cmap_conn_info *conn_info = (struct cmap_conn_info *)api->ipc_private_data_get (conn);
 	int handles_open = 0;
 	hdb_handle_t iter_handle = 0;
-	icmap_iter_t *iter;
+	struct cmap_iter *iter;
 	hdb_handle_t track_handle = 0;
 	icmap_track_t *track;
 
@@ -800,7 +800,10 @@ static int main_config_parser_cb(const char *path,
 			    (strcmp(path, "totem.knet_pmtud_interval") == 0) ||
 			    (strcmp(path, "totem.knet_mtu") == 0) ||
 			    (strcmp(path, "totem.knet_compression_threshold") == 0) ||
-			    (strcmp(path, "totem.netmtu") == 0)) {
+			    (strcmp(path, "totem.netmtu") == 0) ||
+			    (strcmp(path, "totem.recv_batch") == 0) ||
+			    (strcmp(path, "totem.pack_max_delay") == 0) ||
+			    (strcmp(path, "totem.pack_flush_size") == 0)) {
 				val_type = ICMAP_VALUETYPE_UINT32;
 				if (safe_atoq(value, &val, val_type) != 0) {
 					goto safe_atoq_error;
@@ -889,6 +892,16 @@ static int main_config_parser_cb(const char *path,
 			break;
 
 		case MAIN_CP_CB_DATA_STATE_SYSTEM:
+			if (strcmp(path, "system.ipc_outq_max") == 0) {
+				val_type = ICMAP_VALUETYPE_UINT32;
+				if (safe_atoq(value, &val, val_type) != 0) {
+					goto safe_atoq_error;
+				}
+				if ((cs_err = icmap_set_uint32_r(config_map, path, val)) != CS_OK) {
+					goto icmap_set_error;
+				}
+				add_as_string = 0;
+			}
 			if (strcmp(path, "system.qb_ipc_type") == 0) {
 				if ((strcmp(value, "native") != 0) &&
 				    (strcmp(value, "shm") != 0) &&
@@ -906,6 +919,14 @@ static int main_config_parser_cb(const char *path,
 					return (0);
 				}
 			}
+			if (strcmp(path, "system.stats_shm") == 0) {
+				if ((strcmp(value, "yes") != 0) &&
+				    (strcmp(value, "no") != 0)) {
+					*error_string = "Invalid system.stats_shm value";
+
+					return (0);
+				}
+			}
 			if (strcmp(path, "system.move_to_root_cgroup") == 0) {
 				if ((strcmp(value, "yes") != 0) &&
 				    (strcmp(value, "no") != 0) &&
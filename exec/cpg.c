@@ -56,6 +56,7 @@
 
 #include <qb/qblist.h>
 #include <qb/qbmap.h>
+#include <qb/qbloop.h>
 
 #include <corosync/corotypes.h>
 #include <qb/qbipc_common.h>
@@ -74,7 +75,13 @@
 
 LOGSYS_DECLARE_SUBSYS ("CPG");
 
-#define GROUP_HASH_SIZE 32
+#define GROUP_HASH_SIZE 256
+#define NODE_HASH_SIZE 64
+
+/*
+ * Largest number of asynchronous multicasts acknowledged in one event
+ */
+#define CPG_MCAST_ASYNC_ACK_MAX 64
 
 enum cpg_message_req_types {
 	MESSAGE_REQ_EXEC_CPG_PROCJOIN = 0,
@@ -84,6 +91,7 @@ enum cpg_message_req_types {
 	MESSAGE_REQ_EXEC_CPG_DOWNLIST_OLD = 4,
 	MESSAGE_REQ_EXEC_CPG_DOWNLIST = 5,
 	MESSAGE_REQ_EXEC_CPG_PARTIAL_MCAST = 6,
+	MESSAGE_REQ_EXEC_CPG_JOINLIST_DIGEST = 7,
 };
 
 struct zcb_mapped {
@@ -137,7 +145,10 @@ enum cpd_state {
 
 enum cpg_sync_state {
 	CPGSYNC_DOWNLIST,
-	CPGSYNC_JOINLIST
+	CPGSYNC_DIGEST,
+	CPGSYNC_DIGEST_WAIT,
+	CPGSYNC_JOINLIST,
+	CPGSYNC_DONE
 };
 
 static struct qb_list_head joinlist_messages_head;
@@ -151,9 +162,20 @@ struct cpg_pd {
 	int initial_totem_conf_sent;
 	uint64_t transition_counter; /* These two are used when sending fragmented messages */
 	uint64_t initial_transition_counter;
+	/*
+	 * Asynchronous multicasts handled but not acknowledged yet. The
+	 * acknowledgement goes out in one event once the main loop is idle.
+	 */
+	uint32_t async_completed;
+	uint32_t async_failed;
+	uint32_t async_partial_offset; /* bytes of the fragmented message handled */
+	int async_partial_failed;
+	int async_ack_scheduled;
 	struct qb_list_head list;
 	struct qb_list_head iteration_instance_list_head;
 	struct qb_list_head zcb_mapped_list_head;
+	struct cpg_group *group;
+	struct qb_list_head group_list; /* on the cpg_group cpd list */
 };
 
 struct cpg_iteration_instance {
@@ -181,13 +203,56 @@ static enum cpg_sync_state my_sync_state = CPGSYNC_DOWNLIST;
 
 static mar_cpg_ring_id_t last_sync_ring_id;
 
+/*
+ * Key of process_info in the cpg_group pi_map. Fixed width hex of nodeid
+ * and pid, so the string order of the skiplist is the (nodeid, pid) order.
+ */
+#define PROCESS_INFO_KEY_LEN 17
+
 struct process_info {
 	unsigned int nodeid;
 	uint32_t pid;
 	mar_cpg_name_t group;
-	struct qb_list_head list; /* on the group_info members list */
+	struct qb_list_head list; /* on the cpg_node process list */
+	struct cpg_group *cpg_group;
+	char key[PROCESS_INFO_KEY_LEN];
+	int joinlist_seen;
+};
+
+/*
+ * Index of local connections and process_info entries by group name, so
+ * message delivery only looks at the members of the addressed group.
+ * pi_map keeps the members sorted by nodeid and pid, nodes counts the
+ * members per nodeid.
+ */
+struct cpg_group_node {
+	unsigned int nodeid;
+	unsigned int count;
+};
+
+struct cpg_group {
+	mar_cpg_name_t group_name;
+	struct qb_list_head cpd_list_head;
+	qb_map_t *pi_map;
+	struct cpg_group_node *nodes;
+	unsigned int nodes_entries;
+	unsigned int nodes_size;
+	struct qb_list_head list; /* on the group hash chain */
 };
-QB_LIST_DECLARE (process_info_list_head);
+
+static struct qb_list_head cpg_group_hash[GROUP_HASH_SIZE];
+
+/*
+ * Index of process_info entries by nodeid, so node down and joinlist
+ * handling only look at the processes of the nodes involved.
+ */
+struct cpg_node {
+	unsigned int nodeid;
+	struct qb_list_head pi_list_head;
+	struct qb_list_head list; /* on the node hash chain */
+};
+
+static struct qb_list_head cpg_node_hash[NODE_HASH_SIZE];
 
 struct join_list_entry {
 	uint32_t pid;
@@ -200,6 +265,40 @@ struct join_list_confchg_data {
 	int join_list_entries;
 };
 
+/*
+ * Joinlist digests. Before sending joinlists, every node multicasts for
+ * each member the number and a hash of the processes it believes that
+ * member has. A member sends its joinlist only if some node's belief
+ * differs from its own, and a node only processes the joinlists of
+ * members it was wrong about.
+ *
+ * Entries follow my_member_list.
+ */
+struct joinlist_digest_node {
+	int downlist_received;
+	int digest_received;
+	/* What this member says about itself */
+	int self_valid;
+	mar_uint32_t self_count;
+	mar_uint64_t self_hash;
+	/* What this node believes */
+	mar_uint32_t my_count;
+	mar_uint64_t my_hash;
+	/* First belief received and whether any other differed */
+	int ref_valid;
+	mar_uint32_t ref_count;
+	mar_uint64_t ref_hash;
+	int send_needed;
+};
+
+static struct joinlist_digest_node my_digest_nodes[PROCESSOR_COUNT_MAX];
+
+/*
+ * Cleared when a member too old to exchange digests is seen. All members
+ * then send and process full joinlists.
+ */
+static int joinlist_digest_mode;
+
 /*
  * Service Interfaces required by service_message_handler struct
  */
@@ -209,6 +308,8 @@ static int cpg_lib_init_fn (void *conn);
 
 static int cpg_lib_exit_fn (void *conn);
 
+static void cpg_mcast_async_ack_job (void *data);
+
 static void message_handler_req_exec_cpg_procjoin (
 	const void *message,
 	unsigned int nodeid);
@@ -237,6 +338,10 @@ static void message_handler_req_exec_cpg_downlist (
 	const void *message,
 	unsigned int nodeid);
 
+static void message_handler_req_exec_cpg_joinlist_digest (
+	const void *message,
+	unsigned int nodeid);
+
 static void exec_cpg_procjoin_endian_convert (void *msg);
 
 static void exec_cpg_joinlist_endian_convert (void *msg);
@@ -249,6 +354,8 @@ static void exec_cpg_downlist_endian_convert_old (void *msg);
 
 static void exec_cpg_downlist_endian_convert (void *msg);
 
+static void exec_cpg_joinlist_digest_endian_convert (void *msg);
+
 static void message_handler_req_lib_cpg_join (void *conn, const void *message);
 
 static void message_handler_req_lib_cpg_leave (void *conn, const void *message);
@@ -259,6 +366,18 @@ static void message_handler_req_lib_cpg_mcast (void *conn, const void *message);
 
 static void message_handler_req_lib_cpg_partial_mcast (void *conn, const void *message);
 
+static void message_handler_req_lib_cpg_mcast_async (void *conn, const void *message);
+
+static void message_handler_req_lib_cpg_partial_mcast_async (void *conn, const void *message);
+
+static void message_refused_req_lib_cpg_mcast_async (void *conn, const void *message, int error);
+
+static void message_refused_req_lib_cpg_partial_mcast_async (void *conn, const void *message, int error);
+
+static void message_handler_req_lib_cpg_mcast_batch (void *conn, const void *message);
+
+static void message_handler_req_lib_cpg_event_batch_enable (void *conn, const void *message);
+
 static void message_handler_req_lib_cpg_membership (void *conn,
 						    const void *message);
 
@@ -295,6 +414,8 @@ static int cpg_exec_send_downlist(void);
 
 static int cpg_exec_send_joinlist(void);
 
+static int cpg_exec_send_joinlist_digest(void);
+
 static void downlist_inform_clients (void);
 
 static void joinlist_inform_clients (void);
@@ -395,6 +516,24 @@ static struct corosync_lib_handler cpg_lib_engine[] =
 		.lib_handler_fn				= message_handler_req_lib_cpg_partial_mcast,
 		.flow_control				= CS_LIB_FLOW_CONTROL_REQUIRED
 	},
+	{ /* 13 - MESSAGE_REQ_CPG_MCAST_ASYNC */
+		.lib_handler_fn				= message_handler_req_lib_cpg_mcast_async,
+		.flow_control				= CS_LIB_FLOW_CONTROL_REQUIRED,
+		.lib_refused_fn				= message_refused_req_lib_cpg_mcast_async
+	},
+	{ /* 14 - MESSAGE_REQ_CPG_PARTIAL_MCAST_ASYNC */
+		.lib_handler_fn				= message_handler_req_lib_cpg_partial_mcast_async,
+		.flow_control				= CS_LIB_FLOW_CONTROL_REQUIRED,
+		.lib_refused_fn				= message_refused_req_lib_cpg_partial_mcast_async
+	},
+	{ /* 15 - MESSAGE_REQ_CPG_MCAST_BATCH */
+		.lib_handler_fn				= message_handler_req_lib_cpg_mcast_batch,
+		.flow_control				= CS_LIB_FLOW_CONTROL_REQUIRED
+	},
+	{ /* 16 - MESSAGE_REQ_CPG_EVENT_BATCH_ENABLE */
+		.lib_handler_fn				= message_handler_req_lib_cpg_event_batch_enable,
+		.flow_control				= CS_LIB_FLOW_CONTROL_NOT_REQUIRED
+	},
 
 };
 
@@ -428,6 +567,10 @@ static struct corosync_exec_handler cpg_exec_engine[] =
 		.exec_handler_fn	= message_handler_req_exec_cpg_partial_mcast,
 		.exec_endian_convert_fn	= exec_cpg_partial_mcast_endian_convert
 	},
+	{ /* 7 - MESSAGE_REQ_EXEC_CPG_JOINLIST_DIGEST */
+		.exec_handler_fn	= message_handler_req_exec_cpg_joinlist_digest,
+		.exec_endian_convert_fn	= exec_cpg_joinlist_digest_endian_convert
+	},
 };
 
 struct corosync_service_engine cpg_service_engine = {
@@ -448,7 +591,8 @@ struct corosync_service_engine cpg_service_engine = {
 	.sync_init                              = cpg_sync_init,
 	.sync_process                           = cpg_sync_process,
 	.sync_activate                          = cpg_sync_activate,
-	.sync_abort                             = cpg_sync_abort
+	.sync_abort                             = cpg_sync_abort,
+	.sync_independent                       = 1
 };
 
 struct corosync_service_engine *cpg_get_service_engine_ver0 (void)
@@ -496,6 +640,22 @@ struct req_exec_cpg_downlist {
 	/* downlist below */
 	mar_uint32_t left_nodes __attribute__((aligned(8)));
 	mar_uint32_t nodeids[PROCESSOR_COUNT_MAX]  __attribute__((aligned(8)));
+	/* added later, older nodes send a shorter message */
+	mar_uint32_t flags __attribute__((aligned(8)));
+};
+
+#define CPG_DOWNLIST_FLAG_JOINLIST_DIGEST	1
+
+struct joinlist_digest_entry {
+	mar_uint32_t nodeid __attribute__((aligned(8)));
+	mar_uint32_t count;
+	mar_uint64_t hash __attribute__((aligned(8)));
+};
+
+struct req_exec_cpg_joinlist_digest {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+	mar_uint32_t entries __attribute__((aligned(8)));
+	struct joinlist_digest_entry digests[PROCESSOR_COUNT_MAX] __attribute__((aligned(8)));
 };
 
 struct joinlist_msg {
@@ -507,6 +667,256 @@ struct joinlist_msg {
 
 static struct req_exec_cpg_downlist g_req_exec_cpg_downlist;
 
+static unsigned int cpg_group_hash_index (const mar_cpg_name_t *group_name)
+{
+	unsigned int hash = 2166136261U;
+	unsigned int length;
+	unsigned int i;
+
+	length = group_name->length;
+	if (length > CPG_MAX_NAME_LENGTH) {
+		length = CPG_MAX_NAME_LENGTH;
+	}
+
+	for (i = 0; i < length; i++) {
+		hash ^= (unsigned char)group_name->value[i];
+		hash *= 16777619U;
+	}
+
+	return (hash % GROUP_HASH_SIZE);
+}
+
+static struct cpg_group *cpg_group_find (const mar_cpg_name_t *group_name)
+{
+	struct qb_list_head *iter;
+	struct cpg_group *group;
+
+	qb_list_for_each(iter, &cpg_group_hash[cpg_group_hash_index (group_name)]) {
+		group = qb_list_entry (iter, struct cpg_group, list);
+
+		if (mar_name_compare (&group->group_name, group_name) == 0) {
+			return (group);
+		}
+	}
+
+	return (NULL);
+}
+
+static struct cpg_group *cpg_group_get (const mar_cpg_name_t *group_name)
+{
+	struct cpg_group *group;
+
+	group = cpg_group_find (group_name);
+	if (group != NULL) {
+		return (group);
+	}
+
+	group = malloc (sizeof (struct cpg_group));
+	if (group == NULL) {
+		return (NULL);
+	}
+	group->pi_map = qb_skiplist_create ();
+	if (group->pi_map == NULL) {
+		free (group);
+		return (NULL);
+	}
+	memcpy (&group->group_name, group_name, sizeof (mar_cpg_name_t));
+	qb_list_init (&group->cpd_list_head);
+	group->nodes = NULL;
+	group->nodes_entries = 0;
+	group->nodes_size = 0;
+	qb_list_add (&group->list,
+		&cpg_group_hash[cpg_group_hash_index (group_name)]);
+
+	return (group);
+}
+
+/*
+ * Free group once nothing references it anymore. Must not be called while
+ * iterating one of the group lists.
+ */
+static void cpg_group_release (struct cpg_group *group)
+{
+	if (qb_list_empty (&group->cpd_list_head) &&
+	    qb_map_count_get (group->pi_map) == 0) {
+		qb_list_del (&group->list);
+		qb_map_destroy (group->pi_map);
+		free (group->nodes);
+		free (group);
+	}
+}
+
+static struct cpg_group_node *cpg_group_node_find (
+	const struct cpg_group *group,
+	unsigned int nodeid)
+{
+	unsigned int i;
+
+	for (i = 0; i < group->nodes_entries; i++) {
+		if (group->nodes[i].nodeid == nodeid) {
+			return (&group->nodes[i]);
+		}
+	}
+
+	return (NULL);
+}
+
+static int cpg_group_node_add (struct cpg_group *group, unsigned int nodeid)
+{
+	struct cpg_group_node *group_node;
+	unsigned int new_size;
+
+	group_node = cpg_group_node_find (group, nodeid);
+	if (group_node != NULL) {
+		group_node->count++;
+		return (0);
+	}
+
+	if (group->nodes_entries == group->nodes_size) {
+		new_size = group->nodes_size ? group->nodes_size * 2 : 4;
+		group_node = realloc (group->nodes, new_size * sizeof (struct cpg_group_node));
+		if (group_node == NULL) {
+			return (-1);
+		}
+		group->nodes = group_node;
+		group->nodes_size = new_size;
+	}
+	group->nodes[group->nodes_entries].nodeid = nodeid;
+	group->nodes[group->nodes_entries].count = 1;
+	group->nodes_entries++;
+
+	return (0);
+}
+
+static void cpg_group_node_del (struct cpg_group *group, unsigned int nodeid)
+{
+	struct cpg_group_node *group_node;
+
+	group_node = cpg_group_node_find (group, nodeid);
+	if (group_node == NULL) {
+		return;
+	}
+
+	if (--group_node->count == 0) {
+		*group_node = group->nodes[--group->nodes_entries];
+	}
+}
+
+static unsigned int cpg_node_hash_index (unsigned int nodeid)
+{
+	return (nodeid % NODE_HASH_SIZE);
+}
+
+static struct cpg_node *cpg_node_find (unsigned int nodeid)
+{
+	struct qb_list_head *iter;
+	struct cpg_node *node;
+
+	qb_list_for_each(iter, &cpg_node_hash[cpg_node_hash_index (nodeid)]) {
+		node = qb_list_entry (iter, struct cpg_node, list);
+
+		if (node->nodeid == nodeid) {
+			return (node);
+		}
+	}
+
+	return (NULL);
+}
+
+static struct cpg_node *cpg_node_get (unsigned int nodeid)
+{
+	struct cpg_node *node;
+
+	node = cpg_node_find (nodeid);
+	if (node != NULL) {
+		return (node);
+	}
+
+	node = malloc (sizeof (struct cpg_node));
+	if (node == NULL) {
+		return (NULL);
+	}
+	node->nodeid = nodeid;
+	qb_list_init (&node->pi_list_head);
+	qb_list_add (&node->list, &cpg_node_hash[cpg_node_hash_index (nodeid)]);
+
+	return (node);
+}
+
+/*
+ * Nodes are only released once they have left, so walking the process
+ * list of a node never frees the node under the iterator.
+ */
+static void cpg_node_release (unsigned int nodeid)
+{
+	struct cpg_node *node;
+
+	node = cpg_node_find (nodeid);
+	if (node != NULL && qb_list_empty (&node->pi_list_head)) {
+		qb_list_del (&node->list);
+		free (node);
+	}
+}
+
+static void process_info_key_set (char *key, unsigned int nodeid, uint32_t pid)
+{
+	snprintf (key, PROCESS_INFO_KEY_LEN, "%08x%08x", nodeid, pid);
+}
+
+static struct process_info *process_info_find(const mar_cpg_name_t *group_name, uint32_t pid, unsigned int nodeid) {
+	char key[PROCESS_INFO_KEY_LEN];
+	struct cpg_group *group;
+
+	group = cpg_group_find (group_name);
+	if (group == NULL) {
+		return NULL;
+	}
+
+	process_info_key_set (key, nodeid, pid);
+
+	return (qb_map_get (group->pi_map, key));
+}
+
+static cs_error_t cpd_group_join (struct cpg_pd *cpd, const mar_cpg_name_t *group_name)
+{
+	struct cpg_group *group;
+
+	group = cpg_group_get (group_name);
+	if (group == NULL) {
+		log_printf(LOGSYS_LEVEL_WARNING, "Unable to allocate cpg_group struct");
+		return (CS_ERR_NO_MEMORY);
+	}
+	memcpy (&cpd->group_name, group_name, sizeof (cpd->group_name));
+	cpd->group = group;
+	qb_list_add_tail (&cpd->group_list, &group->cpd_list_head);
+
+	return (CS_OK);
+}
+
+static void cpd_group_leave (struct cpg_pd *cpd)
+{
+	struct cpg_group *group = cpd->group;
+
+	if (group == NULL) {
+		return;
+	}
+	qb_list_del (&cpd->group_list);
+	qb_list_init (&cpd->group_list);
+	cpd->group = NULL;
+	cpg_group_release (group);
+}
+
+static void process_info_free (struct process_info *pi)
+{
+	struct cpg_group *group = pi->cpg_group;
+
+	qb_list_del (&pi->list);
+	qb_map_rm (group->pi_map, pi->key);
+	cpg_group_node_del (group, pi->nodeid);
+	cpg_group_release (group);
+	free (pi);
+}
+
 /*
  * Function print group name. It's not reentrant
  */
@@ -557,6 +967,9 @@ static void cpg_sync_init (
 	last_sync_ring_id.nodeid = ring_id->nodeid;
 	last_sync_ring_id.seq = ring_id->seq;
 
+	memset (my_digest_nodes, 0, sizeof (my_digest_nodes));
+	joinlist_digest_mode = 1;
+
 	entries = 0;
 	/*
 	 * Determine list of nodeids for downlist message
@@ -577,19 +990,107 @@ static void cpg_sync_init (
 	g_req_exec_cpg_downlist.left_nodes = entries;
 }
 
+static int cpg_member_index (unsigned int nodeid)
+{
+	int i;
+
+	for (i = 0; i < my_member_list_entries; i++) {
+		if (my_member_list[i] == nodeid) {
+			return (i);
+		}
+	}
+
+	return (-1);
+}
+
+static int joinlist_digest_all_received (int digest)
+{
+	int i;
+
+	for (i = 0; i < my_member_list_entries; i++) {
+		if ((digest ? my_digest_nodes[i].digest_received :
+		    my_digest_nodes[i].downlist_received) == 0) {
+			return (0);
+		}
+	}
+
+	return (1);
+}
+
+/*
+ * Returns 1 if joinlist messages and processes of nodeid have to be looked
+ * at during this sync
+ */
+static int joinlist_digest_node_differs (unsigned int nodeid)
+{
+	int idx;
+
+	if (!joinlist_digest_mode) {
+		return (1);
+	}
+
+	idx = cpg_member_index (nodeid);
+	if (idx == -1) {
+		return (1);
+	}
+
+	return (!my_digest_nodes[idx].self_valid ||
+		my_digest_nodes[idx].self_count != my_digest_nodes[idx].my_count ||
+		my_digest_nodes[idx].self_hash != my_digest_nodes[idx].my_hash);
+}
+
 static int cpg_sync_process (void)
 {
 	int res = -1;
+	int idx;
 
 	if (my_sync_state == CPGSYNC_DOWNLIST) {
 		res = cpg_exec_send_downlist();
 		if (res == -1) {
 			return (-1);
 		}
-		my_sync_state = CPGSYNC_JOINLIST;
+		my_sync_state = CPGSYNC_DIGEST;
+	}
+	if (my_sync_state == CPGSYNC_DIGEST) {
+		/*
+		 * Downlists tell whether every member understands digests.
+		 * Until all of them are in, check again on the next token.
+		 */
+		if (!joinlist_digest_all_received (0)) {
+			return (-1);
+		}
+		if (joinlist_digest_mode) {
+			res = cpg_exec_send_joinlist_digest();
+			if (res == -1) {
+				return (-1);
+			}
+			my_sync_state = CPGSYNC_DIGEST_WAIT;
+		} else {
+			log_printf (LOGSYS_LEVEL_DEBUG, "Not all members support joinlist digests");
+			my_sync_state = CPGSYNC_JOINLIST;
+		}
+	}
+	if (my_sync_state == CPGSYNC_DIGEST_WAIT) {
+		if (!joinlist_digest_all_received (1)) {
+			return (-1);
+		}
+		idx = cpg_member_index (api->totem_nodeid_get ());
+		if (idx == -1 || my_digest_nodes[idx].send_needed) {
+			my_sync_state = CPGSYNC_JOINLIST;
+		} else {
+			log_printf (LOGSYS_LEVEL_DEBUG, "All members know our processes, not sending joinlist");
+			my_sync_state = CPGSYNC_DONE;
+			return (0);
+		}
 	}
 	if (my_sync_state == CPGSYNC_JOINLIST) {
 		res = cpg_exec_send_joinlist();
+		if (res == 0) {
+			my_sync_state = CPGSYNC_DONE;
+		}
+	}
+	if (my_sync_state == CPGSYNC_DONE) {
+		res = 0;
 	}
 	return (res);
 }
@@ -667,40 +1168,45 @@ static void notify_lib_joinlist_fill_member_list(
 	int *member_list_entries,
 	mar_cpg_address_t **member_list)
 {
-	struct qb_list_head *iter;
+	qb_map_iter_t *miter;
+	struct process_info *pi;
+	struct cpg_group *group;
 	int i;
 
 	if (member_list_entries != NULL) {
 		*member_list_entries = 0;
 	}
 
-	qb_list_for_each(iter, &process_info_list_head) {
-		struct process_info *pi = qb_list_entry (iter, struct process_info, list);
+	group = cpg_group_find (group_name);
+	if (group == NULL) {
+		return;
+	}
 
-		if (mar_name_compare (&pi->group, group_name) == 0) {
-			int in_left_list = 0;
+	miter = qb_map_iter_create (group->pi_map);
+	while (qb_map_iter_next (miter, (void **)&pi)) {
+		int in_left_list = 0;
 
-			for (i = 0; i < left_list_entries; i++) {
-				if (left_list[i].nodeid == pi->nodeid && left_list[i].pid == pi->pid) {
-					in_left_list = 1;
-					break ;
-				}
+		for (i = 0; i < left_list_entries; i++) {
+			if (left_list[i].nodeid == pi->nodeid && left_list[i].pid == pi->pid) {
+				in_left_list = 1;
+				break ;
 			}
+		}
 
-			if (!in_left_list) {
-				if (member_list_entries != NULL) {
-					(*member_list_entries)++;
-				}
+		if (!in_left_list) {
+			if (member_list_entries != NULL) {
+				(*member_list_entries)++;
+			}
 
-				if (member_list != NULL) {
-					(*member_list)->nodeid = pi->nodeid;
-					(*member_list)->pid = pi->pid;
-					(*member_list)->reason = CPG_REASON_UNDEFINED;
-					(*member_list)++;
-				}
+			if (member_list != NULL) {
+				(*member_list)->nodeid = pi->nodeid;
+				(*member_list)->pid = pi->pid;
+				(*member_list)->reason = CPG_REASON_UNDEFINED;
+				(*member_list)++;
 			}
 		}
 	}
+	qb_map_iter_free (miter);
 }
 
 static int notify_lib_joinlist(
@@ -717,6 +1223,7 @@ static int notify_lib_joinlist(
 	int member_list_entries;
 	struct res_lib_cpg_confchg_callback *res;
 	mar_cpg_address_t *retgi;
+	struct cpg_group *group;
 	int i;
 
 	/*
@@ -765,12 +1272,12 @@ static int notify_lib_joinlist(
 		/*
 		 * Update cpd_state for all local joined processes in group
 		 */
-		for (i = 0; i < joined_list_entries; i++) {
+		group = cpg_group_find (group_name);
+		for (i = 0; i < joined_list_entries && group != NULL; i++) {
 			if (joined_list[i].nodeid == api->totem_nodeid_get()) {
-				qb_list_for_each(iter, &cpg_pd_list_head) {
-					struct cpg_pd *cpd = qb_list_entry (iter, struct cpg_pd, list);
-					if (joined_list[i].pid == cpd->pid &&
-					    mar_name_compare (&cpd->group_name, group_name) == 0) {
+				qb_list_for_each(iter, &group->cpd_list_head) {
+					struct cpg_pd *cpd = qb_list_entry (iter, struct cpg_pd, group_list);
+					if (joined_list[i].pid == cpd->pid) {
 						cpd->cpd_state = CPD_STATE_JOIN_COMPLETED;
 					}
 				}
@@ -781,9 +1288,10 @@ static int notify_lib_joinlist(
 	/*
 	 * Send notification to all ipc clients joined in group_name
 	 */
-	qb_list_for_each(iter, &cpg_pd_list_head) {
-		struct cpg_pd *cpd = qb_list_entry (iter, struct cpg_pd, list);
-		if (mar_name_compare (&cpd->group_name, group_name) == 0) {
+	group = cpg_group_find (group_name);
+	if (group != NULL) {
+		qb_list_for_each(iter, &group->cpd_list_head) {
+			struct cpg_pd *cpd = qb_list_entry (iter, struct cpg_pd, group_list);
 			if (cpd->cpd_state == CPD_STATE_JOIN_COMPLETED ||
 				cpd->cpd_state == CPD_STATE_LEAVE_STARTED) {
 
@@ -807,6 +1315,7 @@ static int notify_lib_joinlist(
 					struct cpg_pd *cpd = qb_list_entry (iter, struct cpg_pd, list);
 					if (left_list[i].pid == cpd->pid &&
 					    mar_name_compare (&cpd->group_name, group_name) == 0) {
+						cpd_group_leave (cpd);
 						cpd->pid = 0;
 						memset (&cpd->group_name, 0, sizeof(cpd->group_name));
 						cpd->cpd_state = CPD_STATE_UNJOINED;
@@ -841,10 +1350,25 @@ static void downlist_log(const char *msg, struct req_exec_cpg_downlist *dl)
 		    dl->left_nodes);
 }
 
+static int cpg_address_compare (const void *a, const void *b)
+{
+	const mar_cpg_address_t *addr_a = a;
+	const mar_cpg_address_t *addr_b = b;
+
+	if (addr_a->nodeid != addr_b->nodeid) {
+		return (addr_a->nodeid < addr_b->nodeid ? -1 : 1);
+	}
+	if (addr_a->pid != addr_b->pid) {
+		return (addr_a->pid < addr_b->pid ? -1 : 1);
+	}
+
+	return (0);
+}
+
 static void downlist_inform_clients (void)
 {
 	struct qb_list_head *iter, *tmp_iter;
-	struct process_info *left_pi;
+	struct cpg_node *node;
 	qb_map_t *group_map;
 	struct cpg_name cpg_group;
 	mar_cpg_name_t group;
@@ -866,19 +1390,15 @@ static void downlist_inform_clients (void)
 	 * confchg event, so we will collect these cpg groups and
 	 * relative left_lists here.
 	 */
-	qb_list_for_each_safe(iter, tmp_iter, &process_info_list_head) {
-		struct process_info *pi = qb_list_entry(iter, struct process_info, list);
-
-		left_pi = NULL;
-		for (i = 0; i < g_req_exec_cpg_downlist.left_nodes; i++) {
-
-			if (pi->nodeid == g_req_exec_cpg_downlist.nodeids[i]) {
-				left_pi = pi;
-				break;
-			}
+	for (i = 0; i < g_req_exec_cpg_downlist.left_nodes; i++) {
+		node = cpg_node_find (g_req_exec_cpg_downlist.nodeids[i]);
+		if (node == NULL) {
+			continue;
 		}
 
-		if (left_pi) {
+		qb_list_for_each_safe(iter, tmp_iter, &node->pi_list_head) {
+			struct process_info *left_pi = qb_list_entry(iter, struct process_info, list);
+
 			marshall_from_mar_cpg_name_t(&cpg_group, &left_pi->group);
 			cpg_group.value[cpg_group.length] = 0;
 
@@ -893,9 +1413,9 @@ static void downlist_inform_clients (void)
 			pcd->left_list[size].pid = left_pi->pid;
 			pcd->left_list[size].reason = CONFCHG_CPG_REASON_NODEDOWN;
 			pcd->left_list_entries++;
-			qb_list_del (&left_pi->list);
-			free (left_pi);
+			process_info_free (left_pi);
 		}
+		cpg_node_release (g_req_exec_cpg_downlist.nodeids[i]);
 	}
 
 	/* send only one confchg event per cpg group */
@@ -903,6 +1423,9 @@ static void downlist_inform_clients (void)
 	while (qb_map_iter_next(miter, (void **)&pcd)) {
 		marshall_to_mar_cpg_name_t(&group, &pcd->cpg_group);
 
+		qsort (pcd->left_list, pcd->left_list_entries,
+			sizeof (mar_cpg_address_t), cpg_address_compare);
+
 		log_printf (LOG_DEBUG, "left_list_entries:%d", pcd->left_list_entries);
 		for (i=0; i<pcd->left_list_entries; i++) {
 			log_printf (LOG_DEBUG, "left_list[%d] group:%s, ip:%s, pid:%d",
@@ -933,39 +1456,51 @@ static void joinlist_remove_zombie_pi_entries (void)
 	struct qb_list_head *jl_iter;
 	struct process_info *pi;
 	struct joinlist_msg *stored_msg;
-	int found;
+	struct qb_list_head *node_iter;
+	struct cpg_node *node;
+	int i;
 
-	qb_list_for_each_safe(pi_iter, tmp_iter, &process_info_list_head) {
-		pi = qb_list_entry (pi_iter, struct process_info, list);
+	/*
+	 * Mark every process announced in the joinlist messages
+	 */
+	qb_list_for_each(jl_iter, &joinlist_messages_head) {
+		stored_msg = qb_list_entry(jl_iter, struct joinlist_msg, list);
 
-		/*
-		 * Ignore local node
-		 */
-		if (pi->nodeid == api->totem_nodeid_get()) {
+		if (stored_msg->sender_nodeid == api->totem_nodeid_get() ||
+		    !joinlist_digest_node_differs (stored_msg->sender_nodeid)) {
 			continue ;
 		}
 
-		/*
-		 * Try to find message in joinlist messages
-		 */
-		found = 0;
-		qb_list_for_each(jl_iter, &joinlist_messages_head) {
-			stored_msg = qb_list_entry(jl_iter, struct joinlist_msg, list);
+		pi = process_info_find (&stored_msg->group_name, stored_msg->pid,
+			stored_msg->sender_nodeid);
+		if (pi != NULL) {
+			pi->joinlist_seen = 1;
+		}
+	}
 
-			if (stored_msg->sender_nodeid == api->totem_nodeid_get()) {
+	for (i = 0; i < NODE_HASH_SIZE; i++) {
+		qb_list_for_each(node_iter, &cpg_node_hash[i]) {
+			node = qb_list_entry (node_iter, struct cpg_node, list);
+
+			/*
+			 * Ignore local node and nodes whose processes we know already
+			 */
+			if (node->nodeid == api->totem_nodeid_get() ||
+			    !joinlist_digest_node_differs (node->nodeid)) {
 				continue ;
 			}
 
-			if (pi->nodeid == stored_msg->sender_nodeid &&
-			    pi->pid == stored_msg->pid &&
-			    mar_name_compare (&pi->group, &stored_msg->group_name) == 0) {
-				found = 1;
-				break ;
-			}
-		}
+			qb_list_for_each_safe(pi_iter, tmp_iter, &node->pi_list_head) {
+				pi = qb_list_entry (pi_iter, struct process_info, list);
+
+				if (pi->joinlist_seen) {
+					pi->joinlist_seen = 0;
+					continue ;
+				}
 
-		if (!found) {
-			do_proc_leave(&pi->group, pi->pid, pi->nodeid, CONFCHG_CPG_REASON_PROCDOWN);
+				do_proc_leave(&pi->group, pi->pid, pi->nodeid,
+					CONFCHG_CPG_REASON_PROCDOWN);
+			}
 		}
 	}
 }
@@ -1028,7 +1563,15 @@ static void joinlist_messages_delete (void)
 
 static char *cpg_exec_init_fn (struct corosync_api_v1 *corosync_api)
 {
+	int i;
+
 	qb_list_init (&joinlist_messages_head);
+	for (i = 0; i < GROUP_HASH_SIZE; i++) {
+		qb_list_init (&cpg_group_hash[i]);
+	}
+	for (i = 0; i < NODE_HASH_SIZE; i++) {
+		qb_list_init (&cpg_node_hash[i]);
+	}
 	api = corosync_api;
 	return (NULL);
 }
@@ -1061,6 +1604,7 @@ static void cpg_pd_finalize (struct cpg_pd *cpd)
 	}
 
 	qb_list_del (&cpd->list);
+	cpd_group_leave (cpd);
 }
 
 static int cpg_lib_exit_fn (void *conn)
@@ -1074,6 +1618,11 @@ static int cpg_lib_exit_fn (void *conn)
 				MESSAGE_REQ_EXEC_CPG_PROCLEAVE, CONFCHG_CPG_REASON_PROCDOWN);
 	}
 
+	if (cpd->async_ack_scheduled) {
+		qb_loop_job_del (api->poll_handle_get (), QB_LOOP_LOW, cpd, cpg_mcast_async_ack_job);
+		cpd->async_ack_scheduled = 0;
+	}
+
 	cpg_pd_finalize (cpd);
 
 	api->ipc_refcnt_dec (conn);
@@ -1137,12 +1686,35 @@ static void exec_cpg_downlist_endian_convert (void *msg)
 	struct req_exec_cpg_downlist *req_exec_cpg_downlist = msg;
 	unsigned int i;
 
+	swab_coroipc_request_header_t (&req_exec_cpg_downlist->header);
 	req_exec_cpg_downlist->left_nodes = swab32(req_exec_cpg_downlist->left_nodes);
 	req_exec_cpg_downlist->old_members = swab32(req_exec_cpg_downlist->old_members);
 
 	for (i = 0; i < req_exec_cpg_downlist->left_nodes; i++) {
 		req_exec_cpg_downlist->nodeids[i] = swab32(req_exec_cpg_downlist->nodeids[i]);
 	}
+
+	if (req_exec_cpg_downlist->header.size >= sizeof (struct req_exec_cpg_downlist)) {
+		req_exec_cpg_downlist->flags = swab32(req_exec_cpg_downlist->flags);
+	}
+}
+
+static void exec_cpg_joinlist_digest_endian_convert (void *msg)
+{
+	struct req_exec_cpg_joinlist_digest *req_exec_cpg_joinlist_digest = msg;
+	unsigned int i;
+
+	swab_coroipc_request_header_t (&req_exec_cpg_joinlist_digest->header);
+	req_exec_cpg_joinlist_digest->entries = swab32(req_exec_cpg_joinlist_digest->entries);
+
+	for (i = 0; i < req_exec_cpg_joinlist_digest->entries && i < PROCESSOR_COUNT_MAX; i++) {
+		req_exec_cpg_joinlist_digest->digests[i].nodeid =
+			swab32(req_exec_cpg_joinlist_digest->digests[i].nodeid);
+		req_exec_cpg_joinlist_digest->digests[i].count =
+			swab32(req_exec_cpg_joinlist_digest->digests[i].count);
+		req_exec_cpg_joinlist_digest->digests[i].hash =
+			swab64(req_exec_cpg_joinlist_digest->digests[i].hash);
+	}
 }
 
 
@@ -1170,19 +1742,12 @@ static void exec_cpg_partial_mcast_endian_convert (void *msg)
 	swab_mar_message_source_t (&req_exec_cpg_mcast->source);
 }
 
-static struct process_info *process_info_find(const mar_cpg_name_t *group_name, uint32_t pid, unsigned int nodeid) {
-	struct qb_list_head *iter;
-
-	qb_list_for_each(iter, &process_info_list_head) {
-		struct process_info *pi = qb_list_entry (iter, struct process_info, list);
-
-		if (pi->pid == pid && pi->nodeid == nodeid &&
-			mar_name_compare (&pi->group, group_name) == 0) {
-				return pi;
-		}
-	}
-
-	return NULL;
+/*
+ * Returns 1 if any process of nodeid is known to be a member of group.
+ */
+static int cpg_group_has_node (const struct cpg_group *group, unsigned int nodeid)
+{
+	return (cpg_group_node_find (group, nodeid) != NULL);
 }
 
 static void do_proc_join(
@@ -1193,39 +1758,55 @@ static void do_proc_join(
 	qb_map_t *group_notify_map)
 {
 	struct process_info *pi;
-	struct process_info *pi_entry;
 	mar_cpg_address_t notify_info;
-	struct qb_list_head *list;
-	struct qb_list_head *list_to_add = NULL;
+	struct cpg_group *group;
+	struct cpg_node *node;
 	int size;
 
 	if (process_info_find (name, pid, nodeid) != NULL) {
 		return ;
  	}
+	node = cpg_node_get (nodeid);
+	if (!node) {
+		log_printf(LOGSYS_LEVEL_WARNING, "Unable to allocate cpg_node struct");
+		return;
+	}
+	/*
+	 * cpg_node_release frees the node only if it was created here, ie. it
+	 * has no processes yet
+	 */
+	group = cpg_group_get (name);
+	if (!group) {
+		log_printf(LOGSYS_LEVEL_WARNING, "Unable to allocate cpg_group struct");
+		cpg_node_release (nodeid);
+		return;
+	}
 	pi = malloc (sizeof (struct process_info));
 	if (!pi) {
 		log_printf(LOGSYS_LEVEL_WARNING, "Unable to allocate process_info struct");
+		cpg_group_release (group);
+		cpg_node_release (nodeid);
+		return;
+	}
+	if (cpg_group_node_add (group, nodeid) != 0) {
+		log_printf(LOGSYS_LEVEL_WARNING, "Unable to allocate cpg_group_node struct");
+		free (pi);
+		cpg_group_release (group);
+		cpg_node_release (nodeid);
 		return;
 	}
 	pi->nodeid = nodeid;
 	pi->pid = pid;
 	memcpy(&pi->group, name, sizeof(*name));
-	qb_list_init(&pi->list);
+	pi->cpg_group = group;
+	pi->joinlist_seen = 0;
 
 	/*
-	 * Insert new process in sorted order so synchronization works properly
+	 * The group map keeps the members sorted so synchronization works properly
 	 */
-	list_to_add = &process_info_list_head;
-	qb_list_for_each(list, &process_info_list_head) {
-		pi_entry = qb_list_entry(list, struct process_info, list);
-		if (pi_entry->nodeid > pi->nodeid ||
-			(pi_entry->nodeid == pi->nodeid && pi_entry->pid > pi->pid)) {
-
-			break;
-		}
-		list_to_add = list;
-	}
-	qb_list_add (&pi->list, list_to_add);
+	process_info_key_set (pi->key, nodeid, pid);
+	qb_map_put (group->pi_map, pi->key, pi);
+	qb_list_add_tail (&pi->list, &node->pi_list_head);
 
 	notify_info.pid = pi->pid;
 	notify_info.nodeid = nodeid;
@@ -1258,7 +1839,6 @@ static void do_proc_leave(
 	int reason)
 {
 	struct process_info *pi;
-	struct qb_list_head *iter, *tmp_iter;
 	mar_cpg_address_t notify_info;
 
 	notify_info.pid = pid;
@@ -1270,14 +1850,12 @@ static void do_proc_leave(
 		1, &notify_info,
 		MESSAGE_RES_CPG_CONFCHG_CALLBACK);
 
-	qb_list_for_each_safe(iter, tmp_iter, &process_info_list_head) {
-		pi = qb_list_entry(iter, struct process_info, list);
-
-		if (pi->pid == pid && pi->nodeid == nodeid &&
-			mar_name_compare (&pi->group, name)==0) {
-			qb_list_del (&pi->list);
-			free (pi);
-		}
+	/*
+	 * do_proc_join never adds duplicates, so there is at most one entry
+	 */
+	pi = process_info_find (name, pid, nodeid);
+	if (pi != NULL) {
+		process_info_free (pi);
 	}
 }
 
@@ -1285,8 +1863,16 @@ static void message_handler_req_exec_cpg_downlist_old (
 	const void *message,
 	unsigned int nodeid)
 {
+	int idx;
+
 	log_printf (LOGSYS_LEVEL_DEBUG, "downlist OLD from node " CS_PRI_NODE_ID,
 		nodeid);
+
+	idx = cpg_member_index (nodeid);
+	if (idx != -1) {
+		my_digest_nodes[idx].downlist_received = 1;
+		joinlist_digest_mode = 0;
+	}
 }
 
 static void message_handler_req_exec_cpg_downlist(
@@ -1294,9 +1880,63 @@ static void message_handler_req_exec_cpg_downlist(
 	unsigned int nodeid)
 {
 	const struct req_exec_cpg_downlist *req_exec_cpg_downlist = message;
+	int idx;
 
 	log_printf (LOGSYS_LEVEL_DEBUG, "downlist left_list: %d received",
 			req_exec_cpg_downlist->left_nodes);
+
+	idx = cpg_member_index (nodeid);
+	if (idx != -1) {
+		my_digest_nodes[idx].downlist_received = 1;
+		if (req_exec_cpg_downlist->header.size < sizeof (struct req_exec_cpg_downlist) ||
+		    (req_exec_cpg_downlist->flags & CPG_DOWNLIST_FLAG_JOINLIST_DIGEST) == 0) {
+			joinlist_digest_mode = 0;
+		}
+	}
+}
+
+static void message_handler_req_exec_cpg_joinlist_digest (
+	const void *message,
+	unsigned int nodeid)
+{
+	const struct req_exec_cpg_joinlist_digest *req_exec_cpg_joinlist_digest = message;
+	const struct joinlist_digest_entry *digest;
+	struct joinlist_digest_node *node;
+	unsigned int i;
+	int idx;
+
+	log_printf (LOGSYS_LEVEL_DEBUG, "got joinlist digest from node " CS_PRI_NODE_ID,
+		nodeid);
+
+	idx = cpg_member_index (nodeid);
+	if (idx == -1 || req_exec_cpg_joinlist_digest->entries > PROCESSOR_COUNT_MAX) {
+		return ;
+	}
+	my_digest_nodes[idx].digest_received = 1;
+
+	for (i = 0; i < req_exec_cpg_joinlist_digest->entries; i++) {
+		digest = &req_exec_cpg_joinlist_digest->digests[i];
+
+		idx = cpg_member_index (digest->nodeid);
+		if (idx == -1) {
+			continue ;
+		}
+		node = &my_digest_nodes[idx];
+
+		if (digest->nodeid == nodeid) {
+			node->self_valid = 1;
+			node->self_count = digest->count;
+			node->self_hash = digest->hash;
+		}
+
+		if (!node->ref_valid) {
+			node->ref_valid = 1;
+			node->ref_count = digest->count;
+			node->ref_hash = digest->hash;
+		} else if (node->ref_count != digest->count || node->ref_hash != digest->hash) {
+			node->send_needed = 1;
+		}
+	}
 }
 
 
@@ -1346,6 +1986,12 @@ static void message_handler_req_exec_cpg_joinlist (
 	log_printf(LOGSYS_LEVEL_DEBUG, "got joinlist message from node " CS_PRI_NODE_ID,
 		nodeid);
 
+	if (!joinlist_digest_node_differs (nodeid)) {
+		log_printf(LOGSYS_LEVEL_DEBUG, "processes of node " CS_PRI_NODE_ID " already known",
+			nodeid);
+		return ;
+	}
+
 	while ((const char*)jle < message + res->size) {
 		stored_msg = malloc (sizeof (struct joinlist_msg));
 		memset(stored_msg, 0, sizeof (struct joinlist_msg));
@@ -1365,7 +2011,8 @@ static void message_handler_req_exec_cpg_mcast (
 	const struct req_exec_cpg_mcast *req_exec_cpg_mcast = message;
 	struct res_lib_cpg_deliver_callback res_lib_cpg_mcast;
 	int msglen = req_exec_cpg_mcast->msglen;
-	struct qb_list_head *iter, *pi_iter, *tmp_iter;
+	struct qb_list_head *iter, *tmp_iter;
+	struct cpg_group *group;
 	struct cpg_pd *cpd;
 	struct iovec iovec[2];
 	int known_node = 0;
@@ -1384,22 +2031,19 @@ static void message_handler_req_exec_cpg_mcast (
 	iovec[1].iov_base = (char*)message+sizeof(*req_exec_cpg_mcast);
 	iovec[1].iov_len = msglen;
 
-	qb_list_for_each_safe(iter, tmp_iter, &cpg_pd_list_head) {
-		cpd = qb_list_entry(iter, struct cpg_pd, list);
-		if ((cpd->cpd_state == CPD_STATE_LEAVE_STARTED || cpd->cpd_state == CPD_STATE_JOIN_COMPLETED)
-			&& (mar_name_compare (&cpd->group_name, &req_exec_cpg_mcast->group_name) == 0)) {
+	group = cpg_group_find (&req_exec_cpg_mcast->group_name);
+	if (group == NULL) {
+		return ;
+	}
+
+	qb_list_for_each_safe(iter, tmp_iter, &group->cpd_list_head) {
+		cpd = qb_list_entry(iter, struct cpg_pd, group_list);
+
+		if (cpd->cpd_state == CPD_STATE_LEAVE_STARTED || cpd->cpd_state == CPD_STATE_JOIN_COMPLETED) {
 
 			if (!known_node) {
 				/* Try to find, if we know the node */
-				qb_list_for_each(pi_iter, &process_info_list_head) {
-					struct process_info *pi = qb_list_entry (pi_iter, struct process_info, list);
-
-					if (pi->nodeid == nodeid &&
-						mar_name_compare (&pi->group, &req_exec_cpg_mcast->group_name) == 0) {
-						known_node = 1;
-						break;
-					}
-				}
+				known_node = cpg_group_has_node (group, nodeid);
 			}
 
 			if (!known_node) {
@@ -1419,7 +2063,8 @@ static void message_handler_req_exec_cpg_partial_mcast (
 	const struct req_exec_cpg_partial_mcast *req_exec_cpg_mcast = message;
 	struct res_lib_cpg_partial_deliver_callback res_lib_cpg_mcast;
 	int msglen = req_exec_cpg_mcast->fraglen;
-	struct qb_list_head *iter, *pi_iter, *tmp_iter;
+	struct qb_list_head *iter, *tmp_iter;
+	struct cpg_group *group;
 	struct cpg_pd *cpd;
 	struct iovec iovec[2];
 	int known_node = 0;
@@ -1442,23 +2087,19 @@ static void message_handler_req_exec_cpg_partial_mcast (
 	iovec[1].iov_base = (char*)message+sizeof(*req_exec_cpg_mcast);
 	iovec[1].iov_len = msglen;
 
-	qb_list_for_each_safe(iter, tmp_iter, &cpg_pd_list_head) {
-		cpd = qb_list_entry(iter, struct cpg_pd, list);
+	group = cpg_group_find (&req_exec_cpg_mcast->group_name);
+	if (group == NULL) {
+		return ;
+	}
+
+	qb_list_for_each_safe(iter, tmp_iter, &group->cpd_list_head) {
+		cpd = qb_list_entry(iter, struct cpg_pd, group_list);
 
-		if ((cpd->cpd_state == CPD_STATE_LEAVE_STARTED || cpd->cpd_state == CPD_STATE_JOIN_COMPLETED)
-		    && (mar_name_compare (&cpd->group_name, &req_exec_cpg_mcast->group_name) == 0)) {
+		if (cpd->cpd_state == CPD_STATE_LEAVE_STARTED || cpd->cpd_state == CPD_STATE_JOIN_COMPLETED) {
 
 			if (!known_node) {
 				/* Try to find, if we know the node */
-				qb_list_for_each(pi_iter, &process_info_list_head) {
-					struct process_info *pi = qb_list_entry (pi_iter, struct process_info, list);
-
-					if (pi->nodeid == nodeid &&
-					    mar_name_compare (&pi->group, &req_exec_cpg_mcast->group_name) == 0) {
-						known_node = 1;
-						break;
-					}
-				}
+				known_node = cpg_group_has_node (group, nodeid);
 			}
 
 			if (!known_node) {
@@ -1480,6 +2121,7 @@ static int cpg_exec_send_downlist(void)
 	g_req_exec_cpg_downlist.header.size = sizeof(struct req_exec_cpg_downlist);
 
 	g_req_exec_cpg_downlist.old_members = my_old_member_list_entries;
+	g_req_exec_cpg_downlist.flags = CPG_DOWNLIST_FLAG_JOINLIST_DIGEST;
 
 	iov.iov_base = (void *)&g_req_exec_cpg_downlist;
 	iov.iov_len = g_req_exec_cpg_downlist.header.size;
@@ -1496,12 +2138,12 @@ static int cpg_exec_send_joinlist(void)
 	size_t buf_size;
 	struct join_list_entry *jle;
 	struct iovec req_exec_cpg_iovec;
+	struct cpg_node *node;
 
-	qb_list_for_each(iter, &process_info_list_head) {
-		struct process_info *pi = qb_list_entry (iter, struct process_info, list);
-
- 		if (pi->nodeid == api->totem_nodeid_get ()) {
- 			count++;
+	node = cpg_node_find (api->totem_nodeid_get ());
+	if (node != NULL) {
+		qb_list_for_each(iter, &node->pi_list_head) {
+			count++;
 		}
 	}
 
@@ -1520,14 +2162,12 @@ static int cpg_exec_send_joinlist(void)
 	jle = (struct join_list_entry *)(buf + sizeof(struct qb_ipc_response_header));
 	res = (struct qb_ipc_response_header *)buf;
 
-	qb_list_for_each(iter, &process_info_list_head) {
+	qb_list_for_each(iter, &node->pi_list_head) {
 		struct process_info *pi = qb_list_entry (iter, struct process_info, list);
 
-		if (pi->nodeid == api->totem_nodeid_get ()) {
-			memcpy (&jle->group_name, &pi->group, sizeof (mar_cpg_name_t));
-			jle->pid = pi->pid;
-			jle++;
-		}
+		memcpy (&jle->group_name, &pi->group, sizeof (mar_cpg_name_t));
+		jle->pid = pi->pid;
+		jle++;
 	}
 
 	res->id = SERVICE_ID_MAKE(CPG_SERVICE, MESSAGE_REQ_EXEC_CPG_JOINLIST);
@@ -1539,6 +2179,83 @@ static int cpg_exec_send_joinlist(void)
 	return (api->totem_mcast (&req_exec_cpg_iovec, 1, TOTEM_AGREED));
 }
 
+/*
+ * Hash of one process, combined into a digest by adding, so the order of
+ * the cpg_node process list does not matter
+ */
+static uint64_t joinlist_digest_entry_hash (const struct process_info *pi)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	unsigned int length;
+	unsigned int i;
+
+	for (i = 0; i < 4; i++) {
+		hash ^= (pi->pid >> (i * 8)) & 0xff;
+		hash *= 1099511628211ULL;
+	}
+
+	length = pi->group.length;
+	if (length > CPG_MAX_NAME_LENGTH) {
+		length = CPG_MAX_NAME_LENGTH;
+	}
+	hash ^= length;
+	hash *= 1099511628211ULL;
+	for (i = 0; i < length; i++) {
+		hash ^= (unsigned char)pi->group.value[i];
+		hash *= 1099511628211ULL;
+	}
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+
+	return (hash);
+}
+
+static int cpg_exec_send_joinlist_digest(void)
+{
+	struct req_exec_cpg_joinlist_digest req_exec_cpg_joinlist_digest;
+	struct qb_list_head *iter;
+	struct iovec iov;
+	struct cpg_node *node;
+	int i;
+
+	memset (&req_exec_cpg_joinlist_digest, 0, sizeof (req_exec_cpg_joinlist_digest));
+
+	for (i = 0; i < my_member_list_entries; i++) {
+		my_digest_nodes[i].my_count = 0;
+		my_digest_nodes[i].my_hash = 0;
+
+		node = cpg_node_find (my_member_list[i]);
+		if (node == NULL) {
+			continue ;
+		}
+
+		qb_list_for_each(iter, &node->pi_list_head) {
+			struct process_info *pi = qb_list_entry (iter, struct process_info, list);
+
+			my_digest_nodes[i].my_count++;
+			my_digest_nodes[i].my_hash += joinlist_digest_entry_hash (pi);
+		}
+	}
+
+	for (i = 0; i < my_member_list_entries; i++) {
+		req_exec_cpg_joinlist_digest.digests[i].nodeid = my_member_list[i];
+		req_exec_cpg_joinlist_digest.digests[i].count = my_digest_nodes[i].my_count;
+		req_exec_cpg_joinlist_digest.digests[i].hash = my_digest_nodes[i].my_hash;
+	}
+	req_exec_cpg_joinlist_digest.entries = my_member_list_entries;
+
+	req_exec_cpg_joinlist_digest.header.id = SERVICE_ID_MAKE(CPG_SERVICE, MESSAGE_REQ_EXEC_CPG_JOINLIST_DIGEST);
+	req_exec_cpg_joinlist_digest.header.size = sizeof (struct req_exec_cpg_joinlist_digest) -
+		(PROCESSOR_COUNT_MAX - my_member_list_entries) * sizeof (struct joinlist_digest_entry);
+
+	iov.iov_base = (void *)&req_exec_cpg_joinlist_digest;
+	iov.iov_len = req_exec_cpg_joinlist_digest.header.size;
+
+	return (api->totem_mcast (&iov, 1, TOTEM_AGREED));
+}
+
 static int cpg_lib_init_fn (void *conn)
 {
 	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
@@ -1548,6 +2265,7 @@ static int cpg_lib_init_fn (void *conn)
 
 	qb_list_init (&cpd->iteration_instance_list_head);
 	qb_list_init (&cpd->zcb_mapped_list_head);
+	qb_list_init (&cpd->group_list);
 
 	api->ipc_refcnt_inc (conn);
 	log_printf(LOGSYS_LEVEL_DEBUG, "lib_init_fn: conn=%p, cpd=%p", conn, cpd);
@@ -1562,17 +2280,20 @@ static void message_handler_req_lib_cpg_join (void *conn, const void *message)
 	struct res_lib_cpg_join res_lib_cpg_join;
 	cs_error_t error = CS_OK;
 	struct qb_list_head *iter;
+	struct cpg_group *group;
 
-	/* Test, if we don't have same pid and group name joined */
-	qb_list_for_each(iter, &cpg_pd_list_head) {
-		struct cpg_pd *cpd_item = qb_list_entry (iter, struct cpg_pd, list);
+	group = cpg_group_find (&req_lib_cpg_join->group_name);
 
-		if (cpd_item->pid == req_lib_cpg_join->pid &&
-			mar_name_compare(&req_lib_cpg_join->group_name, &cpd_item->group_name) == 0) {
-
-			/* We have same pid and group name joined -> return error */
-			error = CS_ERR_EXIST;
-			goto response_send;
+	/* Test, if we don't have same pid and group name joined */
+	if (group != NULL) {
+		qb_list_for_each(iter, &group->cpd_list_head) {
+			struct cpg_pd *cpd_item = qb_list_entry (iter, struct cpg_pd, group_list);
+
+			if (cpd_item->pid == req_lib_cpg_join->pid) {
+				/* We have same pid and group name joined -> return error */
+				error = CS_ERR_EXIST;
+				goto response_send;
+			}
 		}
 	}
 
@@ -1580,15 +2301,11 @@ static void message_handler_req_lib_cpg_join (void *conn, const void *message)
 	 * Same check must be done in process info list, because there may be not yet delivered
 	 * leave of client.
 	 */
-	qb_list_for_each(iter, &process_info_list_head) {
-		struct process_info *pi = qb_list_entry (iter, struct process_info, list);
-
-		if (pi->nodeid == api->totem_nodeid_get () && pi->pid == req_lib_cpg_join->pid &&
-		    mar_name_compare(&req_lib_cpg_join->group_name, &pi->group) == 0) {
-			/* We have same pid and group name joined -> return error */
-			error = CS_ERR_TRY_AGAIN;
-			goto response_send;
-		}
+	if (process_info_find (&req_lib_cpg_join->group_name, req_lib_cpg_join->pid,
+	    api->totem_nodeid_get ()) != NULL) {
+		/* We have same pid and group name joined -> return error */
+		error = CS_ERR_TRY_AGAIN;
+		goto response_send;
 	}
 
 	if (req_lib_cpg_join->group_name.length > CPG_MAX_NAME_LENGTH) {
@@ -1598,12 +2315,17 @@ static void message_handler_req_lib_cpg_join (void *conn, const void *message)
 
 	switch (cpd->cpd_state) {
 	case CPD_STATE_UNJOINED:
-		error = CS_OK;
+		/*
+		 * Without its group the connection would miss every per group
+		 * operation, so fail the join rather than start it half done
+		 */
+		error = cpd_group_join (cpd, &req_lib_cpg_join->group_name);
+		if (error != CS_OK) {
+			break;
+		}
 		cpd->cpd_state = CPD_STATE_JOIN_STARTED;
 		cpd->pid = req_lib_cpg_join->pid;
 		cpd->flags = req_lib_cpg_join->flags;
-		memcpy (&cpd->group_name, &req_lib_cpg_join->group_name,
-			sizeof (cpd->group_name));
 
 		cpg_node_joinleave_send (req_lib_cpg_join->pid,
 			&req_lib_cpg_join->group_name,
@@ -1681,6 +2403,7 @@ static void message_handler_req_lib_cpg_finalize (
 	 */
 	qb_list_del (&cpd->list);
 	qb_list_init (&cpd->list);
+	cpd_group_leave (cpd);
 
 	res_lib_cpg_finalize.header.size = sizeof (res_lib_cpg_finalize);
 	res_lib_cpg_finalize.header.id = MESSAGE_RES_CPG_FINALIZE;
@@ -1881,15 +2604,25 @@ static void message_handler_req_lib_cpg_zc_free (
 }
 
 /* Fragmented mcast message from the library */
-static void message_handler_req_lib_cpg_partial_mcast (void *conn, const void *message)
+/*
+ * Messages of low latency handles bypass totempg packing delay
+ */
+static unsigned int cpd_mcast_guarantee (const struct cpg_pd *cpd)
+{
+	if (cpd->flags & CPG_MODEL_V1_LOW_LATENCY) {
+		return (TOTEM_AGREED | TOTEM_URGENT);
+	}
+
+	return (TOTEM_AGREED);
+}
+
+static cs_error_t cpg_lib_partial_mcast_send (void *conn, const struct req_lib_cpg_partial_mcast *req_lib_cpg_mcast)
 {
-	const struct req_lib_cpg_partial_mcast *req_lib_cpg_mcast = message;
 	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
 	mar_cpg_name_t group_name = cpd->group_name;
 
 	struct iovec req_exec_cpg_iovec[2];
 	struct req_exec_cpg_partial_mcast req_exec_cpg_mcast;
-	struct res_lib_cpg_partial_send res_lib_cpg_partial_send;
 	int msglen = req_lib_cpg_mcast->fraglen;
 	int result;
 	cs_error_t error = CS_ERR_NOT_EXIST;
@@ -1912,9 +2645,6 @@ static void message_handler_req_lib_cpg_partial_mcast (void *conn, const void *m
 		break;
 	}
 
-	res_lib_cpg_partial_send.header.size = sizeof(res_lib_cpg_partial_send);
-	res_lib_cpg_partial_send.header.id = MESSAGE_RES_CPG_PARTIAL_SEND;
-
 	if (req_lib_cpg_mcast->type == LIBCPG_PARTIAL_FIRST) {
 		cpd->initial_transition_counter = cpd->transition_counter;
 	}
@@ -1939,32 +2669,64 @@ static void message_handler_req_lib_cpg_partial_mcast (void *conn, const void *m
 		req_exec_cpg_iovec[1].iov_base = (char *)&req_lib_cpg_mcast->message;
 		req_exec_cpg_iovec[1].iov_len = msglen;
 
-		result = api->totem_mcast (req_exec_cpg_iovec, 2, TOTEM_AGREED);
+		result = api->totem_mcast (req_exec_cpg_iovec, 2, cpd_mcast_guarantee (cpd));
 		assert(result == 0);
 	} else {
 		log_printf(LOGSYS_LEVEL_ERROR, "*** %p can't mcast to group %s state:%d, error:%d",
 			   conn, group_name.value, cpd->cpd_state, error);
 	}
 
-	res_lib_cpg_partial_send.header.error = error;
+	return (error);
+}
+
+static void message_handler_req_lib_cpg_partial_mcast (void *conn, const void *message)
+{
+	struct res_lib_cpg_partial_send res_lib_cpg_partial_send;
+
+	res_lib_cpg_partial_send.header.size = sizeof(res_lib_cpg_partial_send);
+	res_lib_cpg_partial_send.header.id = MESSAGE_RES_CPG_PARTIAL_SEND;
+	res_lib_cpg_partial_send.header.error = cpg_lib_partial_mcast_send (conn, message);
+
 	api->ipc_response_send (conn, &res_lib_cpg_partial_send,
 				sizeof (res_lib_cpg_partial_send));
 }
 
-/* Mcast message from the library */
-static void message_handler_req_lib_cpg_mcast (void *conn, const void *message)
+/*
+ * Wrap one message from the library in a req_exec_cpg_mcast and hand it
+ * to totem. Returns the totem_mcast result.
+ */
+static int cpg_exec_mcast_send (
+	void *conn,
+	const struct cpg_pd *cpd,
+	const void *message,
+	size_t msglen,
+	unsigned int guarantee)
 {
-	const struct req_lib_cpg_mcast *req_lib_cpg_mcast = message;
-	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
-	mar_cpg_name_t group_name = cpd->group_name;
-
 	struct iovec req_exec_cpg_iovec[2];
 	struct req_exec_cpg_mcast req_exec_cpg_mcast;
-	int msglen = req_lib_cpg_mcast->msglen;
-	int result;
-	cs_error_t error = CS_ERR_NOT_EXIST;
 
-	log_printf(LOGSYS_LEVEL_TRACE, "got mcast request on %p", conn);
+	memset(&req_exec_cpg_mcast, 0, sizeof(req_exec_cpg_mcast));
+
+	req_exec_cpg_mcast.header.size = sizeof(req_exec_cpg_mcast) + msglen;
+	req_exec_cpg_mcast.header.id = SERVICE_ID_MAKE(CPG_SERVICE,
+		MESSAGE_REQ_EXEC_CPG_MCAST);
+	req_exec_cpg_mcast.pid = cpd->pid;
+	req_exec_cpg_mcast.msglen = msglen;
+	api->ipc_source_set (&req_exec_cpg_mcast.source, conn);
+	memcpy(&req_exec_cpg_mcast.group_name, &cpd->group_name,
+		sizeof(mar_cpg_name_t));
+
+	req_exec_cpg_iovec[0].iov_base = (char *)&req_exec_cpg_mcast;
+	req_exec_cpg_iovec[0].iov_len = sizeof(req_exec_cpg_mcast);
+	req_exec_cpg_iovec[1].iov_base = (char *)message;
+	req_exec_cpg_iovec[1].iov_len = msglen;
+
+	return (api->totem_mcast (req_exec_cpg_iovec, 2, guarantee));
+}
+
+static cs_error_t cpg_lib_mcast_allowed (void *conn, const struct cpg_pd *cpd)
+{
+	cs_error_t error = CS_ERR_NOT_EXIST;
 
 	switch (cpd->cpd_state) {
 	case CPD_STATE_UNJOINED:
@@ -1981,29 +2743,298 @@ static void message_handler_req_lib_cpg_mcast (void *conn, const void *message)
 		break;
 	}
 
-	if (error == CS_OK) {
-		memset(&req_exec_cpg_mcast, 0, sizeof(req_exec_cpg_mcast));
+	if (error != CS_OK) {
+		log_printf(LOGSYS_LEVEL_ERROR, "*** %p can't mcast to group %s state:%d, error:%d",
+			conn, cpd->group_name.value, cpd->cpd_state, error);
+	}
 
-		req_exec_cpg_mcast.header.size = sizeof(req_exec_cpg_mcast) + msglen;
-		req_exec_cpg_mcast.header.id = SERVICE_ID_MAKE(CPG_SERVICE,
-			MESSAGE_REQ_EXEC_CPG_MCAST);
-		req_exec_cpg_mcast.pid = cpd->pid;
-		req_exec_cpg_mcast.msglen = msglen;
-		api->ipc_source_set (&req_exec_cpg_mcast.source, conn);
-		memcpy(&req_exec_cpg_mcast.group_name, &group_name,
-			sizeof(mar_cpg_name_t));
+	return (error);
+}
 
-		req_exec_cpg_iovec[0].iov_base = (char *)&req_exec_cpg_mcast;
-		req_exec_cpg_iovec[0].iov_len = sizeof(req_exec_cpg_mcast);
-		req_exec_cpg_iovec[1].iov_base = (char *)&req_lib_cpg_mcast->message;
-		req_exec_cpg_iovec[1].iov_len = msglen;
+static cs_error_t cpg_lib_mcast_send (void *conn, const struct req_lib_cpg_mcast *req_lib_cpg_mcast)
+{
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	int result;
+	cs_error_t error;
+
+	log_printf(LOGSYS_LEVEL_TRACE, "got mcast request on %p", conn);
 
-		result = api->totem_mcast (req_exec_cpg_iovec, 2, TOTEM_AGREED);
+	error = cpg_lib_mcast_allowed (conn, cpd);
+	if (error == CS_OK) {
+		result = cpg_exec_mcast_send (conn, cpd, req_lib_cpg_mcast->message,
+			req_lib_cpg_mcast->msglen, cpd_mcast_guarantee (cpd));
 		assert(result == 0);
-	} else {
-		log_printf(LOGSYS_LEVEL_ERROR, "*** %p can't mcast to group %s state:%d, error:%d",
-			conn, group_name.value, cpd->cpd_state, error);
 	}
+
+	return (error);
+}
+
+/* Mcast message from the library */
+static void message_handler_req_lib_cpg_mcast (void *conn, const void *message)
+{
+
+	(void)cpg_lib_mcast_send (conn, message);
+}
+
+static void cpg_mcast_async_ack_send (struct cpg_pd *cpd)
+{
+	struct res_lib_cpg_mcast_async_ack res_lib_cpg_mcast_async_ack;
+
+	if (cpd->async_completed == 0) {
+		return ;
+	}
+
+	res_lib_cpg_mcast_async_ack.header.size = sizeof(res_lib_cpg_mcast_async_ack);
+	res_lib_cpg_mcast_async_ack.header.id = MESSAGE_RES_CPG_MCAST_ASYNC_ACK;
+	res_lib_cpg_mcast_async_ack.header.error = CS_OK;
+	res_lib_cpg_mcast_async_ack.completed = cpd->async_completed;
+	res_lib_cpg_mcast_async_ack.failed = cpd->async_failed;
+
+	api->ipc_dispatch_send (cpd->conn, &res_lib_cpg_mcast_async_ack,
+		sizeof (res_lib_cpg_mcast_async_ack));
+
+	cpd->async_completed = 0;
+	cpd->async_failed = 0;
+}
+
+static void cpg_mcast_async_ack_job (void *data)
+{
+	struct cpg_pd *cpd = (struct cpg_pd *)data;
+
+	cpd->async_ack_scheduled = 0;
+	cpg_mcast_async_ack_send (cpd);
+}
+
+/*
+ * Count an asynchronous multicast as done. Everything handled during one
+ * main loop pass is acknowledged together, unless the batch grows large.
+ */
+static void cpg_mcast_async_complete (struct cpg_pd *cpd, cs_error_t error)
+{
+
+	cpd->async_completed++;
+	if (error != CS_OK) {
+		cpd->async_failed++;
+	}
+
+	if (cpd->async_completed >= CPG_MCAST_ASYNC_ACK_MAX) {
+		cpg_mcast_async_ack_send (cpd);
+		return ;
+	}
+
+	if (!cpd->async_ack_scheduled &&
+	    qb_loop_job_add (api->poll_handle_get (), QB_LOOP_LOW, cpd, cpg_mcast_async_ack_job) == 0) {
+		cpd->async_ack_scheduled = 1;
+	}
+}
+
+static void message_handler_req_lib_cpg_mcast_async (void *conn, const void *message)
+{
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+
+	cpg_mcast_async_complete (cpd, cpg_lib_mcast_send (conn, message));
+}
+
+/*
+ * Refused by flow control or for its size before reaching the handler.
+ * The library still counts the message, so it is acknowledged as failed.
+ */
+static void message_refused_req_lib_cpg_mcast_async (void *conn, const void *message, int error)
+{
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+
+	cpg_mcast_async_complete (cpd, error);
+}
+
+/*
+ * Check that a fragment continues the message where the previous one
+ * ended and, if it is the last one, completes it. Fragments are only
+ * counted, so a gap shows up as a length mismatch.
+ */
+static int cpg_partial_mcast_async_in_order (
+	struct cpg_pd *cpd,
+	const struct req_lib_cpg_partial_mcast *req_lib_cpg_mcast)
+{
+	if (req_lib_cpg_mcast->fraglen > req_lib_cpg_mcast->msglen - cpd->async_partial_offset) {
+		return (0);
+	}
+
+	if (req_lib_cpg_mcast->type == LIBCPG_PARTIAL_LAST &&
+	    cpd->async_partial_offset + req_lib_cpg_mcast->fraglen != req_lib_cpg_mcast->msglen) {
+		return (0);
+	}
+
+	return (1);
+}
+
+static void cpg_partial_mcast_async_fragment_done (
+	struct cpg_pd *cpd,
+	const struct req_lib_cpg_partial_mcast *req_lib_cpg_mcast)
+{
+	if (req_lib_cpg_mcast->type == LIBCPG_PARTIAL_LAST) {
+		cpg_mcast_async_complete (cpd,
+		    cpd->async_partial_failed ? CS_ERR_INTERRUPT : CS_OK);
+		cpd->async_partial_failed = 0;
+		cpd->async_partial_offset = 0;
+	}
+}
+
+static void message_handler_req_lib_cpg_partial_mcast_async (void *conn, const void *message)
+{
+	const struct req_lib_cpg_partial_mcast *req_lib_cpg_mcast = message;
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	cs_error_t error;
+
+	if (req_lib_cpg_mcast->type == LIBCPG_PARTIAL_FIRST) {
+		cpd->async_partial_failed = 0;
+		cpd->async_partial_offset = 0;
+	}
+
+	if (!cpd->async_partial_failed &&
+	    !cpg_partial_mcast_async_in_order (cpd, req_lib_cpg_mcast)) {
+		log_printf(LOGSYS_LEVEL_WARNING,
+			"*** %p fragment of %u bytes at offset %u doesn't fit a message of %u bytes, dropping it",
+			conn, req_lib_cpg_mcast->fraglen, cpd->async_partial_offset,
+			req_lib_cpg_mcast->msglen);
+		cpd->async_partial_failed = 1;
+	}
+
+	/*
+	 * The library does not wait for each fragment, so once one of them is
+	 * refused the rest of the message is dropped and the whole message is
+	 * reported as failed. Without the last fragment receivers never
+	 * deliver the part which was sent.
+	 */
+	if (!cpd->async_partial_failed) {
+		error = cpg_lib_partial_mcast_send (conn, req_lib_cpg_mcast);
+		if (error != CS_OK) {
+			cpd->async_partial_failed = 1;
+		}
+		cpd->async_partial_offset += req_lib_cpg_mcast->fraglen;
+	}
+
+	cpg_partial_mcast_async_fragment_done (cpd, req_lib_cpg_mcast);
+}
+
+static void message_refused_req_lib_cpg_partial_mcast_async (void *conn, const void *message, int error)
+{
+	const struct req_lib_cpg_partial_mcast *req_lib_cpg_mcast = message;
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+
+	cpd->async_partial_failed = 1;
+	cpg_partial_mcast_async_fragment_done (cpd, req_lib_cpg_mcast);
+}
+
+/*
+ * Several independent messages in one request. Each one still travels as
+ * its own req_exec_cpg_mcast, so delivery is exactly as if they had been
+ * sent one by one, but totempg gets them back to back and packs them into
+ * as few frames as possible.
+ */
+static void message_handler_req_lib_cpg_mcast_batch (void *conn, const void *message)
+{
+	const struct req_lib_cpg_mcast_batch *req_lib_cpg_mcast_batch = message;
+	const struct req_lib_cpg_mcast_batch_item *item;
+	struct res_lib_cpg_mcast_batch res_lib_cpg_mcast_batch;
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	cs_error_t error;
+	size_t len;
+	size_t offset;
+	unsigned int guarantee;
+	unsigned int i;
+
+	log_printf(LOGSYS_LEVEL_TRACE, "got mcast batch request on %p", conn);
+
+	/*
+	 * Check the whole request first, nothing is sent from a malformed one
+	 */
+	error = CS_ERR_INVALID_PARAM;
+	if (req_lib_cpg_mcast_batch->header.size < sizeof (*req_lib_cpg_mcast_batch)) {
+		i = 0;
+		goto response_send;
+	}
+	len = req_lib_cpg_mcast_batch->header.size - sizeof (*req_lib_cpg_mcast_batch);
+
+	for (i = 0, offset = 0; i < req_lib_cpg_mcast_batch->count; i++) {
+		item = (const struct req_lib_cpg_mcast_batch_item *)
+			(req_lib_cpg_mcast_batch->messages + offset);
+		if (len - offset < sizeof (*item) ||
+		    len - offset - sizeof (*item) < item->msglen) {
+			log_printf(LOGSYS_LEVEL_ERROR, "*** %p malformed mcast batch, message %u of %u",
+				conn, i, req_lib_cpg_mcast_batch->count);
+			i = 0;
+			goto response_send;
+		}
+		offset += CPG_MCAST_BATCH_ITEM_SIZE(item->msglen);
+		if (offset > len) {
+			offset = len;
+		}
+	}
+
+	i = 0;
+	error = cpg_lib_mcast_allowed (conn, cpd);
+	if (error != CS_OK) {
+		goto response_send;
+	}
+
+	for (offset = 0; i < req_lib_cpg_mcast_batch->count; i++) {
+		item = (const struct req_lib_cpg_mcast_batch_item *)
+			(req_lib_cpg_mcast_batch->messages + offset);
+		offset += CPG_MCAST_BATCH_ITEM_SIZE(item->msglen);
+
+		/*
+		 * Only the last message may force a flush of the packed frame
+		 */
+		guarantee = cpd_mcast_guarantee (cpd);
+		if (i + 1 < req_lib_cpg_mcast_batch->count) {
+			guarantee &= ~TOTEM_URGENT;
+		}
+
+		/*
+		 * The request was reserved by its size, which does not include
+		 * the per message exec headers, so totem may run out of room.
+		 * Stop there rather than reorder and let the library resend
+		 * the rest.
+		 */
+		if (cpg_exec_mcast_send (conn, cpd, item + 1, item->msglen, guarantee) != 0) {
+			log_printf(LOGSYS_LEVEL_DEBUG, "%p mcast batch: %u of %u messages sent, try again",
+				conn, i, req_lib_cpg_mcast_batch->count);
+			error = CS_ERR_TRY_AGAIN;
+			break;
+		}
+	}
+
+response_send:
+	res_lib_cpg_mcast_batch.header.size = sizeof (res_lib_cpg_mcast_batch);
+	res_lib_cpg_mcast_batch.header.id = MESSAGE_RES_CPG_MCAST_BATCH;
+	res_lib_cpg_mcast_batch.header.error = error;
+	res_lib_cpg_mcast_batch.sent = i;
+
+	api->ipc_response_send (conn, &res_lib_cpg_mcast_batch,
+				sizeof (res_lib_cpg_mcast_batch));
+}
+
+/*
+ * The library can unpack events which pile up for a slow connection from
+ * one MESSAGE_RES_CPG_EVENT_BATCH event
+ */
+static void message_handler_req_lib_cpg_event_batch_enable (void *conn, const void *message)
+{
+	const struct req_lib_cpg_event_batch_enable *req_lib_cpg_event_batch_enable = message;
+	struct res_lib_cpg_event_batch_enable res_lib_cpg_event_batch_enable;
+	cs_error_t error = CS_OK;
+
+	if (api->ipc_dispatch_batch_set (conn, MESSAGE_RES_CPG_EVENT_BATCH,
+	    req_lib_cpg_event_batch_enable->max_size) != 0) {
+		error = CS_ERR_INVALID_PARAM;
+	}
+
+	res_lib_cpg_event_batch_enable.header.size = sizeof (res_lib_cpg_event_batch_enable);
+	res_lib_cpg_event_batch_enable.header.id = MESSAGE_RES_CPG_EVENT_BATCH_ENABLE;
+	res_lib_cpg_event_batch_enable.header.error = error;
+
+	api->ipc_response_send (conn, &res_lib_cpg_event_batch_enable,
+				sizeof (res_lib_cpg_event_batch_enable));
 }
 
 static void message_handler_req_lib_cpg_zc_execute (
@@ -2057,7 +3088,7 @@ static void message_handler_req_lib_cpg_zc_execute (
 		req_exec_cpg_iovec[1].iov_base = (char *)header + sizeof(struct req_lib_cpg_mcast);
 		req_exec_cpg_iovec[1].iov_len = req_exec_cpg_mcast.msglen;
 
-		result = api->totem_mcast (req_exec_cpg_iovec, 2, TOTEM_AGREED);
+		result = api->totem_mcast (req_exec_cpg_iovec, 2, cpd_mcast_guarantee (cpd));
 		if (result == 0) {
 			res_lib_cpg_mcast.header.error = CS_OK;
 		} else {
@@ -2078,7 +3109,9 @@ static void message_handler_req_lib_cpg_membership (void *conn,
 	struct req_lib_cpg_membership_get *req_lib_cpg_membership_get =
 		(struct req_lib_cpg_membership_get *)message;
 	struct res_lib_cpg_membership_get res_lib_cpg_membership_get;
-	struct qb_list_head *iter;
+	qb_map_iter_t *miter;
+	struct process_info *pi;
+	struct cpg_group *group;
 	int member_count = 0;
 
 	res_lib_cpg_membership_get.header.id = MESSAGE_RES_CPG_MEMBERSHIP;
@@ -2086,13 +3119,16 @@ static void message_handler_req_lib_cpg_membership (void *conn,
 	res_lib_cpg_membership_get.header.size =
 		sizeof (struct res_lib_cpg_membership_get);
 
-	qb_list_for_each(iter, &process_info_list_head) {
-		struct process_info *pi = qb_list_entry (iter, struct process_info, list);
-		if (mar_name_compare (&pi->group, &req_lib_cpg_membership_get->group_name) == 0) {
+	group = cpg_group_find (&req_lib_cpg_membership_get->group_name);
+	if (group != NULL) {
+		miter = qb_map_iter_create (group->pi_map);
+		while (qb_map_iter_next (miter, (void **)&pi) &&
+		    member_count < PROCESSOR_COUNT_MAX) {
 			res_lib_cpg_membership_get.member_list[member_count].nodeid = pi->nodeid;
 			res_lib_cpg_membership_get.member_list[member_count].pid = pi->pid;
 			member_count += 1;
 		}
+		qb_map_iter_free (miter);
 	}
 	res_lib_cpg_membership_get.member_count = member_count;
 
@@ -2114,6 +3150,46 @@ static void message_handler_req_lib_cpg_local_get (void *conn,
 		sizeof (res_lib_cpg_local_get));
 }
 
+/*
+ * Append copy of the members of group to the iteration items. Name only
+ * iteration gets one item per group.
+ */
+static cs_error_t cpg_iteration_group_copy (
+	struct cpg_iteration_instance *cpg_iteration_instance,
+	const struct cpg_group *group,
+	mar_uint32_t iteration_type)
+{
+	qb_map_iter_t *miter;
+	struct process_info *pi;
+	struct process_info *new_pi;
+	cs_error_t error = CS_OK;
+
+	miter = qb_map_iter_create (group->pi_map);
+	while (qb_map_iter_next (miter, (void **)&pi)) {
+		new_pi = malloc (sizeof (struct process_info));
+		if (!new_pi) {
+			log_printf(LOGSYS_LEVEL_WARNING, "Unable to allocate process_info struct");
+
+			error = CS_ERR_NO_MEMORY;
+			break;
+		}
+
+		memcpy (new_pi, pi, sizeof (struct process_info));
+		qb_list_add_tail (&new_pi->list, &cpg_iteration_instance->items_list_head);
+
+		if (iteration_type == CPG_ITERATION_NAME_ONLY) {
+			/*
+			 * pid and nodeid -> undefined
+			 */
+			new_pi->pid = new_pi->nodeid = 0;
+			break;
+		}
+	}
+	qb_map_iter_free (miter);
+
+	return (error);
+}
+
 static void message_handler_req_lib_cpg_iteration_initialize (
 	void *conn,
 	const void *message)
@@ -2122,10 +3198,12 @@ static void message_handler_req_lib_cpg_iteration_initialize (
 	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
 	hdb_handle_t cpg_iteration_handle = 0;
 	struct res_lib_cpg_iterationinitialize res_lib_cpg_iterationinitialize;
-	struct qb_list_head *iter, *iter2;
+	struct qb_list_head *iter;
 	struct cpg_iteration_instance *cpg_iteration_instance;
+	struct cpg_group *group;
 	cs_error_t error = CS_OK;
 	int res;
+	int i;
 
 	log_printf (LOGSYS_LEVEL_DEBUG, "cpg iteration initialize");
 
@@ -2157,73 +3235,28 @@ static void message_handler_req_lib_cpg_iteration_initialize (
 	/*
 	 * Create copy of process_info list "grouped by" group name
 	 */
-	qb_list_for_each(iter, &process_info_list_head) {
-		struct process_info *pi = qb_list_entry (iter, struct process_info, list);
-		struct process_info *new_pi;
-
-		if (req_lib_cpg_iterationinitialize->iteration_type == CPG_ITERATION_NAME_ONLY) {
-			/*
-			 * Try to find processed group name in our list new list
-			 */
-			int found = 0;
-
-                        qb_list_for_each(iter2, &(cpg_iteration_instance->items_list_head)) {
-				 struct process_info *pi2 = qb_list_entry (iter2, struct process_info, list);
-
-				 if (mar_name_compare (&pi2->group, &pi->group) == 0) {
-					found = 1;
-					break;
-				 }
-			}
-
-			if (found) {
-				/*
-				 * We have this name in list -> don't add
-				 */
-				continue ;
-			}
-		} else if (req_lib_cpg_iterationinitialize->iteration_type == CPG_ITERATION_ONE_GROUP) {
-			/*
-			 * Test pi group name with request
-			 */
-			if (mar_name_compare (&pi->group, &req_lib_cpg_iterationinitialize->group_name) != 0)
-				/*
-				 * Not same -> don't add
-				 */
-				continue ;
-		}
-
-		new_pi = malloc (sizeof (struct process_info));
-		if (!new_pi) {
-			log_printf(LOGSYS_LEVEL_WARNING, "Unable to allocate process_info struct");
-
-			error = CS_ERR_NO_MEMORY;
-
-			goto error_put_destroy;
-		}
-
-		memcpy (new_pi, pi, sizeof (struct process_info));
-		qb_list_init (&new_pi->list);
-
-		if (req_lib_cpg_iterationinitialize->iteration_type == CPG_ITERATION_NAME_ONLY) {
-			/*
-			 * pid and nodeid -> undefined
-			 */
-			new_pi->pid = new_pi->nodeid = 0;
+	if (req_lib_cpg_iterationinitialize->iteration_type == CPG_ITERATION_ONE_GROUP) {
+		group = cpg_group_find (&req_lib_cpg_iterationinitialize->group_name);
+		if (group != NULL) {
+			error = cpg_iteration_group_copy (cpg_iteration_instance, group,
+				req_lib_cpg_iterationinitialize->iteration_type);
 		}
+	} else {
+		for (i = 0; i < GROUP_HASH_SIZE && error == CS_OK; i++) {
+			qb_list_for_each(iter, &cpg_group_hash[i]) {
+				group = qb_list_entry (iter, struct cpg_group, list);
 
-		/*
-		 * We will return list "grouped" by "group name", so try to find right place to add
-		 */
-		qb_list_for_each(iter2, &(cpg_iteration_instance->items_list_head)) {
-			struct process_info *pi2 = qb_list_entry (iter2, struct process_info, list);
-
-			if (mar_name_compare (&pi2->group, &pi->group) == 0) {
-				break;
+				error = cpg_iteration_group_copy (cpg_iteration_instance, group,
+					req_lib_cpg_iterationinitialize->iteration_type);
+				if (error != CS_OK) {
+					break;
+				}
 			}
 		}
+	}
 
-		qb_list_add (&new_pi->list, iter2);
+	if (error != CS_OK) {
+		goto error_put_destroy;
 	}
 
 	/*
@@ -45,6 +45,14 @@
 
 #define ICMAP_MAX_VALUE_LEN	(16*1024)
 
+/*
+ * Arena size classes are ICMAP_ARENA_MIN_SIZE << class, larger blocks are
+ * allocated by malloc
+ */
+#define ICMAP_ARENA_MIN_SIZE	32
+#define ICMAP_ARENA_CLASSES	4
+#define ICMAP_ARENA_CHUNK_SIZE	(16*1024)
+
 struct icmap_item {
 	char *key_name;
 	icmap_value_types_t type;
@@ -52,8 +60,24 @@ struct icmap_item {
 	char value[];
 };
 
+struct icmap_arena_free {
+	struct icmap_arena_free *next;
+};
+
+struct icmap_arena_chunk {
+	struct icmap_arena_chunk *next;
+	uint64_t pad;
+	char data[];
+};
+
+struct icmap_arena {
+	struct icmap_arena_free *free_list[ICMAP_ARENA_CLASSES];
+	struct icmap_arena_chunk *chunks;
+};
+
 struct icmap_map {
 	qb_map_t *qb_map;
+	struct icmap_arena *arena;
 };
 
 static icmap_map_t icmap_global_map;
@@ -66,6 +90,19 @@ struct icmap_track {
 	struct qb_list_head list;
 };
 
+/*
+ * Counter keeps pointer to current item of key, which is updated by
+ * notification whenever the item is replaced or deleted. tracked is set when
+ * some icmap_track may be interested in changes of key, so
+ * notifications have to be generated.
+ */
+struct icmap_counter {
+	char *key_name;
+	struct icmap_item *item;
+	int tracked;
+	struct qb_list_head list;
+};
+
 struct icmap_ro_access_item {
 	char *key_name;
 	int prefix;
@@ -74,6 +111,7 @@ struct icmap_ro_access_item {
 
 QB_LIST_DECLARE (icmap_ro_access_item_list_head);
 QB_LIST_DECLARE (icmap_track_list_head);
+QB_LIST_DECLARE (icmap_counter_list_head);
 
 /*
  * Static functions declarations
@@ -170,22 +208,134 @@ int32_t icmap_qbtt_to_tt(int32_t track_type)
 	return (res);
 }
 
+/*
+ * Returns arena class of block with given size or -1 if block is too large
+ */
+static int icmap_arena_class(size_t size)
+{
+	int class;
+
+	for (class = 0; class < ICMAP_ARENA_CLASSES; class++) {
+		if (size <= (ICMAP_ARENA_MIN_SIZE << class)) {
+			return (class);
+		}
+	}
+
+	return (-1);
+}
+
+static void *icmap_mem_alloc(const icmap_map_t map, size_t size)
+{
+	struct icmap_arena *arena = map->arena;
+	struct icmap_arena_chunk *chunk;
+	struct icmap_arena_free *block;
+	size_t class_size;
+	size_t offset;
+	int class;
+
+	class = (arena != NULL ? icmap_arena_class(size) : -1);
+	if (class == -1) {
+		return (malloc(size));
+	}
+
+	if (arena->free_list[class] == NULL) {
+		/*
+		 * Carve new chunk into blocks of this class
+		 */
+		chunk = malloc(sizeof(*chunk) + ICMAP_ARENA_CHUNK_SIZE);
+		if (chunk == NULL) {
+			return (NULL);
+		}
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+
+		class_size = ICMAP_ARENA_MIN_SIZE << class;
+		for (offset = ICMAP_ARENA_CHUNK_SIZE; offset >= class_size; offset -= class_size) {
+			block = (struct icmap_arena_free *)(chunk->data + offset - class_size);
+			block->next = arena->free_list[class];
+			arena->free_list[class] = block;
+		}
+	}
+
+	block = arena->free_list[class];
+	arena->free_list[class] = block->next;
+
+	return (block);
+}
+
+static void icmap_mem_free(const icmap_map_t map, void *ptr, size_t size)
+{
+	struct icmap_arena_free *block = ptr;
+	int class;
+
+	if (ptr == NULL) {
+		return ;
+	}
+
+	class = (map->arena != NULL ? icmap_arena_class(size) : -1);
+	if (class == -1) {
+		free(ptr);
+		return ;
+	}
+
+	block->next = map->arena->free_list[class];
+	map->arena->free_list[class] = block;
+}
+
+static char *icmap_key_dup(const icmap_map_t map, const char *key_name)
+{
+	size_t len = strlen(key_name) + 1;
+	char *res;
+
+	res = icmap_mem_alloc(map, len);
+	if (res != NULL) {
+		memcpy(res, key_name, len);
+	}
+
+	return (res);
+}
+
+static void icmap_key_free(const icmap_map_t map, char *key_name)
+{
+
+	if (key_name != NULL) {
+		icmap_mem_free(map, key_name, strlen(key_name) + 1);
+	}
+}
+
+static void icmap_arena_destroy(struct icmap_arena *arena)
+{
+	struct icmap_arena_chunk *chunk;
+
+	if (arena == NULL) {
+		return ;
+	}
+
+	while (arena->chunks != NULL) {
+		chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+	free(arena);
+}
+
 static void icmap_map_free_cb(uint32_t event,
 		char* key, void* old_value,
 		void* value, void* user_data)
 {
+	icmap_map_t map = (icmap_map_t)user_data;
 	struct icmap_item *item = (struct icmap_item *)old_value;
 
 	/*
 	 * value == old_value -> fast_adjust_int was used, don't free data
 	 */
 	if (item != NULL && value != old_value) {
-		free(item->key_name);
-		free(item);
+		icmap_key_free(map, item->key_name);
+		icmap_mem_free(map, item, sizeof(struct icmap_item) + item->value_len);
 	}
 }
 
-cs_error_t icmap_init_r(icmap_map_t *result)
+cs_error_t icmap_init_alloc_r(icmap_map_t *result, icmap_alloc_t alloc)
 {
 	int32_t err;
 
@@ -194,26 +344,48 @@ cs_error_t icmap_init_r(icmap_map_t *result)
 		return (CS_ERR_NO_MEMORY);
 	}
 
+	(*result)->arena = NULL;
+	if (alloc == ICMAP_ALLOC_ARENA) {
+		(*result)->arena = calloc(1, sizeof(struct icmap_arena));
+		if ((*result)->arena == NULL) {
+			free(*result);
+			return (CS_ERR_NO_MEMORY);
+		}
+	}
+
         (*result)->qb_map = qb_trie_create();
 	if ((*result)->qb_map == NULL) {
+		icmap_arena_destroy((*result)->arena);
 		free(*result);
 		return (CS_ERR_INIT);
 	}
 
-	err = qb_map_notify_add((*result)->qb_map, NULL, icmap_map_free_cb, QB_MAP_NOTIFY_FREE, NULL);
+	err = qb_map_notify_add((*result)->qb_map, NULL, icmap_map_free_cb, QB_MAP_NOTIFY_FREE, *result);
 	if (err != 0) {
 		qb_map_destroy((*result)->qb_map);
+		icmap_arena_destroy((*result)->arena);
 		free(*result);
 	}
 
 	return (qb_to_cs_error(err));
 }
 
+cs_error_t icmap_init_r(icmap_map_t *result)
+{
+
+	return (icmap_init_alloc_r(result, ICMAP_ALLOC_MALLOC));
+}
+
 cs_error_t icmap_init(void)
 {
 	return (icmap_init_r(&icmap_global_map));
 }
 
+cs_error_t icmap_init_alloc(icmap_alloc_t alloc)
+{
+	return (icmap_init_alloc_r(&icmap_global_map, alloc));
+}
+
 static void icmap_set_ro_access_free(void)
 {
 	struct qb_list_head *iter, *tmp_iter;
@@ -239,10 +411,23 @@ static void icmap_del_all_track(void)
 	}
 }
 
+static void icmap_del_all_counters(void)
+{
+	struct qb_list_head *iter, *tmp_iter;
+	struct icmap_counter *icmap_counter;
+
+	qb_list_for_each_safe(iter, tmp_iter, &icmap_counter_list_head) {
+		icmap_counter = qb_list_entry(iter, struct icmap_counter, list);
+
+		icmap_counter_release(icmap_counter);
+	}
+}
+
 void icmap_fini_r(const icmap_map_t map)
 {
 
 	qb_map_destroy(map->qb_map);
+	icmap_arena_destroy(map->arena);
 	free(map);
 
 	return;
@@ -252,6 +437,7 @@ void icmap_fini(void)
 {
 
 	icmap_del_all_track();
+	icmap_del_all_counters();
 	/*
 	 * catch 22 warning:
 	 * We need to drop this notify but we can't because it calls icmap_map_free_cb
@@ -457,16 +643,16 @@ cs_error_t icmap_set_r(
 	}
 
 	new_item_size = sizeof(struct icmap_item) + new_value_len;
-	new_item = malloc(new_item_size);
+	new_item = icmap_mem_alloc(map, new_item_size);
 	if (new_item == NULL) {
 		return (CS_ERR_NO_MEMORY);
 	}
 	memset(new_item, 0, new_item_size);
 
 	if (item == NULL) {
-		new_item->key_name = strdup(key_name);
+		new_item->key_name = icmap_key_dup(map, key_name);
 		if (new_item->key_name == NULL) {
-			free(new_item);
+			icmap_mem_free(map, new_item, new_item_size);
 			return (CS_ERR_NO_MEMORY);
 		}
 	} else {
@@ -988,23 +1174,14 @@ cs_error_t icmap_adjust_int(
 	return (icmap_adjust_int_r(icmap_global_map, key_name, step));
 }
 
-cs_error_t icmap_fast_adjust_int_r(
-	const icmap_map_t map,
-	const char *key_name,
-	int32_t step)
+/*
+ * Add step to value of item in place. Returns CS_ERR_INVALID_PARAM for non
+ * integer items.
+ */
+static cs_error_t icmap_item_adjust_int(struct icmap_item *item, int32_t step)
 {
-	struct icmap_item *item;
 	cs_error_t err = CS_OK;
 
-	if (key_name == NULL) {
-		return (CS_ERR_INVALID_PARAM);
-	}
-
-	item = qb_map_get(map->qb_map, key_name);
-	if (item == NULL) {
-		return (CS_ERR_NOT_EXIST);
-	}
-
 	switch (item->type) {
 	case ICMAP_VALUETYPE_INT8:
 	case ICMAP_VALUETYPE_UINT8:
@@ -1030,6 +1207,27 @@ cs_error_t icmap_fast_adjust_int_r(
 		break;
 	}
 
+	return (err);
+}
+
+cs_error_t icmap_fast_adjust_int_r(
+	const icmap_map_t map,
+	const char *key_name,
+	int32_t step)
+{
+	struct icmap_item *item;
+	cs_error_t err;
+
+	if (key_name == NULL) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	item = qb_map_get(map->qb_map, key_name);
+	if (item == NULL) {
+		return (CS_ERR_NOT_EXIST);
+	}
+
+	err = icmap_item_adjust_int(item, step);
 	if (err == CS_OK) {
 		qb_map_put(map->qb_map, item->key_name, item);
 	}
@@ -1122,6 +1320,145 @@ void icmap_iter_finalize(icmap_iter_t iter)
 	qb_map_iter_free(iter);
 }
 
+/*
+ * Returns !0 if icmap_track may be notified about modification of key_name
+ */
+static int icmap_track_matches(const struct icmap_track *icmap_track, const char *key_name)
+{
+	if (!(icmap_track->track_type & ICMAP_TRACK_MODIFY)) {
+		return (0);
+	}
+
+	if (icmap_track->key_name == NULL) {
+		return (1);
+	}
+
+	if (icmap_track->track_type & ICMAP_TRACK_PREFIX) {
+		return (strncmp(key_name, icmap_track->key_name, strlen(icmap_track->key_name)) == 0);
+	}
+
+	return (strcmp(key_name, icmap_track->key_name) == 0);
+}
+
+static void icmap_counter_tracked_update(struct icmap_counter *icmap_counter)
+{
+	struct qb_list_head *iter;
+	struct icmap_track *icmap_track;
+
+	icmap_counter->tracked = 0;
+
+	qb_list_for_each(iter, &icmap_track_list_head) {
+		icmap_track = qb_list_entry(iter, struct icmap_track, list);
+
+		if (icmap_track_matches(icmap_track, icmap_counter->key_name)) {
+			icmap_counter->tracked = 1;
+			break;
+		}
+	}
+}
+
+/*
+ * Called whenever track is added or deleted
+ */
+static void icmap_counters_tracked_update(void)
+{
+	struct qb_list_head *iter;
+
+	qb_list_for_each(iter, &icmap_counter_list_head) {
+		icmap_counter_tracked_update(qb_list_entry(iter, struct icmap_counter, list));
+	}
+}
+
+static void icmap_counter_notify_fn(uint32_t event, char *key, void *old_value, void *value, void *user_data)
+{
+	struct icmap_counter *icmap_counter = (struct icmap_counter *)user_data;
+
+	icmap_counter->item = (struct icmap_item *)value;
+}
+
+cs_error_t icmap_counter_get(const char *key_name, icmap_counter_t *counter)
+{
+	struct icmap_counter *icmap_counter;
+	int32_t err;
+
+	if (key_name == NULL || counter == NULL) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	icmap_counter = malloc(sizeof(*icmap_counter));
+	if (icmap_counter == NULL) {
+		return (CS_ERR_NO_MEMORY);
+	}
+	memset(icmap_counter, 0, sizeof(*icmap_counter));
+
+	icmap_counter->key_name = strdup(key_name);
+	if (icmap_counter->key_name == NULL) {
+		free(icmap_counter);
+		return (CS_ERR_NO_MEMORY);
+	}
+
+	icmap_counter->item = qb_map_get(icmap_global_map->qb_map, key_name);
+	if (icmap_counter->item == NULL) {
+		free(icmap_counter->key_name);
+		free(icmap_counter);
+		return (CS_ERR_NOT_EXIST);
+	}
+
+	if ((err = qb_map_notify_add(icmap_global_map->qb_map, icmap_counter->key_name,
+			icmap_counter_notify_fn,
+			QB_MAP_NOTIFY_INSERTED | QB_MAP_NOTIFY_REPLACED | QB_MAP_NOTIFY_DELETED,
+			icmap_counter)) != 0) {
+		free(icmap_counter->key_name);
+		free(icmap_counter);
+
+		return (qb_to_cs_error(err));
+	}
+
+	icmap_counter_tracked_update(icmap_counter);
+	qb_list_init(&icmap_counter->list);
+	qb_list_add(&icmap_counter->list, &icmap_counter_list_head);
+
+	*counter = icmap_counter;
+
+	return (CS_OK);
+}
+
+cs_error_t icmap_counter_adjust(icmap_counter_t counter, int32_t step)
+{
+	struct icmap_item *item = counter->item;
+	cs_error_t err;
+
+	if (item == NULL) {
+		return (CS_ERR_NOT_EXIST);
+	}
+
+	err = icmap_item_adjust_int(item, step);
+	if (err == CS_OK && counter->tracked) {
+		qb_map_put(icmap_global_map->qb_map, item->key_name, item);
+	}
+
+	return (err);
+}
+
+cs_error_t icmap_counter_inc(icmap_counter_t counter)
+{
+
+	return (icmap_counter_adjust(counter, 1));
+}
+
+void icmap_counter_release(icmap_counter_t counter)
+{
+
+	qb_map_notify_del_2(icmap_global_map->qb_map, counter->key_name,
+		icmap_counter_notify_fn,
+		QB_MAP_NOTIFY_INSERTED | QB_MAP_NOTIFY_REPLACED | QB_MAP_NOTIFY_DELETED,
+		counter);
+
+	qb_list_del(&counter->list);
+	free(counter->key_name);
+	free(counter);
+}
+
 static void icmap_notify_fn(uint32_t event, char *key, void *old_value, void *value, void *user_data)
 {
 	icmap_track_t icmap_track = (icmap_track_t)user_data;
@@ -1201,6 +1538,7 @@ cs_error_t icmap_track_add(
 
 	qb_list_init(&(*icmap_track)->list);
 	qb_list_add (&(*icmap_track)->list, &icmap_track_list_head);
+	icmap_counters_tracked_update();
 
 	return (CS_OK);
 }
@@ -1217,6 +1555,7 @@ cs_error_t icmap_track_delete(icmap_track_t icmap_track)
 	qb_list_del(&icmap_track->list);
 	free(icmap_track->key_name);
 	free(icmap_track);
+	icmap_counters_tracked_update();
 
 	return (CS_OK);
 }
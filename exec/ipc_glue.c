@@ -80,11 +80,30 @@ struct cs_ipcs_mapper {
 	char name[CS_IPCS_MAPPER_SERV_NAME];
 };
 
-struct outq_item {
-	void *msg;
-	size_t mlen;
-	struct qb_list_head list;
-};
+/*
+ * Outgoing event queue of a slow client.  Messages are copied into one
+ * per connection buffer instead of being allocated one by one.  The
+ * buffer doubles as needed up to outq_bytes_max queued bytes
+ * (system.ipc_outq_max), a client falling further behind is disconnected.
+ * Buffers of the initial size are recycled through a small pool once a
+ * queue drains.
+ *
+ * If the client library asked for it (cs_ipcs_dispatch_batch_set), the
+ * queued events are sent packed into one batch event: a
+ * qb_ipc_response_header with the batch id, followed by the events, each
+ * padded to OUTQ_BATCH_ALIGN.  outq_flush stops after OUTQ_FLUSH_MAX events
+ * and reschedules itself, so one backlogged client doesn't hold up the
+ * main loop.
+ */
+#define OUTQ_INITIAL_SIZE	(64 * 1024)
+#define OUTQ_BYTES_MAX_DEFAULT	(32 * 1024 * 1024)
+#define OUTQ_POOL_MAX		16
+#define OUTQ_FLUSH_MAX		64
+#define OUTQ_BATCH_ALIGN	8
+
+static char *outq_pool[OUTQ_POOL_MAX];
+static int outq_pool_entries = 0;
+static uint32_t outq_bytes_max = OUTQ_BYTES_MAX_DEFAULT;
 
 static struct cs_ipcs_mapper ipcs_mapper[SERVICES_COUNT_MAX];
 
@@ -95,6 +114,7 @@ static int32_t cs_ipcs_dispatch_mod(enum qb_loop_priority p, int32_t fd, int32_t
 	void *data, qb_ipcs_dispatch_fn_t fn);
 static int32_t cs_ipcs_dispatch_del(int32_t fd);
 static void outq_flush (void *data);
+static void outq_buf_release (struct cs_ipcs_conn_context *context);
 
 
 static struct qb_ipcs_poll_handlers corosync_poll_funcs = {
@@ -277,7 +297,7 @@ static void cs_ipcs_connection_created(qb_ipcs_connection_t *c)
 		return;
 	}
 
-	qb_list_init(&context->outq_head);
+	context->outq_buf = NULL;
 	context->queuing = QB_FALSE;
 	context->queued = 0;
 	context->sent = 0;
@@ -319,20 +339,12 @@ void *cs_ipcs_private_data_get(void *conn)
 static void cs_ipcs_connection_destroyed (qb_ipcs_connection_t *c)
 {
 	struct cs_ipcs_conn_context *context;
-	struct qb_list_head *list, *tmp_iter;
-	struct outq_item *outq_item;
 
 	log_printf(LOG_DEBUG, "%s() ", __func__);
 
 	context = qb_ipcs_context_get(c);
 	if (context) {
-		qb_list_for_each_safe(list, tmp_iter, &(context->outq_head)) {
-			outq_item = qb_list_entry (list, struct outq_item, list);
-
-			qb_list_del (list);
-			free (outq_item->msg);
-			free (outq_item);
-		}
+		outq_buf_release (context);
 		free(context);
 	}
 }
@@ -380,18 +392,173 @@ int cs_ipcs_response_send(void *conn, const void *msg, size_t mlen)
 	return rc;
 }
 
+static void outq_buf_release (struct cs_ipcs_conn_context *context)
+{
+	if (context->outq_buf == NULL) {
+		return;
+	}
+
+	if (context->outq_size == OUTQ_INITIAL_SIZE &&
+	    outq_pool_entries < OUTQ_POOL_MAX) {
+		outq_pool[outq_pool_entries++] = context->outq_buf;
+	} else {
+		free (context->outq_buf);
+	}
+	context->outq_buf = NULL;
+	context->outq_size = 0;
+	context->outq_head = 0;
+	context->outq_tail = 0;
+}
+
+/*
+ * Make room for needed more bytes at the tail of the queue, either by
+ * moving the unsent records to the front of the buffer or by growing it.
+ */
+static int outq_reserve (struct cs_ipcs_conn_context *context, size_t needed)
+{
+	size_t used = context->outq_tail - context->outq_head;
+	size_t new_size;
+	char *new_buf;
+
+	if (context->outq_size - context->outq_tail >= needed) {
+		return (0);
+	}
+
+	/*
+	 * Compact only when it frees at least half of the buffer, so the
+	 * copying stays amortized
+	 */
+	if (used + needed <= context->outq_size / 2) {
+		memmove (context->outq_buf, context->outq_buf + context->outq_head, used);
+		context->outq_head = 0;
+		context->outq_tail = used;
+		return (0);
+	}
+
+	new_size = (context->outq_size != 0) ? context->outq_size : OUTQ_INITIAL_SIZE;
+	while (new_size < used + needed) {
+		new_size *= 2;
+	}
+
+	if (new_size == OUTQ_INITIAL_SIZE && outq_pool_entries > 0) {
+		new_buf = outq_pool[--outq_pool_entries];
+	} else {
+		new_buf = malloc (new_size);
+		if (new_buf == NULL) {
+			return (-1);
+		}
+	}
+
+	if (context->outq_buf != NULL) {
+		memcpy (new_buf, context->outq_buf + context->outq_head, used);
+		outq_buf_release (context);
+	}
+	context->outq_buf = new_buf;
+	context->outq_size = new_size;
+	context->outq_head = 0;
+	context->outq_tail = used;
+
+	return (0);
+}
+
+#define OUTQ_BATCH_PADDED(len) \
+	(((len) + OUTQ_BATCH_ALIGN - 1) & ~((size_t)OUTQ_BATCH_ALIGN - 1))
+
+/*
+ * Collect up to max_events queued events, starting at outq_head, for one
+ * batch event.  Only events carrying their own size in the header are
+ * packed.  Returns the number of events, *end is where the next event
+ * starts and *event_bytes their total length without padding.
+ */
+static int outq_batch_gather (
+	struct cs_ipcs_conn_context *context,
+	int max_events,
+	struct qb_ipc_response_header *batch_header,
+	struct iovec *iov,
+	unsigned int *iov_len,
+	size_t *end,
+	uint64_t *event_bytes)
+{
+	static const char pad[OUTQ_BATCH_ALIGN];
+	struct qb_ipc_response_header header;
+	size_t pos = context->outq_head;
+	size_t batch_size = sizeof (*batch_header);
+	uint32_t mlen;
+	int events = 0;
+
+	iov[0].iov_base = batch_header;
+	iov[0].iov_len = sizeof (*batch_header);
+	*iov_len = 1;
+	*event_bytes = 0;
+
+	while (events < max_events && pos < context->outq_tail) {
+		memcpy (&mlen, context->outq_buf + pos, sizeof (mlen));
+		if (mlen < sizeof (header) ||
+		    batch_size + OUTQ_BATCH_PADDED (mlen) > context->outq_batch_max) {
+			break;
+		}
+		memcpy (&header, context->outq_buf + pos + sizeof (mlen), sizeof (header));
+		if (header.size != mlen) {
+			break;
+		}
+
+		iov[*iov_len].iov_base = context->outq_buf + pos + sizeof (mlen);
+		iov[(*iov_len)++].iov_len = mlen;
+		if (OUTQ_BATCH_PADDED (mlen) != mlen) {
+			iov[*iov_len].iov_base = (void *)pad;
+			iov[(*iov_len)++].iov_len = OUTQ_BATCH_PADDED (mlen) - mlen;
+		}
+
+		batch_size += OUTQ_BATCH_PADDED (mlen);
+		*event_bytes += mlen;
+		pos += sizeof (mlen) + mlen;
+		events++;
+	}
+
+	batch_header->id = context->outq_batch_id;
+	batch_header->size = batch_size;
+	batch_header->error = CS_OK;
+	*end = pos;
+
+	return (events);
+}
+
 static void outq_flush (void *data)
 {
 	qb_ipcs_connection_t *conn = data;
-	struct qb_list_head *list, *tmp_iter;
-	struct outq_item *outq_item;
+	struct qb_ipc_response_header batch_header;
+	struct iovec iov[1 + 2 * OUTQ_FLUSH_MAX];
+	unsigned int iov_len;
+	uint32_t mlen;
 	int32_t rc;
+	int32_t expected;
+	int sent;
+	int events;
+	size_t end;
+	uint64_t event_bytes;
 	struct cs_ipcs_conn_context *context = qb_ipcs_context_get(conn);
 
-	qb_list_for_each_safe(list, tmp_iter, &(context->outq_head)) {
-		outq_item = qb_list_entry (list, struct outq_item, list);
+	for (sent = 0;
+	     sent < OUTQ_FLUSH_MAX && context->outq_head < context->outq_tail;
+	     sent += events) {
+		events = 0;
+		if (context->outq_batch_id != 0) {
+			events = outq_batch_gather (context, OUTQ_FLUSH_MAX - sent,
+				&batch_header, iov, &iov_len, &end, &event_bytes);
+		}
 
-		rc = qb_ipcs_event_send(conn, outq_item->msg, outq_item->mlen);
+		if (events > 1) {
+			expected = batch_header.size;
+			rc = qb_ipcs_event_sendv(conn, iov, iov_len);
+		} else {
+			memcpy (&mlen, context->outq_buf + context->outq_head, sizeof (mlen));
+			events = 1;
+			event_bytes = mlen;
+			end = context->outq_head + sizeof (mlen) + mlen;
+			expected = mlen;
+			rc = qb_ipcs_event_send(conn,
+				context->outq_buf + context->outq_head + sizeof (mlen), mlen);
+		}
 		if (rc < 0 && rc != -EAGAIN) {
 			errno = -rc;
 			qb_perror(LOG_ERR, "qb_ipcs_event_send");
@@ -399,20 +566,20 @@ static void outq_flush (void *data)
 		} else if (rc == -EAGAIN) {
 			break;
 		}
-		assert(rc == outq_item->mlen);
-		context->sent++;
-		context->queued--;
-
-		qb_list_del (list);
-		free (outq_item->msg);
-		free (outq_item);
+		assert(rc == expected);
+		context->sent += events;
+		context->queued -= events;
+		context->queued_bytes -= event_bytes;
+		context->outq_head = end;
 	}
-	if (qb_list_empty (&context->outq_head)) {
+	if (context->outq_head == context->outq_tail) {
 		context->queuing = QB_FALSE;
 		log_printf(LOGSYS_LEVEL_INFO, "Q empty, queued:%d sent:%d.",
 			context->queued, context->sent);
 		context->queued = 0;
+		context->queued_bytes = 0;
 		context->sent = 0;
+		outq_buf_release (context);
 	} else {
 		qb_loop_job_add(cs_poll_handle_get(), QB_LOOP_HIGH, conn, outq_flush);
 	}
@@ -422,8 +589,7 @@ static void msg_send_or_queue(qb_ipcs_connection_t *conn, const struct iovec *io
 {
 	int32_t rc = 0;
 	int32_t i;
-	int32_t bytes_msg = 0;
-	struct outq_item *outq_item;
+	uint32_t bytes_msg = 0;
 	char *write_buf = 0;
 	struct cs_ipcs_conn_context *context = qb_ipcs_context_get(conn);
 
@@ -432,7 +598,7 @@ static void msg_send_or_queue(qb_ipcs_connection_t *conn, const struct iovec *io
 	}
 
 	if (!context->queuing) {
-		assert(qb_list_empty (&context->outq_head));
+		assert(context->outq_head == context->outq_tail);
 		rc = qb_ipcs_event_sendv(conn, iov, iov_len);
 		if (rc == bytes_msg) {
 			context->sent++;
@@ -440,6 +606,7 @@ static void msg_send_or_queue(qb_ipcs_connection_t *conn, const struct iovec *io
 		}
 		if (rc == -EAGAIN) {
 			context->queued = 0;
+			context->queued_bytes = 0;
 			context->sent = 0;
 			context->queuing = QB_TRUE;
 			qb_loop_job_add(cs_poll_handle_get(), QB_LOOP_HIGH, conn, outq_flush);
@@ -448,27 +615,39 @@ static void msg_send_or_queue(qb_ipcs_connection_t *conn, const struct iovec *io
 			return;
 		}
 	}
-	outq_item = malloc (sizeof (struct outq_item));
-	if (outq_item == NULL) {
+
+	if (outq_bytes_max != 0 &&
+	    context->queued_bytes + bytes_msg > outq_bytes_max) {
+		log_printf(LOGSYS_LEVEL_ERROR,
+			"Outgoing queue of %s exceeded %u bytes, disconnecting",
+			context->proc_name, outq_bytes_max);
+		global_stats.outq_overflow++;
 		qb_ipcs_disconnect(conn);
 		return;
 	}
-	outq_item->msg = malloc (bytes_msg);
-	if (outq_item->msg == NULL) {
-		free (outq_item);
+
+	if (outq_reserve (context, sizeof (bytes_msg) + bytes_msg) != 0) {
 		qb_ipcs_disconnect(conn);
 		return;
 	}
 
-	write_buf = outq_item->msg;
+	write_buf = context->outq_buf + context->outq_tail;
+	memcpy (write_buf, &bytes_msg, sizeof (bytes_msg));
+	write_buf += sizeof (bytes_msg);
 	for (i = 0; i < iov_len; i++) {
 		memcpy (write_buf, iov[i].iov_base, iov[i].iov_len);
 		write_buf += iov[i].iov_len;
 	}
-	outq_item->mlen = bytes_msg;
-	qb_list_init (&outq_item->list);
-	qb_list_add_tail (&outq_item->list, &context->outq_head);
+	context->outq_tail += sizeof (bytes_msg) + bytes_msg;
+
 	context->queued++;
+	context->queued_bytes += bytes_msg;
+	if (context->queued > context->queued_high_water) {
+		context->queued_high_water = context->queued;
+	}
+	if (context->queued_bytes > context->queued_bytes_high_water) {
+		context->queued_bytes_high_water = context->queued_bytes;
+	}
 }
 
 int cs_ipcs_dispatch_send(void *conn, const void *msg, size_t mlen)
@@ -488,6 +667,43 @@ int cs_ipcs_dispatch_iov_send (void *conn,
 	return 0;
 }
 
+/*
+ * The client can unpack several events sent in one batch event with
+ * response id batch_id, which must not be larger than max_size bytes.
+ */
+int cs_ipcs_dispatch_batch_set (void *conn, int32_t batch_id, uint32_t max_size)
+{
+	struct cs_ipcs_conn_context *context = qb_ipcs_context_get(conn);
+
+	if (batch_id == 0 ||
+	    max_size < sizeof (struct qb_ipc_response_header) * 2) {
+		return (-EINVAL);
+	}
+
+	context->outq_batch_id = batch_id;
+	context->outq_batch_max = max_size;
+
+	return (0);
+}
+
+/*
+ * An asynchronous request was refused without a response. Let the service
+ * account for it, e.g. in its acknowledgements.
+ */
+static void cs_ipcs_msg_refused (qb_ipcs_connection_t *c,
+	int32_t service,
+	const struct qb_ipc_request_header *request_pt,
+	cs_error_t error)
+{
+	if (request_pt->id < 0 ||
+	    request_pt->id >= corosync_service[service]->lib_engine_count ||
+	    corosync_service[service]->lib_engine[request_pt->id].lib_refused_fn == NULL) {
+		return ;
+	}
+
+	corosync_service[service]->lib_engine[request_pt->id].lib_refused_fn (c, request_pt, error);
+}
+
 static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
 		void *data, size_t size)
 {
@@ -505,7 +721,13 @@ static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
 			request_pt,
 			&sending_allowed_private_data);
 
-	is_async_call = (service == CPG_SERVICE && request_pt->id == 2);
+	/*
+	 * MESSAGE_REQ_CPG_MCAST, MESSAGE_REQ_CPG_MCAST_ASYNC and
+	 * MESSAGE_REQ_CPG_PARTIAL_MCAST_ASYNC: the library doesn't wait for
+	 * a response, so none may be sent
+	 */
+	is_async_call = (service == CPG_SERVICE &&
+		(request_pt->id == 2 || request_pt->id == 13 || request_pt->id == 14));
 
 	/*
 	 * This happens when the message contains some kind of invalid
@@ -524,6 +746,7 @@ static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
 		if (is_async_call) {
 			log_printf(LOGSYS_LEVEL_INFO, "*** %s() invalid message! size:%d error:%d",
 				__func__, response.size, response.error);
+			cs_ipcs_msg_refused (c, service, request_pt, CS_ERR_INVALID_PARAM);
 		} else {
 			qb_ipcs_response_send (c,
 				&response,
@@ -550,6 +773,7 @@ static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
 				"*** %s() (%d:%d - %d) %s!",
 				__func__, service, request_pt->id,
 				is_async_call, strerror(-send_ok));
+			cs_ipcs_msg_refused (c, service, request_pt, CS_ERR_TRY_AGAIN);
 		}
 		res = -ENOBUFS;
 	}
@@ -733,6 +957,8 @@ void cs_ipcs_clear_stats(void)
 			cnx->invalid_request = 0;
 			cnx->overload = 0;
 			cnx->sent = 0;
+			cnx->queued_high_water = cnx->queued;
+			cnx->queued_bytes_high_water = cnx->queued_bytes;
 
 		}
 	}
@@ -826,4 +1052,8 @@ void cs_ipcs_init(void)
 
 	global_stats.active = 0;
 	global_stats.closed = 0;
+
+	if (icmap_get_uint32("system.ipc_outq_max", &outq_bytes_max) != CS_OK) {
+		outq_bytes_max = OUTQ_BYTES_MAX_DEFAULT;
+	}
 }
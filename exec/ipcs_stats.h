@@ -33,9 +33,25 @@
  */
 
 struct cs_ipcs_conn_context {
-	struct qb_list_head outq_head;
+	/*
+	 * Events that could not be sent yet, stored back to back as
+	 * (uint32_t length, message) records between outq_head and outq_tail
+	 */
+	char *outq_buf;
+	size_t outq_size;
+	size_t outq_head;
+	size_t outq_tail;
+	/*
+	 * Response id queued events are packed under, 0 if the client can't
+	 * unpack them, and the largest such batch event
+	 */
+	int32_t outq_batch_id;
+	uint32_t outq_batch_max;
 	int32_t queuing;
 	uint32_t queued;
+	uint32_t queued_high_water;
+	uint64_t queued_bytes;
+	uint64_t queued_bytes_high_water;
 	uint64_t invalid_request;
 	uint64_t overload;
 	uint32_t sent;
@@ -47,6 +63,7 @@ struct ipcs_global_stats
 {
 	uint64_t active;
 	uint64_t closed;
+	uint64_t outq_overflow;
 };
 
 struct ipcs_conn_stats
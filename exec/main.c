@@ -251,6 +251,7 @@ static void corosync_blackbox_write_to_file (void)
 static void unlink_all_completed (void)
 {
 	api->timer_delete (corosync_stats_timer_handle);
+	stats_shm_fini();
 	qb_loop_stop (corosync_poll_handle);
 	icmap_fini();
 }
@@ -334,6 +335,8 @@ static int corosync_sync_callbacks_retrieve (
 	callbacks->sync_process = corosync_service[service_id]->sync_process;
 	callbacks->sync_activate = corosync_service[service_id]->sync_activate;
 	callbacks->sync_abort = corosync_service[service_id]->sync_abort;
+	callbacks->independent = corosync_service[service_id]->sync_independent;
+	callbacks->duration_key = service_stats_sync_duration[service_id];
 	return (0);
 }
 
@@ -565,6 +568,7 @@ static void corosync_totem_stats_updater (void *data)
 		stats->srp->token[stats->srp->latest_token].rx;
 
 	stats_trigger_trackers();
+	stats_shm_update();
 
 	api->timer_add_duration (1500 * MILLI_2_NANO_SECONDS, NULL,
 		corosync_totem_stats_updater,
@@ -573,6 +577,8 @@ static void corosync_totem_stats_updater (void *data)
 
 static void corosync_totem_stats_init (void)
 {
+	stats_shm_init();
+
 	/* start stats timer */
 	api->timer_add_duration (1500 * MILLI_2_NANO_SECONDS, NULL,
 		corosync_totem_stats_updater,
@@ -612,7 +618,9 @@ static void deliver_fn (
 		return;
 	}
 
-	icmap_fast_inc(service_stats_rx[service][fn_id]);
+	if (service_stats_rx[service][fn_id] != NULL) {
+		icmap_counter_inc(service_stats_rx[service][fn_id]);
+	}
 
 	if (endian_conversion_required) {
 		assert(corosync_service[service]->exec_engine[fn_id].exec_endian_convert_fn != NULL);
@@ -636,8 +644,8 @@ int main_mcast (
 	service = req->id >> 16;
 	fn_id = req->id & 0xffff;
 
-	if (corosync_service[service]) {
-		icmap_fast_inc(service_stats_tx[service][fn_id]);
+	if (corosync_service[service] && service_stats_tx[service][fn_id] != NULL) {
+		icmap_counter_inc(service_stats_tx[service][fn_id]);
 	}
 
 	return (totempg_groups_mcast_joined (corosync_group_handle, iovec, iov_len, guarantee));
@@ -1281,6 +1289,22 @@ static void show_version_info(void)
 	show_version_info_compress();
 }
 
+/*
+ * Item allocation of the global icmap. It has to be known before the
+ * configuration is read into icmap, so it comes from the environment.
+ */
+static icmap_alloc_t corosync_icmap_alloc_get (void)
+{
+	const char *str;
+
+	str = getenv ("COROSYNC_ICMAP_ALLOC");
+	if (str != NULL && strcmp (str, "arena") == 0) {
+		return (ICMAP_ALLOC_ARENA);
+	}
+
+	return (ICMAP_ALLOC_MALLOC);
+}
+
 int main (int argc, char **argv, char **envp)
 {
 	const char *error_string;
@@ -1360,7 +1384,7 @@ int main (int argc, char **argv, char **envp)
 	(void)signal (SIGPIPE, SIG_IGN);
 #endif
 
-	if (icmap_init() != CS_OK) {
+	if (icmap_init_alloc(corosync_icmap_alloc_get()) != CS_OK) {
 		fprintf (stderr, "Corosync Executive couldn't initialize configuration component.\n");
 		syslog (LOGSYS_LEVEL_ERROR, "Corosync Executive couldn't initialize configuration component.");
 		corosync_exit_error (COROSYNC_DONE_ICMAP);
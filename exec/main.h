@@ -106,6 +106,9 @@ extern int cs_ipcs_dispatch_send(void *conn, const void *msg, size_t mlen);
 extern int cs_ipcs_dispatch_iov_send (void *conn,
 	const struct iovec *iov,
 	unsigned int iov_len);
+extern int cs_ipcs_dispatch_batch_set (void *conn,
+	int32_t batch_id,
+	uint32_t max_size);
 
 extern int cs_ipcs_response_send(void *conn, const void *msg, size_t mlen);
 extern int cs_ipcs_response_iov_send (void *conn,
@@ -109,8 +109,9 @@ struct seus_handler_data {
 
 struct corosync_service_engine *corosync_service[SERVICES_COUNT_MAX];
 
-const char *service_stats_rx[SERVICES_COUNT_MAX][SERVICE_HANDLER_MAXIMUM_COUNT];
-const char *service_stats_tx[SERVICES_COUNT_MAX][SERVICE_HANDLER_MAXIMUM_COUNT];
+icmap_counter_t service_stats_rx[SERVICES_COUNT_MAX][SERVICE_HANDLER_MAXIMUM_COUNT];
+icmap_counter_t service_stats_tx[SERVICES_COUNT_MAX][SERVICE_HANDLER_MAXIMUM_COUNT];
+const char *service_stats_sync_duration[SERVICES_COUNT_MAX];
 
 static void (*service_unlink_all_complete) (void) = NULL;
 
@@ -163,11 +164,21 @@ char *corosync_service_link_and_init (
 	for (fn = 0; fn < service_engine->exec_engine_count; fn++) {
 		snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "runtime.services.%s.%d.tx", name_sufix, fn);
 		icmap_set_uint64(key_name, 0);
-		service_stats_tx[service_engine->id][fn] = strdup(key_name);
+		if (service_stats_tx[service_engine->id][fn] == NULL) {
+			icmap_counter_get(key_name, &service_stats_tx[service_engine->id][fn]);
+		}
 
 		snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "runtime.services.%s.%d.rx", name_sufix, fn);
 		icmap_set_uint64(key_name, 0);
-		service_stats_rx[service_engine->id][fn] = strdup(key_name);
+		if (service_stats_rx[service_engine->id][fn] == NULL) {
+			icmap_counter_get(key_name, &service_stats_rx[service_engine->id][fn]);
+		}
+	}
+
+	if (service_engine->sync_init != NULL && service_stats_sync_duration[service_engine->id] == NULL) {
+		snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "runtime.services.%s.sync_duration", name_sufix);
+		icmap_set_uint64(key_name, 0);
+		service_stats_sync_duration[service_engine->id] = strdup(key_name);
 	}
 
 	log_printf (LOGSYS_LEVEL_NOTICE,
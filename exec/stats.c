@@ -36,13 +36,16 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <unistd.h>
 #include <libknet.h>
 
 #include <qb/qblist.h>
+#include <qb/qbutil.h>
 #include <qb/qbipcs.h>
 #include <qb/qbipc_common.h>
 
@@ -51,6 +54,7 @@
 #include <corosync/logsys.h>
 #include <corosync/icmap.h>
 #include <corosync/totem/totemstats.h>
+#include <corosync/statsshm.h>
 
 #include "util.h"
 #include "ipcs_stats.h"
@@ -71,17 +75,60 @@ static unsigned int highest_schedmiss_event;
 
 #define SCHEDMISS_PREFIX "stats.schedmiss"
 
+/*
+ * Shared memory snapshot (system.stats_shm). Keys are parsed once when
+ * the set of keys changes, not on every refresh.
+ */
+struct stats_shm_slot {
+	struct stats_item *item;
+	int nodeid;
+	int link_no;
+	int service_id;
+	uint32_t pid;
+	void *conn_ptr;
+	unsigned int sm_event;
+};
+
+static int stats_shm_fd = -1;
+static struct cs_stats_shm_header *stats_shm_header;
+static size_t stats_shm_mapped;
+static struct stats_shm_slot *stats_shm_slots;
+static size_t stats_shm_slots_allocated;
+static uint32_t stats_shm_entries;
+static uint64_t stats_shm_generation;
+static int stats_shm_keys_changed;
+
 /* Convert iterator number to text and a stats pointer */
 struct cs_stats_conv {
-	enum {STAT_PG, STAT_SRP, STAT_KNET, STAT_KNET_HANDLE, STAT_IPCSC, STAT_IPCSG, STAT_SCHEDMISS} type;
+	enum {STAT_PG, STAT_SRP, STAT_SRP_HIST, STAT_KNET, STAT_KNET_HANDLE, STAT_IPCSC, STAT_IPCSG, STAT_SCHEDMISS} type;
 	const char *name;
 	const size_t offset;
 	const icmap_value_types_t value_type;
+	/* STAT_SRP_HIST only: percentile in 1/10000 */
+	const unsigned int permyriad;
 };
 
+/* Percentiles, max and count of a totem_hist_t */
+#define SRP_HIST_STATS(name, hist) \
+	{ STAT_SRP_HIST, name "_p50",   offsetof(totemsrp_stats_t, hist),       ICMAP_VALUETYPE_UINT32, 5000}, \
+	{ STAT_SRP_HIST, name "_p99",   offsetof(totemsrp_stats_t, hist),       ICMAP_VALUETYPE_UINT32, 9900}, \
+	{ STAT_SRP_HIST, name "_p999",  offsetof(totemsrp_stats_t, hist),       ICMAP_VALUETYPE_UINT32, 9990}, \
+	{ STAT_SRP,      name "_max",   offsetof(totemsrp_stats_t, hist.max),   ICMAP_VALUETYPE_UINT32}, \
+	{ STAT_SRP,      name "_count", offsetof(totemsrp_stats_t, hist.count), ICMAP_VALUETYPE_UINT64}
+
 struct cs_stats_conv cs_pg_stats[] = {
 	{ STAT_PG, "msg_queue_avail",         offsetof(totempg_stats_t, msg_queue_avail),         ICMAP_VALUETYPE_UINT32},
 	{ STAT_PG, "msg_reserved",            offsetof(totempg_stats_t, msg_reserved),            ICMAP_VALUETYPE_UINT32},
+	{ STAT_PG, "packed_1",                offsetof(totempg_stats_t, packed_hist[0]),          ICMAP_VALUETYPE_UINT64},
+	{ STAT_PG, "packed_2_3",              offsetof(totempg_stats_t, packed_hist[1]),          ICMAP_VALUETYPE_UINT64},
+	{ STAT_PG, "packed_4_7",              offsetof(totempg_stats_t, packed_hist[2]),          ICMAP_VALUETYPE_UINT64},
+	{ STAT_PG, "packed_8_15",             offsetof(totempg_stats_t, packed_hist[3]),          ICMAP_VALUETYPE_UINT64},
+	{ STAT_PG, "packed_16_31",            offsetof(totempg_stats_t, packed_hist[4]),          ICMAP_VALUETYPE_UINT64},
+	{ STAT_PG, "packed_32_63",            offsetof(totempg_stats_t, packed_hist[5]),          ICMAP_VALUETYPE_UINT64},
+	{ STAT_PG, "packed_64_more",          offsetof(totempg_stats_t, packed_hist[6]),          ICMAP_VALUETYPE_UINT64},
+	{ STAT_PG, "pack_urgent_flush",       offsetof(totempg_stats_t, pack_urgent_flush),       ICMAP_VALUETYPE_UINT64},
+	{ STAT_PG, "pack_size_flush",         offsetof(totempg_stats_t, pack_size_flush),         ICMAP_VALUETYPE_UINT64},
+	{ STAT_PG, "pack_delayed",            offsetof(totempg_stats_t, pack_delayed),            ICMAP_VALUETYPE_UINT64},
 };
 struct cs_stats_conv cs_srp_stats[] = {
 	{ STAT_SRP, "orf_token_tx",           offsetof(totemsrp_stats_t, orf_token_tx),           ICMAP_VALUETYPE_UINT64},
@@ -114,6 +161,19 @@ struct cs_stats_conv cs_srp_stats[] = {
 	{ STAT_SRP, "mtt_rx_token",           offsetof(totemsrp_stats_t, mtt_rx_token),           ICMAP_VALUETYPE_UINT32},
 	{ STAT_SRP, "avg_token_workload",     offsetof(totemsrp_stats_t, avg_token_workload),     ICMAP_VALUETYPE_UINT32},
 	{ STAT_SRP, "avg_backlog_calc",       offsetof(totemsrp_stats_t, avg_backlog_calc),       ICMAP_VALUETYPE_UINT32},
+	{ STAT_SRP, "rx_batch_size",          offsetof(totemsrp_stats_t, rx_batch_size),          ICMAP_VALUETYPE_UINT32},
+	{ STAT_SRP, "rx_batch_max",           offsetof(totemsrp_stats_t, rx_batch_max),           ICMAP_VALUETYPE_UINT32},
+	{ STAT_SRP, "rx_batches",             offsetof(totemsrp_stats_t, rx_batches),             ICMAP_VALUETYPE_UINT64},
+	{ STAT_SRP, "rx_batch_msgs",          offsetof(totemsrp_stats_t, rx_batch_msgs),          ICMAP_VALUETYPE_UINT64},
+	{ STAT_SRP, "rx_thread_frames",       offsetof(totemsrp_stats_t, rx_thread_frames),       ICMAP_VALUETYPE_UINT64},
+	{ STAT_SRP, "rx_thread_handoffs",     offsetof(totemsrp_stats_t, rx_thread_handoffs),     ICMAP_VALUETYPE_UINT64},
+	{ STAT_SRP, "rx_thread_queue_full",   offsetof(totemsrp_stats_t, rx_thread_queue_full),   ICMAP_VALUETYPE_UINT64},
+	{ STAT_SRP, "rx_thread_discarded",    offsetof(totemsrp_stats_t, rx_thread_discarded),    ICMAP_VALUETYPE_UINT64},
+	SRP_HIST_STATS("token_hold", token_hold_hist),
+	SRP_HIST_STATS("token_rotation", token_rotation_hist),
+	SRP_HIST_STATS("token_mcast", token_mcast_hist),
+	SRP_HIST_STATS("token_rtr", token_rtr_hist),
+	SRP_HIST_STATS("deliver", deliver_hist),
 };
 
 struct cs_stats_conv cs_knet_stats[] = {
@@ -185,6 +245,9 @@ struct cs_stats_conv cs_knet_handle_stats[] = {
 struct cs_stats_conv cs_ipcs_conn_stats[] = {
 	{ STAT_IPCSC, "queueing",        offsetof(struct ipcs_conn_stats, cnx.queuing),          ICMAP_VALUETYPE_INT32},
 	{ STAT_IPCSC, "queued",          offsetof(struct ipcs_conn_stats, cnx.queued),           ICMAP_VALUETYPE_UINT32},
+	{ STAT_IPCSC, "queued_high_water",       offsetof(struct ipcs_conn_stats, cnx.queued_high_water),       ICMAP_VALUETYPE_UINT32},
+	{ STAT_IPCSC, "queued_bytes",            offsetof(struct ipcs_conn_stats, cnx.queued_bytes),            ICMAP_VALUETYPE_UINT64},
+	{ STAT_IPCSC, "queued_bytes_high_water", offsetof(struct ipcs_conn_stats, cnx.queued_bytes_high_water), ICMAP_VALUETYPE_UINT64},
 	{ STAT_IPCSC, "invalid_request", offsetof(struct ipcs_conn_stats, cnx.invalid_request),  ICMAP_VALUETYPE_UINT64},
 	{ STAT_IPCSC, "overload",        offsetof(struct ipcs_conn_stats, cnx.overload),         ICMAP_VALUETYPE_UINT64},
 	{ STAT_IPCSC, "sent",            offsetof(struct ipcs_conn_stats, cnx.sent),             ICMAP_VALUETYPE_UINT32},
@@ -200,6 +263,7 @@ struct cs_stats_conv cs_ipcs_conn_stats[] = {
 struct cs_stats_conv cs_ipcs_global_stats[] = {
 	{ STAT_IPCSG, "global.active",        offsetof(struct ipcs_global_stats, active),           ICMAP_VALUETYPE_UINT64},
 	{ STAT_IPCSG, "global.closed",        offsetof(struct ipcs_global_stats, closed),           ICMAP_VALUETYPE_UINT64},
+	{ STAT_IPCSG, "global.outq_overflow", offsetof(struct ipcs_global_stats, outq_overflow),    ICMAP_VALUETYPE_UINT64},
 };
 struct cs_stats_conv cs_schedmiss_stats[] = {
 	{ STAT_SCHEDMISS, "timestamp",    offsetof(struct schedmiss_entry, timestamp), ICMAP_VALUETYPE_UINT64},
@@ -250,7 +314,14 @@ static void stats_map_set_value(struct cs_stats_conv *conv,
 	if (value) {
 		assert(value_len != NULL);
 
-		memcpy(value, (char *)(stat_array) + conv->offset, *value_len);
+		if (conv->type == STAT_SRP_HIST) {
+			uint32_t percentile = totem_hist_percentile(
+			    (totem_hist_t *)((char *)(stat_array) + conv->offset), conv->permyriad);
+
+			memcpy(value, &percentile, *value_len);
+		} else {
+			memcpy(value, (char *)(stat_array) + conv->offset, *value_len);
+		}
 	}
 }
 
@@ -262,6 +333,7 @@ static void stats_add_entry(const char *key, struct cs_stats_conv *cs_conv)
 		item->cs_conv = cs_conv;
 		item->key_name = strdup(key);
 		qb_map_put(stats_map, item->key_name, item);
+		stats_shm_keys_changed = 1;
 	}
 }
 static void stats_rm_entry(const char *key)
@@ -270,6 +342,7 @@ static void stats_rm_entry(const char *key)
 
 	if (item) {
 		qb_map_rm(stats_map, item->key_name);
+		stats_shm_keys_changed = 1;
 		/* Structures freed in callback below */
 	}
 }
@@ -355,6 +428,7 @@ cs_error_t stats_map_get(const char *key_name,
 			stats_map_set_value(statinfo, pg_stats, value, value_len, type);
 			break;
 		case STAT_SRP:
+		case STAT_SRP_HIST:
 			pg_stats = api->totem_get_stats();
 			stats_map_set_value(statinfo, pg_stats->srp, value, value_len, type);
 			break;
@@ -476,6 +550,7 @@ void stats_add_schedmiss_event(uint64_t timestamp, float delay)
 #define STATS_CLEAR_TOTEM     "stats.clear.totem"
 #define STATS_CLEAR_ALL       "stats.clear.all"
 #define STATS_CLEAR_SCHEDMISS "stats.clear.schedmiss"
+#define STATS_CLEAR_HIST      "stats.clear.hist"
 
 cs_error_t stats_map_set(const char *key_name,
 			 const void *value,
@@ -496,6 +571,10 @@ cs_error_t stats_map_set(const char *key_name,
 		totempg_stats_clear(TOTEMPG_STATS_CLEAR_TOTEM);
 		cleared = 1;
 	}
+	if (strncmp(key_name, STATS_CLEAR_HIST, strlen(STATS_CLEAR_HIST)) == 0) {
+		totempg_stats_clear(TOTEMPG_STATS_CLEAR_HIST);
+		cleared = 1;
+	}
 	if (strncmp(key_name, STATS_CLEAR_SCHEDMISS, strlen(STATS_CLEAR_SCHEDMISS)) == 0) {
 		schedmiss_clear_stats();
 		cleared = 1;
@@ -782,3 +861,315 @@ void stats_ipcs_del_connection(int service_id, uint32_t pid, void *ptr)
 		stats_rm_entry(param);
 	}
 }
+
+/* Rebuild the list of keys published in the snapshot */
+static int stats_shm_slots_build(void)
+{
+	qb_map_iter_t *iter;
+	const char *key_name;
+	struct stats_item *item;
+	struct stats_shm_slot *slot;
+	struct stats_shm_slot *new_slots;
+	size_t count;
+	uint32_t entries;
+	int ok;
+
+	count = qb_map_count_get(stats_map);
+	if (count > stats_shm_slots_allocated) {
+		new_slots = realloc(stats_shm_slots, count * sizeof(struct stats_shm_slot));
+		if (new_slots == NULL) {
+			return (-1);
+		}
+		stats_shm_slots = new_slots;
+		stats_shm_slots_allocated = count;
+	}
+
+	iter = qb_map_iter_create(stats_map);
+	if (iter == NULL) {
+		return (-1);
+	}
+
+	entries = 0;
+	while (entries < count &&
+	    (key_name = qb_map_iter_next(iter, (void **)&item)) != NULL) {
+		if (strlen(key_name) >= CS_STATS_SHM_KEYNAME_LEN) {
+			continue;
+		}
+		slot = &stats_shm_slots[entries];
+		slot->item = item;
+
+		switch (item->cs_conv->type) {
+		case STAT_KNET:
+			ok = (sscanf(key_name, "stats.knet.node%d.link%d",
+			    &slot->nodeid, &slot->link_no) == 2);
+			break;
+		case STAT_IPCSC:
+			ok = (sscanf(key_name, "stats.ipcs.service%d.%d.%p",
+			    &slot->service_id, &slot->pid, &slot->conn_ptr) == 3);
+			break;
+		case STAT_SCHEDMISS:
+			ok = (sscanf(key_name, SCHEDMISS_PREFIX ".%u", &slot->sm_event) == 1 &&
+			    slot->sm_event < MAX_SCHEDMISS_EVENTS);
+			break;
+		default:
+			ok = 1;
+			break;
+		}
+		if (ok) {
+			entries++;
+		}
+	}
+	qb_map_iter_free(iter);
+
+	stats_shm_entries = entries;
+	return (0);
+}
+
+static int stats_shm_resize(size_t size)
+{
+	size_t new_len;
+	void *addr;
+
+	if (size <= stats_shm_mapped) {
+		return (0);
+	}
+
+	/*
+	 * Leave room for connections coming and going so that readers do not
+	 * need to map the file again every time
+	 */
+	new_len = size * 2;
+	new_len = (new_len + sysconf(_SC_PAGESIZE) - 1) & ~(sysconf(_SC_PAGESIZE) - 1);
+
+	if (ftruncate(stats_shm_fd, new_len) == -1) {
+		LOGSYS_PERROR(errno, LOGSYS_LEVEL_WARNING, "Can't resize stats snapshot");
+		return (-1);
+	}
+
+	addr = mmap(NULL, new_len, PROT_READ | PROT_WRITE, MAP_SHARED, stats_shm_fd, 0);
+	if (addr == MAP_FAILED) {
+		LOGSYS_PERROR(errno, LOGSYS_LEVEL_WARNING, "Can't map stats snapshot");
+		return (-1);
+	}
+
+	if (stats_shm_header != NULL) {
+		munmap(stats_shm_header, stats_shm_mapped);
+	}
+	stats_shm_header = addr;
+	stats_shm_mapped = new_len;
+
+	return (0);
+}
+
+static void stats_shm_entry_set(struct cs_stats_shm_entry *entry,
+				struct cs_stats_conv *conv,
+				void *stat_array)
+{
+	size_t value_len;
+	icmap_value_types_t type;
+
+	stats_map_set_value(conv, stat_array, NULL, &value_len, &type);
+	entry->type = type;
+	entry->flags = 0;
+
+	if (stat_array == NULL || value_len == 0) {
+		entry->value_len = 0;
+		return ;
+	}
+
+	/*
+	 * Strings which don't fit are cut, keeping the terminating NUL
+	 */
+	if (type == ICMAP_VALUETYPE_STRING) {
+		if (value_len > CS_STATS_SHM_VALUE_LEN) {
+			value_len = CS_STATS_SHM_VALUE_LEN;
+			entry->flags |= CS_STATS_SHM_VALUE_TRUNCATED;
+		}
+		memcpy(entry->value.data, (char *)stat_array + conv->offset, value_len - 1);
+		entry->value.data[value_len - 1] = '\0';
+		entry->value_len = value_len;
+		return ;
+	}
+
+	assert(value_len <= CS_STATS_SHM_VALUE_LEN);
+	stats_map_set_value(conv, stat_array, entry->value.data, &value_len, NULL);
+	entry->value_len = value_len;
+}
+
+/* Called from main.c after the stats were recalculated */
+void stats_shm_update(void)
+{
+	struct cs_stats_shm_header *header;
+	struct cs_stats_shm_entry *entry;
+	struct stats_shm_slot *slot;
+	struct cs_stats_conv *conv;
+	totempg_stats_t *pg_stats;
+	struct knet_link_status link_status;
+	struct ipcs_conn_stats ipcs_conn_stats;
+	struct ipcs_global_stats ipcs_global_stats;
+	struct knet_handle_stats knet_handle_stats;
+	void *knet_link_array = NULL;
+	void *knet_handle_array = NULL;
+	void *ipcs_conn_array = NULL;
+	void *ipcs_global_array = NULL;
+	void *stat_array;
+	int knet_nodeid = -1;
+	int knet_link_no = -1;
+	void *ipcs_conn_ptr = NULL;
+	int keys_changed;
+	uint32_t seq;
+	uint32_t i;
+
+	if (stats_shm_fd == -1) {
+		return ;
+	}
+
+	keys_changed = stats_shm_keys_changed;
+	if (keys_changed) {
+		if (stats_shm_slots_build() != 0 ||
+		    stats_shm_resize(sizeof(struct cs_stats_shm_header) +
+		    (size_t)stats_shm_entries * sizeof(struct cs_stats_shm_entry)) != 0) {
+			return ;
+		}
+		stats_shm_keys_changed = 0;
+		stats_shm_generation++;
+	}
+	header = stats_shm_header;
+
+	seq = header->seq;
+	__atomic_store_n(&header->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	header->magic = CS_STATS_SHM_MAGIC;
+	header->version = CS_STATS_SHM_VERSION;
+	header->entries = stats_shm_entries;
+	header->entry_size = sizeof(struct cs_stats_shm_entry);
+	header->size = sizeof(struct cs_stats_shm_header) +
+	    (uint64_t)stats_shm_entries * sizeof(struct cs_stats_shm_entry);
+	header->generation = stats_shm_generation;
+	header->timestamp = qb_util_nano_from_epoch_get();
+
+	pg_stats = api->totem_get_stats();
+
+	for (i = 0; i < stats_shm_entries; i++) {
+		slot = &stats_shm_slots[i];
+		conv = slot->item->cs_conv;
+		entry = CS_STATS_SHM_ENTRY(header, i);
+
+		if (keys_changed) {
+			memset(entry, 0, sizeof(*entry));
+			strcpy(entry->key_name, slot->item->key_name);
+		}
+
+		/*
+		 * Keys are in order, so all fields of one knet link or one IPC
+		 * connection are next to each other and fetched only once.
+		 */
+		switch (conv->type) {
+		case STAT_PG:
+			stat_array = pg_stats;
+			break;
+		case STAT_SRP:
+		case STAT_SRP_HIST:
+			stat_array = pg_stats->srp;
+			break;
+		case STAT_KNET_HANDLE:
+			if (knet_handle_array == NULL &&
+			    totemknet_handle_get_stats(&knet_handle_stats) == CS_OK) {
+				knet_handle_array = &knet_handle_stats;
+			}
+			stat_array = knet_handle_array;
+			break;
+		case STAT_KNET:
+			if (slot->nodeid != knet_nodeid || slot->link_no != knet_link_no) {
+				knet_nodeid = slot->nodeid;
+				knet_link_no = slot->link_no;
+				knet_link_array = NULL;
+				if (knet_nodeid > 0 && knet_nodeid <= KNET_MAX_HOST &&
+				    knet_link_no >= 0 && knet_link_no < KNET_MAX_LINK &&
+				    totemknet_link_get_status((knet_node_id_t)knet_nodeid,
+				    (uint8_t)knet_link_no, &link_status) == CS_OK) {
+					knet_link_array = &link_status;
+				}
+			}
+			stat_array = knet_link_array;
+			break;
+		case STAT_IPCSC:
+			if (slot->conn_ptr != ipcs_conn_ptr) {
+				ipcs_conn_ptr = slot->conn_ptr;
+				ipcs_conn_array = NULL;
+				if (cs_ipcs_get_conn_stats(slot->service_id, slot->pid,
+				    slot->conn_ptr, &ipcs_conn_stats) == CS_OK) {
+					ipcs_conn_array = &ipcs_conn_stats;
+				}
+			}
+			stat_array = ipcs_conn_array;
+			break;
+		case STAT_IPCSG:
+			if (ipcs_global_array == NULL) {
+				cs_ipcs_get_global_stats(&ipcs_global_stats);
+				ipcs_global_array = &ipcs_global_stats;
+			}
+			stat_array = ipcs_global_array;
+			break;
+		case STAT_SCHEDMISS:
+			stat_array = &schedmiss_event[slot->sm_event];
+			break;
+		default:
+			stat_array = NULL;
+			break;
+		}
+
+		stats_shm_entry_set(entry, conv, stat_array);
+	}
+
+	__atomic_store_n(&header->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void stats_shm_init(void)
+{
+	char *str;
+	int enabled = 0;
+
+	if (icmap_get_string("system.stats_shm", &str) == CS_OK) {
+		enabled = (strcmp(str, "yes") == 0);
+		free(str);
+	}
+	if (!enabled) {
+		return ;
+	}
+
+	/*
+	 * Never truncate a file a reader may still have mapped, start
+	 * with a new one instead
+	 */
+	unlink(CS_STATS_SHM_PATH);
+	stats_shm_fd = open(CS_STATS_SHM_PATH, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0640);
+	if (stats_shm_fd == -1) {
+		LOGSYS_PERROR(errno, LOGSYS_LEVEL_WARNING, "Can't create stats snapshot %s",
+		    CS_STATS_SHM_PATH);
+		return ;
+	}
+
+	stats_shm_keys_changed = 1;
+	stats_shm_update();
+}
+
+void stats_shm_fini(void)
+{
+	if (stats_shm_fd == -1) {
+		return ;
+	}
+
+	unlink(CS_STATS_SHM_PATH);
+	if (stats_shm_header != NULL) {
+		munmap(stats_shm_header, stats_shm_mapped);
+		stats_shm_header = NULL;
+		stats_shm_mapped = 0;
+	}
+	close(stats_shm_fd);
+	stats_shm_fd = -1;
+	free(stats_shm_slots);
+	stats_shm_slots = NULL;
+	stats_shm_slots_allocated = 0;
+}
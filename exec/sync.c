@@ -52,7 +52,10 @@
 #include <corosync/totem/totempg.h>
 #include <corosync/totem/totem.h>
 #include <corosync/logsys.h>
+#include <corosync/icmap.h>
+#include <qb/qbdefs.h>
 #include <qb/qbipc_common.h>
+#include <qb/qbutil.h>
 #include "schedwrk.h"
 #include "quorum.h"
 #include "sync.h"
@@ -65,6 +68,7 @@ LOGSYS_DECLARE_SUBSYS ("SYNC");
 
 enum sync_process_state {
 	PROCESS,
+	PROCESSED,
 	ACTIVATE
 };
 
@@ -86,6 +90,8 @@ struct service_entry {
 	int (*sync_process) (void);
 	void (*sync_activate) (void);
 	enum sync_process_state state;
+	int independent;
+	const char *duration_key;
 	char name[128];
 };
 
@@ -94,11 +100,17 @@ struct processor_entry {
 	int received;
 };
 
+/*
+ * independent_list was added later. Older nodes ignore it and send a
+ * shorter message, which turns off running independent services together.
+ */
 struct req_exec_service_build_message {
 	struct qb_ipc_request_header header __attribute__((aligned(8)));
 	struct memb_ring_id ring_id __attribute__((aligned(8)));
 	int service_list_entries __attribute__((aligned(8)));
 	int service_list[128] __attribute__((aligned(8)));
+	int independent_list_entries __attribute__((aligned(8)));
+	int independent_list[128] __attribute__((aligned(8)));
 };
 
 struct req_exec_barrier_message {
@@ -112,6 +124,19 @@ static struct memb_ring_id my_ring_id;
 
 static int my_processing_idx = 0;
 
+/*
+ * Services synced in the current round: my_service_list[my_processing_idx]
+ * and the my_processing_count - 1 after it
+ */
+static int my_processing_count = 0;
+
+static uint64_t my_processing_start;
+
+/*
+ * Cleared when any member can't run independent services together
+ */
+static int my_independent_allowed = 0;
+
 static hdb_handle_t my_schedwrk_handle;
 
 static struct processor_entry my_processor_list[PROCESSOR_COUNT_MAX];
@@ -193,6 +218,7 @@ static void sync_barrier_handler (unsigned int nodeid, const void *msg)
 	const struct req_exec_barrier_message *req_exec_barrier_message = msg;
 	int i;
 	int barrier_reached = 1;
+	uint64_t duration;
 
 	if (memcmp (&my_ring_id, &req_exec_barrier_message->ring_id,
 		sizeof (struct memb_ring_id)) != 0) {
@@ -211,15 +237,22 @@ static void sync_barrier_handler (unsigned int nodeid, const void *msg)
 		}
 	}
 	if (barrier_reached) {
-		log_printf (LOGSYS_LEVEL_DEBUG, "Committing synchronization for %s",
-			my_service_list[my_processing_idx].name);
-		my_service_list[my_processing_idx].state = ACTIVATE;
+		duration = (qb_util_nano_current_get () - my_processing_start) / QB_TIME_NS_IN_USEC;
+
+		for (i = my_processing_idx; i < my_processing_idx + my_processing_count; i++) {
+			log_printf (LOGSYS_LEVEL_DEBUG, "Committing synchronization for %s",
+				my_service_list[i].name);
+			my_service_list[i].state = ACTIVATE;
 
-		if (my_sync_callbacks_retrieve(my_service_list[my_processing_idx].service_id, NULL) != -1) {
-			my_service_list[my_processing_idx].sync_activate ();
+			if (my_sync_callbacks_retrieve(my_service_list[i].service_id, NULL) != -1) {
+				my_service_list[i].sync_activate ();
+			}
+			if (my_service_list[i].duration_key != NULL) {
+				icmap_set_uint64 (my_service_list[i].duration_key, duration);
+			}
 		}
 
-		my_processing_idx += 1;
+		my_processing_idx += my_processing_count;
 		if (my_service_list_entries == my_processing_idx) {
 			sync_synchronization_completed ();
 		} else {
@@ -262,6 +295,29 @@ static void sync_service_build_handler (unsigned int nodeid, const void *msg)
 		log_printf (LOGSYS_LEVEL_DEBUG, "service build for old ring - discarding");
 		return;
 	}
+
+	/*
+	 * A service runs together with others only if every member says it may
+	 */
+	if (req_exec_service_build_message->header.size < sizeof (struct req_exec_service_build_message)) {
+		my_independent_allowed = 0;
+	} else {
+		for (j = 0; j < my_service_list_entries; j++) {
+			found = 0;
+			for (i = 0; i < req_exec_service_build_message->independent_list_entries &&
+			    i < SERVICES_COUNT_MAX; i++) {
+				if (req_exec_service_build_message->independent_list[i] ==
+					my_service_list[j].service_id) {
+					found = 1;
+					break;
+				}
+			}
+			if (found == 0) {
+				my_service_list[j].independent = 0;
+			}
+		}
+	}
+
 	for (i = 0; i < req_exec_service_build_message->service_list_entries; i++) {
 
 		found = 0;
@@ -423,6 +479,24 @@ static void sync_process_enter (void)
 		my_processor_list[i].received = 0;
 	}
 
+	/*
+	 * Consecutive independent services are processed in one round and
+	 * share a single barrier. Every member comes to the same list here,
+	 * because it is built from the same service build messages.
+	 */
+	my_processing_count = 1;
+	if (my_independent_allowed && my_service_list[my_processing_idx].independent) {
+		while (my_processing_idx + my_processing_count < my_service_list_entries &&
+		    my_service_list[my_processing_idx + my_processing_count].independent) {
+			my_processing_count++;
+		}
+	}
+	if (my_processing_count > 1) {
+		log_printf (LOGSYS_LEVEL_DEBUG, "Synchronizing %d independent services together",
+			my_processing_count);
+	}
+	my_processing_start = qb_util_nano_current_get ();
+
 	schedwrk_create (&my_schedwrk_handle,
 		schedwrk_processor,
 		NULL);
@@ -452,6 +526,8 @@ static void sync_servicelist_build_enter (
 	my_member_list_entries = member_list_entries;
 
 	my_processing_idx = 0;
+	my_processing_count = 0;
+	my_independent_allowed = 1;
 
 	memset(my_service_list, 0, sizeof (struct service_entry) * SERVICES_COUNT_MAX);
 	my_service_list_entries = 0;
@@ -475,12 +551,18 @@ static void sync_servicelist_build_enter (
 		my_service_list[my_service_list_entries].sync_process = sync_callbacks.sync_process;
 		my_service_list[my_service_list_entries].sync_abort = sync_callbacks.sync_abort;
 		my_service_list[my_service_list_entries].sync_activate = sync_callbacks.sync_activate;
+		my_service_list[my_service_list_entries].independent = sync_callbacks.independent;
+		my_service_list[my_service_list_entries].duration_key = sync_callbacks.duration_key;
 		my_service_list_entries += 1;
 	}
 
 	for (i = 0; i < my_service_list_entries; i++) {
 		service_build.service_list[i] =
 			my_service_list[i].service_id;
+		if (my_service_list[i].independent) {
+			service_build.independent_list[service_build.independent_list_entries++] =
+				my_service_list[i].service_id;
+		}
 	}
 	service_build.service_list_entries = my_service_list_entries;
 
@@ -493,19 +575,30 @@ static void sync_servicelist_build_enter (
 static int schedwrk_processor (const void *context)
 {
 	int res = 0;
+	int pending = 0;
+	int i;
 
-	if (my_service_list[my_processing_idx].state == PROCESS) {
-		if (my_sync_callbacks_retrieve(my_service_list[my_processing_idx].service_id, NULL) != -1) {
-			res = my_service_list[my_processing_idx].sync_process ();
+	for (i = my_processing_idx; i < my_processing_idx + my_processing_count; i++) {
+		if (my_service_list[i].state != PROCESS) {
+			continue;
+		}
+		if (my_sync_callbacks_retrieve(my_service_list[i].service_id, NULL) != -1) {
+			res = my_service_list[i].sync_process ();
 		} else {
 			res = 0;
 		}
 		if (res == 0) {
-			sync_barrier_enter();
+			my_service_list[i].state = PROCESSED;
 		} else {
-			return (-1);
+			pending = 1;
 		}
 	}
+
+	if (pending) {
+		return (-1);
+	}
+
+	sync_barrier_enter();
 	return (0);
 }
 
@@ -534,11 +627,20 @@ void sync_save_transitional (
 
 void sync_abort (void)
 {
+	int i;
+
 	ENTER();
 	if (my_state == SYNC_PROCESS) {
 		schedwrk_destroy (my_schedwrk_handle);
-		if (my_sync_callbacks_retrieve(my_service_list[my_processing_idx].service_id, NULL) != -1) {
-			my_service_list[my_processing_idx].sync_abort ();
+		/*
+		 * Services already done with sync_process may still be waiting
+		 * for the barrier, they have to drop their sync state as well
+		 */
+		for (i = my_processing_idx; i < my_processing_idx + my_processing_count; i++) {
+			if (my_service_list[i].state != ACTIVATE &&
+			    my_sync_callbacks_retrieve(my_service_list[i].service_id, NULL) != -1) {
+				my_service_list[i].sync_abort ();
+			}
 		}
 	}
 
@@ -46,6 +46,8 @@ struct sync_callbacks {
 	void (*sync_activate) (void);
 	void (*sync_abort) (void);
 	const char *name;
+	int independent;
+	const char *duration_key;
 };
 
 extern int sync_init (
@@ -82,6 +82,9 @@
 #define MISS_COUNT_CONST			5
 #define BLOCK_UNLISTED_IPS			1
 #define CANCEL_TOKEN_HOLD_ON_RETRANSMIT		0
+#define RECV_BATCH				8
+#define PACK_MAX_DELAY				0
+#define PACK_FLUSH_SIZE				0
 /* This constant is not used for knet */
 #define UDP_NETMTU                              1500
 
@@ -136,6 +139,10 @@ static void *totem_get_param_by_name(struct totem_config *totem_config, const ch
 		return &totem_config->max_messages;
 	if (strcmp(param_name, "totem.miss_count_const") == 0)
 		return &totem_config->miss_count_const;
+	if (strcmp(param_name, "totem.pack_max_delay") == 0)
+		return &totem_config->pack_max_delay;
+	if (strcmp(param_name, "totem.pack_flush_size") == 0)
+		return &totem_config->pack_flush_size;
 	if (strcmp(param_name, "totem.knet_pmtud_interval") == 0)
 		return &totem_config->knet_pmtud_interval;
 	if (strcmp(param_name, "totem.knet_mtu") == 0)
@@ -337,6 +344,8 @@ void totem_volatile_config_read (struct totem_config *totem_config, icmap_map_t
 	totem_volatile_config_set_uint32_value(totem_config, temp_map, "totem.max_messages", deleted_key, MAX_MESSAGES, 0);
 
 	totem_volatile_config_set_uint32_value(totem_config, temp_map, "totem.miss_count_const", deleted_key, MISS_COUNT_CONST, 0);
+	totem_volatile_config_set_uint32_value(totem_config, temp_map, "totem.pack_max_delay", deleted_key, PACK_MAX_DELAY, 1);
+	totem_volatile_config_set_uint32_value(totem_config, temp_map, "totem.pack_flush_size", deleted_key, PACK_FLUSH_SIZE, 1);
 	totem_volatile_config_set_uint32_value(totem_config, temp_map, "totem.knet_pmtud_interval", deleted_key, KNET_PMTUD_INTERVAL, 0);
 	totem_volatile_config_set_uint32_value(totem_config, temp_map, "totem.knet_mtu", deleted_key, KNET_MTU, 0);
 
@@ -1876,6 +1885,25 @@ extern int totem_config_read (
 
 	icmap_get_uint32("totem.netmtu", &totem_config->net_mtu);
 
+	totem_config->recv_batch = RECV_BATCH;
+	icmap_get_uint32("totem.recv_batch", &totem_config->recv_batch);
+
+	totem_config->knet_direct_send = 0;
+	if (icmap_get_string("totem.knet_direct_send", &str) == CS_OK) {
+		if (strcmp (str, "yes") == 0) {
+			totem_config->knet_direct_send = 1;
+		}
+		free(str);
+	}
+
+	totem_config->knet_recv_thread = 0;
+	if (icmap_get_string("totem.knet_recv_thread", &str) == CS_OK) {
+		if (strcmp (str, "yes") == 0) {
+			totem_config->knet_recv_thread = 1;
+		}
+		free(str);
+	}
+
 	totem_config->ip_version = totem_config_get_ip_version(totem_config);
 
 	if (icmap_get_string("totem.interface.0.bindnetaddr", &str) != CS_OK) {
@@ -2174,6 +2202,15 @@ int totem_config_validate (
 		}
 	}
 
+	if (totem_config->recv_batch < 1 ||
+	    totem_config->recv_batch > UDP_RECV_BATCH_MAX) {
+		snprintf (parse_error, sizeof(parse_error),
+			  "recv_batch (%u) must be between 1 and %u.",
+			  totem_config->recv_batch, UDP_RECV_BATCH_MAX);
+		error_reason = parse_error;
+		goto parse_error;
+	}
+
 	if (totem_config->net_mtu == 0) {
 		if (totem_config->transport_number == TOTEM_TRANSPORT_KNET) {
 			totem_config->net_mtu = KNET_MAX_PACKET_SIZE;
@@ -2355,6 +2392,15 @@ static void debug_dump_totem_config(const struct totem_config *totem_config)
 	    "window size per rotation (%d messages) maximum messages per rotation (%d messages)",
 	    totem_config->window_size, totem_config->max_messages);
 	log_printf(LOGSYS_LEVEL_DEBUG, "missed count const (%d messages)", totem_config->miss_count_const);
+	log_printf(LOGSYS_LEVEL_DEBUG, "receive batch (%d messages)", totem_config->recv_batch);
+	if (totem_config->transport_number == TOTEM_TRANSPORT_KNET) {
+		log_printf(LOGSYS_LEVEL_DEBUG, "knet direct send (%s)",
+		    totem_config->knet_direct_send ? "yes" : "no");
+		log_printf(LOGSYS_LEVEL_DEBUG, "knet receive thread (%s)",
+		    totem_config->knet_recv_thread ? "yes" : "no");
+	}
+	log_printf(LOGSYS_LEVEL_DEBUG, "pack max delay (%d ms) pack flush size (%d bytes)",
+	    totem_config->pack_max_delay, totem_config->pack_flush_size);
 	log_printf(LOGSYS_LEVEL_DEBUG, "heartbeat_failures_allowed (%d)",
 	    totem_config->heartbeat_failures_allowed);
 	log_printf(LOGSYS_LEVEL_DEBUG, "max_network_delay (%d ms)", totem_config->max_network_delay);
@@ -42,6 +42,9 @@
 #include <netdb.h>
 #include <sys/un.h>
 #include <sys/ioctl.h>
+#ifdef HAVE_LINUX_SOCKIOS_H
+#include <linux/sockios.h>
+#endif
 #include <sys/param.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -71,6 +74,7 @@
 #include <corosync/icmap.h>
 #include <corosync/totem/totemip.h>
 #include "totemknet.h"
+#include "totemrx.h"
 
 #include "main.h"
 #include "util.h"
@@ -86,6 +90,11 @@
 static int setup_nozzle(void *knet_context);
 #endif
 
+/*
+ * Frames queued by the receive thread, must be a power of two
+ */
+#define KNET_RECV_QUEUE_LEN 64
+
 /* Should match that used by cfg */
 #define CFG_INTERFACE_STATUS_MAX_LEN 512
 
@@ -106,7 +115,8 @@ struct totemknet_instance {
 		void *context,
 		const void *msg,
 		unsigned int msg_len,
-		const struct sockaddr_storage *system_from);
+		const struct sockaddr_storage *system_from,
+		void **rx_buffer);
 
 	int (*totemknet_iface_change_fn) (
 		void *context,
@@ -149,6 +159,42 @@ struct totemknet_instance {
 
 	char iov_buffer[KNET_MAX_PACKET_SIZE + 1];
 
+	/*
+	 * Buffer the next packet is received into.  It is handed to
+	 * totemsrp along with the packet, which may keep it and leave a
+	 * replacement behind.  iov_buffer is used if none can be allocated.
+	 */
+	void *recv_buffer;
+
+#ifdef HAVE_RECVMMSG
+	/*
+	 * Batched receive state, recv_batch frames each received into its
+	 * own totemknet buffer like recv_buffer
+	 */
+	unsigned int recv_batch;
+
+	void **recv_batch_buffer;
+
+	struct iovec *recv_batch_iov;
+
+	struct mmsghdr *recv_batch_msgs;
+
+	struct sockaddr_storage *recv_batch_from;
+#endif
+
+	totemsrp_stats_t *stats;
+
+	/*
+	 * Receive thread reading knet_fd, NULL if knet_fd is read by the
+	 * main loop
+	 */
+	struct totemrx *rx;
+
+	/*
+	 * rx counters already added to stats
+	 */
+	struct totemrx_stats rx_stats;
+
 	char *link_status[INTERFACE_MAX];
 
 	struct totem_ip_address my_ids[INTERFACE_MAX];
@@ -173,6 +219,18 @@ struct totemknet_instance {
 
 	int logpipes[2];
 	int knet_fd;
+	int8_t knet_channel;
+
+	/*
+	 * Unicast frames are passed to knet_send_sync instead of being written
+	 * to knet_fd
+	 */
+	int direct_send;
+
+	/*
+	 * Frames were written to knet_fd since it was last seen empty
+	 */
+	int datafd_queued;
 
 	pthread_mutex_t log_mutex;
 #ifdef HAVE_LIBNOZZLE
@@ -210,6 +268,10 @@ static void totemknet_stop_merge_detect_timeout(
 static void log_flush_messages (
         void *knet_context);
 
+#ifdef HAVE_RECVMMSG
+static void recv_batch_free (struct totemknet_instance *instance);
+#endif
+
 static void totemknet_instance_initialize (struct totemknet_instance *instance)
 {
 	int res;
@@ -394,6 +456,50 @@ int totemknet_crypto_set (
 }
 
 
+/*
+ * Send unicast frame without the datafd socketpair. knet filters,
+ * compresses, encrypts and transmits it from this thread, so there is no
+ * copy into the socket and no wakeup of the knet TX thread. knet_send_sync
+ * can send to one node only, so multicast frames always go through
+ * knet_fd. Returns -1 with errno set on failure.
+ */
+static inline int direct_send (
+	struct totemknet_instance *instance,
+	const void *msg,
+	unsigned int msg_len)
+{
+#ifdef HAVE_KNET_SEND_SYNC
+	return (knet_send_sync (instance->knet_handle, msg, msg_len, instance->knet_channel));
+#else
+	errno = ENOSYS;
+	return (-1);
+#endif
+}
+
+/*
+ * A frame sent directly must not overtake frames still waiting in knet_fd,
+ * or receivers see a gap for every multicast sent ahead of the token.
+ * knet_send_sync and the knet TX thread serialize on the knet tx mutex, so
+ * once the TX thread has read everything from knet_fd a direct send is
+ * ordered after it.
+ */
+static int datafd_empty (struct totemknet_instance *instance)
+{
+#ifdef SIOCOUTQ
+	int queued;
+
+	if (!instance->datafd_queued) {
+		return (1);
+	}
+
+	if (ioctl (instance->knet_fd, SIOCOUTQ, &queued) == 0 && queued == 0) {
+		instance->datafd_queued = 0;
+		return (1);
+	}
+#endif
+	return (0);
+}
+
 static inline void ucast_sendmsg (
 	struct totemknet_instance *instance,
 	struct totem_ip_address *system_to,
@@ -407,6 +513,18 @@ static inline void ucast_sendmsg (
 
 	header->target_nodeid = system_to->nodeid;
 
+	if (instance->direct_send && datafd_empty (instance)) {
+		if (direct_send (instance, msg, msg_len) == 0) {
+			return;
+		}
+		/*
+		 * Fall back to knet_fd, knet may not be able to send synchronously
+		 * right now (for example while the TX thread is busy)
+		 */
+		KNET_LOGSYS_PERROR (errno, instance->totemknet_log_level_debug,
+				    "knet_send_sync(ucast) failed, using knet datafd");
+	}
+
 	iovec.iov_base = (void *)msg;
 	iovec.iov_len = msg_len;
 
@@ -426,6 +544,8 @@ static inline void ucast_sendmsg (
 	if (res < 0) {
 		KNET_LOGSYS_PERROR (errno, instance->totemknet_log_level_debug,
 				    "sendmsg(ucast) failed (non-critical)");
+	} else {
+		instance->datafd_queued = 1;
 	}
 }
 
@@ -458,6 +578,9 @@ static inline void mcast_sendmsg (
 	if (res < msg_len) {
 		knet_log_printf (LOGSYS_LEVEL_DEBUG, "totemknet: mcast_send sendmsg returned %d", res);
 	}
+	if (res > 0) {
+		instance->datafd_queued = 1;
+	}
 
 	if (!only_active || instance->send_merge_detect_message) {
 		/*
@@ -669,7 +792,12 @@ int totemknet_finalize (
 	knet_log_printf(LOG_DEBUG, "totemknet: finalize");
 
 	qb_loop_poll_del (instance->poll_handle, instance->logpipes[0]);
-	qb_loop_poll_del (instance->poll_handle, instance->knet_fd);
+	if (instance->rx != NULL) {
+		totemrx_destroy (instance->rx);
+		instance->rx = NULL;
+	} else {
+		qb_loop_poll_del (instance->poll_handle, instance->knet_fd);
+	}
 
 	/*
 	 * Disable forwarding to make knet flush send queue. This ensures that the LEAVE message will be sent.
@@ -725,6 +853,12 @@ finalise_error:
 	 */
 	(void)pthread_mutex_destroy(&instance->log_mutex);
 
+	totemknet_buffer_release (instance->recv_buffer);
+	instance->recv_buffer = NULL;
+#ifdef HAVE_RECVMMSG
+	recv_batch_free (instance);
+#endif
+
 	return (res);
 }
 
@@ -777,32 +911,97 @@ static int log_deliver_fn (
 	return 0;
 }
 
-static int data_deliver_fn (
-	int fd,
-	int revents,
-	void *data)
+#ifdef HAVE_RECVMMSG
+static void recv_batch_free (struct totemknet_instance *instance)
 {
-	struct totemknet_instance *instance = (struct totemknet_instance *)data;
-	struct msghdr msg_hdr;
-	struct iovec iov_recv;
-	struct sockaddr_storage system_from;
-	ssize_t msg_len;
-	char *data_ptr = instance->iov_buffer;
+	unsigned int i;
 
-	iov_recv.iov_base = instance->iov_buffer;
-	iov_recv.iov_len = KNET_MAX_PACKET_SIZE + 1;
+	if (instance->recv_batch_buffer != NULL) {
+		for (i = 0; i < instance->recv_batch; i++) {
+			totemknet_buffer_release (instance->recv_batch_buffer[i]);
+		}
+	}
+	free (instance->recv_batch_buffer);
+	free (instance->recv_batch_iov);
+	free (instance->recv_batch_msgs);
+	free (instance->recv_batch_from);
+	instance->recv_batch_buffer = NULL;
+	instance->recv_batch_iov = NULL;
+	instance->recv_batch_msgs = NULL;
+	instance->recv_batch_from = NULL;
+	instance->recv_batch = 1;
+}
 
-	memset(&msg_hdr, 0, sizeof(msg_hdr));
-	msg_hdr.msg_name = &system_from;
-	msg_hdr.msg_namelen = sizeof (struct sockaddr_storage);
-	msg_hdr.msg_iov = &iov_recv;
-	msg_hdr.msg_iovlen = 1;
+static void recv_batch_alloc (struct totemknet_instance *instance)
+{
+	unsigned int i;
 
-	msg_len = recvmsg (fd, &msg_hdr, MSG_NOSIGNAL | MSG_DONTWAIT);
-	if (msg_len <= 0) {
-		return (0);
+	instance->recv_batch = instance->totem_config->recv_batch;
+	if (instance->recv_batch <= 1) {
+		instance->recv_batch = 1;
+		return;
+	}
+
+	instance->recv_batch_buffer = calloc (instance->recv_batch,
+		sizeof (void *));
+	instance->recv_batch_iov = calloc (instance->recv_batch,
+		sizeof (struct iovec));
+	instance->recv_batch_msgs = calloc (instance->recv_batch,
+		sizeof (struct mmsghdr));
+	instance->recv_batch_from = calloc (instance->recv_batch,
+		sizeof (struct sockaddr_storage));
+	if (instance->recv_batch_buffer == NULL ||
+	    instance->recv_batch_iov == NULL ||
+	    instance->recv_batch_msgs == NULL ||
+	    instance->recv_batch_from == NULL) {
+		knet_log_printf (instance->totemknet_log_level_warning,
+			"Unable to allocate receive batch of %u messages, receiving one at a time",
+			instance->recv_batch);
+		recv_batch_free (instance);
+		return;
+	}
+
+	for (i = 0; i < instance->recv_batch; i++) {
+		instance->recv_batch_msgs[i].msg_hdr.msg_name = &instance->recv_batch_from[i];
+		instance->recv_batch_msgs[i].msg_hdr.msg_iov = &instance->recv_batch_iov[i];
+		instance->recv_batch_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	instance->stats->rx_batch_size = instance->recv_batch;
+}
+#endif
+
+/*
+ * Point iov at the receive buffer in *buffer, allocating a new one if
+ * totemsrp kept the last one without leaving a replacement
+ */
+static int recv_buffer_prepare (
+	void **buffer,
+	struct iovec *iov)
+{
+	if (*buffer == NULL) {
+		*buffer = totemknet_buffer_alloc ();
+		if (*buffer == NULL) {
+			return (-1);
+		}
 	}
+	iov->iov_base = *buffer;
+	iov->iov_len = KNET_MAX_PACKET_SIZE + 1;
+
+	return (0);
+}
 
+/*
+ * Check one frame received from fd, strip the knet header and hand it to
+ * totemsrp
+ */
+static void data_deliver_msg (
+	struct totemknet_instance *instance,
+	int fd,
+	char *data_ptr,
+	ssize_t msg_len,
+	const struct sockaddr_storage *system_from,
+	void **rx_buffer)
+{
 	if (msg_len >= KNET_MAX_PACKET_SIZE + 1) {
 		/*
 		 * It this happens it is real bug, because knet always sends packet with maximum size
@@ -812,7 +1011,7 @@ static int data_deliver_fn (
 		 */
 		knet_log_printf(instance->totemknet_log_level_error,
 				"Received truncated packet. Please report this bug. Dropping packet.");
-		return (0);
+		return;
 	}
 
 	/*
@@ -838,7 +1037,138 @@ static int data_deliver_fn (
 		instance->context,
 		data_ptr,
 		msg_len,
-		&system_from);
+		system_from,
+		rx_buffer);
+}
+
+#ifdef HAVE_RECVMMSG
+/*
+ * Receive up to recv_batch frames from knet with one system call and hand
+ * all of them to totemsrp before returning to the main loop.  Returns -1
+ * without receiving anything if no receive buffer could be allocated.
+ */
+static int data_deliver_batch_fn (
+	int fd,
+	struct totemknet_instance *instance)
+{
+	struct mmsghdr *msgs = instance->recv_batch_msgs;
+	int msgs_received;
+	int i;
+
+	for (i = 0; i < instance->recv_batch; i++) {
+		if (recv_buffer_prepare (&instance->recv_batch_buffer[i],
+		    &instance->recv_batch_iov[i]) == -1) {
+			break;
+		}
+		msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_storage);
+		msgs[i].msg_hdr.msg_flags = 0;
+	}
+	if (i == 0) {
+		return (-1);
+	}
+
+	msgs_received = recvmmsg (fd, msgs, i,
+		MSG_NOSIGNAL | MSG_DONTWAIT, NULL);
+	if (msgs_received <= 0) {
+		return (0);
+	}
+
+	instance->stats->rx_batch_size = instance->recv_batch;
+	instance->stats->rx_batches++;
+	instance->stats->rx_batch_msgs += msgs_received;
+	if (msgs_received > instance->stats->rx_batch_max) {
+		instance->stats->rx_batch_max = msgs_received;
+	}
+
+	for (i = 0; i < msgs_received; i++) {
+		data_deliver_msg (instance, fd,
+			instance->recv_batch_iov[i].iov_base,
+			msgs[i].msg_len,
+			&instance->recv_batch_from[i],
+			&instance->recv_batch_buffer[i]);
+	}
+
+	return (0);
+}
+#endif
+
+static void data_deliver_rx_fn (
+	void *context,
+	void *msg,
+	unsigned int msg_len,
+	const struct sockaddr_storage *system_from,
+	void **rx_buffer)
+{
+	struct totemknet_instance *instance = (struct totemknet_instance *)context;
+
+	data_deliver_msg (instance, instance->knet_fd, msg, msg_len, system_from, rx_buffer);
+}
+
+/*
+ * Account a receive thread handoff like a batch received by the main loop
+ * and publish the receive thread counters.  Only the change since the last
+ * handoff is added so clearing the srp stats keeps working.
+ */
+static void data_deliver_rx_handoff_fn (
+	void *context,
+	unsigned int frames)
+{
+	struct totemknet_instance *instance = (struct totemknet_instance *)context;
+	struct totemrx_stats rx_stats;
+
+	instance->stats->rx_batch_size = instance->totem_config->recv_batch;
+	if (frames > 0) {
+		instance->stats->rx_batches++;
+		instance->stats->rx_batch_msgs += frames;
+		if (frames > instance->stats->rx_batch_max) {
+			instance->stats->rx_batch_max = frames;
+		}
+	}
+
+	totemrx_stats_get (instance->rx, &rx_stats);
+	instance->stats->rx_thread_frames += rx_stats.frames - instance->rx_stats.frames;
+	instance->stats->rx_thread_handoffs += rx_stats.handoffs - instance->rx_stats.handoffs;
+	instance->stats->rx_thread_queue_full += rx_stats.queue_full - instance->rx_stats.queue_full;
+	instance->stats->rx_thread_discarded += rx_stats.discarded - instance->rx_stats.discarded;
+	instance->rx_stats = rx_stats;
+}
+
+static int data_deliver_fn (
+	int fd,
+	int revents,
+	void *data)
+{
+	struct totemknet_instance *instance = (struct totemknet_instance *)data;
+	struct msghdr msg_hdr;
+	struct iovec iov_recv;
+	struct sockaddr_storage system_from;
+	ssize_t msg_len;
+	void **rx_buffer = &instance->recv_buffer;
+
+#ifdef HAVE_RECVMMSG
+	if (instance->recv_batch > 1 &&
+	    data_deliver_batch_fn (fd, instance) == 0) {
+		return (0);
+	}
+#endif
+	if (recv_buffer_prepare (rx_buffer, &iov_recv) == -1) {
+		iov_recv.iov_base = instance->iov_buffer;
+		iov_recv.iov_len = KNET_MAX_PACKET_SIZE + 1;
+		rx_buffer = NULL;
+	}
+
+	memset(&msg_hdr, 0, sizeof(msg_hdr));
+	msg_hdr.msg_name = &system_from;
+	msg_hdr.msg_namelen = sizeof (struct sockaddr_storage);
+	msg_hdr.msg_iov = &iov_recv;
+	msg_hdr.msg_iovlen = 1;
+
+	msg_len = recvmsg (fd, &msg_hdr, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (msg_len <= 0) {
+		return (0);
+	}
+
+	data_deliver_msg (instance, fd, iov_recv.iov_base, msg_len, &system_from, rx_buffer);
 
 	return (0);
 }
@@ -1141,7 +1471,8 @@ int totemknet_initialize (
 		void *context,
 		const void *msg,
 		unsigned int msg_len,
-		const struct sockaddr_storage *system_from),
+		const struct sockaddr_storage *system_from,
+		void **rx_buffer),
 
 	int (*iface_change_fn) (
 		void *context,
@@ -1170,6 +1501,7 @@ int totemknet_initialize (
 	totemknet_instance_initialize (instance);
 
 	instance->totem_config = totem_config;
+	instance->stats = stats;
 
 	/*
 	* Configure logging
@@ -1298,6 +1630,17 @@ int totemknet_initialize (
 		knet_log_printf(LOG_DEBUG, "knet_handle_add_datafd failed: %s", strerror(errno));
 		goto exit_error;
 	}
+	instance->knet_channel = channel;
+
+	if (totem_config->knet_direct_send) {
+#ifdef HAVE_KNET_SEND_SYNC
+		instance->direct_send = 1;
+		knet_log_printf (LOGSYS_LEVEL_INFO, "totemknet sends frames directly to knet");
+#else
+		knet_log_printf (LOGSYS_LEVEL_WARNING,
+			"knet_direct_send requested but libknet has no knet_send_sync, using knet datafd");
+#endif
+	}
 
 	/* Enable crypto if requested */
 #ifdef HAVE_KNET_CRYPTO_RECONF
@@ -1364,10 +1707,35 @@ int totemknet_initialize (
 		instance->logpipes[0],
 		POLLIN, instance, log_deliver_fn);
 
-	qb_loop_poll_add (instance->poll_handle,
-		QB_LOOP_HIGH,
-		instance->knet_fd,
-		POLLIN, instance, data_deliver_fn);
+	if (totem_config->knet_recv_thread) {
+		instance->rx = totemrx_create (instance->poll_handle,
+			instance->knet_fd,
+			KNET_RECV_QUEUE_LEN,
+			totem_config->recv_batch,
+			KNET_MAX_PACKET_SIZE + 1,
+			totemknet_buffer_alloc,
+			totemknet_buffer_release,
+			data_deliver_rx_fn,
+			data_deliver_rx_handoff_fn,
+			instance);
+		if (instance->rx == NULL) {
+			KNET_LOGSYS_PERROR(errno, LOGSYS_LEVEL_WARNING,
+				"Can't start knet receive thread, receiving in main loop");
+		} else {
+			knet_log_printf (LOGSYS_LEVEL_INFO, "totemknet receives frames in a separate thread");
+		}
+	}
+
+	if (instance->rx == NULL) {
+#ifdef HAVE_RECVMMSG
+		recv_batch_alloc (instance);
+#endif
+
+		qb_loop_poll_add (instance->poll_handle,
+			QB_LOOP_HIGH,
+			instance->knet_fd,
+			POLLIN, instance, data_deliver_fn);
+	}
 
 	/*
 	 * Upper layer isn't ready to receive message because it hasn't
@@ -1518,6 +1886,13 @@ extern int totemknet_recv_mcast_empty (
 	msg_hdr.msg_iov = &iov_recv;
 	msg_hdr.msg_iovlen = 1;
 
+	/*
+	 * Frames already taken from knet_fd by the receive thread
+	 */
+	if (instance->rx != NULL && totemrx_flush (instance->rx) > 0) {
+		msg_processed = 1;
+	}
+
 	do {
 		ufd.fd = instance->knet_fd;
 		ufd.events = POLLIN;
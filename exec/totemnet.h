@@ -65,7 +65,8 @@ extern int totemnet_initialize (
 		void *context,
 		const void *msg,
 		unsigned int msg_len,
-		const struct sockaddr_storage *system_from),
+		const struct sockaddr_storage *system_from,
+		void **rx_buffer),
 
 	int (*iface_change_fn) (
 		void *context,
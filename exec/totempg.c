@@ -67,19 +67,18 @@
 /*
  * ASSEMBLY AND UNPACKING ALGORITHM:
  *
- * copy incoming packet into assembly data buffer indexed by current
- * location of end of fragment
+ * if a message from this node is being assembled
+ *	append first packed message to assembly data buffer
+ *	if it is now complete, deliver it from assembly data buffer
  *
- * if not fragmented
- *	deliver all messages in assembly data buffer
- * else
- * if msg_count > 1 and fragmented
- *	deliver all messages except last message in assembly data buffer
+ * deliver all other complete messages directly from incoming packet
+ *
+ * if fragmented
  *	copy last fragmented section to start of assembly data buffer
- * else
- * if msg_count = 1 and fragmented
- *	do nothing
  *
+ * Packets which don't continue where the previous one stopped, or need
+ * endian conversion, are copied into the assembly data buffer as a whole
+ * and delivered from there.
  */
 
 #include <config.h>
@@ -104,6 +103,7 @@
 #include <qb/qblist.h>
 #include <qb/qbloop.h>
 #include <qb/qbipcs.h>
+#include <qb/qbutil.h>
 #include <corosync/totem/totempg.h>
 #define LOGSYS_UTILS_ONLY 1
 #include <corosync/logsys.h>
@@ -160,6 +160,14 @@ static unsigned short mcast_packed_msg_lens[FRAME_SIZE_MAX];
 
 static int mcast_packed_msg_count = 0;
 
+/*
+ * Packing policy.  A partially filled frame is normally queued when the
+ * token arrives.  With totem.pack_max_delay set it may be held back over
+ * token rotations, until it is pack_max_delay old or holds
+ * totem.pack_flush_size bytes.  Urgent messages queue the frame right away.
+ */
+static uint64_t fragment_first_staged;
+
 static int totempg_reserved = 1;
 
 static unsigned int totempg_size_limit;
@@ -196,9 +204,25 @@ enum throw_away_mode {
 	THROW_AWAY_ACTIVE
 };
 
+/*
+ * Assembly buffers start small and grow on demand up to
+ * ASSEMBLY_DATA_MAX.  Buffers which grew beyond ASSEMBLY_DATA_KEEP are
+ * freed once their message is complete, so only nodes which are actually
+ * sending large fragmented messages hold large buffers.
+ */
+#define ASSEMBLY_DATA_MIN	4096
+#define ASSEMBLY_DATA_KEEP	FRAME_SIZE_MAX
+#define ASSEMBLY_DATA_MAX	(MESSAGE_SIZE_MAX+KNET_MAX_PACKET_SIZE)
+
+/*
+ * Must be a power of two
+ */
+#define ASSEMBLY_HASH_SIZE	256
+
 struct assembly {
 	unsigned int nodeid;
-	unsigned char data[MESSAGE_SIZE_MAX+KNET_MAX_PACKET_SIZE];
+	unsigned char *data;
+	size_t data_size;
 	int index;
 	unsigned char last_frag_num;
 	enum throw_away_mode throw_away_mode;
@@ -210,15 +234,20 @@ static void assembly_deref (struct assembly *assembly);
 static int callback_token_received_fn (enum totem_callback_token_type type,
 	const void *data);
 
-QB_LIST_DECLARE(assembly_list_inuse);
+/*
+ * In use assemblies are hashed by nodeid, separately for the operational
+ * and the transitional configuration.  They are only touched from the
+ * delivery path in the main loop, so no locking is needed.
+ */
+static struct qb_list_head assembly_table[ASSEMBLY_HASH_SIZE];
+
+static struct qb_list_head assembly_table_trans[ASSEMBLY_HASH_SIZE];
 
 /*
  * Free list is used both for transitional and operational assemblies
  */
 QB_LIST_DECLARE(assembly_list_free);
 
-QB_LIST_DECLARE(assembly_list_inuse_trans);
-
 QB_LIST_DECLARE(totempg_groups_list);
 
 /*
@@ -230,9 +259,23 @@ QB_LIST_DECLARE(totempg_groups_list);
  * the size of message data and where to place new message data.
  * fragment_contuation indicates whether the first packed message in
  * the buffer is a continuation of a previously packed fragment.
+ *
+ * The staging area lives inside a totemsrp transmit buffer
+ * (fragmentation_buffer), far enough in that the totemsrp header, the
+ * totempg header and packed_msg_lens_reserved message lengths can be
+ * written in front of it.  The finished frame is then handed to totemsrp
+ * as is instead of being copied once more.
  */
+#define PACKED_MSG_LENS_RESERVED 64
+
+static unsigned char *fragmentation_buffer;
+
 static unsigned char *fragmentation_data;
 
+static size_t fragmentation_data_offset;
+
+static int packed_msg_lens_reserved;
+
 static int fragment_size = 0;
 
 static int fragment_continuation = 0;
@@ -279,6 +322,8 @@ do {								\
 
 static int msg_count_send_ok (int msg_count);
 
+static void packed_hist_update (int msg_count);
+
 static int byte_count_send_ok (int byte_count);
 
 static void totempg_waiting_trans_ack_cb (int waiting_trans_ack)
@@ -287,22 +332,46 @@ static void totempg_waiting_trans_ack_cb (int waiting_trans_ack)
 	totempg_waiting_transack = waiting_trans_ack;
 }
 
-static struct assembly *assembly_ref (unsigned int nodeid)
+static void assembly_table_init (void)
 {
-	struct assembly *assembly;
-	struct qb_list_head *list;
-	struct qb_list_head *active_assembly_list_inuse;
+	int i;
 
-	if (totempg_waiting_transack) {
-		active_assembly_list_inuse = &assembly_list_inuse_trans;
-	} else {
-		active_assembly_list_inuse = &assembly_list_inuse;
+	for (i = 0; i < ASSEMBLY_HASH_SIZE; i++) {
+		qb_list_init (&assembly_table[i]);
+		qb_list_init (&assembly_table_trans[i]);
 	}
+}
 
+static inline struct qb_list_head *assembly_bucket (
+	struct qb_list_head *table,
+	unsigned int nodeid)
+{
 	/*
-	 * Search inuse list for node id and return assembly buffer if found
+	 * Node ids are often small consecutive numbers but may also be
+	 * derived from IPv4 addresses, so mix all bits into the index
 	 */
-	qb_list_for_each(list, active_assembly_list_inuse) {
+	return (&table[((nodeid * 2654435761U) >> 24) & (ASSEMBLY_HASH_SIZE - 1)]);
+}
+
+static inline struct qb_list_head *assembly_active_bucket (unsigned int nodeid)
+{
+	if (totempg_waiting_transack) {
+		return (assembly_bucket (assembly_table_trans, nodeid));
+	}
+
+	return (assembly_bucket (assembly_table, nodeid));
+}
+
+/*
+ * Return the assembly holding a partially received message from nodeid,
+ * or NULL if there is none
+ */
+static struct assembly *assembly_find (unsigned int nodeid)
+{
+	struct assembly *assembly;
+	struct qb_list_head *list;
+
+	qb_list_for_each(list, assembly_active_bucket (nodeid)) {
 		assembly = qb_list_entry (list, struct assembly, list);
 
 		if (nodeid == assembly->nodeid) {
@@ -310,13 +379,31 @@ static struct assembly *assembly_ref (unsigned int nodeid)
 		}
 	}
 
+	return (NULL);
+}
+
+static struct assembly *assembly_ref (unsigned int nodeid)
+{
+	struct assembly *assembly;
+	struct qb_list_head *bucket;
+
 	/*
-	 * Nothing found in inuse list get one from free list if available
+	 * Search inuse table for node id and return assembly buffer if found
+	 */
+	assembly = assembly_find (nodeid);
+	if (assembly != NULL) {
+		return (assembly);
+	}
+
+	bucket = assembly_active_bucket (nodeid);
+
+	/*
+	 * Nothing found in inuse table get one from free list if available
 	 */
 	if (qb_list_empty (&assembly_list_free) == 0) {
 		assembly = qb_list_first_entry (&assembly_list_free, struct assembly, list);
 		qb_list_del (&assembly->list);
-		qb_list_add (&assembly->list, active_assembly_list_inuse);
+		qb_list_add (&assembly->list, bucket);
 		assembly->nodeid = nodeid;
 		assembly->index = 0;
 		assembly->last_frag_num = 0;
@@ -325,7 +412,7 @@ static struct assembly *assembly_ref (unsigned int nodeid)
 	}
 
 	/*
-	 * Nothing available in inuse or free list, so allocate a new one
+	 * Nothing available in inuse table or free list, so allocate a new one
 	 */
 	assembly = malloc (sizeof (struct assembly));
 	/*
@@ -333,42 +420,90 @@ static struct assembly *assembly_ref (unsigned int nodeid)
 	 */
 	assert (assembly);
 	assembly->nodeid = nodeid;
-	assembly->data[0] = 0;
+	assembly->data = NULL;
+	assembly->data_size = 0;
 	assembly->index = 0;
 	assembly->last_frag_num = 0;
 	assembly->throw_away_mode = THROW_AWAY_INACTIVE;
 	qb_list_init (&assembly->list);
-	qb_list_add (&assembly->list, active_assembly_list_inuse);
+	qb_list_add (&assembly->list, bucket);
 
 	return (assembly);
 }
 
+/*
+ * Make room for at least size bytes of assembled data.  Returns -1 if the
+ * message would be larger than ASSEMBLY_DATA_MAX or memory is exhausted,
+ * the caller then has to drop it.
+ */
+static int assembly_data_reserve (struct assembly *assembly, size_t size)
+{
+	size_t new_size;
+	unsigned char *new_data;
+
+	if (assembly->data != NULL && size <= assembly->data_size) {
+		return (0);
+	}
+
+	if (size > ASSEMBLY_DATA_MAX) {
+		log_printf (LOG_WARNING,
+		    "Message from node " CS_PRI_NODE_ID " would be longer than %d bytes...  Dropping.",
+		    assembly->nodeid, ASSEMBLY_DATA_MAX);
+		return (-1);
+	}
+
+	new_size = assembly->data_size ? assembly->data_size : ASSEMBLY_DATA_MIN;
+	while (new_size < size) {
+		new_size *= 2;
+	}
+	if (new_size > ASSEMBLY_DATA_MAX) {
+		new_size = ASSEMBLY_DATA_MAX;
+	}
+
+	new_data = realloc (assembly->data, new_size);
+	if (new_data == NULL) {
+		log_printf (LOG_WARNING,
+		    "Unable to allocate %zu bytes to assemble message from node " CS_PRI_NODE_ID "...  Dropping.",
+		    new_size, assembly->nodeid);
+		return (-1);
+	}
+	assembly->data = new_data;
+	assembly->data_size = new_size;
+
+	return (0);
+}
+
 static void assembly_deref (struct assembly *assembly)
 {
 	qb_list_del (&assembly->list);
 	qb_list_add (&assembly->list, &assembly_list_free);
+
+	if (assembly->data_size > ASSEMBLY_DATA_KEEP) {
+		free (assembly->data);
+		assembly->data = NULL;
+		assembly->data_size = 0;
+	}
 }
 
 static void assembly_deref_from_normal_and_trans (int nodeid)
 {
 	int j;
 	struct qb_list_head *list, *tmp_iter;
-	struct qb_list_head *active_assembly_list_inuse;
+	struct qb_list_head *bucket;
 	struct assembly *assembly;
 
 	for (j = 0; j < 2; j++) {
 		if (j == 0) {
-			active_assembly_list_inuse = &assembly_list_inuse;
+			bucket = assembly_bucket (assembly_table, nodeid);
 		} else {
-			active_assembly_list_inuse = &assembly_list_inuse_trans;
+			bucket = assembly_bucket (assembly_table_trans, nodeid);
 		}
 
-		qb_list_for_each_safe(list, tmp_iter, active_assembly_list_inuse) {
+		qb_list_for_each_safe(list, tmp_iter, bucket) {
 			assembly = qb_list_entry (list, struct assembly, list);
 
 			if (nodeid == assembly->nodeid) {
-				qb_list_del (&assembly->list);
-				qb_list_add (&assembly->list, &assembly_list_free);
+				assembly_deref (assembly);
 			}
 		}
 	}
@@ -586,6 +721,115 @@ static void totempg_confchg_fn (
 		ring_id);
 }
 
+static inline unsigned short packed_msg_len_get (
+	const unsigned char *msg_lens,
+	int i,
+	int endian_conversion_required)
+{
+	unsigned short len;
+
+	/*
+	 * Length array in a received frame isn't necessarily aligned
+	 */
+	memcpy (&len, &msg_lens[i * sizeof (unsigned short)], sizeof (len));
+	if (endian_conversion_required) {
+		len = swab16 (len);
+	}
+
+	return (len);
+}
+
+/*
+ * Deliver a frame which carries on where the previous one from the same
+ * node left off (or starts afresh).  Complete packed messages are delivered
+ * straight out of the received frame, only the continued head and the
+ * fragmented tail go through the assembly buffer.
+ */
+static void totempg_deliver_in_order (
+	unsigned int nodeid,
+	struct assembly *assembly,
+	const struct totempg_mcast *mcast,
+	int msg_count,
+	const unsigned char *msg_lens,
+	unsigned char *data)
+{
+	int deliver_count;
+	int first = 0;
+	int i;
+	unsigned short len;
+
+	deliver_count = mcast->fragmented ? msg_count - 1 : msg_count;
+
+	if (assembly != NULL) {
+		/*
+		 * First packed message completes the one being assembled
+		 */
+		len = packed_msg_len_get (msg_lens, 0, 0);
+		if (assembly_data_reserve (assembly, assembly->index + len) != 0) {
+			/*
+			 * Drop the message, throw away the rest of it if it
+			 * goes on in the next frame
+			 */
+			assembly->index = 0;
+			data += len;
+			first = 1;
+
+			if (deliver_count == 0) {
+				assembly->throw_away_mode = THROW_AWAY_ACTIVE;
+				assembly->last_frag_num = mcast->fragmented;
+				return;
+			}
+		} else {
+			memcpy (&assembly->data[assembly->index], data, len);
+			assembly->index += len;
+			data += len;
+			first = 1;
+
+			if (deliver_count == 0) {
+				/*
+				 * Still not complete
+				 */
+				assembly->last_frag_num = mcast->fragmented;
+				return;
+			}
+
+			app_deliver_fn (nodeid, assembly->data, assembly->index, 0);
+			assembly->index = 0;
+		}
+	}
+
+	for (i = first; i < deliver_count; i++) {
+		len = packed_msg_len_get (msg_lens, i, 0);
+		app_deliver_fn (nodeid, data, len, 0);
+		data += len;
+	}
+
+	if (mcast->fragmented == 0) {
+		if (assembly != NULL) {
+			assembly->last_frag_num = 0;
+			assembly_deref (assembly);
+		}
+		return;
+	}
+
+	/*
+	 * Keep the fragmented tail until the rest of it arrives
+	 */
+	if (assembly == NULL) {
+		assembly = assembly_ref (nodeid);
+		assert (assembly);
+	}
+	len = packed_msg_len_get (msg_lens, msg_count - 1, 0);
+	assembly->last_frag_num = mcast->fragmented;
+	if (assembly_data_reserve (assembly, len) != 0) {
+		assembly->index = 0;
+		assembly->throw_away_mode = THROW_AWAY_ACTIVE;
+		return;
+	}
+	memcpy (assembly->data, data, len);
+	assembly->index = len;
+}
+
 static void totempg_deliver_fn (
 	unsigned int nodeid,
 	const void *msg,
@@ -593,11 +837,11 @@ static void totempg_deliver_fn (
 	int endian_conversion_required)
 {
 	struct totempg_mcast *mcast;
-	unsigned short *msg_lens;
+	const unsigned char *msg_lens;
 	int i;
 	struct assembly *assembly;
-	char header[FRAME_SIZE_MAX];
 	int msg_count;
+	int packed_count;
 	int continuation;
 	int start;
 	const char *data;
@@ -605,9 +849,6 @@ static void totempg_deliver_fn (
 	struct iovec iov_delv;
 	size_t expected_msg_len;
 
-	assembly = assembly_ref (nodeid);
-	assert (assembly);
-
 	if (msg_len < sizeof(struct totempg_mcast)) {
 		log_printf(LOG_WARNING,
 		    "Message (totempg_mcast) received from node " CS_PRI_NODE_ID " is too short...  Ignoring.", nodeid);
@@ -616,16 +857,14 @@ static void totempg_deliver_fn (
 	}
 
 	/*
-	 * Assemble the header into one block of data and
-	 * assemble the packet contents into one block of data to simplify delivery
+	 * The header is read in place, the received frame is never modified
 	 */
-
 	mcast = (struct totempg_mcast *)msg;
+	msg_count = mcast->msg_count;
 	if (endian_conversion_required) {
-		mcast->msg_count = swab16 (mcast->msg_count);
+		msg_count = swab16 (mcast->msg_count);
 	}
 
-	msg_count = mcast->msg_count;
 	datasize = sizeof (struct totempg_mcast) +
 		msg_count * sizeof (unsigned short);
 
@@ -637,17 +876,13 @@ static void totempg_deliver_fn (
 		return ;
 	}
 
-	memcpy (header, msg, datasize);
 	data = msg;
 
-	msg_lens = (unsigned short *) (header + sizeof (struct totempg_mcast));
+	msg_lens = (const unsigned char *)msg + sizeof (struct totempg_mcast);
 	expected_msg_len = datasize;
-	for (i = 0; i < mcast->msg_count; i++) {
-		if (endian_conversion_required) {
-			msg_lens[i] = swab16 (msg_lens[i]);
-		}
-
-		expected_msg_len += msg_lens[i];
+	for (i = 0; i < msg_count; i++) {
+		expected_msg_len += packed_msg_len_get (msg_lens, i,
+			endian_conversion_required);
 	}
 
 	if (msg_len != expected_msg_len) {
@@ -659,7 +894,51 @@ static void totempg_deliver_fn (
 		return ;
 	}
 
-	assert((assembly->index+msg_len) < sizeof(assembly->data));
+	/*
+	 * Common case: the frame continues exactly where the previous frame
+	 * from this node stopped.  Messages which need endian conversion are
+	 * converted in place by the delivery path, so those are always
+	 * copied out of the frame first.
+	 */
+	assembly = assembly_find (nodeid);
+	if (msg_count > 0 && endian_conversion_required == 0 &&
+	    ((assembly == NULL && mcast->continuation == 0) ||
+	     (assembly != NULL &&
+	      assembly->throw_away_mode == THROW_AWAY_INACTIVE &&
+	      mcast->continuation == assembly->last_frag_num))) {
+
+		totempg_deliver_in_order (nodeid, assembly, mcast, msg_count,
+			msg_lens, (unsigned char *)&data[datasize]);
+		return;
+	}
+
+	assembly = assembly_ref (nodeid);
+	assert (assembly);
+
+	if (assembly_data_reserve (assembly, assembly->index + msg_len - datasize) != 0) {
+		/*
+		 * Drop what was assembled so far and retry with just this
+		 * frame.  Its head continues the dropped message, so it
+		 * has to be thrown away too.
+		 */
+		if (assembly->index > 0 && mcast->continuation != 0) {
+			assembly->throw_away_mode = THROW_AWAY_ACTIVE;
+		}
+		assembly->index = 0;
+		if (assembly_data_reserve (assembly, msg_len - datasize) != 0) {
+			/*
+			 * Not even the frame fits, drop all of it
+			 */
+			assembly->last_frag_num = mcast->fragmented;
+			if (mcast->fragmented == 0) {
+				assembly->throw_away_mode = THROW_AWAY_INACTIVE;
+				assembly_deref (assembly);
+			} else {
+				assembly->throw_away_mode = THROW_AWAY_ACTIVE;
+			}
+			return;
+		}
+	}
 	memcpy (&assembly->data[assembly->index], &data[datasize],
 		msg_len - datasize);
 
@@ -669,10 +948,15 @@ static void totempg_deliver_fn (
 	 * then adjust the assembly buffer so we can add the rest of the
 	 * fragment when it arrives.
 	 */
-	msg_count = mcast->fragmented ? mcast->msg_count - 1 : mcast->msg_count;
+	packed_count = msg_count;
+	msg_count = mcast->fragmented ? msg_count - 1 : msg_count;
 	continuation = mcast->continuation;
 	iov_delv.iov_base = (void *)&assembly->data[0];
-	iov_delv.iov_len = assembly->index + msg_lens[0];
+	iov_delv.iov_len = assembly->index;
+	if (packed_count > 0) {
+		iov_delv.iov_len += packed_msg_len_get (msg_lens, 0,
+			endian_conversion_required);
+	}
 
 	/*
 	 * Make sure that if this message is a continuation, that it
@@ -691,9 +975,16 @@ static void totempg_deliver_fn (
 		if (mcast->fragmented == 0 || mcast->fragmented == 1) {
 			assembly->throw_away_mode = THROW_AWAY_INACTIVE;
 
-			assembly->index += msg_lens[0];
+			iov_delv.iov_len = 0;
+			if (packed_count > 0) {
+				assembly->index += packed_msg_len_get (msg_lens, 0,
+					endian_conversion_required);
+			}
+			if (packed_count > 1) {
+				iov_delv.iov_len = packed_msg_len_get (msg_lens, 1,
+					endian_conversion_required);
+			}
 			iov_delv.iov_base = (void *)&assembly->data[assembly->index];
-			iov_delv.iov_len = msg_lens[1];
 			start = 1;
 		}
 	} else
@@ -703,10 +994,12 @@ static void totempg_deliver_fn (
 			for  (i = start; i < msg_count; i++) {
 				app_deliver_fn(nodeid, iov_delv.iov_base, iov_delv.iov_len,
 					endian_conversion_required);
-				assembly->index += msg_lens[i];
+				assembly->index += packed_msg_len_get (msg_lens, i,
+					endian_conversion_required);
 				iov_delv.iov_base = (void *)&assembly->data[assembly->index];
 				if (i < (msg_count - 1)) {
-					iov_delv.iov_len = msg_lens[i + 1];
+					iov_delv.iov_len = packed_msg_len_get (msg_lens,
+						i + 1, endian_conversion_required);
 				}
 			}
 		} else {
@@ -723,18 +1016,21 @@ static void totempg_deliver_fn (
 		assembly->last_frag_num = 0;
 		assembly->index = 0;
 		assembly_deref (assembly);
-	} else {
+	} else
+	if (packed_count > 0) {
 		/*
 		 * Message is fragmented, keep around assembly list
 		 */
-		if (mcast->msg_count > 1) {
+		if (packed_count > 1) {
 			memmove (&assembly->data[0],
 				&assembly->data[assembly->index],
-				msg_lens[msg_count]);
+				packed_msg_len_get (msg_lens, msg_count,
+					endian_conversion_required));
 
 			assembly->index = 0;
 		}
-		assembly->index += msg_lens[msg_count];
+		assembly->index += packed_msg_len_get (msg_lens, msg_count,
+			endian_conversion_required);
 	}
 }
 
@@ -745,26 +1041,101 @@ static void totempg_deliver_fn (
 
 void *callback_token_received_handle;
 
-int callback_token_received_fn (enum totem_callback_token_type type,
-				const void *data)
+static int fragmentation_buffer_get (void)
 {
-	struct totempg_mcast mcast;
-	struct iovec iovecs[3];
+	if (fragmentation_buffer != NULL) {
+		return (0);
+	}
 
-	if (totempg_threaded_mode == 1) {
-		pthread_mutex_lock (&mcast_msg_mutex);
+	fragmentation_buffer = totemsrp_mcast_buffer_get (totemsrp_context);
+	if (fragmentation_buffer == NULL) {
+		return (-1);
 	}
-	if (mcast_packed_msg_count == 0) {
-		if (totempg_threaded_mode == 1) {
-			pthread_mutex_unlock (&mcast_msg_mutex);
+	fragmentation_data = fragmentation_buffer + fragmentation_data_offset;
+
+	return (0);
+}
+
+/*
+ * Queue the staged frame.  The packed lengths and the totempg header are
+ * written directly in front of the staged data, so apart from the rare
+ * case of more packed messages than reserved length slots no data is
+ * moved.  On success the staging buffer belongs to totemsrp and the
+ * replacement taken up front becomes the new staging buffer.
+ */
+static int fragmentation_buffer_send (
+	struct totempg_mcast *mcast,
+	int data_len,
+	int guarantee)
+{
+	unsigned char *data = fragmentation_data;
+	unsigned char *next_buffer;
+	unsigned char *msg;
+	size_t lens_len;
+	size_t shift = 0;
+	int res;
+
+	next_buffer = totemsrp_mcast_buffer_get (totemsrp_context);
+	if (next_buffer == NULL) {
+		return (-1);
+	}
+
+	lens_len = mcast->msg_count * sizeof (unsigned short);
+	if (mcast->msg_count > packed_msg_lens_reserved) {
+		shift = (mcast->msg_count - packed_msg_lens_reserved) *
+			sizeof (unsigned short);
+		memmove (data + shift, data, data_len);
+		data += shift;
+	}
+
+	msg = data - lens_len - sizeof (struct totempg_mcast);
+	memcpy (msg, mcast, sizeof (struct totempg_mcast));
+	memcpy (msg + sizeof (struct totempg_mcast), mcast_packed_msg_lens,
+		lens_len);
+
+	res = totemsrp_mcast_buffer (totemsrp_context, fragmentation_buffer,
+		msg, sizeof (struct totempg_mcast) + lens_len + data_len,
+		guarantee);
+	if (res == -1) {
+		if (shift) {
+			memmove (fragmentation_data, data, data_len);
 		}
-		return (0);
+		totemsrp_mcast_buffer_put (totemsrp_context, next_buffer);
+		return (-1);
+	}
+
+	fragmentation_buffer = next_buffer;
+	fragmentation_data = fragmentation_buffer + fragmentation_data_offset;
+
+	packed_hist_update (mcast->msg_count);
+
+	return (0);
+}
+
+static void packed_hist_update (int msg_count)
+{
+	int bucket = 0;
+
+	while (msg_count > 1 && bucket < TOTEMPG_PACKED_HIST_MAX - 1) {
+		msg_count >>= 1;
+		bucket++;
+	}
+	totempg_stats.packed_hist[bucket]++;
+}
+
+/*
+ * Queue the partially filled staging frame.  Called with mcast_msg_mutex
+ * held in threaded mode.
+ */
+static void fragmentation_flush (void)
+{
+	struct totempg_mcast mcast;
+
+	if (mcast_packed_msg_count == 0) {
+		return;
 	}
 	if (totemsrp_avail(totemsrp_context) == 0) {
-		if (totempg_threaded_mode == 1) {
-			pthread_mutex_unlock (&mcast_msg_mutex);
-		}
-		return (0);
+		return;
 	}
 	mcast.header.version = 0;
 	mcast.header.type = 0;
@@ -779,16 +1150,31 @@ int callback_token_received_fn (enum totem_callback_token_type type,
 
 	mcast.msg_count = mcast_packed_msg_count;
 
-	iovecs[0].iov_base = (void *)&mcast;
-	iovecs[0].iov_len = sizeof (struct totempg_mcast);
-	iovecs[1].iov_base = (void *)mcast_packed_msg_lens;
-	iovecs[1].iov_len = mcast_packed_msg_count * sizeof (unsigned short);
-	iovecs[2].iov_base = (void *)&fragmentation_data[0];
-	iovecs[2].iov_len = fragment_size;
-	(void)totemsrp_mcast (totemsrp_context, iovecs, 3, 0);
+	(void)fragmentation_buffer_send (&mcast, fragment_size, 0);
 
 	mcast_packed_msg_count = 0;
 	fragment_size = 0;
+	fragment_first_staged = 0;
+}
+
+int callback_token_received_fn (enum totem_callback_token_type type,
+				const void *data)
+{
+	if (totempg_threaded_mode == 1) {
+		pthread_mutex_lock (&mcast_msg_mutex);
+	}
+
+	if (mcast_packed_msg_count != 0 &&
+	    totempg_totem_config->pack_max_delay != 0 &&
+	    qb_util_nano_current_get () - fragment_first_staged <
+	    (uint64_t)totempg_totem_config->pack_max_delay * QB_TIME_NS_IN_MSEC) {
+		/*
+		 * Keep filling the frame until a later token
+		 */
+		totempg_stats.pack_delayed++;
+	} else {
+		fragmentation_flush ();
+	}
 
 	if (totempg_threaded_mode == 1) {
 		pthread_mutex_unlock (&mcast_msg_mutex);
@@ -814,13 +1200,10 @@ int totempg_initialize (
 	totempg_log_printf = totem_config->totem_logging_configuration.log_printf;
 	totempg_subsys_id = totem_config->totem_logging_configuration.log_subsys_id;
 
-	fragmentation_data = malloc (TOTEMPG_PACKET_SIZE);
-	if (fragmentation_data == 0) {
-		return (-1);
-	}
-
 	totemsrp_net_mtu_adjust (totem_config);
 
+	assembly_table_init ();
+
 	res = totemsrp_initialize (
 		poll_handle,
 		&totemsrp_context,
@@ -834,6 +1217,26 @@ int totempg_initialize (
 		goto error_exit;
 	}
 
+	/*
+	 * Reserve room for the usual number of packed message lengths in
+	 * front of the staging area, as far as the transmit buffer allows.
+	 */
+	packed_msg_lens_reserved = PACKED_MSG_LENS_RESERVED;
+	if (totemsrp_mcast_buffer_headroom () + sizeof (struct totempg_mcast) +
+		packed_msg_lens_reserved * sizeof (unsigned short) +
+		TOTEMPG_PACKET_SIZE > FRAME_SIZE_MAX) {
+
+		packed_msg_lens_reserved = 0;
+	}
+	fragmentation_data_offset = totemsrp_mcast_buffer_headroom () +
+		sizeof (struct totempg_mcast) +
+		packed_msg_lens_reserved * sizeof (unsigned short);
+
+	if (fragmentation_buffer_get () == -1) {
+		res = -1;
+		goto error_exit;
+	}
+
 	totemsrp_callback_token_create (
 		totemsrp_context,
 		&callback_token_received_handle,
@@ -857,6 +1260,11 @@ void totempg_finalize (void)
 	if (totempg_threaded_mode == 1) {
 		pthread_mutex_lock (&totempg_mutex);
 	}
+	if (fragmentation_buffer != NULL) {
+		totemsrp_mcast_buffer_put (totemsrp_context, fragmentation_buffer);
+		fragmentation_buffer = NULL;
+		fragmentation_data = NULL;
+	}
 	// coverity[SLEEP:SUPPRESS] sleep is not a problem because it is shutdown
 	totemsrp_finalize (totemsrp_context);
 	if (totempg_threaded_mode == 1) {
@@ -874,7 +1282,6 @@ static int mcast_msg (
 {
 	int res = 0;
 	struct totempg_mcast mcast;
-	struct iovec iovecs[3];
 	struct iovec iovec[64];
 	int i;
 	int dest, src;
@@ -882,12 +1289,23 @@ static int mcast_msg (
 	int copy_len = 0;
 	int copy_base = 0;
 	int total_size = 0;
+	int urgent;
+
+	urgent = guarantee & TOTEMPG_URGENT;
+	guarantee &= ~TOTEMPG_URGENT;
 
 	if (totempg_threaded_mode == 1) {
 		pthread_mutex_lock (&mcast_msg_mutex);
 	}
 	totemsrp_event_signal (totemsrp_context, TOTEM_EVENT_NEW_MSG, 1);
 
+	if (fragmentation_buffer_get () == -1) {
+		if (totempg_threaded_mode == 1) {
+			pthread_mutex_unlock (&mcast_msg_mutex);
+		}
+		return (-1);
+	}
+
 	/*
 	 * Remove zero length iovectors from the list
 	 */
@@ -953,14 +1371,7 @@ static int mcast_msg (
 		 * If it just fits or is too big, then send out what fits.
 		 */
 		} else {
-			unsigned char *data_ptr;
-
 			copy_len = min(copy_len, max_packet_size - fragment_size);
-			if( copy_len == max_packet_size )
-				data_ptr = (unsigned char *)iovec[i].iov_base + copy_base;
-			else {
-				data_ptr = fragmentation_data;
-			}
 
 			memcpy (&fragmentation_data[fragment_size],
 				(unsigned char *)iovec[i].iov_base + copy_base, copy_len);
@@ -988,15 +1399,9 @@ static int mcast_msg (
 			 * assemble the message and send it
 			 */
 			mcast.msg_count = ++mcast_packed_msg_count;
-			iovecs[0].iov_base = (void *)&mcast;
-			iovecs[0].iov_len = sizeof(struct totempg_mcast);
-			iovecs[1].iov_base = (void *)mcast_packed_msg_lens;
-			iovecs[1].iov_len = mcast_packed_msg_count *
-				sizeof(unsigned short);
-			iovecs[2].iov_base = (void *)data_ptr;
-			iovecs[2].iov_len = fragment_size + copy_len;
 			assert (totemsrp_avail(totemsrp_context) > 0);
-			res = totemsrp_mcast (totemsrp_context, iovecs, 3, guarantee);
+			res = fragmentation_buffer_send (&mcast,
+				fragment_size + copy_len, guarantee);
 			if (res == -1) {
 				goto error_exit;
 			}
@@ -1007,6 +1412,7 @@ static int mcast_msg (
 			mcast_packed_msg_lens[0] = 0;
 			mcast_packed_msg_count = 0;
 			fragment_size = 0;
+			fragment_first_staged = 0;
 			max_packet_size = TOTEMPG_PACKET_SIZE - (sizeof(unsigned short));
 
 			/*
@@ -1036,6 +1442,22 @@ static int mcast_msg (
 			mcast_packed_msg_count++;
 	}
 
+	if (mcast_packed_msg_count) {
+		if (fragment_first_staged == 0) {
+			fragment_first_staged = qb_util_nano_current_get ();
+		}
+
+		if (urgent) {
+			totempg_stats.pack_urgent_flush++;
+			fragmentation_flush ();
+		} else
+		if (totempg_totem_config->pack_flush_size != 0 &&
+		    fragment_size >= totempg_totem_config->pack_flush_size) {
+			totempg_stats.pack_size_flush++;
+			fragmentation_flush ();
+		}
+	}
+
 error_exit:
 	if (totempg_threaded_mode == 1) {
 		pthread_mutex_unlock (&mcast_msg_mutex);
@@ -1581,6 +2003,10 @@ extern void totempg_stats_clear (int flags)
 	if (flags & TOTEMPG_STATS_CLEAR_TOTEM) {
 		totempg_stats.msg_reserved = 0;
 		totempg_stats.msg_queue_avail = 0;
+		memset (totempg_stats.packed_hist, 0, sizeof (totempg_stats.packed_hist));
+		totempg_stats.pack_urgent_flush = 0;
+		totempg_stats.pack_size_flush = 0;
+		totempg_stats.pack_delayed = 0;
 	}
 	return totemsrp_stats_clear (totemsrp_context, flags);
 }
@@ -0,0 +1,614 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <qb/qbdefs.h>
+#include <qb/qbloop.h>
+
+#include "totemrx.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/*
+ * How long the worker waits before trying again when no receive buffer
+ * can be allocated
+ */
+#define TOTEMRX_ALLOC_RETRY_MS	10
+
+struct totemrx_slot {
+	void *buffer;
+
+	unsigned int msg_len;
+
+	struct sockaddr_storage system_from;
+};
+
+struct totemrx {
+	qb_loop_t *poll_handle;
+
+	int fd;
+
+	unsigned int queue_len;
+
+	unsigned int batch;
+
+	size_t frame_len;
+
+	void *(*buffer_alloc) (void);
+
+	void (*buffer_release) (void *ptr);
+
+	void (*deliver_fn) (
+		void *context,
+		void *msg,
+		unsigned int msg_len,
+		const struct sockaddr_storage *system_from,
+		void **rx_buffer);
+
+	void (*handoff_fn) (
+		void *context,
+		unsigned int frames);
+
+	void *context;
+
+	struct totemrx_slot *slots;
+
+	/*
+	 * Free running indexes into slots. Slots from head to tail are
+	 * queued. tail is written only by the worker, head only by the
+	 * main thread.
+	 */
+	uint32_t tail;
+
+	uint32_t head;
+
+	/*
+	 * Number of queued frames, counted from head, which are dropped
+	 * instead of delivered. Never more than queue_len.
+	 */
+	unsigned int discard;
+
+	int delivering;
+
+	/*
+	 * Set by the worker when it has written to deliver_pipe and cleared
+	 * by the main thread before it looks at the queue
+	 */
+	int deliver_pending;
+
+	/*
+	 * Set by the worker when it waits for a free slot
+	 */
+	int worker_waiting;
+
+	int stop;
+
+	int deliver_pipe[2];
+
+	int worker_pipe[2];
+
+	pthread_t thread;
+
+	int thread_running;
+
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr *msgs;
+
+	struct iovec *iov;
+#endif
+
+	struct totemrx_stats stats;
+};
+
+static void pipe_write (int fd)
+{
+	char c = 0;
+	ssize_t res;
+
+	do {
+		res = write (fd, &c, 1);
+	} while (res == -1 && errno == EINTR);
+}
+
+static void pipe_drain (int fd)
+{
+	char buf[64];
+	ssize_t res;
+
+	do {
+		res = read (fd, buf, sizeof (buf));
+	} while (res == sizeof (buf) || (res == -1 && errno == EINTR));
+}
+
+static int pipe_create (int fds[2])
+{
+	if (pipe (fds) == -1) {
+		return (-1);
+	}
+
+	if (fcntl (fds[0], F_SETFL, O_NONBLOCK) == -1 ||
+	    fcntl (fds[1], F_SETFL, O_NONBLOCK) == -1 ||
+	    fcntl (fds[0], F_SETFD, FD_CLOEXEC) == -1 ||
+	    fcntl (fds[1], F_SETFD, FD_CLOEXEC) == -1) {
+		close (fds[0]);
+		close (fds[1]);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Worker side
+ */
+
+/*
+ * Receive up to count frames into the slots starting at tail. Returns
+ * number of frames received, 0 if there was nothing to read and -1 if no
+ * receive buffer could be allocated.
+ */
+static int totemrx_recv (struct totemrx *rx, unsigned int count)
+{
+	struct totemrx_slot *slot;
+	unsigned int i;
+#ifdef HAVE_RECVMMSG
+	int res;
+#else
+	struct msghdr msg_hdr;
+	struct iovec iov;
+	ssize_t res;
+#endif
+
+#ifndef HAVE_RECVMMSG
+	count = 1;
+#endif
+	for (i = 0; i < count; i++) {
+		slot = &rx->slots[(rx->tail + i) & (rx->queue_len - 1)];
+		if (slot->buffer == NULL) {
+			slot->buffer = rx->buffer_alloc ();
+			if (slot->buffer == NULL) {
+				break;
+			}
+		}
+#ifdef HAVE_RECVMMSG
+		rx->iov[i].iov_base = slot->buffer;
+		rx->iov[i].iov_len = rx->frame_len;
+		memset (&rx->msgs[i], 0, sizeof (rx->msgs[i]));
+		rx->msgs[i].msg_hdr.msg_name = &slot->system_from;
+		rx->msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_storage);
+		rx->msgs[i].msg_hdr.msg_iov = &rx->iov[i];
+		rx->msgs[i].msg_hdr.msg_iovlen = 1;
+#endif
+	}
+	if (i == 0) {
+		return (-1);
+	}
+
+#ifdef HAVE_RECVMMSG
+	res = recvmmsg (rx->fd, rx->msgs, i, MSG_NOSIGNAL | MSG_DONTWAIT, NULL);
+	if (res <= 0) {
+		return (0);
+	}
+
+	for (i = 0; i < res; i++) {
+		rx->slots[(rx->tail + i) & (rx->queue_len - 1)].msg_len = rx->msgs[i].msg_len;
+	}
+#else
+	slot = &rx->slots[rx->tail & (rx->queue_len - 1)];
+	iov.iov_base = slot->buffer;
+	iov.iov_len = rx->frame_len;
+
+	memset (&msg_hdr, 0, sizeof (msg_hdr));
+	msg_hdr.msg_name = &slot->system_from;
+	msg_hdr.msg_namelen = sizeof (struct sockaddr_storage);
+	msg_hdr.msg_iov = &iov;
+	msg_hdr.msg_iovlen = 1;
+
+	res = recvmsg (rx->fd, &msg_hdr, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (res <= 0) {
+		return (0);
+	}
+	slot->msg_len = res;
+	res = 1;
+#endif
+
+	return (res);
+}
+
+/*
+ * Block until fd is readable or the main thread writes to worker_pipe.
+ * fd is not watched if wait_fd is 0.
+ */
+static void totemrx_wait (struct totemrx *rx, int wait_fd, int timeout)
+{
+	struct pollfd ufds[2];
+	int nfds = 0;
+
+	ufds[nfds].fd = rx->worker_pipe[0];
+	ufds[nfds].events = POLLIN;
+	ufds[nfds++].revents = 0;
+	if (wait_fd) {
+		ufds[nfds].fd = rx->fd;
+		ufds[nfds].events = POLLIN;
+		ufds[nfds++].revents = 0;
+	}
+
+	if (poll (ufds, nfds, timeout) <= 0) {
+		return;
+	}
+
+	if (wait_fd && (ufds[1].revents & (POLLERR | POLLHUP | POLLNVAL)) &&
+	    !(ufds[1].revents & POLLIN)) {
+		/*
+		 * Socket is gone, nothing to do until we are stopped
+		 */
+		ufds[0].revents = 0;
+		(void)poll (ufds, 1, -1);
+	}
+
+	if (ufds[0].revents) {
+		pipe_drain (rx->worker_pipe[0]);
+	}
+}
+
+static void *totemrx_worker (void *data)
+{
+	struct totemrx *rx = (struct totemrx *)data;
+	uint32_t head;
+	unsigned int free_slots;
+	int received;
+
+	while (!__atomic_load_n (&rx->stop, __ATOMIC_ACQUIRE)) {
+		head = __atomic_load_n (&rx->head, __ATOMIC_ACQUIRE);
+		free_slots = rx->queue_len - (rx->tail - head);
+		if (free_slots == 0) {
+			/*
+			 * Announce the wait before checking head again, so the
+			 * main thread either sees worker_waiting or we see its
+			 * new head
+			 */
+			__atomic_store_n (&rx->worker_waiting, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n (&rx->head, __ATOMIC_SEQ_CST) == head) {
+				__atomic_add_fetch (&rx->stats.queue_full, 1, __ATOMIC_RELAXED);
+				totemrx_wait (rx, 0, -1);
+			}
+			__atomic_store_n (&rx->worker_waiting, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		received = totemrx_recv (rx, QB_MIN (free_slots, rx->batch));
+		if (received == 0) {
+			totemrx_wait (rx, 1, -1);
+			continue;
+		}
+		if (received < 0) {
+			totemrx_wait (rx, 0, TOTEMRX_ALLOC_RETRY_MS);
+			continue;
+		}
+
+		__atomic_add_fetch (&rx->stats.frames, received, __ATOMIC_RELAXED);
+		__atomic_store_n (&rx->tail, rx->tail + received, __ATOMIC_RELEASE);
+
+		if (__atomic_exchange_n (&rx->deliver_pending, 1, __ATOMIC_SEQ_CST) == 0) {
+			pipe_write (rx->deliver_pipe[1]);
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * Main thread side
+ */
+
+/*
+ * Deliver (or drop) the frames queued when called. Frames queued meanwhile
+ * are left for the next wakeup, so the main loop gets to run other work.
+ * Returns the number of dropped frames, the delivered ones are counted in
+ * *delivered.
+ */
+static unsigned int totemrx_queue_process (struct totemrx *rx, unsigned int *delivered)
+{
+	struct totemrx_slot *slot;
+	uint32_t head;
+	uint32_t tail;
+	unsigned int discarded = 0;
+
+	rx->delivering = 1;
+
+	tail = __atomic_load_n (&rx->tail, __ATOMIC_ACQUIRE);
+	while ((head = rx->head) != tail) {
+		slot = &rx->slots[head & (rx->queue_len - 1)];
+
+		if (rx->discard == 0) {
+			rx->deliver_fn (rx->context, slot->buffer, slot->msg_len,
+				&slot->system_from, &slot->buffer);
+			(*delivered)++;
+		} else {
+			rx->discard--;
+			discarded++;
+		}
+
+		/*
+		 * Seq_cst pairs with the worker_waiting check of the worker
+		 */
+		__atomic_store_n (&rx->head, head + 1, __ATOMIC_SEQ_CST);
+	}
+
+	rx->delivering = 0;
+	rx->stats.discarded += discarded;
+
+	if (__atomic_load_n (&rx->worker_waiting, __ATOMIC_SEQ_CST)) {
+		pipe_write (rx->worker_pipe[1]);
+	}
+
+	return (discarded);
+}
+
+static int totemrx_deliver_fn (
+	int fd,
+	int revents,
+	void *data)
+{
+	struct totemrx *rx = (struct totemrx *)data;
+	unsigned int delivered = 0;
+
+	pipe_drain (fd);
+
+	/*
+	 * Clear before looking at the queue, frames queued after this make
+	 * the worker write to the pipe again
+	 */
+	__atomic_store_n (&rx->deliver_pending, 0, __ATOMIC_SEQ_CST);
+
+	rx->stats.handoffs++;
+	totemrx_queue_process (rx, &delivered);
+
+	if (rx->handoff_fn != NULL) {
+		rx->handoff_fn (rx->context, delivered);
+	}
+
+	return (0);
+}
+
+unsigned int totemrx_flush (struct totemrx *rx)
+{
+	unsigned int delivered = 0;
+
+	rx->discard = __atomic_load_n (&rx->tail, __ATOMIC_ACQUIRE) - rx->head;
+
+	if (rx->delivering) {
+		/*
+		 * Called from deliver_fn for the frame at head, the running
+		 * totemrx_queue_process drops the frames after it
+		 */
+		rx->discard--;
+		return (rx->discard);
+	}
+
+	return (totemrx_queue_process (rx, &delivered));
+}
+
+void totemrx_stats_get (struct totemrx *rx, struct totemrx_stats *stats)
+{
+	stats->frames = __atomic_load_n (&rx->stats.frames, __ATOMIC_RELAXED);
+	stats->queue_full = __atomic_load_n (&rx->stats.queue_full, __ATOMIC_RELAXED);
+	stats->handoffs = rx->stats.handoffs;
+	stats->discarded = rx->stats.discarded;
+}
+
+static void totemrx_free (struct totemrx *rx)
+{
+	unsigned int i;
+
+	if (rx->slots != NULL) {
+		for (i = 0; i < rx->queue_len; i++) {
+			rx->buffer_release (rx->slots[i].buffer);
+		}
+	}
+	free (rx->slots);
+#ifdef HAVE_RECVMMSG
+	free (rx->msgs);
+	free (rx->iov);
+#endif
+	if (rx->deliver_pipe[0] != -1) {
+		close (rx->deliver_pipe[0]);
+		close (rx->deliver_pipe[1]);
+	}
+	if (rx->worker_pipe[0] != -1) {
+		close (rx->worker_pipe[0]);
+		close (rx->worker_pipe[1]);
+	}
+	free (rx);
+}
+
+/*
+ * first_index is where the free running indexes start, 0 except in tests
+ * of their wrap around
+ */
+static struct totemrx *totemrx_create_at (
+	qb_loop_t *poll_handle,
+	int fd,
+	unsigned int queue_len,
+	unsigned int batch,
+	size_t frame_len,
+	void *(*buffer_alloc) (void),
+	void (*buffer_release) (void *ptr),
+	void (*deliver_fn) (
+		void *context,
+		void *msg,
+		unsigned int msg_len,
+		const struct sockaddr_storage *system_from,
+		void **rx_buffer),
+	void (*handoff_fn) (
+		void *context,
+		unsigned int frames),
+	void *context,
+	uint32_t first_index)
+{
+	struct totemrx *rx;
+	sigset_t sigset, oldset;
+	int res;
+
+	/*
+	 * queue_len has to be a power of two
+	 */
+	if (queue_len < 2 || (queue_len & (queue_len - 1)) != 0) {
+		errno = EINVAL;
+		return (NULL);
+	}
+
+	rx = malloc (sizeof (*rx));
+	if (rx == NULL) {
+		return (NULL);
+	}
+	memset (rx, 0, sizeof (*rx));
+	rx->deliver_pipe[0] = rx->deliver_pipe[1] = -1;
+	rx->worker_pipe[0] = rx->worker_pipe[1] = -1;
+	rx->head = rx->tail = first_index;
+
+	rx->poll_handle = poll_handle;
+	rx->fd = fd;
+	rx->queue_len = queue_len;
+	rx->batch = QB_MAX (1, QB_MIN (batch, queue_len));
+	rx->frame_len = frame_len;
+	rx->buffer_alloc = buffer_alloc;
+	rx->buffer_release = buffer_release;
+	rx->deliver_fn = deliver_fn;
+	rx->handoff_fn = handoff_fn;
+	rx->context = context;
+
+	rx->slots = calloc (queue_len, sizeof (struct totemrx_slot));
+#ifdef HAVE_RECVMMSG
+	rx->msgs = calloc (rx->batch, sizeof (struct mmsghdr));
+	rx->iov = calloc (rx->batch, sizeof (struct iovec));
+	if (rx->msgs == NULL || rx->iov == NULL) {
+		goto error_free;
+	}
+#endif
+	if (rx->slots == NULL) {
+		goto error_free;
+	}
+
+	if (pipe_create (rx->deliver_pipe) == -1) {
+		rx->deliver_pipe[0] = -1;
+		goto error_free;
+	}
+	if (pipe_create (rx->worker_pipe) == -1) {
+		rx->worker_pipe[0] = -1;
+		goto error_free;
+	}
+
+	if (qb_loop_poll_add (poll_handle, QB_LOOP_HIGH, rx->deliver_pipe[0],
+	    POLLIN, rx, totemrx_deliver_fn) != 0) {
+		goto error_free;
+	}
+
+	/*
+	 * Signals are handled by the main thread only
+	 */
+	sigfillset (&sigset);
+	pthread_sigmask (SIG_BLOCK, &sigset, &oldset);
+	res = pthread_create (&rx->thread, NULL, totemrx_worker, rx);
+	pthread_sigmask (SIG_SETMASK, &oldset, NULL);
+	if (res != 0) {
+		qb_loop_poll_del (poll_handle, rx->deliver_pipe[0]);
+		errno = res;
+		goto error_free;
+	}
+	rx->thread_running = 1;
+
+	return (rx);
+
+error_free:
+	res = errno;
+	totemrx_free (rx);
+	errno = res;
+	return (NULL);
+}
+
+struct totemrx *totemrx_create (
+	qb_loop_t *poll_handle,
+	int fd,
+	unsigned int queue_len,
+	unsigned int batch,
+	size_t frame_len,
+	void *(*buffer_alloc) (void),
+	void (*buffer_release) (void *ptr),
+	void (*deliver_fn) (
+		void *context,
+		void *msg,
+		unsigned int msg_len,
+		const struct sockaddr_storage *system_from,
+		void **rx_buffer),
+	void (*handoff_fn) (
+		void *context,
+		unsigned int frames),
+	void *context)
+{
+
+	return (totemrx_create_at (poll_handle, fd, queue_len, batch, frame_len,
+	    buffer_alloc, buffer_release, deliver_fn, handoff_fn, context, 0));
+}
+
+void totemrx_destroy (struct totemrx *rx)
+{
+	if (rx == NULL) {
+		return;
+	}
+
+	if (rx->thread_running) {
+		__atomic_store_n (&rx->stop, 1, __ATOMIC_RELEASE);
+		pipe_write (rx->worker_pipe[1]);
+		pthread_join (rx->thread, NULL);
+		rx->thread_running = 0;
+	}
+
+	qb_loop_poll_del (rx->poll_handle, rx->deliver_pipe[0]);
+
+	totemrx_free (rx);
+}
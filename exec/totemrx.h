@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TOTEMRX_H_DEFINED
+#define TOTEMRX_H_DEFINED
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <qb/qbloop.h>
+
+/*
+ * Receive thread for a transport socket.
+ *
+ * A worker thread reads frames from fd into transport buffers and queues
+ * them on a single producer, single consumer ring.  The main loop is woken
+ * through a pipe at most once per batch and hands the queued frames to
+ * deliver_fn in the order they were received.
+ *
+ * deliver_fn follows the totemsrp rx_buffer contract: it may keep the
+ * buffer and leave a replacement (or NULL) in *rx_buffer.  Missing buffers
+ * are allocated again by the worker with buffer_alloc, which therefore
+ * has to be thread safe.
+ *
+ * handoff_fn, if not NULL, is called in the main loop after each wakeup
+ * with the number of frames delivered in it.
+ */
+
+struct totemrx;
+
+struct totemrx_stats {
+	uint64_t frames;
+	uint64_t handoffs;
+	uint64_t queue_full;
+	uint64_t discarded;
+};
+
+extern struct totemrx *totemrx_create (
+	qb_loop_t *poll_handle,
+	int fd,
+	unsigned int queue_len,
+	unsigned int batch,
+	size_t frame_len,
+	void *(*buffer_alloc) (void),
+	void (*buffer_release) (void *ptr),
+	void (*deliver_fn) (
+		void *context,
+		void *msg,
+		unsigned int msg_len,
+		const struct sockaddr_storage *system_from,
+		void **rx_buffer),
+	void (*handoff_fn) (
+		void *context,
+		unsigned int frames),
+	void *context);
+
+extern void totemrx_destroy (struct totemrx *rx);
+
+/*
+ * Drop frames which are already queued. Can be called from deliver_fn.
+ */
+extern unsigned int totemrx_flush (struct totemrx *rx);
+
+extern void totemrx_stats_get (struct totemrx *rx, struct totemrx_stats *stats);
+
+#endif /* TOTEMRX_H_DEFINED */
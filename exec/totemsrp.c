@@ -72,6 +72,7 @@
 #include <sys/poll.h>
 #include <sys/uio.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include <qb/qblist.h>
 #include <qb/qbdefs.h>
@@ -85,6 +86,7 @@
 #include <corosync/logsys.h>
 
 #include "totemsrp.h"
+#include "totemsrp_msg.h"
 #include "totemnet.h"
 
 #include "icmap.h"
@@ -143,15 +145,6 @@ struct srp_addr {
  */
 #define ENDIAN_LOCAL					 0xff22
 
-enum message_type {
-	MESSAGE_TYPE_ORF_TOKEN = 0,			/* Ordering, Reliability, Flow (ORF) control Token */
-	MESSAGE_TYPE_MCAST = 1,				/* ring ordered multicast message */
-	MESSAGE_TYPE_MEMB_MERGE_DETECT = 2,	/* merge rings if there are available rings */
-	MESSAGE_TYPE_MEMB_JOIN = 3,			/* membership join message */
-	MESSAGE_TYPE_MEMB_COMMIT_TOKEN = 4,	/* membership commit token */
-	MESSAGE_TYPE_TOKEN_HOLD_CANCEL = 5,	/* cancel the holding of the token */
-};
-
 enum encapsulation_type {
 	MESSAGE_ENCAPSULATED = 1,
 	MESSAGE_NOT_ENCAPSULATED = 2
@@ -191,27 +184,6 @@ struct mcast {
 } __attribute__((packed));
 
 
-struct rtr_item  {
-	struct memb_ring_id ring_id;
-	unsigned int seq;
-}__attribute__((packed));
-
-
-struct orf_token {
-	struct totem_message_header header;
-	unsigned int seq;
-	unsigned int token_seq;
-	unsigned int aru;
-	unsigned int aru_addr;
-	struct memb_ring_id ring_id;
-	unsigned int backlog;
-	unsigned int fcc;
-	int retrans_flg;
-	int rtr_list_entries;
-	struct rtr_item rtr_list[0];
-}__attribute__((packed));
-
-
 struct memb_join {
 	struct totem_message_header header;
 	struct srp_addr system_from;
@@ -264,14 +236,31 @@ struct memb_commit_token {
  */
 }__attribute__((packed));
 
+/*
+ * buffer is the allocation mcast lives in, or NULL if the item does not
+ * own its storage.  mcast may point anywhere inside buffer, so callers
+ * that hand a prebuilt frame to totemsrp_mcast_buffer avoid a copy.
+ */
 struct message_item {
 	struct mcast *mcast;
 	unsigned int msg_len;
+	void *buffer;
 };
 
 struct sort_queue_item {
 	struct mcast *mcast;
 	unsigned int msg_len;
+	void *buffer;
+};
+
+/*
+ * Released transmit/receive buffers are kept on a free list, linked
+ * through their first bytes, so the hot path does not malloc per message.
+ */
+#define BUFFER_POOL_MAX		128
+
+struct buffer_pool_entry {
+	struct buffer_pool_entry *next;
 };
 
 enum memb_state {
@@ -515,6 +504,13 @@ struct totemsrp_instance {
 
 	totemsrp_stats_t stats;
 
+	/*
+	 * Monotonic time in nanoseconds the current and previous token were received
+	 */
+	uint64_t token_rx_time;
+
+	uint64_t prev_token_rx_time;
+
 	uint32_t orf_token_discard;
 
 	uint32_t originated_orf_token;
@@ -523,6 +519,18 @@ struct totemsrp_instance {
 
 	uint32_t waiting_trans_ack;
 
+	struct buffer_pool_entry *buffer_pool;
+
+	unsigned int buffer_pool_count;
+
+	pthread_mutex_t buffer_pool_mutex;
+
+	/*
+	 * Transport receive buffer holding the frame being handled, if the
+	 * transport allows it to be kept, see main_deliver_fn
+	 */
+	void **rx_buffer;
+
 	int 	flushing;
 
 	void * token_recv_event_handle;
@@ -662,13 +670,15 @@ static void timer_function_token_hold_retransmit_timeout (void *data);
 static void timer_function_merge_detect_timeout (void *data);
 static void *totemsrp_buffer_alloc (struct totemsrp_instance *instance);
 static void totemsrp_buffer_release (struct totemsrp_instance *instance, void *ptr);
+static void totemsrp_buffer_pool_free (struct totemsrp_instance *instance);
 static const char* gsfrom_to_msg(enum gather_state_from gsfrom);
 
 int main_deliver_fn (
 	void *context,
 	const void *msg,
 	unsigned int msg_len,
-	const struct sockaddr_storage *system_from);
+	const struct sockaddr_storage *system_from,
+	void **rx_buffer);
 
 int main_iface_change_fn (
 	void *context,
@@ -770,11 +780,20 @@ static int pause_flush (struct totemsrp_instance *instance)
 static int token_event_stats_collector (enum totem_callback_token_type type, const void *void_instance)
 {
 	struct totemsrp_instance *instance = (struct totemsrp_instance *)void_instance;
+	uint64_t time_now_ns;
 	uint64_t time_now;
 
-	time_now = (qb_util_nano_current_get() / QB_TIME_NS_IN_MSEC);
+	time_now_ns = qb_util_nano_current_get();
+	time_now = (time_now_ns / QB_TIME_NS_IN_MSEC);
 
 	if (type == TOTEM_CALLBACK_TOKEN_RECEIVED) {
+		instance->prev_token_rx_time = instance->token_rx_time;
+		instance->token_rx_time = time_now_ns;
+		if (instance->prev_token_rx_time != 0) {
+			totem_hist_add (&instance->stats.token_rotation_hist,
+				(time_now_ns - instance->prev_token_rx_time) / QB_TIME_NS_IN_USEC);
+		}
+
 		/* incr latest token the index */
 		if (instance->stats.latest_token == (TOTEM_TOKEN_STATS_MAX - 1))
 			instance->stats.latest_token = 0;
@@ -797,6 +816,10 @@ static int token_event_stats_collector (enum totem_callback_token_type type, con
 		instance->stats.token[instance->stats.latest_token].tx = 0; /* in case we drop the token */
 	} else {
 		instance->stats.token[instance->stats.latest_token].tx = time_now;
+		if (instance->token_rx_time != 0) {
+			totem_hist_add (&instance->stats.token_hold_hist,
+				(time_now_ns - instance->token_rx_time) / QB_TIME_NS_IN_USEC);
+		}
 	}
 	return 0;
 }
@@ -934,6 +957,8 @@ int totemsrp_initialize (
 	cs_queue_init (&instance->retrans_message_queue, RETRANS_MESSAGE_QUEUE_SIZE_MAX,
 		sizeof (struct message_item), instance->threaded_mode_enabled);
 
+	pthread_mutex_init (&instance->buffer_pool_mutex, NULL);
+
 	sq_init (&instance->regular_sort_queue,
 		QUEUE_RTR_ITEMS_SIZE_MAX, sizeof (struct sort_queue_item), 0);
 
@@ -1029,7 +1054,9 @@ void totemsrp_finalize (
 	struct totemsrp_instance *instance = (struct totemsrp_instance *)srp_context;
 
 	memb_leave_message_send (instance);
+	totemsrp_buffer_pool_free (instance);
 	totemnet_finalize (instance->totemnet_context);
+	pthread_mutex_destroy (&instance->buffer_pool_mutex);
 	cs_queue_free (&instance->new_message_queue);
 	cs_queue_free (&instance->new_message_queue_trans);
 	cs_queue_free (&instance->retrans_message_queue);
@@ -1498,14 +1525,65 @@ static void my_leave_memb_set(
 
 static void *totemsrp_buffer_alloc (struct totemsrp_instance *instance)
 {
+	struct buffer_pool_entry *entry;
+
 	assert (instance != NULL);
+
+	if (instance->threaded_mode_enabled) {
+		pthread_mutex_lock (&instance->buffer_pool_mutex);
+	}
+	entry = instance->buffer_pool;
+	if (entry != NULL) {
+		instance->buffer_pool = entry->next;
+		instance->buffer_pool_count--;
+	}
+	if (instance->threaded_mode_enabled) {
+		pthread_mutex_unlock (&instance->buffer_pool_mutex);
+	}
+
+	if (entry != NULL) {
+		return (entry);
+	}
 	return totemnet_buffer_alloc (instance->totemnet_context);
 }
 
 static void totemsrp_buffer_release (struct totemsrp_instance *instance, void *ptr)
 {
+	struct buffer_pool_entry *entry = ptr;
+
 	assert (instance != NULL);
-	totemnet_buffer_release (instance->totemnet_context, ptr);
+
+	if (ptr == NULL) {
+		return;
+	}
+
+	if (instance->threaded_mode_enabled) {
+		pthread_mutex_lock (&instance->buffer_pool_mutex);
+	}
+	if (instance->buffer_pool_count < BUFFER_POOL_MAX) {
+		entry->next = instance->buffer_pool;
+		instance->buffer_pool = entry;
+		instance->buffer_pool_count++;
+		entry = NULL;
+	}
+	if (instance->threaded_mode_enabled) {
+		pthread_mutex_unlock (&instance->buffer_pool_mutex);
+	}
+
+	if (entry != NULL) {
+		totemnet_buffer_release (instance->totemnet_context, entry);
+	}
+}
+
+static void totemsrp_buffer_pool_free (struct totemsrp_instance *instance)
+{
+	struct buffer_pool_entry *entry;
+
+	while ((entry = instance->buffer_pool) != NULL) {
+		instance->buffer_pool = entry->next;
+		totemnet_buffer_release (instance->totemnet_context, entry);
+	}
+	instance->buffer_pool_count = 0;
 }
 
 static void reset_token_retransmit_timeout (struct totemsrp_instance *instance)
@@ -1886,6 +1964,10 @@ static void deliver_messages_from_recovery_to_regular (struct totemsrp_instance
 				(struct mcast *)(((char *)recovery_message_item->mcast) + sizeof (struct mcast));
 			regular_message_item.msg_len =
 			recovery_message_item->msg_len - sizeof (struct mcast);
+			/*
+			 * Storage stays owned by the recovery queue item
+			 */
+			regular_message_item.buffer = NULL;
 			mcast = regular_message_item.mcast;
 		} else {
 			/*
@@ -2084,7 +2166,7 @@ static void memb_state_operational_enter (struct totemsrp_instance *instance)
 			struct sort_queue_item *regular_message;
 
 			regular_message = ptr;
-			free (regular_message->mcast);
+			totemsrp_buffer_release (instance, regular_message->buffer);
 		}
 	}
 	sq_items_release (&instance->regular_sort_queue, instance->my_high_delivered);
@@ -2440,8 +2522,9 @@ static void memb_state_recovery_enter (
 		messages_originated++;
 		memset (&message_item, 0, sizeof (struct message_item));
 	// TODO	 LEAK
-		message_item.mcast = totemsrp_buffer_alloc (instance);
-		assert (message_item.mcast);
+		message_item.buffer = totemsrp_buffer_alloc (instance);
+		assert (message_item.buffer);
+		message_item.mcast = message_item.buffer;
 		memset(message_item.mcast, 0, sizeof (struct mcast));
 		message_item.mcast->header.magic = TOTEM_MH_MAGIC;
 		message_item.mcast->header.version = TOTEM_MH_VERSION;
@@ -2494,19 +2577,45 @@ void totemsrp_event_signal (void *srp_context, enum totem_event_type type, int v
 	return;
 }
 
-int totemsrp_mcast (
+void *totemsrp_mcast_buffer_get (void *srp_context)
+{
+	struct totemsrp_instance *instance = (struct totemsrp_instance *)srp_context;
+
+	return (totemsrp_buffer_alloc (instance));
+}
+
+void totemsrp_mcast_buffer_put (void *srp_context, void *buffer)
+{
+	struct totemsrp_instance *instance = (struct totemsrp_instance *)srp_context;
+
+	totemsrp_buffer_release (instance, buffer);
+}
+
+size_t totemsrp_mcast_buffer_headroom (void)
+{
+	return (sizeof (struct mcast));
+}
+
+/*
+ * Queue a message that was built in place inside a buffer obtained from
+ * totemsrp_mcast_buffer_get.  msg must start at least
+ * totemsrp_mcast_buffer_headroom() bytes into buffer; the mcast header is
+ * written immediately in front of it.  On success the buffer belongs to
+ * totemsrp, on failure it is still owned by the caller.
+ */
+int totemsrp_mcast_buffer (
 	void *srp_context,
-	struct iovec *iovec,
-	unsigned int iov_len,
+	void *buffer,
+	void *msg,
+	unsigned int msg_len,
 	int guarantee)
 {
 	struct totemsrp_instance *instance = (struct totemsrp_instance *)srp_context;
-	int i;
 	struct message_item message_item;
-	char *addr;
-	unsigned int addr_idx;
 	struct cs_queue *queue_use;
 
+	assert ((char *)msg >= (char *)buffer + sizeof (struct mcast));
+
 	if (instance->waiting_trans_ack) {
 		queue_use = &instance->new_message_queue_trans;
 	} else {
@@ -2519,14 +2628,8 @@ int totemsrp_mcast (
 	}
 
 	memset (&message_item, 0, sizeof (struct message_item));
-
-	/*
-	 * Allocate pending item
-	 */
-	message_item.mcast = totemsrp_buffer_alloc (instance);
-	if (message_item.mcast == 0) {
-		goto error_mcast;
-	}
+	message_item.buffer = buffer;
+	message_item.mcast = (struct mcast *)((char *)msg - sizeof (struct mcast));
 
 	/*
 	 * Set mcast header
@@ -2543,23 +2646,49 @@ int totemsrp_mcast (
 	message_item.mcast->guarantee = guarantee;
 	message_item.mcast->system_from = instance->my_id;
 
-	addr = (char *)message_item.mcast;
-	addr_idx = sizeof (struct mcast);
-	for (i = 0; i < iov_len; i++) {
-		memcpy (&addr[addr_idx], iovec[i].iov_base, iovec[i].iov_len);
-		addr_idx += iovec[i].iov_len;
-	}
-
-	message_item.msg_len = addr_idx;
+	message_item.msg_len = msg_len + sizeof (struct mcast);
 
 	log_printf (instance->totemsrp_log_level_trace, "mcasted message added to pending queue");
 	instance->stats.mcast_tx++;
 	cs_queue_item_add (queue_use, &message_item);
 
 	return (0);
+}
 
-error_mcast:
-	return (-1);
+int totemsrp_mcast (
+	void *srp_context,
+	struct iovec *iovec,
+	unsigned int iov_len,
+	int guarantee)
+{
+	struct totemsrp_instance *instance = (struct totemsrp_instance *)srp_context;
+	int i;
+	char *buffer;
+	unsigned int addr_idx;
+	int res;
+
+	/*
+	 * Allocate pending item
+	 */
+	buffer = totemsrp_buffer_alloc (instance);
+	if (buffer == NULL) {
+		return (-1);
+	}
+
+	addr_idx = sizeof (struct mcast);
+	for (i = 0; i < iov_len; i++) {
+		memcpy (&buffer[addr_idx], iovec[i].iov_base, iovec[i].iov_len);
+		addr_idx += iovec[i].iov_len;
+	}
+
+	res = totemsrp_mcast_buffer (srp_context, buffer,
+		&buffer[sizeof (struct mcast)], addr_idx - sizeof (struct mcast),
+		guarantee);
+	if (res == -1) {
+		totemsrp_buffer_release (instance, buffer);
+	}
+
+	return (res);
 }
 
 /*
@@ -2670,7 +2799,7 @@ static void messages_free (
 			instance->last_released + i, &ptr);
 		if (res == 0) {
 			regular_message = ptr;
-			totemsrp_buffer_release (instance, regular_message->mcast);
+			totemsrp_buffer_release (instance, regular_message->buffer);
 		}
 		sq_items_release (&instance->regular_sort_queue,
 			instance->last_released + i);
@@ -2688,11 +2817,8 @@ static void messages_free (
 static void update_aru (
 	struct totemsrp_instance *instance)
 {
-	unsigned int i;
-	int res;
 	struct sq *sort_queue;
 	unsigned int range;
-	unsigned int my_aru_saved = 0;
 
 	if (instance->memb_state == MEMB_STATE_RECOVERY) {
 		sort_queue = &instance->recovery_sort_queue;
@@ -2702,20 +2828,11 @@ static void update_aru (
 
 	range = instance->my_high_seq_received - instance->my_aru;
 
-	my_aru_saved = instance->my_aru;
-	for (i = 1; i <= range; i++) {
-
-		void *ptr;
-
-		res = sq_item_get (sort_queue, my_aru_saved + i, &ptr);
-		/*
-		 * If hole, stop updating aru
-		 */
-		if (res != 0) {
-			break;
-		}
-	}
-	instance->my_aru += i - 1;
+	/*
+	 * Advance the aru over every message received up to the first hole
+	 */
+	instance->my_aru += sq_items_inuse_run (sort_queue,
+		instance->my_aru + 1, range);
 }
 
 /*
@@ -2762,6 +2879,7 @@ static int orf_token_mcast (
 		memset (&sort_queue_item, 0, sizeof (struct sort_queue_item));
 		sort_queue_item.mcast = message_item->mcast;
 		sort_queue_item.msg_len = message_item->msg_len;
+		sort_queue_item.buffer = message_item->buffer;
 
 		mcast = sort_queue_item.mcast;
 
@@ -2808,6 +2926,7 @@ static int orf_token_rtr (
 	unsigned int res;
 	unsigned int i, j;
 	unsigned int found;
+	unsigned int received;
 	struct sq *sort_queue;
 	struct rtr_item *rtr_list;
 	unsigned int range = 0;
@@ -2890,42 +3009,47 @@ static int orf_token_rtr (
 		}
 
 		/*
-		 * Find if a message is missing from this processor
+		 * Skip over the run of messages this processor already has
 		 */
-		res = sq_item_inuse (sort_queue, instance->my_aru + i);
-		if (res == 0) {
-			/*
-			 * Determine how many times we have missed receiving
-			 * this sequence number.  sq_item_miss_count increments
-			 * a counter for the sequence number.  The miss count
-			 * will be returned and compared.  This allows time for
-			 * delayed multicast messages to be received before
-			 * declaring the message is missing and requesting a
-			 * retransmit.
-			 */
-			res = sq_item_miss_count (sort_queue, instance->my_aru + i);
-			if (res < instance->totem_config->miss_count_const) {
-				continue;
-			}
+		received = sq_items_inuse_run (sort_queue, instance->my_aru + i,
+			range - i + 1);
+		if (received > 0) {
+			i += received - 1;
+			continue;
+		}
+
+		/*
+		 * The message is missing from this processor.
+		 * Determine how many times we have missed receiving
+		 * this sequence number.  sq_item_miss_count increments
+		 * a counter for the sequence number.  The miss count
+		 * will be returned and compared.  This allows time for
+		 * delayed multicast messages to be received before
+		 * declaring the message is missing and requesting a
+		 * retransmit.
+		 */
+		res = sq_item_miss_count (sort_queue, instance->my_aru + i);
+		if (res < instance->totem_config->miss_count_const) {
+			continue;
+		}
 
+		/*
+		 * Determine if missing message is already in retransmit list
+		 */
+		found = 0;
+		for (j = 0; j < orf_token->rtr_list_entries; j++) {
+			if (instance->my_aru + i == rtr_list[j].seq) {
+				found = 1;
+			}
+		}
+		if (found == 0) {
 			/*
-			 * Determine if missing message is already in retransmit list
+			 * Missing message not found in current retransmit list so add it
 			 */
-			found = 0;
-			for (j = 0; j < orf_token->rtr_list_entries; j++) {
-				if (instance->my_aru + i == rtr_list[j].seq) {
-					found = 1;
-				}
-			}
-			if (found == 0) {
-				/*
-				 * Missing message not found in current retransmit list so add it
-				 */
-				memcpy (&rtr_list[orf_token->rtr_list_entries].ring_id,
-					&instance->my_ring_id, sizeof (struct memb_ring_id));
-				rtr_list[orf_token->rtr_list_entries].seq = instance->my_aru + i;
-				orf_token->rtr_list_entries++;
-			}
+			memcpy (&rtr_list[orf_token->rtr_list_entries].ring_id,
+				&instance->my_ring_id, sizeof (struct memb_ring_id));
+			rtr_list[orf_token->rtr_list_entries].seq = instance->my_aru + i;
+			orf_token->rtr_list_entries++;
 		}
 	}
 	return (instance->fcc_remcast_current);
@@ -4033,6 +4157,9 @@ printf ("token seq %d\n", token->seq);
 		fcc_token_update (instance, token, mcasted_retransmit +
 			mcasted_regular);
 
+		totem_hist_add (&instance->stats.token_mcast_hist, mcasted_regular);
+		totem_hist_add (&instance->stats.token_rtr_hist, mcasted_retransmit);
+
 		if (sq_lt_compare (instance->my_aru, token->aru) ||
 			instance->my_id.nodeid == token->aru_addr ||
 			token->aru_addr == 0) {
@@ -4189,14 +4316,19 @@ static void messages_deliver_to_app (
 	int endian_conversion_required;
 	unsigned int my_high_delivered_stored = 0;
 	struct srp_addr aligned_system_from;
+	uint64_t start_time;
 
 	range = end_point - instance->my_high_delivered;
 
-	if (range) {
-		log_printf (instance->totemsrp_log_level_trace,
-			"Delivering %x to %x", instance->my_high_delivered,
-			end_point);
+	if (range == 0) {
+		return;
 	}
+
+	log_printf (instance->totemsrp_log_level_trace,
+		"Delivering %x to %x", instance->my_high_delivered,
+		end_point);
+	start_time = qb_util_nano_current_get ();
+
 	assert (range < QUEUE_RTR_ITEMS_SIZE_MAX);
 	my_high_delivered_stored = instance->my_high_delivered;
 
@@ -4277,6 +4409,9 @@ static void messages_deliver_to_app (
 			sort_queue_item_p->msg_len - sizeof (struct mcast),
 			endian_conversion_required);
 	}
+
+	totem_hist_add (&instance->stats.deliver_hist,
+		(qb_util_nano_current_get () - start_time) / QB_TIME_NS_IN_USEC);
 }
 
 /*
@@ -4374,15 +4509,25 @@ static int message_handler_mcast (
 		sq_in_range (sort_queue, mcast_header.seq) &&
 		sq_item_inuse (sort_queue, mcast_header.seq) == 0) {
 
-		/*
-		 * Allocate new multicast memory block
-		 */
-// TODO LEAK
-		sort_queue_item.mcast = totemsrp_buffer_alloc (instance);
-		if (sort_queue_item.mcast == NULL) {
-			return (-1); /* error here is corrected by the algorithm */
+		if (instance->rx_buffer != NULL && *instance->rx_buffer != NULL) {
+			/*
+			 * Keep the frame in the transport's receive buffer and
+			 * give the transport a pooled one for the next frame
+			 */
+			sort_queue_item.buffer = *instance->rx_buffer;
+			sort_queue_item.mcast = (struct mcast *)msg;
+			*instance->rx_buffer = totemsrp_buffer_alloc (instance);
+		} else {
+			/*
+			 * Allocate new multicast memory block
+			 */
+			sort_queue_item.buffer = totemsrp_buffer_alloc (instance);
+			if (sort_queue_item.buffer == NULL) {
+				return (-1); /* error here is corrected by the algorithm */
+			}
+			sort_queue_item.mcast = sort_queue_item.buffer;
+			memcpy (sort_queue_item.mcast, msg, msg_len);
 		}
-		memcpy (sort_queue_item.mcast, msg, msg_len);
 		sort_queue_item.msg_len = msg_len;
 
 		if (sq_lt_compare (instance->my_high_seq_received,
@@ -5056,10 +5201,13 @@ int main_deliver_fn (
 	void *context,
 	const void *msg,
 	unsigned int msg_len,
-	const struct sockaddr_storage *system_from)
+	const struct sockaddr_storage *system_from,
+	void **rx_buffer)
 {
 	struct totemsrp_instance *instance = context;
 	const struct totem_message_header *message_header = msg;
+	void **rx_buffer_saved;
+	int res;
 
 	if (check_message_header_validity(context, msg, msg_len, system_from) == -1) {
 		return -1;
@@ -5094,13 +5242,20 @@ int main_deliver_fn (
 		return 0;
 	}
 	/*
-	 * Handle incoming message
+	 * Handle incoming message.  Handlers may run recv_flush, which
+	 * delivers frames from the transport's flush buffer, so the receive
+	 * buffer of an outer frame is restored afterwards.
 	 */
-	return totemsrp_message_handlers.handler_functions[(int)message_header->type] (
+	rx_buffer_saved = instance->rx_buffer;
+	instance->rx_buffer = rx_buffer;
+	res = totemsrp_message_handlers.handler_functions[(int)message_header->type] (
 		instance,
 		msg,
 		msg_len,
 		message_header->magic != TOTEM_MH_MAGIC);
+	instance->rx_buffer = rx_buffer_saved;
+
+	return (res);
 }
 
 int totemsrp_iface_set (
@@ -5260,6 +5415,15 @@ void totemsrp_stats_clear (void *context, int flags)
 {
 	struct totemsrp_instance *instance = (struct totemsrp_instance *)context;
 
+	if (flags == TOTEMPG_STATS_CLEAR_HIST) {
+		memset(&instance->stats.token_hold_hist, 0, sizeof(totem_hist_t));
+		memset(&instance->stats.token_rotation_hist, 0, sizeof(totem_hist_t));
+		memset(&instance->stats.token_mcast_hist, 0, sizeof(totem_hist_t));
+		memset(&instance->stats.token_rtr_hist, 0, sizeof(totem_hist_t));
+		memset(&instance->stats.deliver_hist, 0, sizeof(totem_hist_t));
+		return ;
+	}
+
 	memset(&instance->stats, 0, sizeof(totemsrp_stats_t));
 	if (flags & TOTEMPG_STATS_CLEAR_TRANSPORT) {
 		totemnet_stats_clear (instance->totemnet_context);
@@ -80,6 +80,32 @@ int totemsrp_mcast (
 	unsigned int iov_len,
 	int priority);
 
+/**
+ * Get a transmit buffer that a message can be built in place in
+ */
+extern void *totemsrp_mcast_buffer_get (void *srp_context);
+
+/**
+ * Return an unused transmit buffer
+ */
+extern void totemsrp_mcast_buffer_put (void *srp_context, void *buffer);
+
+/**
+ * Bytes that must be left free in front of a message built in place
+ */
+extern size_t totemsrp_mcast_buffer_headroom (void);
+
+/**
+ * Multicast a message built in place in a transmit buffer without copying
+ * it.  Ownership of buffer passes to totemsrp only on success.
+ */
+extern int totemsrp_mcast_buffer (
+	void *srp_context,
+	void *buffer,
+	void *msg,
+	unsigned int msg_len,
+	int priority);
+
 /**
  * Return number of available messages that can be queued
  */
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TOTEMSRP_MSG_H_DEFINED
+#define TOTEMSRP_MSG_H_DEFINED
+
+#include <corosync/totem/totem.h>
+
+/*
+ * Wire format of the totemsrp messages that are needed outside of
+ * totemsrp.c, for example by test/totembench.c to tell tokens carrying
+ * retransmit requests from the others
+ */
+enum message_type {
+	MESSAGE_TYPE_ORF_TOKEN = 0,			/* Ordering, Reliability, Flow (ORF) control Token */
+	MESSAGE_TYPE_MCAST = 1,				/* ring ordered multicast message */
+	MESSAGE_TYPE_MEMB_MERGE_DETECT = 2,	/* merge rings if there are available rings */
+	MESSAGE_TYPE_MEMB_JOIN = 3,			/* membership join message */
+	MESSAGE_TYPE_MEMB_COMMIT_TOKEN = 4,	/* membership commit token */
+	MESSAGE_TYPE_TOKEN_HOLD_CANCEL = 5,	/* cancel the holding of the token */
+};
+
+struct rtr_item  {
+	struct memb_ring_id ring_id;
+	unsigned int seq;
+}__attribute__((packed));
+
+
+struct orf_token {
+	struct totem_message_header header;
+	unsigned int seq;
+	unsigned int token_seq;
+	unsigned int aru;
+	unsigned int aru_addr;
+	struct memb_ring_id ring_id;
+	unsigned int backlog;
+	unsigned int fcc;
+	int retrans_flg;
+	int rtr_list_entries;
+	struct rtr_item rtr_list[0];
+}__attribute__((packed));
+
+#endif /* TOTEMSRP_MSG_H_DEFINED */
@@ -114,7 +114,8 @@ struct totemudp_instance {
 		void *context,
 		const void *msg,
 		unsigned int msg_len,
-		const struct sockaddr_storage *system_from);
+		const struct sockaddr_storage *system_from,
+		void **rx_buffer);
 
 	int (*totemudp_iface_change_fn) (
 		void *context,
@@ -153,6 +154,13 @@ struct totemudp_instance {
 
 	char iov_buffer[UDP_RECEIVE_FRAME_SIZE_MAX + 1];
 
+	/*
+	 * Buffer the next datagram is received into.  It is handed to
+	 * totemsrp along with the datagram, which may keep it and leave a
+	 * replacement behind.  iov_buffer is used if none can be allocated.
+	 */
+	void *recv_buffer;
+
 	char iov_buffer_flush[UDP_RECEIVE_FRAME_SIZE_MAX + 1];
 
 	struct iovec totemudp_iov_recv;
@@ -190,6 +198,22 @@ struct totemudp_instance {
 	totemsrp_stats_t *stats;
 
 	struct totem_ip_address token_target;
+
+#ifdef HAVE_RECVMMSG
+	/*
+	 * Batched receive state, recv_batch frames each received into its
+	 * own totemnet buffer like recv_buffer
+	 */
+	unsigned int recv_batch;
+
+	void **recv_batch_buffer;
+
+	struct iovec *recv_batch_iov;
+
+	struct mmsghdr *recv_batch_msgs;
+
+	struct sockaddr_storage *recv_batch_from;
+#endif
 };
 
 struct work_item {
@@ -205,6 +229,10 @@ static int totemudp_build_sockets (
 	struct totemudp_socket *sockets,
 	struct totem_ip_address *bound_to);
 
+#ifdef HAVE_RECVMMSG
+static void recv_batch_free (struct totemudp_instance *instance);
+#endif
+
 static struct totem_ip_address localhost;
 
 static void totemudp_instance_initialize (struct totemudp_instance *instance)
@@ -375,9 +403,182 @@ int totemudp_finalize (
 		close (instance->totemudp_sockets.token);
 	}
 
+	totemudp_buffer_release (instance->recv_buffer);
+	instance->recv_buffer = NULL;
+#ifdef HAVE_RECVMMSG
+	recv_batch_free (instance);
+#endif
+
 	return (res);
 }
 
+#ifdef HAVE_RECVMMSG
+static void recv_batch_free (struct totemudp_instance *instance)
+{
+	unsigned int i;
+
+	if (instance->recv_batch_buffer != NULL) {
+		for (i = 0; i < instance->recv_batch; i++) {
+			totemudp_buffer_release (instance->recv_batch_buffer[i]);
+		}
+	}
+	free (instance->recv_batch_buffer);
+	free (instance->recv_batch_iov);
+	free (instance->recv_batch_msgs);
+	free (instance->recv_batch_from);
+	instance->recv_batch_buffer = NULL;
+	instance->recv_batch_iov = NULL;
+	instance->recv_batch_msgs = NULL;
+	instance->recv_batch_from = NULL;
+	instance->recv_batch = 1;
+}
+
+static void recv_batch_alloc (struct totemudp_instance *instance)
+{
+	unsigned int i;
+
+	instance->recv_batch = instance->totem_config->recv_batch;
+	if (instance->recv_batch <= 1) {
+		instance->recv_batch = 1;
+		return;
+	}
+
+	instance->recv_batch_buffer = calloc (instance->recv_batch,
+		sizeof (void *));
+	instance->recv_batch_iov = calloc (instance->recv_batch,
+		sizeof (struct iovec));
+	instance->recv_batch_msgs = calloc (instance->recv_batch,
+		sizeof (struct mmsghdr));
+	instance->recv_batch_from = calloc (instance->recv_batch,
+		sizeof (struct sockaddr_storage));
+	if (instance->recv_batch_buffer == NULL ||
+	    instance->recv_batch_iov == NULL ||
+	    instance->recv_batch_msgs == NULL ||
+	    instance->recv_batch_from == NULL) {
+		log_printf (instance->totemudp_log_level_warning,
+			"Unable to allocate receive batch of %u messages, receiving one at a time",
+			instance->recv_batch);
+		recv_batch_free (instance);
+		return;
+	}
+
+	for (i = 0; i < instance->recv_batch; i++) {
+		instance->recv_batch_msgs[i].msg_hdr.msg_name = &instance->recv_batch_from[i];
+		instance->recv_batch_msgs[i].msg_hdr.msg_iov = &instance->recv_batch_iov[i];
+		instance->recv_batch_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	instance->stats->rx_batch_size = instance->recv_batch;
+}
+#endif
+
+/*
+ * Point iov at the receive buffer in *buffer, allocating a new one if
+ * totemsrp kept the last one without leaving a replacement
+ */
+static int recv_buffer_prepare (
+	void **buffer,
+	struct iovec *iov)
+{
+	if (*buffer == NULL) {
+		*buffer = totemudp_buffer_alloc ();
+		if (*buffer == NULL) {
+			return (-1);
+		}
+	}
+	iov->iov_base = *buffer;
+	iov->iov_len = UDP_RECEIVE_BUFFER_LEN;
+
+	return (0);
+}
+
+/*
+ * Check and hand one received datagram to totemsrp
+ */
+static void net_deliver_msg (
+	struct totemudp_instance *instance,
+	void *msg,
+	int bytes_received,
+	const struct sockaddr_storage *system_from,
+	void **rx_buffer)
+{
+	if (bytes_received >= UDP_RECEIVE_FRAME_SIZE_MAX + 1) {
+		/*
+		 * Maximum packet size should be UDP_RECEIVE_FRAME_SIZE_MAX.
+		 * If received packet is UDP_RECEIVE_FRAME_SIZE_MAX + 1 it means packet was truncated
+		 * (iov_buffer size and iov_len are intentionally set to UDP_RECEIVE_FRAME_SIZE_MAX + 1).
+		 */
+		log_printf (instance->totemudp_log_level_error,
+				"Received too big message. This may be because something bad is happening "
+				"on the network (attack?), or you tried join more nodes than corosync is "
+				"compiled with (%u) or bug in the code (bad estimation of "
+				"the UDP_RECEIVE_FRAME_SIZE_MAX). Dropping packet.", PROCESSOR_COUNT_MAX);
+		return;
+	}
+
+	/*
+	 * Handle incoming message
+	 */
+	instance->totemudp_deliver_fn (
+		instance->context,
+		msg,
+		bytes_received,
+		system_from,
+		rx_buffer);
+}
+
+#ifdef HAVE_RECVMMSG
+/*
+ * Receive up to recv_batch datagrams with one system call and hand all of
+ * them to totemsrp before returning to the main loop.  Returns -1 without
+ * receiving anything if no receive buffer could be allocated.
+ */
+static int net_deliver_batch_fn (
+	int fd,
+	struct totemudp_instance *instance)
+{
+	struct mmsghdr *msgs = instance->recv_batch_msgs;
+	int msgs_received;
+	int i;
+
+	for (i = 0; i < instance->recv_batch; i++) {
+		if (recv_buffer_prepare (&instance->recv_batch_buffer[i],
+		    &instance->recv_batch_iov[i]) == -1) {
+			break;
+		}
+		msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_storage);
+		msgs[i].msg_hdr.msg_flags = 0;
+	}
+	if (i == 0) {
+		return (-1);
+	}
+
+	msgs_received = recvmmsg (fd, msgs, i,
+		MSG_NOSIGNAL | MSG_DONTWAIT, NULL);
+	if (msgs_received <= 0) {
+		return (0);
+	}
+
+	instance->stats->rx_batch_size = instance->recv_batch;
+	instance->stats->rx_batches++;
+	instance->stats->rx_batch_msgs += msgs_received;
+	if (msgs_received > instance->stats->rx_batch_max) {
+		instance->stats->rx_batch_max = msgs_received;
+	}
+
+	for (i = 0; i < msgs_received; i++) {
+		instance->stats_recv += msgs[i].msg_len;
+
+		net_deliver_msg (instance,
+			instance->recv_batch_iov[i].iov_base,
+			msgs[i].msg_len,
+			&instance->recv_batch_from[i],
+			&instance->recv_batch_buffer[i]);
+	}
+
+	return (0);
+}
+#endif
+
 /*
  * Only designed to work with a message with one iov
  */
@@ -390,13 +591,27 @@ static int net_deliver_fn (
 	struct totemudp_instance *instance = (struct totemudp_instance *)data;
 	struct msghdr msg_recv;
 	struct iovec *iovec;
+	struct iovec iov_recv;
 	struct sockaddr_storage system_from;
 	int bytes_received;
+	void **rx_buffer = NULL;
 
 	if (instance->flushing == 1) {
 		iovec = &instance->totemudp_iov_recv_flush;
 	} else {
-		iovec = &instance->totemudp_iov_recv;
+#ifdef HAVE_RECVMMSG
+		if (instance->recv_batch > 1 &&
+		    net_deliver_batch_fn (fd, instance) == 0) {
+			return (0);
+		}
+#endif
+		rx_buffer = &instance->recv_buffer;
+		if (recv_buffer_prepare (rx_buffer, &iov_recv) == 0) {
+			iovec = &iov_recv;
+		} else {
+			iovec = &instance->totemudp_iov_recv;
+			rx_buffer = NULL;
+		}
 	}
 
 	/*
@@ -415,32 +630,9 @@ static int net_deliver_fn (
 		instance->stats_recv += bytes_received;
 	}
 
-	if (bytes_received >= UDP_RECEIVE_FRAME_SIZE_MAX + 1) {
-		/*
-		 * Maximum packet size should be UDP_RECEIVE_FRAME_SIZE_MAX.
-		 * If received packet is UDP_RECEIVE_FRAME_SIZE_MAX + 1 it means packet was truncated
-		 * (iov_buffer size and iov_len are intentionally set to UDP_RECEIVE_FRAME_SIZE_MAX + 1).
-		 */
-		log_printf (instance->totemudp_log_level_error,
-				"Received too big message. This may be because something bad is happening "
-				"on the network (attack?), or you tried join more nodes than corosync is "
-				"compiled with (%u) or bug in the code (bad estimation of "
-				"the UDP_RECEIVE_FRAME_SIZE_MAX). Dropping packet.", PROCESSOR_COUNT_MAX);
-		return (0);
-	}
-
-	iovec->iov_len = bytes_received;
+	net_deliver_msg (instance, iovec->iov_base, bytes_received, &system_from,
+		rx_buffer);
 
-	/*
-	 * Handle incoming message
-	 */
-	instance->totemudp_deliver_fn (
-		instance->context,
-		iovec->iov_base,
-		iovec->iov_len,
-		&system_from);
-
-	iovec->iov_len = UDP_RECEIVE_FRAME_SIZE_MAX + 1;
 	return (0);
 }
 
@@ -1098,7 +1290,8 @@ int totemudp_initialize (
 		void *context,
 		const void *msg,
 		unsigned int msg_len,
-		const struct sockaddr_storage *system_from),
+		const struct sockaddr_storage *system_from,
+		void **rx_buffer),
 
 	int (*iface_change_fn) (
 		void *context,
@@ -1142,6 +1335,9 @@ int totemudp_initialize (
 	totemip_copy (&instance->mcast_address, &instance->totem_interface->mcast_addr);
 	memset (instance->iov_buffer, 0, UDP_RECEIVE_FRAME_SIZE_MAX + 1);
 	memset (instance->iov_buffer_flush, 0, UDP_RECEIVE_FRAME_SIZE_MAX + 1);
+#ifdef HAVE_RECVMMSG
+	recv_batch_alloc (instance);
+#endif
 
 	instance->totemudp_poll_handle = poll_handle;
 
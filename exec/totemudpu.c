@@ -82,13 +82,27 @@
 #define BIND_STATE_REGULAR	1
 #define BIND_STATE_LOOPBACK	2
 
+/*
+ * Number of noflush multicast messages held back so they can be handed
+ * to the kernel as one batch per member
+ */
+#define MCAST_PENDING_MAX	64
+
 struct totemudpu_member {
 	struct qb_list_head list;
 	struct totem_ip_address member;
+	struct sockaddr_storage sockaddr;
+	int addrlen;
 	int fd;
 	int active;
 };
 
+struct mcast_pending {
+	const void *msg;
+	unsigned int msg_len;
+	int send_to_inactive;
+};
+
 struct totemudpu_instance {
 	qb_loop_t *totemudpu_poll_handle;
 
@@ -104,7 +118,8 @@ struct totemudpu_instance {
 		void *context,
 		const void *msg,
 		unsigned int msg_len,
-		const struct sockaddr_storage *system_from);
+		const struct sockaddr_storage *system_from,
+		void **rx_buffer);
 
 	int (*totemudpu_iface_change_fn) (
 		void *context,
@@ -141,6 +156,13 @@ struct totemudpu_instance {
 
 	char iov_buffer[UDP_RECEIVE_FRAME_SIZE_MAX + 1];
 
+	/*
+	 * Buffer the next datagram is received into.  It is handed to
+	 * totemsrp along with the datagram, which may keep it and leave a
+	 * replacement behind.  iov_buffer is used if none can be allocated.
+	 */
+	void *recv_buffer;
+
 	struct iovec totemudpu_iov_recv;
 
 	struct qb_list_head member_list;
@@ -180,6 +202,26 @@ struct totemudpu_instance {
 	int send_merge_detect_message;
 
 	unsigned int merge_detect_messages_sent_before_timeout;
+
+	struct mcast_pending mcast_pending[MCAST_PENDING_MAX];
+
+	unsigned int mcast_pending_entries;
+
+#ifdef HAVE_RECVMMSG
+	/*
+	 * Batched receive state, recv_batch frames each received into its
+	 * own totemnet buffer like recv_buffer
+	 */
+	unsigned int recv_batch;
+
+	void **recv_batch_buffer;
+
+	struct iovec *recv_batch_iov;
+
+	struct mmsghdr *recv_batch_msgs;
+
+	struct sockaddr_storage *recv_batch_from;
+#endif
 };
 
 struct work_item {
@@ -197,6 +239,10 @@ static int totemudpu_create_sending_socket(
 	void *udpu_context,
 	const struct totem_ip_address *member);
 
+#ifdef HAVE_RECVMMSG
+static void recv_batch_free (struct totemudpu_instance *instance);
+#endif
+
 int totemudpu_member_list_rebind_ip (
 	void *udpu_context);
 
@@ -298,43 +344,97 @@ static inline void ucast_sendmsg (
 	}
 }
 
-static inline void mcast_sendmsg (
-	struct totemudpu_instance *instance,
-	const void *msg,
-	unsigned int msg_len,
-	int only_active)
+static void mcast_pending_flush (
+	struct totemudpu_instance *instance)
 {
 	struct msghdr msg_mcast;
 	int res = 0;
-	struct iovec iovec;
-	struct sockaddr_storage sockaddr;
-	int addrlen;
+	struct iovec iovec[MCAST_PENDING_MAX];
 	struct qb_list_head *list;
 	struct totemudpu_member *member;
+	unsigned int i;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr mmsg[MCAST_PENDING_MAX];
+	unsigned int mmsg_entries;
+	unsigned int sent;
+#endif
 
-	iovec.iov_base = (void *)msg;
-	iovec.iov_len = msg_len;
+	if (instance->mcast_pending_entries == 0) {
+		return;
+	}
 
-	memset(&msg_mcast, 0, sizeof(msg_mcast));
-	/*
-	 * Build multicast message
-	 */
-	if (instance->netif_bind_state == BIND_STATE_REGULAR) {
-		qb_list_for_each(list, &(instance->member_list)) {
-			member = qb_list_entry (list, struct totemudpu_member, list);
+	for (i = 0; i < instance->mcast_pending_entries; i++) {
+		iovec[i].iov_base = (void *)instance->mcast_pending[i].msg;
+		iovec[i].iov_len = instance->mcast_pending[i].msg_len;
+	}
+
+	if (instance->netif_bind_state != BIND_STATE_REGULAR) {
+		/*
+		 * Transmit multicast messages to local unix mcast loop
+		 * An error here is recovered by totemsrp
+		 */
+		for (i = 0; i < instance->mcast_pending_entries; i++) {
+			memset(&msg_mcast, 0, sizeof(msg_mcast));
+			msg_mcast.msg_iov = &iovec[i];
+			msg_mcast.msg_iovlen = 1;
+
+			res = sendmsg (instance->local_loop_sock[1], &msg_mcast,
+				MSG_NOSIGNAL);
+			if (res < 0) {
+				LOGSYS_PERROR (errno, instance->totemudpu_log_level_debug,
+					"sendmsg(local mcast loop) failed (non-critical)");
+			}
+		}
+		instance->mcast_pending_entries = 0;
+		return;
+	}
+
+	qb_list_for_each(list, &(instance->member_list)) {
+		member = qb_list_entry (list, struct totemudpu_member, list);
+
+#ifdef HAVE_SENDMMSG
+		mmsg_entries = 0;
+		for (i = 0; i < instance->mcast_pending_entries; i++) {
 			/*
-			 * Do not send multicast message if message is not "flush", member
-			 * is inactive and timeout for sending merge message didn't expired.
+			 * Inactive members only get messages which were queued
+			 * as "flush" or while merge detection was due
 			 */
-			if (only_active && !member->active && !instance->send_merge_detect_message)
-				continue ;
+			if (!member->active && !instance->mcast_pending[i].send_to_inactive) {
+				continue;
+			}
+			memset(&mmsg[mmsg_entries], 0, sizeof(mmsg[mmsg_entries]));
+			mmsg[mmsg_entries].msg_hdr.msg_name = &member->sockaddr;
+			mmsg[mmsg_entries].msg_hdr.msg_namelen = member->addrlen;
+			mmsg[mmsg_entries].msg_hdr.msg_iov = &iovec[i];
+			mmsg[mmsg_entries].msg_hdr.msg_iovlen = 1;
+			mmsg_entries++;
+		}
 
-			totemip_totemip_to_sockaddr_convert(&member->member,
-				instance->totem_interface->ip_port, &sockaddr, &addrlen);
+		/*
+		 * Transmit multicast messages
+		 * An error here is recovered by totemsrp, so a message the
+		 * kernel refuses is skipped and the rest are still sent
+		 */
+		sent = 0;
+		while (sent < mmsg_entries) {
+			res = sendmmsg (member->fd, &mmsg[sent], mmsg_entries - sent,
+				MSG_NOSIGNAL);
+			if (res < 0) {
+				LOGSYS_PERROR (errno, instance->totemudpu_log_level_debug,
+					"sendmmsg(mcast) failed (non-critical)");
+				res = 1;
+			}
+			sent += res;
+		}
+#else
+		for (i = 0; i < instance->mcast_pending_entries; i++) {
+			if (!member->active && !instance->mcast_pending[i].send_to_inactive) {
+				continue;
+			}
 			memset(&msg_mcast, 0, sizeof(msg_mcast));
-			msg_mcast.msg_name = &sockaddr;
-			msg_mcast.msg_namelen = addrlen;
-			msg_mcast.msg_iov = (void *)&iovec;
+			msg_mcast.msg_name = &member->sockaddr;
+			msg_mcast.msg_namelen = member->addrlen;
+			msg_mcast.msg_iov = &iovec[i];
 			msg_mcast.msg_iovlen = 1;
 
 			/*
@@ -347,30 +447,45 @@ static inline void mcast_sendmsg (
 					"sendmsg(mcast) failed (non-critical)");
 			}
 		}
+#endif
+	}
 
-		if (!only_active || instance->send_merge_detect_message) {
-			/*
-			 * Current message was sent to all nodes
-			 */
-			instance->merge_detect_messages_sent_before_timeout++;
-			instance->send_merge_detect_message = 0;
-		}
-	} else {
+	instance->mcast_pending_entries = 0;
+}
+
+/*
+ * Queue a multicast message.  "flush" messages (only_active == 0) are
+ * transmitted right away together with anything queued before them, noflush
+ * messages are held until the next token send or explicit send flush.
+ * totemsrp keeps noflush messages in its sort queue until after the token
+ * has been forwarded, so msg stays valid until then.
+ */
+static inline void mcast_sendmsg (
+	struct totemudpu_instance *instance,
+	const void *msg,
+	unsigned int msg_len,
+	int only_active)
+{
+	struct mcast_pending *pending;
+
+	pending = &instance->mcast_pending[instance->mcast_pending_entries++];
+	pending->msg = msg;
+	pending->msg_len = msg_len;
+	pending->send_to_inactive = 0;
+
+	if (instance->netif_bind_state == BIND_STATE_REGULAR &&
+	    (!only_active || instance->send_merge_detect_message)) {
 		/*
-		 * Transmit multicast message to local unix mcast loop
-		 * An error here is recovered by totemsrp
+		 * Current message will be sent to all nodes
 		 */
-		msg_mcast.msg_name = NULL;
-		msg_mcast.msg_namelen = 0;
-		msg_mcast.msg_iov = (void *)&iovec;
-		msg_mcast.msg_iovlen = 1;
-
-		res = sendmsg (instance->local_loop_sock[1], &msg_mcast,
-			MSG_NOSIGNAL);
-		if (res < 0) {
-			LOGSYS_PERROR (errno, instance->totemudpu_log_level_debug,
-				"sendmsg(local mcast loop) failed (non-critical)");
-		}
+		pending->send_to_inactive = 1;
+		instance->merge_detect_messages_sent_before_timeout++;
+		instance->send_merge_detect_message = 0;
+	}
+
+	if (!only_active ||
+	    instance->mcast_pending_entries == MCAST_PENDING_MAX) {
+		mcast_pending_flush (instance);
 	}
 }
 
@@ -380,6 +495,8 @@ int totemudpu_finalize (
 	struct totemudpu_instance *instance = (struct totemudpu_instance *)udpu_context;
 	int res = 0;
 
+	mcast_pending_flush (instance);
+
 	if (instance->token_socket > 0) {
 		qb_loop_poll_del (instance->totemudpu_poll_handle,
 			instance->token_socket);
@@ -395,6 +512,12 @@ int totemudpu_finalize (
 
 	totemudpu_stop_merge_detect_timeout(instance);
 
+	totemudpu_buffer_release (instance->recv_buffer);
+	instance->recv_buffer = NULL;
+#ifdef HAVE_RECVMMSG
+	recv_batch_free (instance);
+#endif
+
 	return (res);
 }
 
@@ -424,35 +547,95 @@ static struct totemudpu_member *find_member_by_sockaddr(
 }
 
 
-static int net_deliver_fn (
-	int fd,
-	int revents,
-	void *data)
+#ifdef HAVE_RECVMMSG
+static void recv_batch_free (struct totemudpu_instance *instance)
 {
-	struct totemudpu_instance *instance = (struct totemudpu_instance *)data;
-	struct msghdr msg_recv;
-	struct iovec *iovec;
-	struct sockaddr_storage system_from;
-	int bytes_received;
+	unsigned int i;
 
-	iovec = &instance->totemudpu_iov_recv;
+	if (instance->recv_batch_buffer != NULL) {
+		for (i = 0; i < instance->recv_batch; i++) {
+			totemudpu_buffer_release (instance->recv_batch_buffer[i]);
+		}
+	}
+	free (instance->recv_batch_buffer);
+	free (instance->recv_batch_iov);
+	free (instance->recv_batch_msgs);
+	free (instance->recv_batch_from);
+	instance->recv_batch_buffer = NULL;
+	instance->recv_batch_iov = NULL;
+	instance->recv_batch_msgs = NULL;
+	instance->recv_batch_from = NULL;
+	instance->recv_batch = 1;
+}
 
-	/*
-	 * Receive datagram
-	 */
-	memset(&msg_recv, 0, sizeof(msg_recv));
-	msg_recv.msg_name = &system_from;
-	msg_recv.msg_namelen = sizeof (struct sockaddr_storage);
-	msg_recv.msg_iov = iovec;
-	msg_recv.msg_iovlen = 1;
+static void recv_batch_alloc (struct totemudpu_instance *instance)
+{
+	unsigned int i;
 
-	bytes_received = recvmsg (fd, &msg_recv, MSG_NOSIGNAL | MSG_DONTWAIT);
-	if (bytes_received == -1) {
-		return (0);
-	} else {
-		instance->stats_recv += bytes_received;
+	instance->recv_batch = instance->totem_config->recv_batch;
+	if (instance->recv_batch <= 1) {
+		instance->recv_batch = 1;
+		return;
 	}
 
+	instance->recv_batch_buffer = calloc (instance->recv_batch,
+		sizeof (void *));
+	instance->recv_batch_iov = calloc (instance->recv_batch,
+		sizeof (struct iovec));
+	instance->recv_batch_msgs = calloc (instance->recv_batch,
+		sizeof (struct mmsghdr));
+	instance->recv_batch_from = calloc (instance->recv_batch,
+		sizeof (struct sockaddr_storage));
+	if (instance->recv_batch_buffer == NULL ||
+	    instance->recv_batch_iov == NULL ||
+	    instance->recv_batch_msgs == NULL ||
+	    instance->recv_batch_from == NULL) {
+		log_printf (instance->totemudpu_log_level_warning,
+			"Unable to allocate receive batch of %u messages, receiving one at a time",
+			instance->recv_batch);
+		recv_batch_free (instance);
+		return;
+	}
+
+	for (i = 0; i < instance->recv_batch; i++) {
+		instance->recv_batch_msgs[i].msg_hdr.msg_name = &instance->recv_batch_from[i];
+		instance->recv_batch_msgs[i].msg_hdr.msg_iov = &instance->recv_batch_iov[i];
+		instance->recv_batch_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	instance->stats->rx_batch_size = instance->recv_batch;
+}
+#endif
+
+/*
+ * Point iov at the receive buffer in *buffer, allocating a new one if
+ * totemsrp kept the last one without leaving a replacement
+ */
+static int recv_buffer_prepare (
+	void **buffer,
+	struct iovec *iov)
+{
+	if (*buffer == NULL) {
+		*buffer = totemudpu_buffer_alloc ();
+		if (*buffer == NULL) {
+			return (-1);
+		}
+	}
+	iov->iov_base = *buffer;
+	iov->iov_len = UDP_RECEIVE_BUFFER_LEN;
+
+	return (0);
+}
+
+/*
+ * Check and hand one received datagram to totemsrp
+ */
+static void net_deliver_msg (
+	struct totemudpu_instance *instance,
+	void *msg,
+	int bytes_received,
+	const struct sockaddr_storage *system_from,
+	void **rx_buffer)
+{
 	if (bytes_received >= UDP_RECEIVE_FRAME_SIZE_MAX + 1) {
 		/*
 		 * Maximum packet size should be UDP_RECEIVE_FRAME_SIZE_MAX.
@@ -464,30 +647,129 @@ static int net_deliver_fn (
 				"on the network (attack?), or you tried join more nodes than corosync is "
 				"compiled with (%u) or bug in the code (bad estimation of "
 				"the UDP_RECEIVE_FRAME_SIZE_MAX). Dropping packet.", PROCESSOR_COUNT_MAX);
-		return (0);
+		return;
 	}
 
 	if (instance->totem_config->block_unlisted_ips &&
 	    instance->netif_bind_state == BIND_STATE_REGULAR &&
-	    find_member_by_sockaddr(instance, (const struct sockaddr *)&system_from) == NULL) {
+	    find_member_by_sockaddr(instance, (const struct sockaddr *)system_from) == NULL) {
 		log_printf(instance->totemudpu_log_level_debug, "Packet rejected from %s",
-		    totemip_sa_print((const struct sockaddr *)&system_from));
+		    totemip_sa_print((const struct sockaddr *)system_from));
 
-		return (0);
+		return;
 	}
 
-	iovec->iov_len = bytes_received;
-
 	/*
 	 * Handle incoming message
 	 */
 	instance->totemudpu_deliver_fn (
 		instance->context,
-		iovec->iov_base,
-		iovec->iov_len,
-		&system_from);
+		msg,
+		bytes_received,
+		system_from,
+		rx_buffer);
+}
+
+#ifdef HAVE_RECVMMSG
+/*
+ * Receive up to recv_batch datagrams with one system call and hand all of
+ * them to totemsrp before returning to the main loop.  Returns -1 without
+ * receiving anything if no receive buffer could be allocated.
+ */
+static int net_deliver_batch_fn (
+	int fd,
+	struct totemudpu_instance *instance)
+{
+	struct mmsghdr *msgs = instance->recv_batch_msgs;
+	int msgs_received;
+	int i;
+
+	for (i = 0; i < instance->recv_batch; i++) {
+		if (recv_buffer_prepare (&instance->recv_batch_buffer[i],
+		    &instance->recv_batch_iov[i]) == -1) {
+			break;
+		}
+		msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_storage);
+		msgs[i].msg_hdr.msg_flags = 0;
+	}
+	if (i == 0) {
+		return (-1);
+	}
+
+	msgs_received = recvmmsg (fd, msgs, i,
+		MSG_NOSIGNAL | MSG_DONTWAIT, NULL);
+	if (msgs_received <= 0) {
+		return (0);
+	}
+
+	instance->stats->rx_batch_size = instance->recv_batch;
+	instance->stats->rx_batches++;
+	instance->stats->rx_batch_msgs += msgs_received;
+	if (msgs_received > instance->stats->rx_batch_max) {
+		instance->stats->rx_batch_max = msgs_received;
+	}
+
+	for (i = 0; i < msgs_received; i++) {
+		instance->stats_recv += msgs[i].msg_len;
+
+		net_deliver_msg (instance,
+			instance->recv_batch_iov[i].iov_base,
+			msgs[i].msg_len,
+			&instance->recv_batch_from[i],
+			&instance->recv_batch_buffer[i]);
+	}
+
+	return (0);
+}
+#endif
+
+static int net_deliver_fn (
+	int fd,
+	int revents,
+	void *data)
+{
+	struct totemudpu_instance *instance = (struct totemudpu_instance *)data;
+	struct msghdr msg_recv;
+	struct iovec *iovec;
+	struct iovec iov_recv;
+	struct sockaddr_storage system_from;
+	int bytes_received;
+	void **rx_buffer;
+
+#ifdef HAVE_RECVMMSG
+	if (instance->recv_batch > 1 &&
+	    net_deliver_batch_fn (fd, instance) == 0) {
+		return (0);
+	}
+#endif
+
+	rx_buffer = &instance->recv_buffer;
+	if (recv_buffer_prepare (rx_buffer, &iov_recv) == 0) {
+		iovec = &iov_recv;
+	} else {
+		iovec = &instance->totemudpu_iov_recv;
+		rx_buffer = NULL;
+	}
+
+	/*
+	 * Receive datagram
+	 */
+	memset(&msg_recv, 0, sizeof(msg_recv));
+	msg_recv.msg_name = &system_from;
+	msg_recv.msg_namelen = sizeof (struct sockaddr_storage);
+	msg_recv.msg_iov = iovec;
+	msg_recv.msg_iovlen = 1;
+
+	bytes_received = recvmsg (fd, &msg_recv, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (bytes_received == -1) {
+		return (0);
+	} else {
+		instance->stats_recv += bytes_received;
+	}
+
+	net_deliver_msg (instance, iovec->iov_base, bytes_received, &system_from,
+		rx_buffer);
 
-	iovec->iov_len = UDP_RECEIVE_FRAME_SIZE_MAX + 1;
 	return (0);
 }
 
@@ -896,7 +1178,8 @@ int totemudpu_initialize (
 		void *context,
 		const void *msg,
 		unsigned int msg_len,
-		const struct sockaddr_storage *system_from),
+		const struct sockaddr_storage *system_from,
+		void **rx_buffer),
 
         int (*iface_change_fn) (
 		void *context,
@@ -938,6 +1221,9 @@ int totemudpu_initialize (
 	 */
 	instance->totem_interface = &totem_config->interfaces[0];
 	memset (instance->iov_buffer, 0, UDP_RECEIVE_FRAME_SIZE_MAX + 1);
+#ifdef HAVE_RECVMMSG
+	recv_batch_alloc (instance);
+#endif
 
 	instance->totemudpu_poll_handle = poll_handle;
 
@@ -954,6 +1240,9 @@ int totemudpu_initialize (
 	 * Create static local mcast sockets
 	 */
 	if (totemudpu_build_local_sockets(instance) == -1) {
+#ifdef HAVE_RECVMMSG
+		recv_batch_free (instance);
+#endif
 		free(instance);
 		return (-1);
 	}
@@ -1022,8 +1311,11 @@ int totemudpu_recv_flush (void *udpu_context)
 
 int totemudpu_send_flush (void *udpu_context)
 {
+	struct totemudpu_instance *instance = (struct totemudpu_instance *)udpu_context;
 	int res = 0;
 
+	mcast_pending_flush (instance);
+
 	return (res);
 }
 
@@ -1035,6 +1327,11 @@ int totemudpu_token_send (
 	struct totemudpu_instance *instance = (struct totemudpu_instance *)udpu_context;
 	int res = 0;
 
+	/*
+	 * Messages multicast while holding the token must leave before it
+	 */
+	mcast_pending_flush (instance);
+
 	ucast_sendmsg (instance, &instance->token_target, msg, msg_len);
 
 	return (res);
@@ -1256,6 +1553,9 @@ int totemudpu_member_add (
 	qb_list_init (&new_member->list);
 	qb_list_add_tail (&new_member->list, &instance->member_list);
 	memcpy (&new_member->member, member, sizeof (struct totem_ip_address));
+	totemip_totemip_to_sockaddr_convert(&new_member->member,
+		instance->totem_interface->ip_port, &new_member->sockaddr,
+		&new_member->addrlen);
 	new_member->fd = totemudpu_create_sending_socket(udpu_context, member);
 	new_member->active = 1;
 
@@ -1273,6 +1573,8 @@ int totemudpu_member_remove (
 
 	struct totemudpu_instance *instance = (struct totemudpu_instance *)udpu_context;
 
+	mcast_pending_flush (instance);
+
 	/*
 	 * Find the member to remove and close its socket
 	 */
@@ -1318,6 +1620,8 @@ int totemudpu_member_list_rebind_ip (
 
 	struct totemudpu_instance *instance = (struct totemudpu_instance *)udpu_context;
 
+	mcast_pending_flush (instance);
+
 	qb_list_for_each(list, &(instance->member_list)) {
 		member = qb_list_entry (list,
 			struct totemudpu_member,
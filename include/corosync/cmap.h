@@ -110,6 +110,36 @@ typedef enum {
 	CMAP_MAP_STATS          = 1,
 } cmap_map_t;
 
+/**
+ * Item stored by cmap_iter_bulk. Items are packed one after another, each one
+ * starting item_len bytes after the previous one at an 8 byte aligned offset.
+ * key_name is zero terminated and the value (of value_len bytes) follows it,
+ * see CMAP_BULK_ITEM_VALUE.
+ */
+struct cmap_bulk_item {
+	uint32_t item_len;
+	uint32_t key_len;
+	uint64_t value_len;
+	uint32_t type;
+	uint32_t reserved;
+	char key_name[];
+};
+
+#define CMAP_BULK_ALIGN(len)		(((len) + 7) & ~((size_t)7))
+
+/*
+ * Size of item with key of key_len bytes (without trailing zero) and value
+ * of value_len bytes
+ */
+#define CMAP_BULK_ITEM_LEN(key_len, value_len) \
+	(sizeof(struct cmap_bulk_item) + CMAP_BULK_ALIGN((key_len) + 1) + CMAP_BULK_ALIGN(value_len))
+
+#define CMAP_BULK_ITEM_VALUE(item) \
+	((void *)((item)->key_name + CMAP_BULK_ALIGN((item)->key_len + 1)))
+
+#define CMAP_BULK_ITEM_NEXT(item) \
+	((struct cmap_bulk_item *)((char *)(item) + (item)->item_len))
+
 /**
  * Structure passed as new_value and old_value in change callback. It contains type of
  * key, length of key and pointer to value of key
@@ -332,6 +362,30 @@ extern cs_error_t cmap_iter_next(
 		size_t *value_len,
 		cmap_value_types_t *type);
 
+/**
+ * @brief Return as many of the next items in iterator iter as fit into buffer
+ *
+ * Unlike cmap_iter_next, values are returned together with key names and types,
+ * and the whole batch costs a single round trip to corosync. Items are stored
+ * as struct cmap_bulk_item records, first one at the start of buffer, which has
+ * to be 8 byte aligned. An item which doesn't fit is returned by the next call
+ * of cmap_iter_bulk or cmap_iter_next.
+ *
+ * @param handle cmap handle
+ * @param iter_handle handle of iteration returned by cmap_iter_init
+ * @param buffer place to store items
+ * @param buffer_len size of buffer on input, number of bytes used by items on return
+ * @param items number of items stored
+ * @return CS_ERR_NO_SECTIONS if there are no more items to iterate, CS_ERR_TOO_BIG if
+ *         the next item doesn't fit even into an empty buffer
+ */
+extern cs_error_t cmap_iter_bulk(
+		cmap_handle_t handle,
+		cmap_iter_handle_t iter_handle,
+		void *buffer,
+		size_t *buffer_len,
+		size_t *items);
+
 /**
  * @brief Finalize iterator
  * @param handle
@@ -362,6 +416,36 @@ extern cs_error_t cmap_track_add(
         void *user_data,
         cmap_track_handle_t *cmap_track_handle);
 
+/**
+ * @brief Add tracking function for given key_name with coalesced notifications.
+ *
+ * Same as cmap_track_add, but changes are collected for coalesce_window milliseconds
+ * after first change and then sent to the client together. Changes of the same key
+ * within window are merged, so notify_fn is called only once per key with the
+ * oldest old value and the newest new value. Key which is created and deleted within
+ * window is not reported at all. Notifications are delivered sorted by key name.
+ * coalesce_window 0 means no coalescing. Maximum is 60000 ms.
+ *
+ * Corosync without coalescing support ignores coalesce_window and sends
+ * notifications immediately.
+ *
+ * @param handle cmap handle
+ * @param key_name name of key to track changes on
+ * @param track_type bitwise-or of CMAP_TRACK_* values
+ * @param notify_fn function to be called on change of key
+ * @param user_data given pointer is unchanged passed to notify_fn
+ * @param coalesce_window time in milliseconds for which changes are collected
+ * @param cmap_track_handle handle used for removing of newly created track
+ */
+extern cs_error_t cmap_track_add_coalesced(
+	cmap_handle_t handle,
+	const char *key_name,
+	int32_t track_type,
+	cmap_notify_fn_t notify_fn,
+	void *user_data,
+	uint32_t coalesce_window,
+	cmap_track_handle_t *cmap_track_handle);
+
 /**
  * Delete track created previously by cmap_track_add
  * @param handle cmap handle
@@ -101,6 +101,10 @@ struct corosync_tpg_group {
 
 #define TOTEM_AGREED	0
 #define TOTEM_SAFE	1
+/*
+ * May be OR'ed into the guarantee to skip the packing delay
+ */
+#define TOTEM_URGENT	2
 
 #define MILLI_2_NANO_SECONDS 1000000ULL
 
@@ -269,6 +273,8 @@ struct corosync_api_v1 {
 
 	void (*ipc_refcnt_dec) (void *conn);
 
+	int (*ipc_dispatch_batch_set) (void *conn, int32_t batch_id, uint32_t max_size);
+
 	/*
 	 * Totem APIs
 	 */
@@ -467,6 +473,11 @@ struct corosync_api_v1 {
 struct corosync_lib_handler {
 	void (*lib_handler_fn) (void *conn, const void *msg);
 	enum cs_lib_flow_control flow_control;
+	/*
+	 * Called instead of lib_handler_fn when an asynchronous request is
+	 * refused, with the error the library would have been sent
+	 */
+	void (*lib_refused_fn) (void *conn, const void *msg, int error);
 };
 
 /**
@@ -521,6 +532,9 @@ struct corosync_service_engine {
 	int (*sync_process) (void);
 	void (*sync_activate) (void);
 	void (*sync_abort) (void);
+	int sync_independent; /* Sync neither needs nor affects the state other
+			       * services sync, so it may run together with them
+			       */
 };
 
 #endif /* COROAPI_H_DEFINED */
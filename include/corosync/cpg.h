@@ -192,6 +192,7 @@ typedef struct {
 } cpg_model_data_t;
 
 #define CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF 0x01
+#define CPG_MODEL_V1_LOW_LATENCY 0x02
 
 /**
  * @brief The cpg_model_v1_data_t struct
@@ -317,6 +318,11 @@ cs_error_t cpg_leave (
 	cpg_handle_t handle,
 	const struct cpg_name *group);
 
+/**
+ * @brief Default number of cpg_mcast_joined_async messages in flight
+ */
+#define CPG_MCAST_WINDOW_DEFAULT 128
+
 /**
  * @brief Multicast to groups joined with cpg_join.
  *
@@ -332,6 +338,85 @@ cs_error_t cpg_mcast_joined (
 	const struct iovec *iovec,
 	unsigned int iov_len);
 
+/**
+ * @brief Multicast to groups joined with cpg_join without waiting for corosync.
+ *
+ * The message is handed to corosync and the call returns at once. Large
+ * messages are sent as fragments without waiting for each of them.
+ * Completions are reported in batches on the file descriptor returned by
+ * cpg_fd_get and are processed by cpg_dispatch. They do not call any callback.
+ *
+ * When the number of multicasts not completed yet reaches the window set by
+ * cpg_mcast_window_set, CS_ERR_TRY_AGAIN is returned. Poll the dispatch file
+ * descriptor, call cpg_dispatch and try again. CS_ERR_TRY_AGAIN with nothing
+ * in flight means corosync itself is applying flow control.
+ *
+ * @param handle
+ * @param guarantee
+ * @param iovec This iovec will be multicasted to all groups joined with
+ *              the cpg_join interface for handle. It may be reused as soon
+ *              as the call returns.
+ * @param iov_len
+ */
+cs_error_t cpg_mcast_joined_async (
+	cpg_handle_t handle,
+	cpg_guarantee_t guarantee,
+	const struct iovec *iovec,
+	unsigned int iov_len);
+
+/**
+ * @brief Multicast several independent messages to groups joined with cpg_join.
+ *
+ * Each element of msgs is one message. They are delivered exactly as if
+ * each had been passed to cpg_mcast_joined in turn, but they reach
+ * corosync in as few requests as possible and are packed densely on the
+ * wire. This pays off for bursts of small messages.
+ *
+ * On CS_ERR_TRY_AGAIN the first *sent messages were accepted and the call
+ * should be repeated with the rest.
+ *
+ * @param handle
+ * @param guarantee
+ * @param msgs array of msg_count messages
+ * @param msg_count
+ * @param sent number of messages accepted. May be NULL.
+ */
+cs_error_t cpg_mcast_joined_batch (
+	cpg_handle_t handle,
+	cpg_guarantee_t guarantee,
+	const struct iovec *msgs,
+	unsigned int msg_count,
+	unsigned int *sent);
+
+/**
+ * @brief Set how many cpg_mcast_joined_async messages may be in flight.
+ *
+ * The default is CPG_MCAST_WINDOW_DEFAULT.
+ *
+ * @param handle
+ * @param window at least 1
+ */
+cs_error_t cpg_mcast_window_set (
+	cpg_handle_t handle,
+	uint32_t window);
+
+/**
+ * @brief Get the state of cpg_mcast_joined_async messages.
+ *
+ * Also sends the rest of a fragmented message which was cut short by
+ * flow control, so it is worth calling periodically while waiting for
+ * in_flight to drop to 0.
+ *
+ * @param handle
+ * @param in_flight number of messages sent but not completed yet
+ * @param failed number of messages corosync refused so far (for example
+ *               because the process is not joined). May be NULL.
+ */
+cs_error_t cpg_mcast_async_state_get (
+	cpg_handle_t handle,
+	uint32_t *in_flight,
+	uint64_t *failed);
+
 /**
  * @brief Get membership information from cpg
  * @param handle
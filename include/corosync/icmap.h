@@ -117,6 +117,20 @@ typedef void (*icmap_notify_fn_t) (
  */
 typedef struct icmap_map *icmap_map_t;
 
+/**
+ * @brief Memory allocation of icmap items.
+ *
+ * ICMAP_ALLOC_MALLOC allocates every item and key with malloc.
+ * ICMAP_ALLOC_ARENA carves small items and keys out of larger chunks
+ * owned by the map and reuses freed ones, which saves allocator calls
+ * and keeps items packed together. corosync uses it for the global map
+ * if COROSYNC_ICMAP_ALLOC=arena is set in its environment.
+ */
+typedef enum {
+	ICMAP_ALLOC_MALLOC = 0,
+	ICMAP_ALLOC_ARENA = 1,
+} icmap_alloc_t;
+
 /**
  * @brief Itterator type
  */
@@ -127,12 +141,24 @@ typedef qb_map_iter_t *icmap_iter_t;
  */
 typedef struct icmap_track *icmap_track_t;
 
+/**
+ * @brief Counter type
+ */
+typedef struct icmap_counter *icmap_counter_t;
+
 /**
  * @brief Initialize global icmap
  * @return
  */
 extern cs_error_t icmap_init(void);
 
+/**
+ * @brief Initialize global icmap with given item allocation
+ * @param alloc
+ * @return
+ */
+extern cs_error_t icmap_init_alloc(icmap_alloc_t alloc);
+
 /**
  * @brief Initialize additional (local, reentrant) icmap_map. Content of variable
  * result is undefined if return code is not CS_OK.
@@ -141,6 +167,15 @@ extern cs_error_t icmap_init(void);
  */
 extern cs_error_t icmap_init_r(icmap_map_t *result);
 
+/**
+ * @brief Initialize additional (local, reentrant) icmap_map with given
+ * item allocation. icmap_init and icmap_init_r use ICMAP_ALLOC_MALLOC.
+ * @param result
+ * @param alloc
+ * @return
+ */
+extern cs_error_t icmap_init_alloc_r(icmap_map_t *result, icmap_alloc_t alloc);
+
 /**
  * @brief Finalize global icmap
  */
@@ -440,6 +475,44 @@ extern cs_error_t icmap_fast_dec(const char *key_name);
  */
 extern cs_error_t icmap_fast_dec_r(const icmap_map_t map, const char *key_name);
 
+/**
+ * @brief Get counter handle for [u]int* key in global map.
+ *
+ * Key is looked up only once, so adjusting value with counter handle
+ * costs no lookup. Tracking callbacks are called in same way as with
+ * icmap_fast_adjust_int. Handle stays valid when key is changed or
+ * deleted, adjusting deleted key returns CS_ERR_NOT_EXIST.
+ *
+ * @param key_name
+ * @param counter
+ * @return
+ */
+extern cs_error_t icmap_counter_get(const char *key_name, icmap_counter_t *counter);
+
+/**
+ * @brief Add step to value of counter.
+ *
+ * Same as icmap_fast_adjust_int, but without key lookup.
+ *
+ * @param counter
+ * @param step
+ * @return
+ */
+extern cs_error_t icmap_counter_adjust(icmap_counter_t counter, int32_t step);
+
+/**
+ * @brief Increase value of counter by one
+ * @param counter
+ * @return
+ */
+extern cs_error_t icmap_counter_inc(icmap_counter_t counter);
+
+/**
+ * @brief Release counter handle returned by icmap_counter_get
+ * @param counter
+ */
+extern void icmap_counter_release(icmap_counter_t counter);
+
 /**
  * @brief Initialize iterator with given prefix
  * @param prefix
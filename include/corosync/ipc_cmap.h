@@ -53,6 +53,7 @@ enum req_cmap_types {
 	MESSAGE_REQ_CMAP_TRACK_ADD = 7,
 	MESSAGE_REQ_CMAP_TRACK_DELETE = 8,
 	MESSAGE_REQ_CMAP_SET_CURRENT_MAP = 9,
+	MESSAGE_REQ_CMAP_ITER_BULK = 10,
 };
 
 /**
@@ -70,6 +71,8 @@ enum res_cmap_types {
 	MESSAGE_RES_CMAP_TRACK_DELETE = 8,
 	MESSAGE_RES_CMAP_NOTIFY_CALLBACK = 9,
 	MESSAGE_RES_CMAP_SET_CURRENT_MAP = 10,
+	MESSAGE_RES_CMAP_ITER_BULK = 11,
+	MESSAGE_RES_CMAP_NOTIFY_BATCH_CALLBACK = 12,
 };
 
 enum {
@@ -179,6 +182,28 @@ struct res_lib_cmap_iter_next {
 	mar_uint8_t type __attribute__((aligned(8)));
 };
 
+/**
+ * @brief The req_lib_cmap_iter_bulk struct
+ */
+struct req_lib_cmap_iter_bulk {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+	mar_uint64_t iter_handle __attribute__((aligned(8)));
+	mar_size_t max_len __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The res_lib_cmap_iter_bulk struct
+ */
+struct res_lib_cmap_iter_bulk {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_uint64_t items __attribute__((aligned(8)));
+	mar_size_t items_len __attribute__((aligned(8)));
+	/*
+	 * items_len bytes of struct cmap_bulk_item records
+	 */
+	mar_uint8_t items_data[] __attribute__((aligned(8)));
+};
+
 /**
  * @brief The req_lib_cmap_iter_finalize struct
  */
@@ -202,6 +227,10 @@ struct req_lib_cmap_track_add {
 	mar_name_t key_name __attribute__((aligned(8)));
 	mar_int32_t track_type __attribute__((aligned(8)));
 	mar_uint64_t track_inst_handle __attribute__((aligned(8)));
+	/*
+	 * Added later, older libraries send request without it
+	 */
+	mar_uint32_t coalesce_window __attribute__((aligned(8)));
 };
 
 /**
@@ -250,6 +279,46 @@ struct res_lib_cmap_notify_callback {
 	mar_uint8_t new_value[];
 };
 
+/**
+ * @brief One change of res_lib_cmap_notify_batch_callback.
+ *
+ * Followed by key_name (zero terminated), new value and old value, each
+ * padded to CMAP_NOTIFY_BATCH_ALIGN
+ */
+struct cmap_notify_batch_item {
+	mar_uint32_t item_len;
+	mar_int32_t event;
+	mar_uint32_t key_len;
+	mar_uint8_t new_value_type;
+	mar_uint8_t old_value_type;
+	mar_uint16_t reserved;
+	mar_uint64_t new_value_len;
+	mar_uint64_t old_value_len;
+	char key_name[];
+};
+
+#define CMAP_NOTIFY_BATCH_ALIGN(len)	(((len) + 7) & ~((size_t)7))
+
+#define CMAP_NOTIFY_BATCH_ITEM_LEN(key_len, new_value_len, old_value_len) \
+	(sizeof(struct cmap_notify_batch_item) + CMAP_NOTIFY_BATCH_ALIGN((key_len) + 1) + \
+	 CMAP_NOTIFY_BATCH_ALIGN(new_value_len) + CMAP_NOTIFY_BATCH_ALIGN(old_value_len))
+
+/**
+ * @brief The res_lib_cmap_notify_batch_callback struct
+ *
+ * Changes of keys of coalescing track collected during its window
+ */
+struct res_lib_cmap_notify_batch_callback {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_uint64_t track_inst_handle __attribute__((aligned(8)));
+	mar_uint64_t items __attribute__((aligned(8)));
+	mar_size_t items_len __attribute__((aligned(8)));
+	/*
+	 * items_len bytes of struct cmap_notify_batch_item records
+	 */
+	mar_uint8_t items_data[] __attribute__((aligned(8)));
+};
+
 /**
  * @brief The req_lib_cmap_set_current_map struct
  * used by cmap_initialize_map()
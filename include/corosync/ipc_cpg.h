@@ -59,6 +59,10 @@ enum req_cpg_types {
 	MESSAGE_REQ_CPG_ZC_FREE = 10,
 	MESSAGE_REQ_CPG_ZC_EXECUTE = 11,
 	MESSAGE_REQ_CPG_PARTIAL_MCAST = 12,
+	MESSAGE_REQ_CPG_MCAST_ASYNC = 13,
+	MESSAGE_REQ_CPG_PARTIAL_MCAST_ASYNC = 14,
+	MESSAGE_REQ_CPG_MCAST_BATCH = 15,
+	MESSAGE_REQ_CPG_EVENT_BATCH_ENABLE = 16,
 };
 
 /**
@@ -84,6 +88,10 @@ enum res_cpg_types {
 	MESSAGE_RES_CPG_ZC_EXECUTE = 16,
 	MESSAGE_RES_CPG_PARTIAL_DELIVER_CALLBACK = 17,
 	MESSAGE_RES_CPG_PARTIAL_SEND = 18,
+	MESSAGE_RES_CPG_MCAST_ASYNC_ACK = 19,
+	MESSAGE_RES_CPG_MCAST_BATCH = 20,
+	MESSAGE_RES_CPG_EVENT_BATCH_ENABLE = 21,
+	MESSAGE_RES_CPG_EVENT_BATCH = 22,
 };
 
 /**
@@ -298,6 +306,18 @@ struct res_lib_cpg_partial_send {
 	struct qb_ipc_response_header header __attribute__((aligned(8)));
 };
 
+/**
+ * @brief The res_lib_cpg_mcast_async_ack struct
+ *
+ * Sent on the dispatch channel for a batch of asynchronous multicasts.
+ * completed counts all of them, failed the ones which were refused.
+ */
+struct res_lib_cpg_mcast_async_ack {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_uint32_t completed __attribute__((aligned(8)));
+	mar_uint32_t failed __attribute__((aligned(8)));
+};
+
 /**
  * @brief The req_lib_cpg_mcast struct
  */
@@ -320,6 +340,73 @@ struct req_lib_cpg_partial_mcast {
 	mar_uint8_t message[] __attribute__((aligned(8)));
 };
 
+/**
+ * @brief The req_lib_cpg_mcast_batch struct
+ *
+ * Carries count independent messages. Each one is a
+ * req_lib_cpg_mcast_batch_item followed by msglen bytes of data, padded
+ * to CPG_MCAST_BATCH_ALIGN.
+ */
+struct req_lib_cpg_mcast_batch {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_uint32_t guarantee __attribute__((aligned(8)));
+	mar_uint32_t count __attribute__((aligned(8)));
+	mar_uint8_t messages[] __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The req_lib_cpg_mcast_batch_item struct
+ */
+struct req_lib_cpg_mcast_batch_item {
+	mar_uint32_t msglen __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The res_lib_cpg_mcast_batch struct
+ *
+ * sent is the number of messages of the batch handed to totem, counted
+ * from the first one.
+ */
+struct res_lib_cpg_mcast_batch {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_uint32_t sent __attribute__((aligned(8)));
+};
+
+#define CPG_MCAST_BATCH_ALIGN		8
+#define CPG_MCAST_BATCH_ITEM_SIZE(msglen) \
+	(sizeof (struct req_lib_cpg_mcast_batch_item) + \
+	(((msglen) + CPG_MCAST_BATCH_ALIGN - 1) & ~(CPG_MCAST_BATCH_ALIGN - 1)))
+
+/**
+ * @brief The req_lib_cpg_event_batch_enable struct
+ *
+ * Lets corosync pack events queued for this connection into one
+ * MESSAGE_RES_CPG_EVENT_BATCH event of at most max_size bytes.
+ */
+struct req_lib_cpg_event_batch_enable {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+	mar_uint32_t max_size __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The res_lib_cpg_event_batch_enable struct
+ */
+struct res_lib_cpg_event_batch_enable {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+};
+
+/**
+ * @brief The res_lib_cpg_event_batch struct
+ *
+ * Followed by complete events up to header.size, each padded to
+ * CPG_EVENT_BATCH_ALIGN.
+ */
+struct res_lib_cpg_event_batch {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+};
+
+#define CPG_EVENT_BATCH_ALIGN		8
+
 /**
  * @brief The res_lib_cpg_mcast struct
  */
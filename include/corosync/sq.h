@@ -36,6 +36,16 @@
 
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
+
+/**
+ * Occupancy of the queue positions is kept in a bitmap so runs of
+ * received or missing messages can be found a word at a time.
+ */
+#define SQ_BITS_PER_WORD (sizeof (unsigned long) * CHAR_BIT)
+
+#define SQ_BITMAP_WORDS(items) \
+	(((items) + SQ_BITS_PER_WORD - 1) / SQ_BITS_PER_WORD)
 
 /**
  * @brief The sq struct
@@ -44,7 +54,7 @@ struct sq {
 	unsigned int head;
 	unsigned int size;
 	void *items;
-	unsigned int *items_inuse;
+	unsigned long *items_inuse;
 	unsigned int *items_miss_count;
 	unsigned int size_per_item;
 	unsigned int head_seqid;
@@ -107,6 +117,72 @@ static inline int sq_lte_compare (unsigned int a, unsigned int b) {
 	return (0);
 }
 
+static inline int sq_bit_test (const unsigned long *map, unsigned int pos)
+{
+	return ((map[pos / SQ_BITS_PER_WORD] >>
+		(pos % SQ_BITS_PER_WORD)) & 1UL);
+}
+
+static inline void sq_bit_set (unsigned long *map, unsigned int pos)
+{
+	map[pos / SQ_BITS_PER_WORD] |= 1UL << (pos % SQ_BITS_PER_WORD);
+}
+
+/**
+ * Clear len bits starting at pos, without wrapping
+ */
+static inline void sq_bits_clear (unsigned long *map, unsigned int pos,
+	unsigned int len)
+{
+	unsigned int bit;
+	unsigned int word_len;
+	unsigned long mask;
+
+	while (len > 0) {
+		bit = pos % SQ_BITS_PER_WORD;
+		word_len = SQ_BITS_PER_WORD - bit;
+		if (word_len > len) {
+			word_len = len;
+		}
+		if (word_len == SQ_BITS_PER_WORD) {
+			mask = ~0UL;
+		} else {
+			mask = ((1UL << word_len) - 1) << bit;
+		}
+		map[pos / SQ_BITS_PER_WORD] &= ~mask;
+		pos += word_len;
+		len -= word_len;
+	}
+}
+
+/**
+ * Return the offset from pos of the first bit within len bits (without
+ * wrapping) which is set (want_set = 1) or clear (want_set = 0), or len
+ * if there is none.
+ */
+static inline unsigned int sq_bits_scan (const unsigned long *map,
+	unsigned int pos, unsigned int len, int want_set)
+{
+	unsigned int offset = 0;
+	unsigned int bit;
+	unsigned long word;
+
+	while (offset < len) {
+		bit = (pos + offset) % SQ_BITS_PER_WORD;
+		word = map[(pos + offset) / SQ_BITS_PER_WORD];
+		if (want_set == 0) {
+			word = ~word;
+		}
+		word >>= bit;
+		if (word != 0) {
+			offset += __builtin_ctzl (word);
+			return (offset < len ? offset : len);
+		}
+		offset += SQ_BITS_PER_WORD - bit;
+	}
+	return (len);
+}
+
 /**
  * @brief sq_init
  * @param sq
@@ -134,15 +210,15 @@ static inline int sq_init (
 	}
 	memset (sq->items, 0, item_count * size_per_item);
 
-	if ((sq->items_inuse = malloc (item_count * sizeof (unsigned int)))
-	    == NULL) {
+	if ((sq->items_inuse = malloc (SQ_BITMAP_WORDS (item_count) *
+	    sizeof (unsigned long))) == NULL) {
 		return (-ENOMEM);
 	}
 	if ((sq->items_miss_count = malloc (item_count * sizeof (unsigned int)))
 	    == NULL) {
 		return (-ENOMEM);
 	}
-	memset (sq->items_inuse, 0, item_count * sizeof (unsigned int));
+	memset (sq->items_inuse, 0, SQ_BITMAP_WORDS (item_count) * sizeof (unsigned long));
 	memset (sq->items_miss_count, 0, item_count * sizeof (unsigned int));
 	return (0);
 }
@@ -159,7 +235,7 @@ static inline void sq_reinit (struct sq *sq, unsigned int head_seqid)
 	sq->pos_max = 0;
 
 	memset (sq->items, 0, sq->item_count * sq->size_per_item);
-	memset (sq->items_inuse, 0, sq->item_count * sizeof (unsigned int));
+	memset (sq->items_inuse, 0, SQ_BITMAP_WORDS (sq->item_count) * sizeof (unsigned long));
 	memset (sq->items_miss_count, 0, sq->item_count * sizeof (unsigned int));
 }
 
@@ -175,7 +251,7 @@ static inline void sq_assert (const struct sq *sq, unsigned int pos)
 //	printf ("Instrument[%d] Asserting from %d to %d\n",
 //		pos, sq->pos_max, sq->size);
 	for (i = sq->pos_max + 1; i < sq->size; i++) {
-		assert (sq->items_inuse[i] == 0);
+		assert (sq_bit_test (sq->items_inuse, i) == 0);
 	}
 }
 
@@ -196,7 +272,7 @@ static inline void sq_copy (struct sq *sq_dest, const struct sq *sq_src)
 	memcpy (sq_dest->items, sq_src->items,
 		sq_src->item_count * sq_src->size_per_item);
 	memcpy (sq_dest->items_inuse, sq_src->items_inuse,
-		sq_src->item_count * sizeof (unsigned int));
+		SQ_BITMAP_WORDS (sq_src->item_count) * sizeof (unsigned long));
 	memcpy (sq_dest->items_miss_count, sq_src->items_miss_count,
 		sq_src->item_count * sizeof (unsigned int));
 }
@@ -233,13 +309,9 @@ static inline void *sq_item_add (
 
 	sq_item = sq->items;
 	sq_item += sq_position * sq->size_per_item;
-	assert(sq->items_inuse[sq_position] == 0);
+	assert(sq_bit_test (sq->items_inuse, sq_position) == 0);
 	memcpy (sq_item, item, sq->size_per_item);
-	if (seqid == 0) {
-		sq->items_inuse[sq_position] = 1;
-	} else {
-		sq->items_inuse[sq_position] = seqid;
-	}
+	sq_bit_set (sq->items_inuse, sq_position);
 	sq->items_miss_count[sq_position] = 0;
 
 	return (sq_item);
@@ -270,7 +342,49 @@ static inline unsigned int sq_item_inuse (
 	}
 #endif
 	sq_position = (sq->head - sq->head_seqid + seq_id) % sq->size;
-	return (sq->items_inuse[sq_position] != 0);
+	return (sq_bit_test (sq->items_inuse, sq_position));
+}
+
+/**
+ * @brief Count consecutive items in use starting at seq_id
+ * @param sq
+ * @param seq_id first sequence number to check
+ * @param count maximum number of sequence numbers to check
+ * @return number of items in use before the first hole, the end of the
+ *	queue or count, whichever comes first
+ */
+static inline unsigned int sq_items_inuse_run (
+	const struct sq *sq,
+	unsigned int seq_id,
+	unsigned int count)
+{
+	unsigned int offset;
+	unsigned int sq_position;
+	unsigned int len;
+	unsigned int run;
+
+	offset = seq_id - sq->head_seqid;
+	if (offset >= sq->size) {
+		return (0);
+	}
+	if (count > sq->size - offset) {
+		count = sq->size - offset;
+	}
+
+	sq_position = (sq->head + offset) % sq->size;
+	len = sq->size - sq_position;
+	if (len > count) {
+		len = count;
+	}
+
+	run = sq_bits_scan (sq->items_inuse, sq_position, len, 0);
+	if (run == len && len < count) {
+		/*
+		 * Continue after wrapping to the start of the queue
+		 */
+		run += sq_bits_scan (sq->items_inuse, 0, count - len, 0);
+	}
+	return (run);
 }
 
 /**
@@ -365,7 +479,7 @@ static inline unsigned int sq_item_get (
 //	sq_position = (sq->head - sq->head_seqid + seq_id) % sq->size;
 //printf ("sq_position = %x\n", sq_position);
 //printf ("ITEMGET %d %d %d %d\n", sq_position, sq->head, sq->head_seqid, seq_id);
-	if (sq->items_inuse[sq_position] == 0) {
+	if (sq_bit_test (sq->items_inuse, sq_position) == 0) {
 		return (ENOENT);
 	}
 	sq_item = sq->items;
@@ -389,12 +503,15 @@ static inline void sq_items_release (struct sq *sq, unsigned int seqid)
 	if ((oldhead + seqid - sq->head_seqid + 1) > sq->size) {
 //		printf ("releasing %d for %d\n", oldhead, sq->size - oldhead);
 //		printf ("releasing %d for %d\n", 0, sq->head);
-		memset (&sq->items_inuse[oldhead], 0, (sq->size - oldhead) * sizeof (unsigned int));
-		memset (sq->items_inuse, 0, sq->head * sizeof (unsigned int));
+		sq_bits_clear (sq->items_inuse, oldhead, sq->size - oldhead);
+		sq_bits_clear (sq->items_inuse, 0, sq->head);
+		memset (&sq->items_miss_count[oldhead], 0,
+			(sq->size - oldhead) * sizeof (unsigned int));
+		memset (sq->items_miss_count, 0, sq->head * sizeof (unsigned int));
 	} else {
 //		printf ("releasing %d for %d\n", oldhead, seqid - sq->head_seqid + 1);
-		memset (&sq->items_inuse[oldhead], 0,
-			(seqid - sq->head_seqid + 1) * sizeof (unsigned int));
+		sq_bits_clear (sq->items_inuse, oldhead,
+			seqid - sq->head_seqid + 1);
 		memset (&sq->items_miss_count[oldhead], 0,
 			(seqid - sq->head_seqid + 1) * sizeof (unsigned int));
 	}
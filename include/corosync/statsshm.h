@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef COROSYNC_STATSSHM_H_DEFINED
+#define COROSYNC_STATSSHM_H_DEFINED
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @addtogroup cmap_corosync
+ *
+ * @{
+ */
+
+/*
+ * Layout of the read-only statistics snapshot corosync publishes when
+ * system.stats_shm is enabled.  The file holds a header followed by
+ * header->entries fixed-size entries, one per stats.* key, in key order.
+ *
+ * The header seq field is a sequence lock.  It is odd while corosync
+ * rewrites the snapshot.  Readers copy what they need and retry when
+ * seq was odd or changed in the meantime.  When size grows past the
+ * length a reader has mapped, the reader has to map the file again.
+ * A snapshot that stays odd means corosync died while updating it.
+ */
+#define CS_STATS_SHM_PATH		"/dev/shm/corosync-stats"
+
+#define CS_STATS_SHM_MAGIC		0x53545343	/* "CSTS" */
+#define CS_STATS_SHM_VERSION		1
+
+#define CS_STATS_SHM_KEYNAME_LEN	256
+#define CS_STATS_SHM_VALUE_LEN		32
+
+/*
+ * Entry flags
+ */
+#define CS_STATS_SHM_VALUE_TRUNCATED	0x00000001
+
+struct cs_stats_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq;
+	uint32_t entries;
+	uint64_t size;
+	/*
+	 * Incremented whenever keys are added or removed
+	 */
+	uint64_t generation;
+	/*
+	 * Wall clock time of the last refresh in nanoseconds
+	 */
+	uint64_t timestamp;
+	uint32_t entry_size;
+	uint32_t reserved;
+};
+
+struct cs_stats_shm_entry {
+	char key_name[CS_STATS_SHM_KEYNAME_LEN];
+	/*
+	 * cmap_value_types_t of value
+	 */
+	uint32_t type;
+	/*
+	 * 0 when the value could not be read during the last refresh
+	 */
+	uint32_t value_len;
+	/*
+	 * CS_STATS_SHM_VALUE_TRUNCATED when a string was longer than
+	 * CS_STATS_SHM_VALUE_LEN - 1 characters and only its beginning is in
+	 * value.  The string is always NUL terminated.
+	 */
+	uint32_t flags;
+	uint32_t reserved;
+	union {
+		uint64_t align;
+		char data[CS_STATS_SHM_VALUE_LEN];
+	} value;
+};
+
+#define CS_STATS_SHM_ENTRY(header, n) \
+	((struct cs_stats_shm_entry *)((char *)(header) + \
+	    sizeof(struct cs_stats_shm_header) + (size_t)(n) * (header)->entry_size))
+
+/**
+ * @brief Start reading the snapshot
+ * @return sequence number to pass to cs_stats_shm_read_retry
+ */
+static inline uint32_t cs_stats_shm_read_begin(const struct cs_stats_shm_header *header)
+{
+
+	return (__atomic_load_n(&header->seq, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * @brief Check whether data copied since cs_stats_shm_read_begin is consistent
+ * @return non zero when the copy has to be discarded and read again
+ */
+static inline int cs_stats_shm_read_retry(const struct cs_stats_shm_header *header, uint32_t seq)
+{
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return ((seq & 1) || __atomic_load_n(&header->seq, __ATOMIC_RELAXED) != seq);
+}
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COROSYNC_STATSSHM_H_DEFINED */
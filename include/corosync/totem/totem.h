@@ -61,6 +61,20 @@
  */
 #define UDP_RECEIVE_FRAME_SIZE_MAX     (PROCESSOR_COUNT_MAX * (INTERFACE_MAX * 2 * sizeof(struct totem_ip_address)) + 1024)
 
+/*
+ * Maximum number of datagrams totemudp and totemudpu receive in one batch
+ */
+#define UDP_RECV_BATCH_MAX	64
+
+/*
+ * Bytes totemudp and totemudpu receive into a totemnet buffer of
+ * FRAME_SIZE_MAX bytes.  No UDP datagram is that large, so the extra byte
+ * used to detect truncation is only needed when UDP_RECEIVE_FRAME_SIZE_MAX
+ * is the smaller of the two.
+ */
+#define UDP_RECEIVE_BUFFER_LEN	(UDP_RECEIVE_FRAME_SIZE_MAX + 1 < FRAME_SIZE_MAX ? \
+	UDP_RECEIVE_FRAME_SIZE_MAX + 1 : FRAME_SIZE_MAX)
+
 #define TRANSMITS_ALLOWED	16
 #define SEND_THREADS_MAX	16
 
@@ -249,6 +263,16 @@ struct totem_config {
 
 	unsigned char ip_dscp;
 
+	unsigned int recv_batch;
+
+	unsigned int knet_direct_send;
+
+	unsigned int knet_recv_thread;
+
+	unsigned int pack_max_delay;
+
+	unsigned int pack_flush_size;
+
 	void (*totem_memb_ring_id_create_or_load) (
 	    struct memb_ring_id *memb_ring_id,
 	    unsigned int nodeid);
@@ -59,6 +59,10 @@ struct totempg_group {
 
 #define TOTEMPG_AGREED			0
 #define TOTEMPG_SAFE			1
+/*
+ * May be OR'ed into the guarantee to skip the packing delay
+ */
+#define TOTEMPG_URGENT			2
 
 /**
  * Initialize the totem process groups abstraction
@@ -34,6 +34,8 @@
 #ifndef TOTEMSTATS_H_DEFINED
 #define TOTEMSTATS_H_DEFINED
 
+#include <stdint.h>
+
 typedef struct {
 	int is_dirty;
 	time_t last_updated;
@@ -50,6 +52,91 @@ typedef struct {
 	int backlog_calc;
 } totemsrp_token_stats_t;
 
+/*
+ * Log bucketed histogram. Values below 8 have a bucket of their own, above
+ * that every power of two is split into 8 buckets, so percentiles are off
+ * by at most 12.5%.
+ */
+#define TOTEM_HIST_SUB_BITS 3
+#define TOTEM_HIST_SUB (1 << TOTEM_HIST_SUB_BITS)
+#define TOTEM_HIST_BUCKETS ((32 - TOTEM_HIST_SUB_BITS + 1) * TOTEM_HIST_SUB)
+
+typedef struct {
+	uint64_t count;
+	uint32_t max;
+	uint64_t buckets[TOTEM_HIST_BUCKETS];
+} totem_hist_t;
+
+static inline unsigned int totem_hist_bucket (uint32_t value)
+{
+	unsigned int msb;
+
+	if (value < TOTEM_HIST_SUB) {
+		return (value);
+	}
+	msb = 31 - __builtin_clz (value);
+
+	return ((msb - TOTEM_HIST_SUB_BITS + 1) * TOTEM_HIST_SUB +
+	    ((value >> (msb - TOTEM_HIST_SUB_BITS)) & (TOTEM_HIST_SUB - 1)));
+}
+
+/*
+ * Highest value counted in a bucket
+ */
+static inline uint32_t totem_hist_bucket_high (unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < TOTEM_HIST_SUB) {
+		return (bucket);
+	}
+	shift = bucket / TOTEM_HIST_SUB - 1;
+
+	return ((((uint64_t)(TOTEM_HIST_SUB + bucket % TOTEM_HIST_SUB) + 1) << shift) - 1);
+}
+
+static inline void totem_hist_add (totem_hist_t *hist, uint64_t value)
+{
+	uint32_t v;
+
+	v = (value > UINT32_MAX) ? UINT32_MAX : (uint32_t)value;
+
+	hist->buckets[totem_hist_bucket (v)]++;
+	hist->count++;
+	if (v > hist->max) {
+		hist->max = v;
+	}
+}
+
+/*
+ * Value below which permyriad / 10000 of the recorded values are
+ */
+static inline uint32_t totem_hist_percentile (const totem_hist_t *hist, unsigned int permyriad)
+{
+	uint64_t rank;
+	uint64_t seen = 0;
+	uint32_t high;
+	unsigned int i;
+
+	if (hist->count == 0) {
+		return (0);
+	}
+	rank = (hist->count * permyriad + 9999) / 10000;
+	if (rank == 0) {
+		rank = 1;
+	}
+
+	for (i = 0; i < TOTEM_HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank) {
+			high = totem_hist_bucket_high (i);
+			return (high < hist->max ? high : hist->max);
+		}
+	}
+
+	return (hist->max);
+}
+
 typedef struct {
 	totem_stats_header_t hdr;
 	uint64_t orf_token_tx;
@@ -84,6 +171,24 @@ typedef struct {
 	uint32_t avg_token_workload;
 	uint32_t avg_backlog_calc;
 
+	uint32_t rx_batch_size;
+	uint32_t rx_batch_max;
+	uint64_t rx_batches;
+	uint64_t rx_batch_msgs;
+	uint64_t rx_thread_frames;
+	uint64_t rx_thread_handoffs;
+	uint64_t rx_thread_queue_full;
+	uint64_t rx_thread_discarded;
+
+	/*
+	 * Times are in microseconds
+	 */
+	totem_hist_t token_hold_hist;
+	totem_hist_t token_rotation_hist;
+	totem_hist_t token_mcast_hist;
+	totem_hist_t token_rtr_hist;
+	totem_hist_t deliver_hist;
+
 	int earliest_token;
 	int latest_token;
 #define TOTEM_TOKEN_STATS_MAX 100
@@ -91,11 +196,20 @@ typedef struct {
 
 } totemsrp_stats_t;
 
+/*
+ * Frames by number of packed messages: 1, 2-3, 4-7, ... 64 and more
+ */
+#define TOTEMPG_PACKED_HIST_MAX 7
+
 typedef struct {
 	totem_stats_header_t hdr;
 	totemsrp_stats_t *srp;
 	uint32_t msg_reserved;
 	uint32_t msg_queue_avail;
+	uint64_t packed_hist[TOTEMPG_PACKED_HIST_MAX];
+	uint64_t pack_urgent_flush;
+	uint64_t pack_size_flush;
+	uint64_t pack_delayed;
 } totempg_stats_t;
 
 
@@ -114,6 +228,7 @@ void stats_knet_add_handle(void);
 
 #define TOTEMPG_STATS_CLEAR_TOTEM     1
 #define TOTEMPG_STATS_CLEAR_TRANSPORT 2
+#define TOTEMPG_STATS_CLEAR_HIST      4
 
 extern void totempg_stats_clear (int flags);
 
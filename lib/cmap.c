@@ -237,9 +237,13 @@ cs_error_t cmap_dispatch (
 	struct qb_ipc_response_header *dispatch_data;
 	char dispatch_buf[IPC_DISPATCH_SIZE];
 	struct res_lib_cmap_notify_callback *res_lib_cmap_notify_callback;
+	struct res_lib_cmap_notify_batch_callback *res_lib_cmap_notify_batch_callback;
+	const struct cmap_notify_batch_item *item;
 	struct cmap_track_inst *cmap_track_inst;
 	struct cmap_notify_value old_val;
 	struct cmap_notify_value new_val;
+	size_t items_offset;
+	uint64_t i;
 
 	error = hdb_error_to_cs(hdb_handle_get (&cmap_handle_t_db, handle, (void *)&cmap_inst));
 	if (error != CS_OK) {
@@ -322,6 +326,62 @@ cs_error_t cmap_dispatch (
 
 			(void)hdb_handle_put(&cmap_track_handle_t_db, res_lib_cmap_notify_callback->track_inst_handle);
 			break;
+		case MESSAGE_RES_CMAP_NOTIFY_BATCH_CALLBACK:
+			res_lib_cmap_notify_batch_callback = (struct res_lib_cmap_notify_batch_callback *)dispatch_data;
+
+			error = hdb_error_to_cs(hdb_handle_get(&cmap_track_handle_t_db,
+					res_lib_cmap_notify_batch_callback->track_inst_handle,
+					(void *)&cmap_track_inst));
+			if (error == CS_ERR_BAD_HANDLE) {
+				/*
+				 * User deleted tracker -> ignore error
+				 */
+				 break;
+			}
+			if (error != CS_OK) {
+				goto error_put;
+			}
+
+			/*
+			 * Deliver changes one by one, so notify_fn doesn't need to know
+			 * about coalescing
+			 */
+			items_offset = 0;
+			for (i = 0; i < res_lib_cmap_notify_batch_callback->items; i++) {
+				if (items_offset + sizeof(*item) > res_lib_cmap_notify_batch_callback->items_len) {
+					break;
+				}
+				item = (const struct cmap_notify_batch_item *)
+				    (res_lib_cmap_notify_batch_callback->items_data + items_offset);
+				if (item->item_len < sizeof(*item) ||
+				    items_offset + item->item_len > res_lib_cmap_notify_batch_callback->items_len) {
+					break;
+				}
+
+				new_val.type = item->new_value_type;
+				old_val.type = item->old_value_type;
+				new_val.len = item->new_value_len;
+				old_val.len = item->old_value_len;
+				new_val.data = item->key_name + CMAP_NOTIFY_BATCH_ALIGN(item->key_len + 1);
+				old_val.data = ((const char *)new_val.data) + CMAP_NOTIFY_BATCH_ALIGN(new_val.len);
+
+				cmap_track_inst->notify_fn(handle,
+						cmap_track_inst->track_handle,
+						item->event,
+						item->key_name,
+						new_val,
+						old_val,
+						cmap_track_inst->user_data);
+
+				if (cmap_inst->finalize) {
+					break;
+				}
+
+				items_offset += item->item_len;
+			}
+
+			(void)hdb_handle_put(&cmap_track_handle_t_db, res_lib_cmap_notify_batch_callback->track_inst_handle);
+			break;
 		default:
 			error = CS_ERR_LIBRARY;
 			goto error_put;
@@ -935,6 +995,78 @@ cs_error_t cmap_iter_next(
 	return (error);
 }
 
+cs_error_t cmap_iter_bulk(
+		cmap_handle_t handle,
+		cmap_iter_handle_t iter_handle,
+		void *buffer,
+		size_t *buffer_len,
+		size_t *items)
+{
+	cs_error_t error;
+	struct iovec iov;
+	struct cmap_inst *cmap_inst;
+	struct req_lib_cmap_iter_bulk req_lib_cmap_iter_bulk;
+	struct res_lib_cmap_iter_bulk *res_lib_cmap_iter_bulk;
+	size_t res_size;
+
+	if (buffer == NULL || buffer_len == NULL || items == NULL) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	error = hdb_error_to_cs(hdb_handle_get (&cmap_handle_t_db, handle, (void *)&cmap_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	memset(&req_lib_cmap_iter_bulk, 0, sizeof(req_lib_cmap_iter_bulk));
+	req_lib_cmap_iter_bulk.header.size = sizeof(req_lib_cmap_iter_bulk);
+	req_lib_cmap_iter_bulk.header.id = MESSAGE_REQ_CMAP_ITER_BULK;
+	req_lib_cmap_iter_bulk.iter_handle = iter_handle;
+
+	/*
+	 * Whole response has to fit into IPC buffer
+	 */
+	req_lib_cmap_iter_bulk.max_len = *buffer_len;
+	if (req_lib_cmap_iter_bulk.max_len > IPC_RESPONSE_SIZE - sizeof(struct res_lib_cmap_iter_bulk)) {
+		req_lib_cmap_iter_bulk.max_len = IPC_RESPONSE_SIZE - sizeof(struct res_lib_cmap_iter_bulk);
+	}
+
+	iov.iov_base = (char *)&req_lib_cmap_iter_bulk;
+	iov.iov_len = sizeof(req_lib_cmap_iter_bulk);
+
+	res_size = sizeof(struct res_lib_cmap_iter_bulk) + req_lib_cmap_iter_bulk.max_len;
+
+	res_lib_cmap_iter_bulk = malloc(res_size);
+	if (res_lib_cmap_iter_bulk == NULL) {
+		error = CS_ERR_NO_MEMORY;
+		goto error_put;
+	}
+
+	error = qb_to_cs_error(qb_ipcc_sendv_recv(
+		cmap_inst->c,
+		&iov,
+		1,
+		res_lib_cmap_iter_bulk,
+		res_size, CS_IPC_TIMEOUT_MS));
+
+	if (error == CS_OK) {
+		error = res_lib_cmap_iter_bulk->header.error;
+	}
+
+	if (error == CS_OK) {
+		memcpy(buffer, res_lib_cmap_iter_bulk->items_data, res_lib_cmap_iter_bulk->items_len);
+		*buffer_len = res_lib_cmap_iter_bulk->items_len;
+		*items = res_lib_cmap_iter_bulk->items;
+	}
+
+	free(res_lib_cmap_iter_bulk);
+
+error_put:
+	(void)hdb_handle_put (&cmap_handle_t_db, handle);
+
+	return (error);
+}
+
 cs_error_t cmap_iter_finalize(
 		cmap_handle_t handle,
 		cmap_iter_handle_t iter_handle)
@@ -974,12 +1106,13 @@ cs_error_t cmap_iter_finalize(
 	return (error);
 }
 
-cs_error_t cmap_track_add(
+static cs_error_t cmap_track_add_window(
 	cmap_handle_t handle,
 	const char *key_name,
 	int32_t track_type,
 	cmap_notify_fn_t notify_fn,
 	void *user_data,
+	uint32_t coalesce_window,
 	cmap_track_handle_t *cmap_track_handle)
 {
 	cs_error_t error;
@@ -1029,6 +1162,7 @@ cs_error_t cmap_track_add(
 
 	req_lib_cmap_track_add.track_type = track_type;
 	req_lib_cmap_track_add.track_inst_handle = cmap_track_inst_handle;
+	req_lib_cmap_track_add.coalesce_window = coalesce_window;
 
 	iov.iov_base = (char *)&req_lib_cmap_track_add;
 	iov.iov_len = sizeof(req_lib_cmap_track_add);
@@ -1065,6 +1199,33 @@ error_put:
 	return (error);
 }
 
+cs_error_t cmap_track_add(
+	cmap_handle_t handle,
+	const char *key_name,
+	int32_t track_type,
+	cmap_notify_fn_t notify_fn,
+	void *user_data,
+	cmap_track_handle_t *cmap_track_handle)
+{
+
+	return (cmap_track_add_window(handle, key_name, track_type, notify_fn, user_data,
+	    0, cmap_track_handle));
+}
+
+cs_error_t cmap_track_add_coalesced(
+	cmap_handle_t handle,
+	const char *key_name,
+	int32_t track_type,
+	cmap_notify_fn_t notify_fn,
+	void *user_data,
+	uint32_t coalesce_window,
+	cmap_track_handle_t *cmap_track_handle)
+{
+
+	return (cmap_track_add_window(handle, key_name, track_type, notify_fn, user_data,
+	    coalesce_window, cmap_track_handle));
+}
+
 cs_error_t cmap_track_delete(
 		cmap_handle_t handle,
 		cmap_track_handle_t track_handle)
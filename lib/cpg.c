@@ -75,6 +75,13 @@
  */
 #define MAX_RETRIES 100
 
+/*
+ * Maximum number of messages in one cpg_mcast_joined_batch request.
+ * corosync reserves totem space by request size, which does not cover
+ * the header each message gets on the wire, so keep that bounded.
+ */
+#define CPG_MCAST_BATCH_MAX 128
+
 /*
  * ZCB files have following umask (umask is same as used in libqb)
  */
@@ -87,6 +94,9 @@ struct cpg_assembly_data
 	uint32_t pid;
 	char *assembly_buf;
 	uint32_t assembly_buf_ptr;
+	uint32_t assembly_buf_size;
+	uint32_t assembly_len;
+	int in_progress;
 };
 
 struct cpg_inst {
@@ -100,9 +110,28 @@ struct cpg_inst {
 	struct qb_list_head iteration_list_head;
 	uint32_t max_msg_size;
 	struct qb_list_head assembly_list_head;
+	/*
+	 * cpg_mcast_joined_async state. The counters are updated atomically
+	 * because cpg_dispatch may run in another thread.
+	 */
+	uint32_t mcast_window;
+	uint32_t mcast_in_flight;
+	uint64_t mcast_failed;
+	/*
+	 * Rest of an asynchronous fragmented message, kept when corosync
+	 * refused a fragment after the first one was sent already
+	 */
+	struct req_lib_cpg_partial_mcast frag_req;
+	char *frag_buf;
+	size_t frag_base;
+	size_t frag_sent;
 };
 static void cpg_inst_free (void *inst);
 
+static cs_error_t async_fragments_resume (struct cpg_inst *cpg_inst);
+
+static void event_batch_enable (struct cpg_inst *cpg_inst);
+
 DECLARE_HDB_DATABASE(cpg_handle_t_db, cpg_inst_free);
 
 struct cpg_iteration_instance_t {
@@ -137,10 +166,49 @@ static void cpg_iteration_instance_finalize (struct cpg_iteration_instance_t *cp
 	hdb_handle_destroy (&cpg_iteration_handle_t_db, cpg_iteration_instance->cpg_iteration_handle);
 }
 
+static void cpg_assembly_data_free (struct cpg_assembly_data *assembly_data)
+{
+	qb_list_del (&assembly_data->list);
+	free(assembly_data->assembly_buf);
+	free(assembly_data);
+}
+
 static void cpg_inst_free (void *inst)
 {
 	struct cpg_inst *cpg_inst = (struct cpg_inst *)inst;
+	struct qb_list_head *iter, *tmp_iter;
+
 	qb_ipcc_disconnect(cpg_inst->c);
+	free(cpg_inst->frag_buf);
+
+	qb_list_for_each_safe(iter, tmp_iter, &(cpg_inst->assembly_list_head)) {
+		cpg_assembly_data_free (qb_list_entry (iter, struct cpg_assembly_data, list));
+	}
+}
+
+/*
+ * Let corosync pack events which pile up for this connection into one
+ * event. Older versions don't know the request and refuse it, they keep
+ * sending every event on its own.
+ */
+static void event_batch_enable (struct cpg_inst *cpg_inst)
+{
+	struct iovec iov;
+	struct req_lib_cpg_event_batch_enable req_lib_cpg_event_batch_enable;
+	struct res_lib_cpg_event_batch_enable res_lib_cpg_event_batch_enable;
+
+	req_lib_cpg_event_batch_enable.header.size = sizeof (struct req_lib_cpg_event_batch_enable);
+	req_lib_cpg_event_batch_enable.header.id = MESSAGE_REQ_CPG_EVENT_BATCH_ENABLE;
+	req_lib_cpg_event_batch_enable.max_size = IPC_DISPATCH_SIZE;
+
+	iov.iov_base = (void *)&req_lib_cpg_event_batch_enable;
+	iov.iov_len = sizeof (struct req_lib_cpg_event_batch_enable);
+
+	(void)coroipcc_msg_send_reply_receive (cpg_inst->c,
+		&iov,
+		1,
+		&res_lib_cpg_event_batch_enable,
+		sizeof (struct res_lib_cpg_event_batch_enable));
 }
 
 static void cpg_inst_finalize (struct cpg_inst *cpg_inst, hdb_handle_t handle)
@@ -206,6 +274,11 @@ cs_error_t cpg_model_initialize (
 		goto error_destroy;
 	}
 
+	/*
+	 * cpg_inst_free walks this list, so it must be valid on error paths too
+	 */
+	qb_list_init(&cpg_inst->assembly_list_head);
+
 	cpg_inst->c = qb_ipcc_connect ("cpg", IPC_REQUEST_SIZE);
 	if (cpg_inst->c == NULL) {
 		error = qb_to_cs_error(-errno);
@@ -216,7 +289,8 @@ cs_error_t cpg_model_initialize (
 		switch (model) {
 		case CPG_MODEL_V1:
 			memcpy (&cpg_inst->model_v1_data, model_data, sizeof (cpg_model_v1_data_t));
-			if ((cpg_inst->model_v1_data.flags & ~(CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF)) != 0) {
+			if ((cpg_inst->model_v1_data.flags & ~(CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF |
+			    CPG_MODEL_V1_LOW_LATENCY)) != 0) {
 				error = CS_ERR_INVALID_PARAM;
 
 				goto error_destroy;
@@ -227,12 +301,13 @@ cs_error_t cpg_model_initialize (
 
 	/* Allow space for corosync internal headers */
 	cpg_inst->max_msg_size = IPC_REQUEST_SIZE - 1024;
+	cpg_inst->mcast_window = CPG_MCAST_WINDOW_DEFAULT;
 	cpg_inst->model_data.model = model;
 	cpg_inst->context = context;
 
 	qb_list_init(&cpg_inst->iteration_list_head);
 
-	qb_list_init(&cpg_inst->assembly_list_head);
+	event_batch_enable (cpg_inst);
 
 	hdb_handle_put (&cpg_handle_t_db, *handle);
 
@@ -379,7 +454,8 @@ cs_error_t cpg_dispatch (
 	struct res_lib_cpg_deliver_callback *res_cpg_deliver_callback;
 	struct res_lib_cpg_partial_deliver_callback *res_cpg_partial_deliver_callback;
 	struct res_lib_cpg_totem_confchg_callback *res_cpg_totem_confchg_callback;
-	struct cpg_inst cpg_inst_copy;
+	struct res_lib_cpg_mcast_async_ack *res_cpg_mcast_async_ack;
+	cpg_model_v1_data_t model_v1_data;
 	struct qb_ipc_response_header *dispatch_data;
 	struct cpg_address member_list[CPG_MEMBERS_MAX];
 	struct cpg_address left_list[CPG_MEMBERS_MAX];
@@ -393,6 +469,8 @@ cs_error_t cpg_dispatch (
 	struct cpg_ring_id ring_id;
 	uint32_t totem_member_list[CPG_MEMBERS_MAX];
 	int32_t errno_res;
+	size_t batch_pos;
+	size_t batch_len;
 	char dispatch_buf[IPC_DISPATCH_SIZE];
 
 	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
@@ -408,8 +486,8 @@ cs_error_t cpg_dispatch (
 		timeout = 0;
 	}
 
-	dispatch_data = (struct qb_ipc_response_header *)dispatch_buf;
 	do {
+		dispatch_data = (struct qb_ipc_response_header *)dispatch_buf;
 		errno_res = qb_ipcc_event_recv (
 			cpg_inst->c,
 			dispatch_buf,
@@ -439,19 +517,48 @@ cs_error_t cpg_dispatch (
 		}
 
 		/*
-		 * Make copy of callbacks, message data, unlock instance, and call callback
+		 * Events corosync packed into one are all dispatched now, even
+		 * for CS_DISPATCH_ONE_NONBLOCKING, as nothing would wake up a
+		 * poll() for the rest
+		 */
+		batch_pos = 0;
+		batch_len = 0;
+		if (dispatch_data->id == MESSAGE_RES_CPG_EVENT_BATCH) {
+			batch_pos = sizeof (struct res_lib_cpg_event_batch);
+			batch_len = dispatch_data->size;
+			if (batch_len <= batch_pos || batch_len > errno_res) {
+				error = CS_ERR_LIBRARY;
+				goto error_put;
+			}
+		}
+
+dispatch_next_in_batch:
+		if (batch_len != 0) {
+			dispatch_data = (struct qb_ipc_response_header *)(dispatch_buf + batch_pos);
+			if (batch_len - batch_pos < sizeof (struct qb_ipc_response_header) ||
+			    dispatch_data->size < sizeof (struct qb_ipc_response_header) ||
+			    dispatch_data->size > batch_len - batch_pos) {
+				error = CS_ERR_LIBRARY;
+				goto error_put;
+			}
+			batch_pos += (dispatch_data->size + CPG_EVENT_BATCH_ALIGN - 1) &
+				~(CPG_EVENT_BATCH_ALIGN - 1);
+		}
+
+		/*
+		 * Make copy of callbacks, unlock instance, and call callback
 		 * A risk of this dispatch method is that the callback routines may
 		 * operate at the same time that cpgFinalize has been called.
 		 */
-		memcpy (&cpg_inst_copy, cpg_inst, sizeof (struct cpg_inst));
-		switch (cpg_inst_copy.model_data.model) {
+		memcpy (&model_v1_data, &cpg_inst->model_v1_data, sizeof (cpg_model_v1_data_t));
+		switch (model_v1_data.model) {
 		case CPG_MODEL_V1:
 			/*
 			 * Dispatch incoming message
 			 */
 			switch (dispatch_data->id) {
 			case MESSAGE_RES_CPG_DELIVER_CALLBACK:
-				if (cpg_inst_copy.model_v1_data.cpg_deliver_fn == NULL) {
+				if (model_v1_data.cpg_deliver_fn == NULL) {
 					break;
 				}
 
@@ -461,7 +568,7 @@ cs_error_t cpg_dispatch (
 					&group_name,
 					&res_cpg_deliver_callback->group_name);
 
-				cpg_inst_copy.model_v1_data.cpg_deliver_fn (handle,
+				model_v1_data.cpg_deliver_fn (handle,
 					&group_name,
 					res_cpg_deliver_callback->nodeid,
 					res_cpg_deliver_callback->pid,
@@ -491,61 +598,83 @@ cs_error_t cpg_dispatch (
 				if (res_cpg_partial_deliver_callback->type == LIBCPG_PARTIAL_FIRST) {
 
 					/*
-					 * As this is LIBCPG_PARTIAL_FIRST packet, check that there is no ongoing assembly.
-					 * Otherwise the sending of packet must have been interrupted and error should have
-					 * been reported to sending client. Therefore here last assembly will be dropped.
+					 * As this is LIBCPG_PARTIAL_FIRST packet, an ongoing assembly means
+					 * the sending of packet must have been interrupted and error should have
+					 * been reported to sending client. Therefore last assembly is dropped
+					 * and its buffer reused.
 					 */
-					if (assembly_data) {
-						qb_list_del (&assembly_data->list);
-						free(assembly_data->assembly_buf);
-						free(assembly_data);
-						// coverity[UNUSED_VALUE:SUPPRESS] defensive programming
-						assembly_data = NULL;
-					}
-
-					assembly_data = malloc(sizeof(struct cpg_assembly_data));
 					if (!assembly_data) {
-						error = CS_ERR_NO_MEMORY;
-						goto error_put;
+						assembly_data = calloc(1, sizeof(struct cpg_assembly_data));
+						if (!assembly_data) {
+							error = CS_ERR_NO_MEMORY;
+							goto error_put;
+						}
+
+						assembly_data->nodeid = res_cpg_partial_deliver_callback->nodeid;
+						assembly_data->pid = res_cpg_partial_deliver_callback->pid;
+						qb_list_init (&assembly_data->list);
+						qb_list_add (&assembly_data->list, &cpg_inst->assembly_list_head);
 					}
 
-					assembly_data->nodeid = res_cpg_partial_deliver_callback->nodeid;
-					assembly_data->pid = res_cpg_partial_deliver_callback->pid;
-					assembly_data->assembly_buf = malloc(res_cpg_partial_deliver_callback->msglen);
-					if (!assembly_data->assembly_buf) {
-						free(assembly_data);
-						error = CS_ERR_NO_MEMORY;
-						goto error_put;
+					if (assembly_data->assembly_buf_size < res_cpg_partial_deliver_callback->msglen) {
+						/*
+						 * Nothing in the old buffer is needed, so don't realloc
+						 */
+						free(assembly_data->assembly_buf);
+						assembly_data->assembly_buf = malloc(res_cpg_partial_deliver_callback->msglen);
+						if (!assembly_data->assembly_buf) {
+							cpg_assembly_data_free (assembly_data);
+							error = CS_ERR_NO_MEMORY;
+							goto error_put;
+						}
+						assembly_data->assembly_buf_size = res_cpg_partial_deliver_callback->msglen;
 					}
 					assembly_data->assembly_buf_ptr = 0;
-					qb_list_init (&assembly_data->list);
-
-					qb_list_add (&assembly_data->list, &cpg_inst->assembly_list_head);
+					assembly_data->assembly_len = res_cpg_partial_deliver_callback->msglen;
+					assembly_data->in_progress = 1;
 				}
-				if (assembly_data) {
+				if (assembly_data && assembly_data->in_progress) {
+					if (res_cpg_partial_deliver_callback->fraglen >
+					    assembly_data->assembly_len - assembly_data->assembly_buf_ptr) {
+						/*
+						 * Fragments don't add up to the announced length
+						 */
+						assembly_data->in_progress = 0;
+						break;
+					}
+
 					memcpy(assembly_data->assembly_buf + assembly_data->assembly_buf_ptr,
 						res_cpg_partial_deliver_callback->message, res_cpg_partial_deliver_callback->fraglen);
 					assembly_data->assembly_buf_ptr += res_cpg_partial_deliver_callback->fraglen;
 
 					if (res_cpg_partial_deliver_callback->type == LIBCPG_PARTIAL_LAST) {
-						if (cpg_inst_copy.model_v1_data.cpg_deliver_fn != NULL) {
-							cpg_inst_copy.model_v1_data.cpg_deliver_fn (handle,
+						/*
+						 * Keep the buffer for the next large message from this sender.
+						 * It is freed when the sender leaves or the handle is finalized.
+						 */
+						assembly_data->in_progress = 0;
+
+						if (assembly_data->assembly_buf_ptr != assembly_data->assembly_len) {
+							/*
+							 * A fragment in the middle is missing
+							 */
+							break;
+						}
+
+						if (model_v1_data.cpg_deliver_fn != NULL) {
+							model_v1_data.cpg_deliver_fn (handle,
 								&group_name,
 								res_cpg_partial_deliver_callback->nodeid,
 								res_cpg_partial_deliver_callback->pid,
 								assembly_data->assembly_buf,
 								res_cpg_partial_deliver_callback->msglen);
 						}
-
-						qb_list_del (&assembly_data->list);
-						free(assembly_data->assembly_buf);
-						free(assembly_data);
 					}
 				}
 				break;
 
 			case MESSAGE_RES_CPG_CONFCHG_CALLBACK:
-				if (cpg_inst_copy.model_v1_data.cpg_confchg_fn == NULL) {
+				if (model_v1_data.cpg_confchg_fn == NULL) {
 					break;
 				}
 
@@ -572,7 +701,7 @@ cs_error_t cpg_dispatch (
 					&group_name,
 					&res_cpg_confchg_callback->group_name);
 
-				cpg_inst_copy.model_v1_data.cpg_confchg_fn (handle,
+				model_v1_data.cpg_confchg_fn (handle,
 					&group_name,
 					member_list,
 					res_cpg_confchg_callback->member_list_entries,
@@ -590,15 +719,13 @@ cs_error_t cpg_dispatch (
 						if (current_assembly_data->nodeid != left_list[i].nodeid || current_assembly_data->pid != left_list[i].pid)
 							continue;
 
-						qb_list_del (&current_assembly_data->list);
-						free(current_assembly_data->assembly_buf);
-						free(current_assembly_data);
+						cpg_assembly_data_free (current_assembly_data);
 					}
 				}
 
 				break;
 			case MESSAGE_RES_CPG_TOTEM_CONFCHG_CALLBACK:
-				if (cpg_inst_copy.model_v1_data.cpg_totem_confchg_fn == NULL) {
+				if (model_v1_data.cpg_totem_confchg_fn == NULL) {
 					break;
 				}
 
@@ -609,20 +736,28 @@ cs_error_t cpg_dispatch (
 					totem_member_list[i] = res_cpg_totem_confchg_callback->member_list[i];
 				}
 
-				cpg_inst_copy.model_v1_data.cpg_totem_confchg_fn (handle,
+				model_v1_data.cpg_totem_confchg_fn (handle,
 					ring_id,
 					res_cpg_totem_confchg_callback->member_list_entries,
 					totem_member_list);
 				break;
+			case MESSAGE_RES_CPG_MCAST_ASYNC_ACK:
+				res_cpg_mcast_async_ack = (struct res_lib_cpg_mcast_async_ack *)dispatch_data;
+
+				__atomic_sub_fetch (&cpg_inst->mcast_in_flight,
+					res_cpg_mcast_async_ack->completed, __ATOMIC_RELAXED);
+				__atomic_add_fetch (&cpg_inst->mcast_failed,
+					res_cpg_mcast_async_ack->failed, __ATOMIC_RELAXED);
+				break;
 			default:
 				error = CS_ERR_LIBRARY;
 				goto error_put;
 				break;
 			} /* - switch (dispatch_data->id) */
 			break; /* case CPG_MODEL_V1 */
-		} /* - switch (cpg_inst_copy.model_data.model) */
+		} /* - switch (model_v1_data.model) */
 
-		if (cpg_inst_copy.finalize || cpg_inst->finalize) {
+		if (cpg_inst->finalize) {
 			/*
 			 * If the finalize has been called then get out of the dispatch.
 			 */
@@ -631,6 +766,10 @@ cs_error_t cpg_dispatch (
 			goto error_put;
 		}
 
+		if (batch_pos < batch_len) {
+			goto dispatch_next_in_batch;
+		}
+
 		/*
 		 * Determine if more messages should be processed
 		 */
@@ -1219,6 +1358,16 @@ cs_error_t cpg_mcast_joined (
 		return (error);
 	}
 
+	/*
+	 * Fragments of different messages must not interleave
+	 */
+	if (cpg_inst->frag_buf != NULL) {
+		error = async_fragments_resume (cpg_inst);
+		if (error != CS_OK) {
+			goto error_exit;
+		}
+	}
+
 	for (i = 0; i < iov_len; i++ ) {
 		msg_len += iovec[i].iov_len;
 	}
@@ -1249,6 +1398,414 @@ error_exit:
 	return (error);
 }
 
+/*
+ * Send fragments of a message without waiting for corosync. iovec holds the
+ * message starting at offset base, *sent is how much of the message is out.
+ * On CS_ERR_TRY_AGAIN *sent tells where to continue.
+ */
+static cs_error_t send_fragments_nowait (
+	struct cpg_inst *cpg_inst,
+	struct req_lib_cpg_partial_mcast *req_lib_cpg_mcast,
+	size_t base,
+	size_t *sent,
+	const struct iovec *iovec,
+	unsigned int iov_len)
+{
+	unsigned int i = 0;
+	size_t offset = *sent - base;
+	struct iovec iov[2];
+	cs_error_t error = CS_OK;
+
+	iov[0].iov_base = (void *)req_lib_cpg_mcast;
+	iov[0].iov_len = sizeof (struct req_lib_cpg_partial_mcast);
+
+	qb_ipcc_fc_enable_max_set(cpg_inst->c,  2);
+
+	while (*sent < req_lib_cpg_mcast->msglen) {
+		while (i < iov_len && offset >= iovec[i].iov_len) {
+			offset -= iovec[i].iov_len;
+			i++;
+		}
+		if (i == iov_len) {
+			error = CS_ERR_LIBRARY;
+			break;
+		}
+
+		iov[1].iov_base = (char *)iovec[i].iov_base + offset;
+		iov[1].iov_len = iovec[i].iov_len - offset;
+		if (iov[1].iov_len > cpg_inst->max_msg_size) {
+			iov[1].iov_len = cpg_inst->max_msg_size;
+		}
+
+		if (*sent == 0) {
+			req_lib_cpg_mcast->type = LIBCPG_PARTIAL_FIRST;
+		}
+		else if ((*sent + iov[1].iov_len) == req_lib_cpg_mcast->msglen) {
+			req_lib_cpg_mcast->type = LIBCPG_PARTIAL_LAST;
+		}
+		else {
+			req_lib_cpg_mcast->type = LIBCPG_PARTIAL_CONTINUED;
+		}
+
+		req_lib_cpg_mcast->fraglen = iov[1].iov_len;
+		req_lib_cpg_mcast->header.size = sizeof (struct req_lib_cpg_partial_mcast) + iov[1].iov_len;
+
+		error = qb_to_cs_error(qb_ipcc_sendv(cpg_inst->c, iov, 2));
+		if (error != CS_OK) {
+			break;
+		}
+
+		*sent += iov[1].iov_len;
+		offset += iov[1].iov_len;
+	}
+
+	qb_ipcc_fc_enable_max_set(cpg_inst->c,  1);
+
+	return (error);
+}
+
+/*
+ * Try to send the rest of a fragmented asynchronous message
+ */
+static cs_error_t async_fragments_resume (struct cpg_inst *cpg_inst)
+{
+	struct iovec iov;
+	cs_error_t error;
+
+	iov.iov_base = cpg_inst->frag_buf;
+	iov.iov_len = cpg_inst->frag_req.msglen - cpg_inst->frag_base;
+
+	error = send_fragments_nowait (cpg_inst, &cpg_inst->frag_req,
+		cpg_inst->frag_base, &cpg_inst->frag_sent, &iov, 1);
+	if (error == CS_ERR_TRY_AGAIN) {
+		return (error);
+	}
+
+	if (error != CS_OK) {
+		/*
+		 * corosync never sees the end of the message, so it will not
+		 * be acknowledged either
+		 */
+		__atomic_sub_fetch (&cpg_inst->mcast_in_flight, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch (&cpg_inst->mcast_failed, 1, __ATOMIC_RELAXED);
+	}
+
+	free (cpg_inst->frag_buf);
+	cpg_inst->frag_buf = NULL;
+
+	return (error);
+}
+
+cs_error_t cpg_mcast_joined_async (
+	cpg_handle_t handle,
+	cpg_guarantee_t guarantee,
+	const struct iovec *iovec,
+	unsigned int iov_len)
+{
+	int i;
+	cs_error_t error;
+	struct cpg_inst *cpg_inst;
+	struct iovec iov[64];
+	struct req_lib_cpg_mcast req_lib_cpg_mcast;
+	struct req_lib_cpg_partial_mcast req_lib_cpg_partial_mcast;
+	size_t msg_len = 0;
+	size_t sent = 0;
+	size_t copied;
+
+	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	if (cpg_inst->frag_buf != NULL) {
+		error = async_fragments_resume (cpg_inst);
+		if (error != CS_OK) {
+			goto error_exit;
+		}
+	}
+
+	if (__atomic_load_n (&cpg_inst->mcast_in_flight, __ATOMIC_RELAXED) >= cpg_inst->mcast_window) {
+		error = CS_ERR_TRY_AGAIN;
+		goto error_exit;
+	}
+
+	for (i = 0; i < iov_len; i++ ) {
+		msg_len += iovec[i].iov_len;
+	}
+
+	if (msg_len > cpg_inst->max_msg_size) {
+		req_lib_cpg_partial_mcast.header.id = MESSAGE_REQ_CPG_PARTIAL_MCAST_ASYNC;
+		req_lib_cpg_partial_mcast.guarantee = guarantee;
+		req_lib_cpg_partial_mcast.msglen = msg_len;
+
+		error = send_fragments_nowait (cpg_inst, &req_lib_cpg_partial_mcast,
+			0, &sent, iovec, iov_len);
+		if (error == CS_ERR_TRY_AGAIN && sent > 0) {
+			/*
+			 * Part of the message is out already, so it has to be
+			 * finished later. Keep a copy of the rest.
+			 */
+			cpg_inst->frag_buf = malloc (msg_len - sent);
+			if (cpg_inst->frag_buf == NULL) {
+				error = CS_ERR_NO_MEMORY;
+				goto error_exit;
+			}
+			copied = 0;
+			for (i = 0; i < iov_len; i++) {
+				if (copied + iovec[i].iov_len > sent) {
+					size_t skip = (sent > copied) ? sent - copied : 0;
+
+					memcpy (cpg_inst->frag_buf + copied + skip - sent,
+						(char *)iovec[i].iov_base + skip,
+						iovec[i].iov_len - skip);
+				}
+				copied += iovec[i].iov_len;
+			}
+			memcpy (&cpg_inst->frag_req, &req_lib_cpg_partial_mcast,
+				sizeof (struct req_lib_cpg_partial_mcast));
+			cpg_inst->frag_base = sent;
+			cpg_inst->frag_sent = sent;
+			error = CS_OK;
+		}
+	} else {
+		req_lib_cpg_mcast.header.size = sizeof (struct req_lib_cpg_mcast) +
+			msg_len;
+		req_lib_cpg_mcast.header.id = MESSAGE_REQ_CPG_MCAST_ASYNC;
+		req_lib_cpg_mcast.guarantee = guarantee;
+		req_lib_cpg_mcast.msglen = msg_len;
+
+		iov[0].iov_base = (void *)&req_lib_cpg_mcast;
+		iov[0].iov_len = sizeof (struct req_lib_cpg_mcast);
+		memcpy (&iov[1], iovec, iov_len * sizeof (struct iovec));
+
+		qb_ipcc_fc_enable_max_set(cpg_inst->c,  2);
+		error = qb_to_cs_error(qb_ipcc_sendv(cpg_inst->c, iov, iov_len + 1));
+		qb_ipcc_fc_enable_max_set(cpg_inst->c,  1);
+	}
+
+	if (error == CS_OK) {
+		__atomic_add_fetch (&cpg_inst->mcast_in_flight, 1, __ATOMIC_RELAXED);
+	}
+
+error_exit:
+	hdb_handle_put (&cpg_handle_t_db, handle);
+
+	return (error);
+}
+
+/*
+ * Send msgs[0..count) in one MESSAGE_REQ_CPG_MCAST_BATCH request. *accepted
+ * is set to the number of messages corosync passed on to totem.
+ */
+static cs_error_t mcast_batch_send (
+	struct cpg_inst *cpg_inst,
+	cpg_guarantee_t guarantee,
+	const struct iovec *msgs,
+	unsigned int count,
+	size_t size,
+	unsigned int *accepted)
+{
+	static const char pad[CPG_MCAST_BATCH_ALIGN];
+	struct req_lib_cpg_mcast_batch req_lib_cpg_mcast_batch;
+	struct req_lib_cpg_mcast_batch_item items[CPG_MCAST_BATCH_MAX];
+	struct iovec iov[1 + 3 * CPG_MCAST_BATCH_MAX];
+	struct res_lib_cpg_mcast_batch res_lib_cpg_mcast_batch;
+	unsigned int iov_len = 0;
+	unsigned int i;
+	size_t pad_len;
+	cs_error_t error;
+
+	req_lib_cpg_mcast_batch.header.size = sizeof (struct req_lib_cpg_mcast_batch) + size;
+	req_lib_cpg_mcast_batch.header.id = MESSAGE_REQ_CPG_MCAST_BATCH;
+	req_lib_cpg_mcast_batch.guarantee = guarantee;
+	req_lib_cpg_mcast_batch.count = count;
+
+	iov[iov_len].iov_base = (void *)&req_lib_cpg_mcast_batch;
+	iov[iov_len++].iov_len = sizeof (struct req_lib_cpg_mcast_batch);
+
+	for (i = 0; i < count; i++) {
+		items[i].msglen = msgs[i].iov_len;
+		iov[iov_len].iov_base = (void *)&items[i];
+		iov[iov_len++].iov_len = sizeof (struct req_lib_cpg_mcast_batch_item);
+
+		if (msgs[i].iov_len) {
+			iov[iov_len].iov_base = msgs[i].iov_base;
+			iov[iov_len++].iov_len = msgs[i].iov_len;
+		}
+
+		pad_len = CPG_MCAST_BATCH_ITEM_SIZE(msgs[i].iov_len) -
+			sizeof (struct req_lib_cpg_mcast_batch_item) - msgs[i].iov_len;
+		if (pad_len) {
+			iov[iov_len].iov_base = (void *)pad;
+			iov[iov_len++].iov_len = pad_len;
+		}
+	}
+
+	/*
+	 * A refused request is answered with a bare header, so nothing was sent
+	 */
+	res_lib_cpg_mcast_batch.sent = 0;
+
+	qb_ipcc_fc_enable_max_set(cpg_inst->c,  2);
+	error = coroipcc_msg_send_reply_receive (cpg_inst->c, iov, iov_len,
+		&res_lib_cpg_mcast_batch, sizeof (res_lib_cpg_mcast_batch));
+	qb_ipcc_fc_enable_max_set(cpg_inst->c,  1);
+
+	*accepted = 0;
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	error = res_lib_cpg_mcast_batch.header.error;
+	if (error == CS_OK) {
+		*accepted = count;
+	} else if (res_lib_cpg_mcast_batch.sent < count) {
+		*accepted = res_lib_cpg_mcast_batch.sent;
+	}
+
+	return (error);
+}
+
+cs_error_t cpg_mcast_joined_batch (
+	cpg_handle_t handle,
+	cpg_guarantee_t guarantee,
+	const struct iovec *msgs,
+	unsigned int msg_count,
+	unsigned int *sent)
+{
+	cs_error_t error;
+	struct cpg_inst *cpg_inst;
+	unsigned int first = 0;
+	unsigned int i;
+	size_t size = 0;
+	size_t item_size;
+	unsigned int accepted;
+
+	if (sent != NULL) {
+		*sent = 0;
+	}
+
+	if (msgs == NULL && msg_count > 0) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	/*
+	 * Fragments of different messages must not interleave
+	 */
+	if (cpg_inst->frag_buf != NULL) {
+		error = async_fragments_resume (cpg_inst);
+		if (error != CS_OK) {
+			goto error_exit;
+		}
+	}
+
+	for (i = 0; i < msg_count; i++) {
+		item_size = CPG_MCAST_BATCH_ITEM_SIZE(msgs[i].iov_len);
+
+		/*
+		 * Flush what is collected so far if this message does not fit
+		 */
+		if (i > first &&
+		    (i - first == CPG_MCAST_BATCH_MAX || size + item_size > cpg_inst->max_msg_size)) {
+			error = mcast_batch_send (cpg_inst, guarantee, &msgs[first], i - first, size,
+				&accepted);
+			first += accepted;
+			if (error != CS_OK) {
+				goto error_exit;
+			}
+			size = 0;
+		}
+
+		/*
+		 * A message too large for a batch of its own goes out in fragments
+		 */
+		if (item_size > cpg_inst->max_msg_size) {
+			error = send_fragments (cpg_inst, guarantee, msgs[i].iov_len, &msgs[i], 1);
+			if (error != CS_OK) {
+				goto error_exit;
+			}
+			first = i + 1;
+			continue;
+		}
+
+		size += item_size;
+	}
+
+	if (msg_count > first) {
+		error = mcast_batch_send (cpg_inst, guarantee, &msgs[first], msg_count - first, size,
+			&accepted);
+		first += accepted;
+	}
+
+error_exit:
+	if (sent != NULL) {
+		*sent = first;
+	}
+
+	hdb_handle_put (&cpg_handle_t_db, handle);
+
+	return (error);
+}
+
+cs_error_t cpg_mcast_window_set (
+	cpg_handle_t handle,
+	uint32_t window)
+{
+	cs_error_t error;
+	struct cpg_inst *cpg_inst;
+
+	if (window == 0) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	cpg_inst->mcast_window = window;
+
+	hdb_handle_put (&cpg_handle_t_db, handle);
+
+	return (CS_OK);
+}
+
+cs_error_t cpg_mcast_async_state_get (
+	cpg_handle_t handle,
+	uint32_t *in_flight,
+	uint64_t *failed)
+{
+	cs_error_t error;
+	struct cpg_inst *cpg_inst;
+
+	if (in_flight == NULL) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	if (cpg_inst->frag_buf != NULL) {
+		(void)async_fragments_resume (cpg_inst);
+	}
+
+	*in_flight = __atomic_load_n (&cpg_inst->mcast_in_flight, __ATOMIC_RELAXED);
+	if (failed != NULL) {
+		*failed = __atomic_load_n (&cpg_inst->mcast_failed, __ATOMIC_RELAXED);
+	}
+
+	hdb_handle_put (&cpg_handle_t_db, handle);
+
+	return (CS_OK);
+}
+
 cs_error_t cpg_iteration_initialize(
 	cpg_handle_t handle,
 	cpg_iteration_type_t iteration_type,
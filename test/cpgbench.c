@@ -45,6 +45,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <poll.h>
 #include <sys/uio.h>
 #include <sys/un.h>
 #include <netinet/in.h>
@@ -61,6 +62,25 @@ static cpg_handle_t handle;
 
 static pthread_t thread;
 
+/*
+ * Use cpg_mcast_joined_async and dispatch from the sending thread
+ */
+static int async_mode;
+
+/*
+ * Send this many messages per cpg_mcast_joined_batch call, 0 to not batch
+ */
+#define BATCH_MAX 1024
+static unsigned int batch_count;
+
+/*
+ * Seconds each message size is run for. To compare transports, run the
+ * same -s, -r and -t on one node of a cluster configured with
+ * "transport: udpu" and then with "transport: knet", with the same
+ * nodes and the same other totem settings.
+ */
+static unsigned int run_time = 10;
+
 #ifndef timersub
 #define timersub(a, b, result)						\
 	do {								\
@@ -111,19 +131,51 @@ static void cpg_benchmark (
 {
 	struct timeval tv1, tv2, tv_elapsed;
 	struct iovec iov;
+	struct iovec batch_iov[BATCH_MAX];
+	unsigned int batch_first = 0;
+	unsigned int batch_sent;
 	unsigned int res;
+	struct pollfd pfd;
+	int fd;
+	int i;
 
 	alarm_notice = 0;
 	iov.iov_base = data;
 	iov.iov_len = write_size;
+	for (i = 0; i < batch_count; i++) {
+		batch_iov[i] = iov;
+	}
 
 	write_count = 0;
-	alarm (10);
+	alarm (run_time);
+
+	cpg_fd_get (handle_in, &fd);
+	pfd.fd = fd;
+	pfd.events = POLLIN;
 
 	gettimeofday (&tv1, NULL);
 	do {
-		res = cpg_mcast_joined (handle_in, CPG_TYPE_AGREED, &iov, 1);
+		if (async_mode) {
+			res = cpg_mcast_joined_async (handle_in, CPG_TYPE_AGREED, &iov, 1);
+			if (res == CS_ERR_TRY_AGAIN) {
+				/*
+				 * Window is full, wait for completions
+				 */
+				if (poll (&pfd, 1, 10) > 0) {
+					cpg_dispatch (handle_in, CS_DISPATCH_ALL);
+				}
+			}
+		} else if (batch_count) {
+			res = cpg_mcast_joined_batch (handle_in, CPG_TYPE_AGREED,
+				&batch_iov[batch_first], batch_count - batch_first, &batch_sent);
+			batch_first = (batch_first + batch_sent) % batch_count;
+		} else {
+			res = cpg_mcast_joined (handle_in, CPG_TYPE_AGREED, &iov, 1);
+		}
 	} while (alarm_notice == 0 && (res == CS_OK || res == CS_ERR_TRY_AGAIN));
+	if (async_mode) {
+		cpg_dispatch (handle_in, CS_DISPATCH_ALL);
+	}
 	gettimeofday (&tv2, NULL);
 	timersub (&tv2, &tv1, &tv_elapsed);
 
@@ -153,10 +205,73 @@ static void* dispatch_thread (void *arg)
 	return NULL;
 }
 
-int main (void) {
+static void usage (const char *cmd)
+{
+	printf ("%s [-a] [-w window] [-b count] [-s size] [-r runs] [-t seconds]\n", cmd);
+	printf ("\n");
+	printf ("  -a           use cpg_mcast_joined_async\n");
+	printf ("  -b count     send count messages per cpg_mcast_joined_batch (max %d)\n", BATCH_MAX);
+	printf ("  -w window    messages in flight with -a (default %d)\n", CPG_MCAST_WINDOW_DEFAULT);
+	printf ("  -s size      only run messages of size bytes, repeatedly with -r\n");
+	printf ("  -r runs      number of runs with -s (default 1)\n");
+	printf ("  -t seconds   length of each run (default 10)\n");
+}
+
+int main (int argc, char *argv[]) {
 	unsigned int size;
 	int i;
 	unsigned int res;
+	int c;
+	uint32_t window = CPG_MCAST_WINDOW_DEFAULT;
+	unsigned int fixed_size = 0;
+	unsigned int runs = 1;
+
+	while ((c = getopt (argc, argv, "ab:w:s:r:t:h")) != -1) {
+		switch (c) {
+		case 'a':
+			async_mode = 1;
+			break;
+		case 'b':
+			batch_count = atoi (optarg);
+			if (batch_count == 0 || batch_count > BATCH_MAX) {
+				usage (argv[0]);
+				exit (1);
+			}
+			break;
+		case 'w':
+			window = atoi (optarg);
+			if (window == 0) {
+				usage (argv[0]);
+				exit (1);
+			}
+			break;
+		case 's':
+			fixed_size = atoi (optarg);
+			if (fixed_size == 0 || fixed_size >= (ONE_MEG - 100)) {
+				usage (argv[0]);
+				exit (1);
+			}
+			break;
+		case 'r':
+			runs = atoi (optarg);
+			if (runs == 0) {
+				usage (argv[0]);
+				exit (1);
+			}
+			break;
+		case 't':
+			run_time = atoi (optarg);
+			if (run_time == 0) {
+				usage (argv[0]);
+				exit (1);
+			}
+			break;
+		case 'h':
+		default:
+			usage (argv[0]);
+			exit (c == 'h' ? 0 : 1);
+		}
+	}
 
 	qb_log_init("cpgbench", LOG_USER, LOG_EMERG);
 	qb_log_ctl(QB_LOG_SYSLOG, QB_LOG_CONF_ENABLED, QB_FALSE);
@@ -171,7 +286,11 @@ int main (void) {
 		printf ("cpg_initialize failed with result %d\n", res);
 		exit (1);
 	}
-	pthread_create (&thread, NULL, dispatch_thread, NULL);
+	if (async_mode) {
+		cpg_mcast_window_set (handle, window);
+	} else {
+		pthread_create (&thread, NULL, dispatch_thread, NULL);
+	}
 
 	res = cpg_join (handle, &group_name);
 	if (res != CS_OK) {
@@ -179,7 +298,16 @@ int main (void) {
 		exit (1);
 	}
 
-	for (i = 0; i < 10; i++) { /* number of repetitions - up to 50k */
+	/*
+	 * A fixed small size shows the per message cost of the transports,
+	 * like the number of send syscalls per member with udpu
+	 */
+	for (i = 0; fixed_size && i < runs; i++) {
+		cpg_benchmark (handle, fixed_size);
+		signal (SIGALRM, sigalrm_handler);
+	}
+
+	for (i = 0; !fixed_size && i < 10; i++) { /* number of repetitions - up to 50k */
 		cpg_benchmark (handle, size);
 		signal (SIGALRM, sigalrm_handler);
 		size *= 5;
@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures CPG delivery rate on one group while many other local
+ * connections are joined to many other groups.  Delivery cost in the
+ * CPG service should only depend on the members of the addressed group,
+ * so the rate should stay flat as -c and -g grow.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#include <qb/qblog.h>
+#include <qb/qbutil.h>
+
+#include <corosync/corotypes.h>
+#include <corosync/cpg.h>
+
+#ifndef timersub
+#define timersub(a, b, result)						\
+	do {								\
+		(result)->tv_sec = (a)->tv_sec - (b)->tv_sec;		\
+		(result)->tv_usec = (a)->tv_usec - (b)->tv_usec;	\
+		if ((result)->tv_usec < 0) {				\
+			--(result)->tv_sec;				\
+			(result)->tv_usec += 1000000;			\
+		}							\
+	} while (0)
+#endif /* timersub */
+
+#define DEFAULT_CONNECTIONS	400
+#define DEFAULT_GROUPS		150
+#define DEFAULT_MSG_SIZE	64
+#define DEFAULT_RUNTIME		10
+
+static cpg_handle_t handle;
+
+static cpg_handle_t *idle_handles;
+
+static pthread_t thread;
+
+static int alarm_notice;
+
+static unsigned int deliver_count;
+
+static char data[65536];
+
+static void cpg_bm_confchg_fn (
+	cpg_handle_t handle_in,
+	const struct cpg_name *group_name,
+	const struct cpg_address *member_list, size_t member_list_entries,
+	const struct cpg_address *left_list, size_t left_list_entries,
+	const struct cpg_address *joined_list, size_t joined_list_entries)
+{
+}
+
+static void cpg_bm_deliver_fn (
+	cpg_handle_t handle_in,
+	const struct cpg_name *group_name,
+	uint32_t nodeid,
+	uint32_t pid,
+	void *msg,
+	size_t msg_len)
+{
+	deliver_count++;
+}
+
+static cpg_callbacks_t callbacks = {
+	.cpg_deliver_fn 	= cpg_bm_deliver_fn,
+	.cpg_confchg_fn		= cpg_bm_confchg_fn
+};
+
+static struct cpg_name bench_group_name = {
+	.value = "cpg_bm_groups",
+	.length = 13
+};
+
+static void sigalrm_handler (int num)
+{
+	alarm_notice = 1;
+}
+
+static void* dispatch_thread (void *arg)
+{
+	cpg_dispatch (handle, CS_DISPATCH_BLOCKING);
+	return NULL;
+}
+
+static int idle_connections_create (int connections, int groups)
+{
+	struct cpg_name group_name;
+	cs_error_t res;
+	int i;
+
+	idle_handles = calloc (connections, sizeof (cpg_handle_t));
+	if (idle_handles == NULL) {
+		return (-1);
+	}
+
+	for (i = 0; i < connections; i++) {
+		res = cpg_initialize (&idle_handles[i], &callbacks);
+		if (res != CS_OK) {
+			printf ("cpg_initialize of connection %d failed with result %d\n", i, res);
+			return (-1);
+		}
+
+		group_name.length = snprintf (group_name.value, sizeof (group_name.value),
+			"cpg_bm_idle_%d", i % groups);
+		do {
+			res = cpg_join (idle_handles[i], &group_name);
+		} while (res == CS_ERR_TRY_AGAIN);
+		if (res != CS_OK) {
+			printf ("cpg_join of connection %d failed with result %d\n", i, res);
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+static void idle_connections_destroy (int connections)
+{
+	int i;
+
+	for (i = 0; i < connections; i++) {
+		if (idle_handles[i]) {
+			cpg_finalize (idle_handles[i]);
+		}
+	}
+	free (idle_handles);
+}
+
+static void cpg_benchmark (
+	cpg_handle_t handle_in,
+	int write_size,
+	int runtime)
+{
+	struct timeval tv1, tv2, tv_elapsed;
+	struct iovec iov;
+	double elapsed;
+	unsigned int res;
+
+	alarm_notice = 0;
+	iov.iov_base = data;
+	iov.iov_len = write_size;
+
+	deliver_count = 0;
+	alarm (runtime);
+
+	gettimeofday (&tv1, NULL);
+	do {
+		res = cpg_mcast_joined (handle_in, CPG_TYPE_AGREED, &iov, 1);
+	} while (alarm_notice == 0 && (res == CS_OK || res == CS_ERR_TRY_AGAIN));
+	gettimeofday (&tv2, NULL);
+	timersub (&tv2, &tv1, &tv_elapsed);
+	elapsed = tv_elapsed.tv_sec + (tv_elapsed.tv_usec / 1000000.0);
+
+	printf ("%9d messages received ", deliver_count);
+	printf ("%5d bytes per write ", write_size);
+	printf ("%7.3f Seconds runtime ", elapsed);
+	printf ("%9.3f TP/s\n", ((float)deliver_count) / elapsed);
+}
+
+static void usage (const char *cmd)
+{
+	printf ("%s [-c connections] [-g groups] [-s size] [-t seconds]\n\n", cmd);
+	printf ("  -c  number of idle local connections (default %d)\n", DEFAULT_CONNECTIONS);
+	printf ("  -g  number of groups the idle connections are spread over (default %d)\n", DEFAULT_GROUPS);
+	printf ("  -s  message size in bytes (default %d)\n", DEFAULT_MSG_SIZE);
+	printf ("  -t  runtime in seconds (default %d)\n", DEFAULT_RUNTIME);
+}
+
+int main (int argc, char *argv[]) {
+	int connections = DEFAULT_CONNECTIONS;
+	int groups = DEFAULT_GROUPS;
+	int size = DEFAULT_MSG_SIZE;
+	int runtime = DEFAULT_RUNTIME;
+	unsigned int res;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "c:g:s:t:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			connections = atoi (optarg);
+			break;
+		case 'g':
+			groups = atoi (optarg);
+			break;
+		case 's':
+			size = atoi (optarg);
+			break;
+		case 't':
+			runtime = atoi (optarg);
+			break;
+		case 'h':
+		default:
+			usage (argv[0]);
+			exit (1);
+		}
+	}
+
+	if (connections < 0 || groups < 1 || size < 1 || size > sizeof (data) || runtime < 1) {
+		usage (argv[0]);
+		exit (1);
+	}
+
+	qb_log_init("cpgbenchgroups", LOG_USER, LOG_EMERG);
+	qb_log_ctl(QB_LOG_SYSLOG, QB_LOG_CONF_ENABLED, QB_FALSE);
+	qb_log_filter_ctl(QB_LOG_STDERR, QB_LOG_FILTER_ADD,
+			  QB_LOG_FILTER_FILE, "*", LOG_DEBUG);
+	qb_log_ctl(QB_LOG_STDERR, QB_LOG_CONF_ENABLED, QB_TRUE);
+
+	signal (SIGALRM, sigalrm_handler);
+
+	if (idle_connections_create (connections, groups) != 0) {
+		exit (1);
+	}
+	printf ("%d idle connections joined to %d groups\n", connections, groups);
+
+	res = cpg_initialize (&handle, &callbacks);
+	if (res != CS_OK) {
+		printf ("cpg_initialize failed with result %d\n", res);
+		exit (1);
+	}
+	pthread_create (&thread, NULL, dispatch_thread, NULL);
+
+	res = cpg_join (handle, &bench_group_name);
+	if (res != CS_OK) {
+		printf ("cpg_join failed with result %d\n", res);
+		exit (1);
+	}
+
+	cpg_benchmark (handle, size, runtime);
+
+	res = cpg_finalize (handle);
+	if (res != CS_OK) {
+		printf ("cpg_finalize failed with result %d\n", res);
+		exit (1);
+	}
+	idle_connections_destroy (connections);
+
+	return (0);
+}
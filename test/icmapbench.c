@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * icmap microbenchmark
+ *
+ * Runs icmap from the corosync executive in this process and compares the
+ * malloc and arena item allocation of the global map.  An unreported
+ * malloc pass runs first, so neither allocation pays for growing the heap.  The map is filled
+ * with nodelist., runtime. and stats. keys like a large cluster has, and
+ * for every allocation the following is reported:
+ *
+ *   set       creating one key
+ *   get       reading one key
+ *   replace   setting a new value of an existing uint64 key
+ *   iterate   visiting one key of a nodelist. prefix iteration
+ *   track     replacing a value of a key covered by a prefix track
+ *   counter   icmap_counter_inc of a tracked key
+ *   delete    deleting one key
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include <qb/qbutil.h>
+#include <corosync/corotypes.h>
+#include <corosync/icmap.h>
+
+#define KEYS_PER_NODE 6
+
+static unsigned int bench_nodes = 1000;
+static unsigned int bench_rounds = 10;
+
+static unsigned int track_notifications;
+
+struct bench_result {
+	const char *name;
+	uint64_t ns;
+	uint64_t ops;
+};
+
+static void key_name_get (char *key_name, unsigned int node, unsigned int key)
+{
+	switch (key) {
+	case 0:
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "nodelist.node.%u.ring0_addr", node);
+		break;
+	case 1:
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "nodelist.node.%u.nodeid", node);
+		break;
+	case 2:
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "nodelist.node.%u.name", node);
+		break;
+	case 3:
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "runtime.members.%u.join_count", node);
+		break;
+	case 4:
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "runtime.members.%u.status", node);
+		break;
+	default:
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "stats.knet.node%u.link0.rx_data_packets", node);
+		break;
+	}
+}
+
+static cs_error_t key_set (unsigned int node, unsigned int key, uint64_t value)
+{
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+	char str[64];
+
+	key_name_get (key_name, node, key);
+
+	switch (key) {
+	case 0:
+		snprintf (str, sizeof (str), "192.168.%u.%u", (node >> 8) & 0xff, node & 0xff);
+		return (icmap_set_string (key_name, str));
+	case 1:
+		return (icmap_set_uint32 (key_name, node + 1));
+	case 2:
+		snprintf (str, sizeof (str), "node%u", node);
+		return (icmap_set_string (key_name, str));
+	case 4:
+		return (icmap_set_string (key_name, "joined"));
+	default:
+		return (icmap_set_uint64 (key_name, value));
+	}
+}
+
+static void track_fn (
+	int32_t event,
+	const char *key_name,
+	struct icmap_notify_value new_value,
+	struct icmap_notify_value old_value,
+	void *user_data)
+{
+	track_notifications++;
+}
+
+static int bench_run (icmap_alloc_t alloc, struct bench_result *results)
+{
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+	icmap_counter_t counter;
+	icmap_track_t track;
+	icmap_iter_t iter;
+	uint64_t u64;
+	uint64_t ns;
+	unsigned int node, key, round;
+	int i = 0;
+
+	if (icmap_init_alloc (alloc) != CS_OK) {
+		printf ("icmap_init_alloc failed\n");
+		return (-1);
+	}
+
+	results[i].name = "set";
+	ns = qb_util_nano_current_get ();
+	for (node = 0; node < bench_nodes; node++) {
+		for (key = 0; key < KEYS_PER_NODE; key++) {
+			if (key_set (node, key, 0) != CS_OK) {
+				printf ("icmap_set failed\n");
+				return (-1);
+			}
+		}
+	}
+	results[i].ns = qb_util_nano_current_get () - ns;
+	results[i++].ops = bench_nodes * KEYS_PER_NODE;
+
+	results[i].name = "get";
+	ns = qb_util_nano_current_get ();
+	for (round = 0; round < bench_rounds; round++) {
+		for (node = 0; node < bench_nodes; node++) {
+			for (key = 0; key < KEYS_PER_NODE; key++) {
+				key_name_get (key_name, node, key);
+				if (icmap_get (key_name, NULL, NULL, NULL) != CS_OK) {
+					printf ("icmap_get failed\n");
+					return (-1);
+				}
+			}
+		}
+	}
+	results[i].ns = qb_util_nano_current_get () - ns;
+	results[i++].ops = bench_rounds * bench_nodes * KEYS_PER_NODE;
+
+	results[i].name = "replace";
+	ns = qb_util_nano_current_get ();
+	for (round = 0; round < bench_rounds; round++) {
+		for (node = 0; node < bench_nodes; node++) {
+			key_set (node, 5, round + 1);
+		}
+	}
+	results[i].ns = qb_util_nano_current_get () - ns;
+	results[i++].ops = bench_rounds * bench_nodes;
+
+	results[i].name = "iterate";
+	results[i].ops = 0;
+	ns = qb_util_nano_current_get ();
+	for (round = 0; round < bench_rounds; round++) {
+		iter = icmap_iter_init ("nodelist.");
+		while (icmap_iter_next (iter, NULL, NULL) != NULL) {
+			results[i].ops++;
+		}
+		icmap_iter_finalize (iter);
+	}
+	results[i++].ns = qb_util_nano_current_get () - ns;
+
+	if (icmap_track_add ("runtime.members.", ICMAP_TRACK_MODIFY | ICMAP_TRACK_PREFIX,
+	    track_fn, NULL, &track) != CS_OK) {
+		printf ("icmap_track_add failed\n");
+		return (-1);
+	}
+
+	results[i].name = "track";
+	track_notifications = 0;
+	ns = qb_util_nano_current_get ();
+	for (round = 0; round < bench_rounds; round++) {
+		for (node = 0; node < bench_nodes; node++) {
+			key_set (node, 3, round + 1);
+		}
+	}
+	results[i].ns = qb_util_nano_current_get () - ns;
+	results[i++].ops = bench_rounds * bench_nodes;
+	if (track_notifications != bench_rounds * bench_nodes) {
+		printf ("expected %u notifications, got %u\n",
+			bench_rounds * bench_nodes, track_notifications);
+		return (-1);
+	}
+
+	results[i].name = "counter";
+	key_name_get (key_name, 0, 3);
+	if (icmap_counter_get (key_name, &counter) != CS_OK) {
+		printf ("icmap_counter_get failed\n");
+		return (-1);
+	}
+	ns = qb_util_nano_current_get ();
+	for (round = 0; round < bench_rounds * bench_nodes; round++) {
+		icmap_counter_inc (counter);
+	}
+	results[i].ns = qb_util_nano_current_get () - ns;
+	results[i++].ops = bench_rounds * bench_nodes;
+	icmap_counter_release (counter);
+	icmap_track_delete (track);
+
+	if (icmap_get_uint64 (key_name, &u64) != CS_OK ||
+	    u64 != bench_rounds + bench_rounds * bench_nodes) {
+		printf ("counter has wrong value\n");
+		return (-1);
+	}
+
+	results[i].name = "delete";
+	ns = qb_util_nano_current_get ();
+	for (node = 0; node < bench_nodes; node++) {
+		for (key = 0; key < KEYS_PER_NODE; key++) {
+			key_name_get (key_name, node, key);
+			icmap_delete (key_name);
+		}
+	}
+	results[i].ns = qb_util_nano_current_get () - ns;
+	results[i++].ops = bench_nodes * KEYS_PER_NODE;
+
+	icmap_fini ();
+
+	return (i);
+}
+
+static void usage (const char *prog)
+{
+	printf ("%s [-n nodes] [-r rounds]\n", prog);
+	printf ("\n");
+	printf ("  -n  number of nodes, each has %d keys (default 1000)\n", KEYS_PER_NODE);
+	printf ("  -r  rounds of get, replace, iterate and track (default 10)\n");
+}
+
+int main (int argc, char *argv[])
+{
+	struct bench_result malloc_results[16];
+	struct bench_result arena_results[16];
+	int entries;
+	int opt;
+	int i;
+
+	while ((opt = getopt (argc, argv, "n:r:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			bench_nodes = atoi (optarg);
+			break;
+		case 'r':
+			bench_rounds = atoi (optarg);
+			break;
+		case 'h':
+		default:
+			usage (argv[0]);
+			exit (0);
+		}
+	}
+	if (bench_nodes < 1 || bench_rounds < 1) {
+		usage (argv[0]);
+		exit (1);
+	}
+
+	entries = bench_run (ICMAP_ALLOC_MALLOC, malloc_results);
+	if (entries < 0 ||
+	    bench_run (ICMAP_ALLOC_MALLOC, malloc_results) != entries ||
+	    bench_run (ICMAP_ALLOC_ARENA, arena_results) != entries) {
+		exit (1);
+	}
+
+	printf ("%u nodes, %u keys, %u rounds\n", bench_nodes,
+		bench_nodes * KEYS_PER_NODE, bench_rounds);
+	printf ("%-10s %10s %14s %14s\n", "", "ops", "malloc ns/op", "arena ns/op");
+	for (i = 0; i < entries; i++) {
+		printf ("%-10s %10" PRIu64 " %14.1f %14.1f\n", malloc_results[i].name,
+			malloc_results[i].ops,
+			(double)malloc_results[i].ns / malloc_results[i].ops,
+			(double)arena_results[i].ns / arena_results[i].ops);
+	}
+
+	return (0);
+}
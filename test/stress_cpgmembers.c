@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Join a large number of processes to a few groups and time the membership
+ * operations of corosync. Every child process holds -c connections, so
+ * there are -p times -c members, e.g. "-p 10 -c 100 -g 100" gives 1000.
+ * Each connection takes file descriptors, so the open files limit has to
+ * allow -c connections. Each connection also maps its own request,
+ * response and event rings of IPC_REQUEST_SIZE (1 MiB) shared memory in
+ * both the client and corosync, about 3 MiB per member on each side, so a
+ * single host runs out of memory long before 100000 members.
+ *
+ * A process can be a member of a group only once, so the connections of one
+ * child all join different groups and -g can't be smaller than -c.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <corosync/corotypes.h>
+#include <corosync/cpg.h>
+
+static void cpg_deliver_fn (
+        cpg_handle_t handle,
+        const struct cpg_name *group_name,
+        uint32_t nodeid,
+        uint32_t pid,
+        void *m,
+        size_t msg_len)
+{
+}
+
+static void cpg_confchg_fn (
+        cpg_handle_t handle,
+        const struct cpg_name *group_name,
+        const struct cpg_address *member_list, size_t member_list_entries,
+        const struct cpg_address *left_list, size_t left_list_entries,
+        const struct cpg_address *joined_list, size_t joined_list_entries)
+{
+}
+
+static cpg_callbacks_t callbacks = {
+	cpg_deliver_fn,
+	cpg_confchg_fn
+};
+
+static void sigintr_handler (int num)
+{
+	exit (1);
+}
+
+static double elapsed_get (const struct timeval *tv1)
+{
+	struct timeval tv2, tv_elapsed;
+
+	gettimeofday (&tv2, NULL);
+	timersub (&tv2, tv1, &tv_elapsed);
+
+	return (tv_elapsed.tv_sec + (tv_elapsed.tv_usec / 1000000.0));
+}
+
+static void group_name_set (struct cpg_name *group_name, int group)
+{
+	group_name->length = snprintf (group_name->value, CPG_MAX_NAME_LENGTH,
+		"stress_cpgmembers%d", group);
+}
+
+static cs_error_t cpg_join_retry (cpg_handle_t handle, const struct cpg_name *group_name)
+{
+	cs_error_t res;
+
+	do {
+		res = cpg_join (handle, group_name);
+		if (res == CS_ERR_TRY_AGAIN) {
+			usleep (10000);
+		}
+	} while (res == CS_ERR_TRY_AGAIN);
+
+	return (res);
+}
+
+static int child_run (int child, int connections, int groups, int ready_fd, int leave_fd)
+{
+	cpg_handle_t *handle;
+	struct cpg_name group_name;
+	struct timeval tv1;
+	cs_error_t res;
+	char c;
+	int i;
+
+	handle = calloc (connections, sizeof (cpg_handle_t));
+	if (handle == NULL) {
+		printf ("FAIL out of memory\n");
+		return (1);
+	}
+
+	gettimeofday (&tv1, NULL);
+	for (i = 0; i < connections; i++) {
+		res = cpg_initialize (&handle[i], &callbacks);
+		if (res != CS_OK) {
+			printf ("FAIL cpg_initialize %d (connection %d)\n", res, i);
+			return (1);
+		}
+
+		group_name_set (&group_name, (child * connections + i) % groups);
+		res = cpg_join_retry (handle[i], &group_name);
+		if (res != CS_OK) {
+			printf ("FAIL cpg_join %d (connection %d)\n", res, i);
+			return (1);
+		}
+	}
+	printf ("child %d: %d joins %7.3f Seconds\n", child, connections, elapsed_get (&tv1));
+
+	c = 0;
+	if (write (ready_fd, &c, 1) != 1) {
+		return (1);
+	}
+	/*
+	 * Closed pipe means leave as well
+	 */
+	if (read (leave_fd, &c, 1) < 0) {
+		return (1);
+	}
+
+	for (i = 0; i < connections; i++) {
+		cpg_finalize (handle[i]);
+	}
+	free (handle);
+
+	return (0);
+}
+
+/*
+ * Count members of one group or of all groups with the iteration API, which
+ * unlike cpg_membership_get is not limited to PROCESSOR_COUNT_MAX entries.
+ */
+static int members_count (cpg_handle_t handle, const struct cpg_name *group_name)
+{
+	cpg_iteration_handle_t iter_handle;
+	struct cpg_iteration_description_t description;
+	cs_error_t res;
+	int count = 0;
+
+	res = cpg_iteration_initialize (handle,
+		group_name != NULL ? CPG_ITERATION_ONE_GROUP : CPG_ITERATION_ALL,
+		group_name, &iter_handle);
+	if (res != CS_OK) {
+		printf ("FAIL cpg_iteration_initialize %d\n", res);
+		return (-1);
+	}
+
+	while (cpg_iteration_next (iter_handle, &description) == CS_OK) {
+		if (strncmp (description.group.value, "stress_cpgmembers",
+		    strlen ("stress_cpgmembers")) == 0) {
+			count++;
+		}
+	}
+	cpg_iteration_finalize (iter_handle);
+
+	return (count);
+}
+
+static void usage (const char *cmd)
+{
+	printf ("%s [-p processes] [-c connections] [-g groups]\n\n", cmd);
+	printf ("  -p   number of child processes (default 100)\n");
+	printf ("  -c   connections joined by each child (default 10)\n");
+	printf ("  -g   number of groups the members are spread over, at least\n");
+	printf ("       connections (default 10)\n");
+}
+
+int main (int argc, char *argv[])
+{
+	cpg_handle_t handle;
+	struct cpg_name group_name;
+	struct cpg_address member_list[CPG_MEMBERS_MAX];
+	int member_list_entries;
+	struct timeval tv1;
+	int ready_pipe[2], leave_pipe[2];
+	int processes = 100;
+	int connections = 10;
+	int groups = 10;
+	int expected, count;
+	int failed = 0;
+	pid_t pid;
+	char c;
+	int opt;
+	int i;
+
+	while ((opt = getopt (argc, argv, "p:c:g:h")) != -1) {
+		switch (opt) {
+		case 'p':
+			processes = atoi (optarg);
+			break;
+		case 'c':
+			connections = atoi (optarg);
+			break;
+		case 'g':
+			groups = atoi (optarg);
+			break;
+		case 'h':
+		default:
+			usage (argv[0]);
+			exit (0);
+		}
+	}
+	if (processes < 1 || connections < 1 || groups < connections) {
+		usage (argv[0]);
+		exit (1);
+	}
+	expected = processes * connections;
+
+	signal (SIGINT, sigintr_handler);
+
+	if (pipe (ready_pipe) != 0 || pipe (leave_pipe) != 0) {
+		printf ("FAIL pipe %s\n", strerror (errno));
+		exit (1);
+	}
+
+	gettimeofday (&tv1, NULL);
+	for (i = 0; i < processes; i++) {
+		pid = fork ();
+		if (pid == -1) {
+			printf ("FAIL fork %s\n", strerror (errno));
+			exit (1);
+		}
+		if (pid == 0) {
+			close (ready_pipe[0]);
+			close (leave_pipe[1]);
+			exit (child_run (i, connections, groups, ready_pipe[1], leave_pipe[0]));
+		}
+	}
+	close (ready_pipe[1]);
+	close (leave_pipe[0]);
+
+	if (cpg_initialize (&handle, &callbacks) != CS_OK) {
+		printf ("FAIL cpg_initialize\n");
+		exit (1);
+	}
+
+	for (i = 0; i < processes; i++) {
+		if (read (ready_pipe[0], &c, 1) != 1) {
+			printf ("FAIL child exited before joining\n");
+			failed = 1;
+			break;
+		}
+	}
+	if (!failed) {
+		printf ("%d members joined %7.3f Seconds\n", expected, elapsed_get (&tv1));
+
+		gettimeofday (&tv1, NULL);
+		count = members_count (handle, NULL);
+		printf ("%d members iterated %7.3f Seconds\n", count, elapsed_get (&tv1));
+		if (count != expected) {
+			printf ("FAIL expected %d members\n", expected);
+			failed = 1;
+		}
+
+		gettimeofday (&tv1, NULL);
+		count = 0;
+		for (i = 0; i < groups; i++) {
+			group_name_set (&group_name, i);
+			count += members_count (handle, &group_name);
+
+			member_list_entries = CPG_MEMBERS_MAX;
+			if (cpg_membership_get (handle, &group_name,
+			    member_list, &member_list_entries) != CS_OK) {
+				printf ("FAIL cpg_membership_get\n");
+				failed = 1;
+			}
+		}
+		printf ("%d groups queried %7.3f Seconds\n", groups, elapsed_get (&tv1));
+		if (count != expected) {
+			printf ("FAIL expected %d members in groups\n", expected);
+			failed = 1;
+		}
+	}
+
+	/*
+	 * Let the children leave and wait until corosync has removed them
+	 */
+	gettimeofday (&tv1, NULL);
+	for (i = 0; i < processes; i++) {
+		c = 0;
+		if (write (leave_pipe[1], &c, 1) != 1) {
+			break;
+		}
+	}
+	close (leave_pipe[1]);
+	while (wait (NULL) > 0 || errno == EINTR) {
+	}
+	while ((count = members_count (handle, NULL)) > 0) {
+		usleep (10000);
+	}
+	printf ("%d members left %7.3f Seconds\n", expected, elapsed_get (&tv1));
+	if (count < 0) {
+		failed = 1;
+	}
+
+	cpg_finalize (handle);
+
+	if (failed) {
+		exit (1);
+	}
+	printf ("PASS\n");
+	return (0);
+}
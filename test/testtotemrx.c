@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Test of totemrx ordering and flushing.
+ *
+ * totemrx.c is included, so the free running queue indexes can be started
+ * just before they wrap (at 2^31, where the signed difference changes sign,
+ * and at 2^32).  Frames are written into a datagram socketpair, received
+ * by the totemrx thread and must be delivered to the main loop complete and
+ * in order.  Queued frames must be dropped by totemrx_flush, both outside
+ * and inside of deliver_fn, and frames received afterwards delivered again.
+ */
+
+#include "../exec/totemrx.c"
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#define TEST_QUEUE_LEN	16
+#define TEST_FRAMES	100
+#define TEST_FRAME_LEN	64
+
+static qb_loop_t *loop;
+static int sockets[2];
+
+static uint32_t expected_seq;
+static unsigned int delivered;
+static unsigned int deliver_stop;
+static int flush_in_deliver;
+static int failed;
+
+static void *frame_buffer_alloc (void)
+{
+	return (malloc (TEST_FRAME_LEN + 1));
+}
+
+static void frame_buffer_release (void *ptr)
+{
+	free (ptr);
+}
+
+static void frames_send (uint32_t first_seq, unsigned int count)
+{
+	char frame[TEST_FRAME_LEN];
+	uint32_t seq;
+
+	memset (frame, 0, sizeof (frame));
+	for (seq = first_seq; seq < first_seq + count; seq++) {
+		memcpy (frame, &seq, sizeof (seq));
+		if (send (sockets[1], frame, sizeof (frame), MSG_NOSIGNAL) != sizeof (frame)) {
+			printf ("FAIL send %s\n", strerror (errno));
+			exit (1);
+		}
+	}
+}
+
+static void deliver_fn (
+	void *context,
+	void *msg,
+	unsigned int msg_len,
+	const struct sockaddr_storage *system_from,
+	void **rx_buffer)
+{
+	struct totemrx *rx = (struct totemrx *)context;
+	uint32_t seq;
+
+	memcpy (&seq, msg, sizeof (seq));
+	if (msg_len != TEST_FRAME_LEN || seq != expected_seq) {
+		printf ("FAIL got frame %u (len %u), expected %u\n", seq, msg_len, expected_seq);
+		failed = 1;
+	}
+	expected_seq = seq + 1;
+	delivered++;
+
+	if (flush_in_deliver) {
+		flush_in_deliver = 0;
+		if (totemrx_flush (rx) != TEST_QUEUE_LEN - 1) {
+			printf ("FAIL flush in deliver_fn\n");
+			failed = 1;
+		}
+	}
+
+	if (delivered == deliver_stop) {
+		qb_loop_stop (loop);
+	}
+}
+
+/*
+ * Wait until the worker has queued count frames after index
+ */
+static int queued_wait (struct totemrx *rx, uint32_t index, unsigned int count)
+{
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		if (__atomic_load_n (&rx->tail, __ATOMIC_ACQUIRE) - index == count) {
+			return (0);
+		}
+		usleep (1000);
+	}
+
+	printf ("FAIL frames were not queued\n");
+	return (-1);
+}
+
+static int test_run (uint32_t first_index)
+{
+	struct totemrx *rx;
+	struct totemrx_stats stats;
+
+	if (socketpair (AF_UNIX, SOCK_DGRAM, 0, sockets) == -1) {
+		printf ("FAIL socketpair %s\n", strerror (errno));
+		return (-1);
+	}
+
+	loop = qb_loop_create ();
+	rx = totemrx_create_at (loop, sockets[0], TEST_QUEUE_LEN, 4, TEST_FRAME_LEN + 1,
+		frame_buffer_alloc, frame_buffer_release, deliver_fn, NULL, NULL, first_index);
+	if (rx == NULL) {
+		printf ("FAIL totemrx_create %s\n", strerror (errno));
+		return (-1);
+	}
+	/*
+	 * deliver_fn flushes through its context
+	 */
+	rx->context = rx;
+	failed = 0;
+
+	/*
+	 * All frames delivered in order across the wrap
+	 */
+	expected_seq = 0;
+	delivered = 0;
+	deliver_stop = TEST_FRAMES;
+	frames_send (0, TEST_FRAMES);
+	qb_loop_run (loop);
+
+	/*
+	 * Flush from main loop drops everything queued
+	 */
+	frames_send (TEST_FRAMES, TEST_QUEUE_LEN);
+	if (queued_wait (rx, rx->head, TEST_QUEUE_LEN) != 0) {
+		return (-1);
+	}
+	if (totemrx_flush (rx) != TEST_QUEUE_LEN) {
+		printf ("FAIL flush dropped wrong number of frames\n");
+		failed = 1;
+	}
+
+	/*
+	 * Flush from deliver_fn drops frames after the one being delivered
+	 */
+	frames_send (TEST_FRAMES + TEST_QUEUE_LEN, TEST_QUEUE_LEN);
+	if (queued_wait (rx, rx->head, TEST_QUEUE_LEN) != 0) {
+		return (-1);
+	}
+	expected_seq = TEST_FRAMES + TEST_QUEUE_LEN;
+	flush_in_deliver = 1;
+	deliver_stop = delivered + 1;
+	pipe_write (rx->deliver_pipe[1]);
+	qb_loop_run (loop);
+
+	/*
+	 * And frames received later are delivered again
+	 */
+	expected_seq = TEST_FRAMES + 2 * TEST_QUEUE_LEN;
+	deliver_stop = delivered + TEST_FRAMES;
+	frames_send (expected_seq, TEST_FRAMES);
+	qb_loop_run (loop);
+
+	totemrx_stats_get (rx, &stats);
+	if (stats.frames != 2 * TEST_FRAMES + 2 * TEST_QUEUE_LEN ||
+	    stats.discarded != 2 * TEST_QUEUE_LEN - 1) {
+		printf ("FAIL stats frames %" PRIu64 " discarded %" PRIu64 "\n",
+			stats.frames, stats.discarded);
+		failed = 1;
+	}
+
+	totemrx_destroy (rx);
+	qb_loop_destroy (loop);
+	close (sockets[0]);
+	close (sockets[1]);
+
+	printf ("%s first index 0x%08x, %u frames delivered\n",
+		failed ? "FAIL" : "PASS", first_index, delivered);
+
+	return (failed ? -1 : 0);
+}
+
+int main (void)
+{
+	uint32_t first_index[] = { 0, 0x7ffffff0, 0xfffffff0 };
+	int res = 0;
+	int i;
+
+	for (i = 0; i < sizeof (first_index) / sizeof (first_index[0]); i++) {
+		if (test_run (first_index[i]) != 0) {
+			res = 1;
+		}
+	}
+
+	return (res);
+}
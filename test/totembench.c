@@ -0,0 +1,1459 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Totem microbenchmark
+ *
+ * Runs totemsrp and totempg from the corosync executive in a single
+ * process without any network.  The totemnet interface is implemented
+ * here as an in-process loopback bus, so every frame a node sends is
+ * queued in memory and handed to the receiving nodes from the main loop.
+ *
+ * Two rings are formed on the bus.  The srp ring consists only of bare
+ * totemsrp instances and is used to measure totemsrp_mcast and the
+ * handling of tokens and multicast messages.  The pg ring contains the
+ * totempg instance of this process plus bare totemsrp peers and is used
+ * to measure the totempg send and receive paths.
+ *
+ * Frames sent by the totempg node are recorded by one of its peers and
+ * multicast back to it afterwards, so the totempg receive path is measured
+ * with the same frames the send path produced.
+ *
+ * For every message size the following is reported:
+ *
+ *   totemsrp_mcast           one call queueing a message on the srp ring
+ *   orf_token_mcast          handling of one token on the srp ring that
+ *                            carries no retransmit requests
+ *   orf_token_rtr            handling of one token on the srp ring that
+ *                            carries retransmit requests, only seen when
+ *                            multicast messages are lost (-l)
+ *   messages_deliver_to_app  handling of one multicast frame on an srp
+ *                            ring node other than the sender
+ *   mcast_msg                one totempg_groups_mcast_joined call
+ *   totempg_deliver_fn       handling of one multicast frame by the totempg
+ *                            node, including the totemsrp receive path
+ *
+ * Time spent copying frames onto the bus is part of the measured calls,
+ * in the same way sendmsg is when running over a real network.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <qb/qblog.h>
+#include <qb/qbloop.h>
+#include <qb/qbutil.h>
+
+#include <corosync/corotypes.h>
+#include <corosync/logsys.h>
+#include <corosync/icmap.h>
+#include <corosync/totem/totem.h>
+#include <corosync/totem/totempg.h>
+
+#include "../exec/totemsrp.h"
+#include "../exec/totemsrp_msg.h"
+#include "../exec/totemnet.h"
+#include "../exec/totemconfig.h"
+
+#define BENCH_NODES_MAX		16
+
+#define BENCH_RING_SRP		0
+#define BENCH_RING_PG		1
+#define BENCH_RINGS		2
+
+#define BENCH_PORT		5405
+
+/*
+ * Frames up to this size are recycled through a free list
+ */
+#define BENCH_FRAME_SMALL	2048
+
+#define BENCH_DISPATCH_BURST	64
+
+#define BENCH_SEND_BURST	64
+
+#define BENCH_FORM_TIMEOUT	(30 * QB_TIME_NS_IN_SEC)
+
+#define BENCH_PHASE_TIMEOUT	(120 * QB_TIME_NS_IN_SEC)
+
+/*
+ * Upper bound for the data sent through totempg per message size, it is
+ * recorded for the replay
+ */
+#define BENCH_REPLAY_BYTES_MAX	(64 * 1024 * 1024)
+
+enum bench_counter_type {
+	BENCH_SRP_MCAST,
+	BENCH_SRP_TOKEN,
+	BENCH_SRP_TOKEN_RTR,
+	BENCH_SRP_DELIVER,
+	BENCH_PG_MCAST,
+	BENCH_PG_DELIVER,
+	BENCH_COUNTER_MAX
+};
+
+static const char *bench_counter_names[BENCH_COUNTER_MAX] = {
+	"totemsrp_mcast",
+	"orf_token_mcast",
+	"orf_token_rtr",
+	"messages_deliver_to_app",
+	"mcast_msg",
+	"totempg_deliver_fn"
+};
+
+struct bench_counter {
+	uint64_t ops;
+	uint64_t ns;
+	uint64_t allocs;
+};
+
+/*
+ * Measurements nest, for example a token handler flushes the multicast
+ * messages received before it.  Time and allocations of a nested
+ * measurement are only charged to the inner one.
+ */
+struct bench_measure {
+	struct bench_measure *parent;
+	uint64_t ns;
+	uint64_t allocs;
+	uint64_t child_ns;
+	uint64_t child_allocs;
+};
+
+struct bench_frame {
+	struct bench_frame *next;
+	int token;
+	unsigned int msg_len;
+	unsigned int size;
+	unsigned char msg[];
+};
+
+/*
+ * One node on the bus.  The node is also the totemnet context handed
+ * back to totemsrp.
+ */
+struct bench_node {
+	int index;
+	int ring;
+	unsigned int nodeid;
+	struct totem_config totem_config;
+	totempg_stats_t stats;
+	void *srp_context;
+	size_t members;
+
+	void *context;
+	int (*deliver_fn) (
+		void *context,
+		const void *msg,
+		unsigned int msg_len,
+		const struct sockaddr_storage *system_from,
+		void **rx_buffer);
+	int (*iface_change_fn) (
+		void *context,
+		const struct totem_ip_address *iface_address,
+		unsigned int iface_no);
+	void (*target_set_completed) (
+		void *context);
+
+	struct totem_ip_address boundto;
+	struct sockaddr_storage system_from;
+	unsigned int token_target;
+	int processor_count;
+	int attached;
+	struct bench_frame *head;
+	struct bench_frame *tail;
+	unsigned int mcast_queued;
+	void *recv_buffer;
+};
+
+enum bench_phase_type {
+	BENCH_PHASE_SRP,
+	BENCH_PHASE_PG_SEND,
+	BENCH_PHASE_PG_RECV
+};
+
+struct bench_phase {
+	enum bench_phase_type type;
+	int ring;
+	unsigned int size;
+	unsigned int count;
+	unsigned int sent;
+	unsigned int delivered;
+	unsigned int expected;
+	int draining;
+};
+
+static qb_loop_t *bench_loop;
+
+static struct bench_node bench_nodes[BENCH_RINGS * BENCH_NODES_MAX];
+
+static int bench_node_count;
+
+static int bench_nodes_per_ring = 3;
+
+static struct bench_node *bench_current;
+
+static struct bench_frame *bench_frame_free_list;
+
+static int bench_dispatch_queued;
+
+static int bench_measure_ring = -1;
+
+static unsigned int bench_loss_percent;
+
+static int bench_verbose;
+
+static struct bench_counter bench_counters[BENCH_COUNTER_MAX];
+
+static struct bench_measure *bench_measure_current;
+
+static struct bench_phase *bench_phase;
+
+/*
+ * Frames recorded for the replay, each one preceded by its length
+ */
+static unsigned char *bench_replay;
+
+static size_t bench_replay_len;
+
+static size_t bench_replay_size;
+
+static size_t bench_replay_offset;
+
+static void *bench_pg_handle;
+
+static int bench_timed_out;
+
+static char bench_data[MESSAGE_SIZE_MAX];
+
+/*
+ * Allocation accounting.  malloc and friends are interposed so the number
+ * of allocations made by the measured code paths can be reported.
+ */
+#ifdef __GLIBC__
+#define BENCH_COUNT_ALLOCS 1
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void __libc_free (void *ptr);
+#endif
+
+static int bench_alloc_counting;
+
+static uint64_t bench_alloc_count;
+
+#ifdef BENCH_COUNT_ALLOCS
+void *malloc (size_t size)
+{
+	if (bench_alloc_counting) {
+		bench_alloc_count++;
+	}
+	return (__libc_malloc (size));
+}
+
+void *calloc (size_t nmemb, size_t size)
+{
+	if (bench_alloc_counting) {
+		bench_alloc_count++;
+	}
+	return (__libc_calloc (nmemb, size));
+}
+
+void *realloc (void *ptr, size_t size)
+{
+	if (bench_alloc_counting) {
+		bench_alloc_count++;
+	}
+	return (__libc_realloc (ptr, size));
+}
+
+void free (void *ptr)
+{
+	__libc_free (ptr);
+}
+#endif
+
+static inline void bench_measure_start (struct bench_measure *measure)
+{
+	measure->parent = bench_measure_current;
+	measure->child_ns = 0;
+	measure->child_allocs = 0;
+	bench_measure_current = measure;
+	measure->allocs = bench_alloc_count;
+	bench_alloc_counting = 1;
+	measure->ns = qb_util_nano_current_get ();
+}
+
+static inline void bench_measure_cancel (struct bench_measure *measure)
+{
+	bench_measure_current = measure->parent;
+	if (bench_measure_current == NULL) {
+		bench_alloc_counting = 0;
+	}
+}
+
+static inline void bench_measure_end (enum bench_counter_type type,
+	struct bench_measure *measure)
+{
+	struct bench_counter *counter = &bench_counters[type];
+	uint64_t ns;
+	uint64_t allocs;
+
+	ns = qb_util_nano_current_get () - measure->ns;
+	allocs = bench_alloc_count - measure->allocs;
+
+	bench_measure_cancel (measure);
+	if (measure->parent) {
+		measure->parent->child_ns += ns;
+		measure->parent->child_allocs += allocs;
+	}
+
+	counter->ns += ns - measure->child_ns;
+	counter->allocs += allocs - measure->child_allocs;
+	counter->ops += 1;
+}
+
+/*
+ * Stand-ins for the parts of the executive totemsrp links against
+ */
+icmap_map_t icmap_get_global_map (void)
+{
+	return (NULL);
+}
+
+int totemconfig_commit_new_params (
+	struct totem_config *totem_config,
+	icmap_map_t map)
+{
+	return (0);
+}
+
+static void bench_log_printf (
+	int level,
+	int subsys,
+	const char *function_name,
+	const char *file_name,
+	int file_line,
+	const char *format,
+	...) __attribute__((format(printf, 6, 7)));
+
+static void bench_log_printf (
+	int level,
+	int subsys,
+	const char *function_name,
+	const char *file_name,
+	int file_line,
+	const char *format,
+	...)
+{
+	va_list ap;
+
+	if (level > LOGSYS_LEVEL_WARNING + bench_verbose) {
+		return;
+	}
+
+	va_start (ap, format);
+	vfprintf (stderr, format, ap);
+	fprintf (stderr, "\n");
+	va_end (ap);
+}
+
+static void bench_ring_id_create_or_load (
+	struct memb_ring_id *memb_ring_id,
+	unsigned int nodeid)
+{
+	memb_ring_id->rep = nodeid;
+	memb_ring_id->seq = 0;
+}
+
+static void bench_ring_id_store (
+	const struct memb_ring_id *memb_ring_id,
+	unsigned int nodeid)
+{
+}
+
+/*
+ * Loopback bus
+ */
+static struct bench_frame *bench_frame_get (unsigned int msg_len)
+{
+	struct bench_frame *frame;
+	unsigned int size;
+	int alloc_counting;
+
+	if (msg_len <= BENCH_FRAME_SMALL && bench_frame_free_list != NULL) {
+		frame = bench_frame_free_list;
+		bench_frame_free_list = frame->next;
+		return (frame);
+	}
+
+	size = msg_len <= BENCH_FRAME_SMALL ? BENCH_FRAME_SMALL : msg_len;
+
+	/*
+	 * The bus stands in for the network, so its allocations are not
+	 * charged to the code being measured
+	 */
+	alloc_counting = bench_alloc_counting;
+	bench_alloc_counting = 0;
+	frame = malloc (sizeof (struct bench_frame) + size);
+	bench_alloc_counting = alloc_counting;
+	assert (frame != NULL);
+	frame->size = size;
+	return (frame);
+}
+
+static void bench_frame_put (struct bench_frame *frame)
+{
+	if (frame->size == BENCH_FRAME_SMALL) {
+		frame->next = bench_frame_free_list;
+		bench_frame_free_list = frame;
+	} else {
+		free (frame);
+	}
+}
+
+static void bench_dispatch_job (void *data);
+
+static void bench_frame_queue (
+	struct bench_node *node,
+	const void *msg,
+	unsigned int msg_len,
+	int token)
+{
+	struct bench_frame *frame;
+
+	frame = bench_frame_get (msg_len);
+	frame->next = NULL;
+	frame->token = token;
+	frame->msg_len = msg_len;
+	memcpy (frame->msg, msg, msg_len);
+
+	if (node->tail) {
+		node->tail->next = frame;
+	} else {
+		node->head = frame;
+	}
+	node->tail = frame;
+	if (token == 0) {
+		node->mcast_queued += 1;
+	}
+
+	if (bench_dispatch_queued == 0) {
+		bench_dispatch_queued = 1;
+		qb_loop_job_add (bench_loop, QB_LOOP_MED, NULL, bench_dispatch_job);
+	}
+}
+
+static void bench_frame_deliver (
+	struct bench_node *node,
+	struct bench_frame *frame)
+{
+	const struct totem_message_header *header =
+		(const struct totem_message_header *)frame->msg;
+	struct bench_node *current_saved;
+	enum bench_counter_type type = BENCH_COUNTER_MAX;
+	struct bench_measure measure;
+	const void *msg = frame->msg;
+	void **rx_buffer = NULL;
+	int alloc_counting;
+
+	if (node->ring == bench_measure_ring) {
+		if (frame->token) {
+			if (node->ring == BENCH_RING_SRP) {
+				type = BENCH_SRP_TOKEN;
+				if (((const struct orf_token *)frame->msg)->rtr_list_entries > 0) {
+					type = BENCH_SRP_TOKEN_RTR;
+				}
+			}
+		} else
+		if (header->type == MESSAGE_TYPE_MCAST &&
+		    header->nodeid != node->nodeid) {
+			if (node->ring == BENCH_RING_SRP) {
+				type = BENCH_SRP_DELIVER;
+			} else
+			if (node->srp_context == NULL) {
+				type = BENCH_PG_DELIVER;
+			}
+		}
+	}
+
+	current_saved = bench_current;
+	if (current_saved != node) {
+		/*
+		 * Copy the frame into the node's receive buffer as recvmsg()
+		 * would, so totemsrp can keep it like it does with the real
+		 * transports.  Frames delivered by recv_flush while the node is
+		 * busy with another one are handed over directly instead.
+		 */
+		if (node->recv_buffer == NULL) {
+			alloc_counting = bench_alloc_counting;
+			bench_alloc_counting = 0;
+			node->recv_buffer = totemnet_buffer_alloc (node);
+			bench_alloc_counting = alloc_counting;
+			assert (node->recv_buffer != NULL);
+		}
+		memcpy (node->recv_buffer, frame->msg, frame->msg_len);
+		msg = node->recv_buffer;
+		rx_buffer = &node->recv_buffer;
+	}
+
+	bench_current = node;
+	if (type != BENCH_COUNTER_MAX) {
+		bench_measure_start (&measure);
+		node->deliver_fn (node->context, msg, frame->msg_len,
+			&node->system_from, rx_buffer);
+		bench_measure_end (type, &measure);
+	} else {
+		node->deliver_fn (node->context, msg, frame->msg_len,
+			&node->system_from, rx_buffer);
+	}
+	bench_current = current_saved;
+}
+
+static struct bench_frame *bench_frame_dequeue (
+	struct bench_node *node,
+	int mcast_only)
+{
+	struct bench_frame *frame;
+	struct bench_frame *prev = NULL;
+
+	for (frame = node->head; frame != NULL; frame = frame->next) {
+		if (mcast_only == 0 || frame->token == 0) {
+			break;
+		}
+		prev = frame;
+	}
+	if (frame == NULL) {
+		return (NULL);
+	}
+
+	if (prev) {
+		prev->next = frame->next;
+	} else {
+		node->head = frame->next;
+	}
+	if (node->tail == frame) {
+		node->tail = prev;
+	}
+	if (frame->token == 0) {
+		node->mcast_queued -= 1;
+	}
+	return (frame);
+}
+
+/*
+ * Hands queued frames to the nodes, one frame per node per pass so no
+ * node can starve the others
+ */
+static void bench_dispatch_job (void *data)
+{
+	struct bench_frame *frame;
+	int delivered = 0;
+	int pass_delivered;
+	int i;
+
+	bench_dispatch_queued = 0;
+
+	do {
+		pass_delivered = 0;
+		for (i = 0; i < bench_node_count; i++) {
+			frame = bench_frame_dequeue (&bench_nodes[i], 0);
+			if (frame == NULL) {
+				continue;
+			}
+			bench_frame_deliver (&bench_nodes[i], frame);
+			bench_frame_put (frame);
+			pass_delivered++;
+		}
+		delivered += pass_delivered;
+	} while (pass_delivered > 0 && delivered < BENCH_DISPATCH_BURST);
+
+	for (i = 0; i < bench_node_count; i++) {
+		if (bench_nodes[i].head != NULL && bench_dispatch_queued == 0) {
+			bench_dispatch_queued = 1;
+			qb_loop_job_add (bench_loop, QB_LOOP_MED, NULL,
+				bench_dispatch_job);
+		}
+	}
+
+	/*
+	 * Nothing is left on the bus only once the ring representative holds
+	 * the token, which it does after the ring has been idle for a while
+	 */
+	if (bench_dispatch_queued == 0 && bench_phase != NULL &&
+	    bench_phase->draining) {
+		qb_loop_stop (bench_loop);
+	}
+}
+
+static void bench_mcast_send (
+	struct bench_node *from,
+	const void *msg,
+	unsigned int msg_len)
+{
+	const struct totem_message_header *header = msg;
+	struct bench_node *node;
+	int i;
+
+	for (i = 0; i < bench_node_count; i++) {
+		node = &bench_nodes[i];
+		if (node->ring != from->ring || node->attached == 0) {
+			continue;
+		}
+		if (node != from && bench_loss_percent &&
+		    from->ring == BENCH_RING_SRP &&
+		    from->ring == bench_measure_ring &&
+		    header->type == MESSAGE_TYPE_MCAST &&
+		    (unsigned int)(random () % 100) < bench_loss_percent) {
+			continue;
+		}
+		bench_frame_queue (node, msg, msg_len, 0);
+	}
+}
+
+static void bench_iface_change_job (void *data)
+{
+	struct bench_node *node = data;
+	struct bench_node *current_saved;
+
+	node->attached = 1;
+	current_saved = bench_current;
+	bench_current = node;
+	node->iface_change_fn (node->context, &node->boundto, 0);
+	bench_current = current_saved;
+}
+
+/*
+ * totemnet interface implemented on top of the loopback bus
+ */
+int totemnet_initialize (
+	qb_loop_t *loop_pt,
+	void **net_context,
+	struct totem_config *totem_config,
+	totemsrp_stats_t *stats,
+	void *context,
+
+	int (*deliver_fn) (
+		void *context,
+		const void *msg,
+		unsigned int msg_len,
+		const struct sockaddr_storage *system_from,
+		void **rx_buffer),
+
+	int (*iface_change_fn) (
+		void *context,
+		const struct totem_ip_address *iface_address,
+		unsigned int iface_no),
+
+	void (*mtu_changed) (
+		void *context,
+		int net_mtu),
+
+	void (*target_set_completed) (
+		void *context))
+{
+	struct bench_node *node = NULL;
+	int i;
+
+	for (i = 0; i < bench_node_count; i++) {
+		if (&bench_nodes[i].totem_config == totem_config) {
+			node = &bench_nodes[i];
+		}
+	}
+	if (node == NULL) {
+		return (-1);
+	}
+
+	node->context = context;
+	node->deliver_fn = deliver_fn;
+	node->iface_change_fn = iface_change_fn;
+	node->target_set_completed = target_set_completed;
+	*net_context = node;
+	return (0);
+}
+
+void *totemnet_buffer_alloc (void *net_context)
+{
+	return malloc (FRAME_SIZE_MAX);
+}
+
+void totemnet_buffer_release (void *net_context, void *ptr)
+{
+	free (ptr);
+}
+
+int totemnet_processor_count_set (
+	void *net_context,
+	int processor_count)
+{
+	struct bench_node *node = net_context;
+
+	node->processor_count = processor_count;
+	return (0);
+}
+
+int totemnet_token_send (
+	void *net_context,
+	const void *msg,
+	unsigned int msg_len)
+{
+	struct bench_node *from = net_context;
+	struct bench_node *node;
+	int i;
+
+	for (i = 0; i < bench_node_count; i++) {
+		node = &bench_nodes[i];
+		if (node->ring == from->ring && node->attached &&
+		    node->nodeid == from->token_target) {
+			bench_frame_queue (node, msg, msg_len, 1);
+			break;
+		}
+	}
+	return (0);
+}
+
+int totemnet_mcast_flush_send (
+	void *net_context,
+	const void *msg,
+	unsigned int msg_len)
+{
+	bench_mcast_send (net_context, msg, msg_len);
+	return (0);
+}
+
+int totemnet_mcast_noflush_send (
+	void *net_context,
+	const void *msg,
+	unsigned int msg_len)
+{
+	bench_mcast_send (net_context, msg, msg_len);
+	return (0);
+}
+
+int totemnet_recv_flush (void *net_context)
+{
+	struct bench_node *node = net_context;
+	struct bench_frame *frame;
+
+	while ((frame = bench_frame_dequeue (node, 1)) != NULL) {
+		bench_frame_deliver (node, frame);
+		bench_frame_put (frame);
+	}
+	return (0);
+}
+
+int totemnet_send_flush (void *net_context)
+{
+	return (0);
+}
+
+int totemnet_iface_set (void *net_context,
+	const struct totem_ip_address *interface_addr,
+	unsigned short ip_port,
+	unsigned int iface_no)
+{
+	struct bench_node *node = net_context;
+
+	memcpy (&node->boundto, interface_addr, sizeof (struct totem_ip_address));
+	qb_loop_job_add (bench_loop, QB_LOOP_MED, node, bench_iface_change_job);
+	return (0);
+}
+
+int totemnet_iface_check (void *net_context)
+{
+	return (0);
+}
+
+int totemnet_finalize (void *net_context)
+{
+	struct bench_node *node = net_context;
+	struct bench_frame *frame;
+
+	node->attached = 0;
+	while ((frame = bench_frame_dequeue (node, 0)) != NULL) {
+		bench_frame_put (frame);
+	}
+	return (0);
+}
+
+int totemnet_net_mtu_adjust (void *net_context, struct totem_config *totem_config)
+{
+	return (0);
+}
+
+int totemnet_reconfigure (void *net_context, struct totem_config *totem_config)
+{
+	return (0);
+}
+
+int totemnet_crypto_reconfigure_phase (void *net_context,
+	struct totem_config *totem_config,
+	cfg_message_crypto_reconfig_phase_t phase)
+{
+	return (0);
+}
+
+void totemnet_stats_clear (void *net_context)
+{
+}
+
+const char *totemnet_iface_print (void *net_context)
+{
+	return ("loopback");
+}
+
+int totemnet_nodestatus_get (
+	void *net_context,
+	unsigned int nodeid,
+	struct totem_node_status *node_status)
+{
+	return (-1);
+}
+
+int totemnet_ifaces_get (
+	void *net_context,
+	char ***status,
+	unsigned int *iface_count)
+{
+	static char bench_status_ok[] = "OK";
+	static char *bench_status[] = { bench_status_ok };
+
+	*status = bench_status;
+	*iface_count = 1;
+	return (0);
+}
+
+int totemnet_token_target_set (
+	void *net_context,
+	unsigned int target_nodeid)
+{
+	struct bench_node *node = net_context;
+
+	node->token_target = target_nodeid;
+	node->target_set_completed (node->context);
+	return (0);
+}
+
+int totemnet_crypto_set (
+	void *net_context,
+	const char *cipher_type,
+	const char *hash_type)
+{
+	return (0);
+}
+
+int totemnet_recv_mcast_empty (
+	void *net_context)
+{
+	struct bench_node *node = net_context;
+
+	return (node->mcast_queued == 0);
+}
+
+int totemnet_member_add (
+	void *net_context,
+	const struct totem_ip_address *local,
+	const struct totem_ip_address *member,
+	int ring_no)
+{
+	return (0);
+}
+
+int totemnet_member_remove (
+	void *net_context,
+	const struct totem_ip_address *member,
+	int ring_no)
+{
+	return (0);
+}
+
+int totemnet_member_set_active (
+	void *net_context,
+	const struct totem_ip_address *member,
+	int active)
+{
+	return (0);
+}
+
+/*
+ * Nodes
+ */
+static void bench_node_config (
+	struct bench_node *node,
+	int ring,
+	unsigned int nodeid)
+{
+	struct totem_config *totem_config = &node->totem_config;
+	struct totem_interface *iface;
+	struct sockaddr_in *sin;
+
+	node->ring = ring;
+	node->nodeid = nodeid;
+
+	totem_config->interfaces = calloc (INTERFACE_MAX,
+		sizeof (struct totem_interface));
+	assert (totem_config->interfaces != NULL);
+	iface = &totem_config->interfaces[0];
+	iface->configured = 1;
+	iface->ip_port = BENCH_PORT + ring;
+	iface->boundto.nodeid = nodeid;
+	iface->boundto.family = AF_INET;
+	iface->boundto.addr[0] = 127;
+	iface->boundto.addr[2] = ring;
+	iface->boundto.addr[3] = nodeid;
+	memcpy (&iface->bindnet, &iface->boundto, sizeof (struct totem_ip_address));
+	memcpy (&iface->mcast_addr, &iface->boundto, sizeof (struct totem_ip_address));
+
+	sin = (struct sockaddr_in *)&node->system_from;
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+	totem_config->node_id = nodeid;
+	totem_config->transport_number = TOTEM_TRANSPORT_UDPU;
+	totem_config->ip_version = TOTEM_IP_VERSION_4;
+	totem_config->net_mtu = 1500;
+
+	totem_config->token_timeout = 1000;
+	totem_config->token_retransmits_before_loss_const = 4;
+	totem_config->token_retransmit_timeout = 238;
+	totem_config->token_hold_timeout = 180;
+	totem_config->join_timeout = 50;
+	totem_config->consensus_timeout = 1200;
+	totem_config->merge_timeout = 200;
+	totem_config->downcheck_timeout = 1000;
+	totem_config->fail_to_recv_const = 2500;
+	totem_config->seqno_unchanged_const = 30;
+	totem_config->max_network_delay = 50;
+	totem_config->window_size = 50;
+	totem_config->max_messages = 17;
+	totem_config->miss_count_const = 5;
+	totem_config->block_unlisted_ips = 1;
+	totem_config->recv_batch = 8;
+	strcpy (totem_config->crypto_cipher_type, "none");
+	strcpy (totem_config->crypto_hash_type, "none");
+
+	totem_config->totem_logging_configuration.log_printf = bench_log_printf;
+	totem_config->totem_logging_configuration.log_level_security = LOGSYS_LEVEL_WARNING;
+	totem_config->totem_logging_configuration.log_level_error = LOGSYS_LEVEL_ERROR;
+	totem_config->totem_logging_configuration.log_level_warning = LOGSYS_LEVEL_WARNING;
+	totem_config->totem_logging_configuration.log_level_notice = LOGSYS_LEVEL_NOTICE;
+	totem_config->totem_logging_configuration.log_level_debug = LOGSYS_LEVEL_DEBUG;
+	totem_config->totem_logging_configuration.log_level_trace = LOGSYS_LEVEL_TRACE;
+
+	totem_config->totem_memb_ring_id_create_or_load = bench_ring_id_create_or_load;
+	totem_config->totem_memb_ring_id_store = bench_ring_id_store;
+}
+
+static void bench_phase_delivered (unsigned int count)
+{
+	if (bench_phase == NULL) {
+		return;
+	}
+	bench_phase->delivered += count;
+	if (bench_phase->delivered < bench_phase->expected) {
+		return;
+	}
+
+	/*
+	 * The totempg node delivers its own messages before the peers do,
+	 * wait until the peer recording them has seen all of them
+	 */
+	if (bench_phase->type == BENCH_PHASE_PG_SEND &&
+	    bench_nodes_per_ring > 1) {
+		bench_phase->draining = 1;
+	} else {
+		qb_loop_stop (bench_loop);
+	}
+}
+
+static void bench_replay_record (const void *msg, unsigned int msg_len)
+{
+	int alloc_counting;
+
+	if (bench_replay_len + sizeof (msg_len) + msg_len > bench_replay_size) {
+		alloc_counting = bench_alloc_counting;
+		bench_alloc_counting = 0;
+		bench_replay_size = (bench_replay_size + msg_len) * 2;
+		bench_replay = realloc (bench_replay, bench_replay_size);
+		assert (bench_replay != NULL);
+		bench_alloc_counting = alloc_counting;
+	}
+	memcpy (&bench_replay[bench_replay_len], &msg_len, sizeof (msg_len));
+	bench_replay_len += sizeof (msg_len);
+	memcpy (&bench_replay[bench_replay_len], msg, msg_len);
+	bench_replay_len += msg_len;
+}
+
+static void bench_srp_deliver_fn (
+	unsigned int nodeid,
+	const void *msg,
+	unsigned int msg_len,
+	int endian_conversion_required)
+{
+	if (bench_current == NULL) {
+		return;
+	}
+	if (bench_current->ring == BENCH_RING_SRP) {
+		bench_phase_delivered (1);
+	} else
+	if (bench_current == &bench_nodes[1] && bench_phase != NULL &&
+	    bench_phase->type == BENCH_PHASE_PG_SEND) {
+		bench_replay_record (msg, msg_len);
+	}
+}
+
+static void bench_srp_confchg_fn (
+	enum totem_configuration_type configuration_type,
+	const unsigned int *member_list, size_t member_list_entries,
+	const unsigned int *left_list, size_t left_list_entries,
+	const unsigned int *joined_list, size_t joined_list_entries,
+	const struct memb_ring_id *ring_id)
+{
+	if (configuration_type == TOTEM_CONFIGURATION_REGULAR &&
+	    bench_current != NULL) {
+		bench_current->members = member_list_entries;
+	}
+}
+
+static void bench_srp_waiting_trans_ack_fn (int waiting_trans_ack)
+{
+}
+
+static void bench_pg_deliver_fn (
+	unsigned int nodeid,
+	const void *msg,
+	unsigned int msg_len,
+	int endian_conversion_required)
+{
+	bench_phase_delivered (1);
+}
+
+static void bench_pg_confchg_fn (
+	enum totem_configuration_type configuration_type,
+	const unsigned int *member_list, size_t member_list_entries,
+	const unsigned int *left_list, size_t left_list_entries,
+	const unsigned int *joined_list, size_t joined_list_entries,
+	const struct memb_ring_id *ring_id)
+{
+	if (configuration_type == TOTEM_CONFIGURATION_REGULAR) {
+		bench_nodes[0].members = member_list_entries;
+	}
+}
+
+static struct totempg_group bench_group = {
+	.group = "totembench",
+	.group_len = 10
+};
+
+static int bench_nodes_create (void)
+{
+	struct bench_node *node;
+	int ring;
+	int i;
+	int res;
+
+	/*
+	 * The totempg node has to be the first one, its confchg callback
+	 * doesn't tell which node it belongs to
+	 */
+	for (ring = BENCH_RING_PG; ring >= BENCH_RING_SRP; ring--) {
+		for (i = 0; i < bench_nodes_per_ring; i++) {
+			node = &bench_nodes[bench_node_count];
+			node->index = bench_node_count;
+			bench_node_config (node, ring, i + 1);
+			bench_node_count++;
+		}
+	}
+
+	for (i = 0; i < bench_node_count; i++) {
+		node = &bench_nodes[i];
+
+		if (i == 0) {
+			res = totempg_initialize (bench_loop, &node->totem_config);
+			if (res != 0) {
+				return (-1);
+			}
+			res = totempg_groups_initialize (&bench_pg_handle,
+				bench_pg_deliver_fn, bench_pg_confchg_fn);
+			if (res != 0) {
+				return (-1);
+			}
+			res = totempg_groups_join (bench_pg_handle, &bench_group, 1);
+			if (res != 0) {
+				return (-1);
+			}
+			res = totempg_iface_set (&node->totem_config.interfaces[0].boundto,
+				node->totem_config.interfaces[0].ip_port, 0);
+		} else {
+			totemsrp_net_mtu_adjust (&node->totem_config);
+			res = totemsrp_initialize (bench_loop, &node->srp_context,
+				&node->totem_config, &node->stats,
+				bench_srp_deliver_fn, bench_srp_confchg_fn,
+				bench_srp_waiting_trans_ack_fn);
+			if (res != 0) {
+				return (-1);
+			}
+			res = totemsrp_iface_set (node->srp_context,
+				&node->totem_config.interfaces[0].boundto,
+				node->totem_config.interfaces[0].ip_port, 0);
+		}
+		if (res != 0) {
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+static void bench_timeout_fn (void *data)
+{
+	bench_timed_out = 1;
+	qb_loop_stop (bench_loop);
+}
+
+static void bench_form_check_fn (void *data)
+{
+	qb_loop_timer_handle timer;
+	int i;
+
+	for (i = 0; i < bench_node_count; i++) {
+		if (bench_nodes[i].members != bench_nodes_per_ring) {
+			qb_loop_timer_add (bench_loop, QB_LOOP_LOW,
+				10 * QB_TIME_NS_IN_MSEC, NULL, bench_form_check_fn,
+				&timer);
+			return;
+		}
+	}
+	qb_loop_stop (bench_loop);
+}
+
+static int bench_rings_form (void)
+{
+	qb_loop_timer_handle timeout_timer;
+	qb_loop_timer_handle timer;
+	int i;
+
+	bench_timed_out = 0;
+	qb_loop_timer_add (bench_loop, QB_LOOP_LOW, BENCH_FORM_TIMEOUT, NULL,
+		bench_timeout_fn, &timeout_timer);
+	qb_loop_timer_add (bench_loop, QB_LOOP_LOW, 10 * QB_TIME_NS_IN_MSEC,
+		NULL, bench_form_check_fn, &timer);
+	qb_loop_run (bench_loop);
+	qb_loop_timer_del (bench_loop, timeout_timer);
+	if (bench_timed_out) {
+		return (-1);
+	}
+
+	/*
+	 * Nothing is synchronized, so the transitional configuration can be
+	 * left right away
+	 */
+	totempg_trans_ack ();
+	for (i = 1; i < bench_node_count; i++) {
+		totemsrp_trans_ack (bench_nodes[i].srp_context);
+	}
+	return (0);
+}
+
+static struct bench_node *bench_srp_sender (void)
+{
+	int i;
+
+	for (i = 0; i < bench_node_count; i++) {
+		if (bench_nodes[i].ring == BENCH_RING_SRP) {
+			return (&bench_nodes[i]);
+		}
+	}
+	return (NULL);
+}
+
+static void bench_send_job (void *data)
+{
+	struct bench_phase *phase = data;
+	struct iovec iov;
+	struct bench_measure measure;
+	unsigned int msg_len;
+	int res;
+	int i;
+
+	iov.iov_base = bench_data;
+	iov.iov_len = phase->size;
+
+	for (i = 0; i < BENCH_SEND_BURST && phase->sent < phase->count; i++) {
+		switch (phase->type) {
+		case BENCH_PHASE_SRP:
+			bench_measure_start (&measure);
+			res = totemsrp_mcast (bench_srp_sender ()->srp_context,
+				&iov, 1, TOTEMPG_AGREED);
+			if (res == 0) {
+				bench_measure_end (BENCH_SRP_MCAST, &measure);
+			} else {
+				bench_measure_cancel (&measure);
+			}
+			break;
+		case BENCH_PHASE_PG_SEND:
+			bench_measure_start (&measure);
+			res = totempg_groups_mcast_joined (bench_pg_handle,
+				&iov, 1, TOTEMPG_AGREED);
+			if (res == 0) {
+				bench_measure_end (BENCH_PG_MCAST, &measure);
+			} else {
+				bench_measure_cancel (&measure);
+			}
+			break;
+		case BENCH_PHASE_PG_RECV:
+		default:
+			if (bench_replay_offset >= bench_replay_len) {
+				phase->sent = phase->count;
+				return;
+			}
+			memcpy (&msg_len, &bench_replay[bench_replay_offset],
+				sizeof (msg_len));
+			iov.iov_base = &bench_replay[bench_replay_offset + sizeof (msg_len)];
+			iov.iov_len = msg_len;
+			res = totemsrp_mcast (bench_nodes[1].srp_context,
+				&iov, 1, TOTEMPG_AGREED);
+			if (res == 0) {
+				bench_replay_offset += sizeof (msg_len) + msg_len;
+				/*
+				 * Messages are counted on delivery
+				 */
+				continue;
+			}
+			break;
+		}
+		if (res != 0) {
+			/*
+			 * Queue is full, let the token drain it
+			 */
+			break;
+		}
+		phase->sent++;
+	}
+
+	if (phase->sent < phase->count) {
+		qb_loop_job_add (bench_loop, QB_LOOP_LOW, phase, bench_send_job);
+	}
+}
+
+static int bench_phase_run (
+	enum bench_phase_type type,
+	unsigned int size,
+	unsigned int count)
+{
+	struct bench_phase phase;
+	qb_loop_timer_handle timeout_timer;
+
+	memset (&phase, 0, sizeof (phase));
+	phase.type = type;
+	phase.size = size;
+	phase.count = count;
+	switch (type) {
+	case BENCH_PHASE_SRP:
+		phase.ring = BENCH_RING_SRP;
+		phase.expected = count * bench_nodes_per_ring;
+		break;
+	case BENCH_PHASE_PG_SEND:
+		phase.ring = BENCH_RING_PG;
+		phase.expected = count;
+		bench_replay_len = 0;
+		break;
+	case BENCH_PHASE_PG_RECV:
+		phase.ring = BENCH_RING_PG;
+		phase.expected = count;
+		bench_replay_offset = 0;
+		break;
+	}
+
+	memset (bench_counters, 0, sizeof (bench_counters));
+	bench_phase = &phase;
+	bench_measure_ring = phase.ring;
+	bench_timed_out = 0;
+
+	qb_loop_timer_add (bench_loop, QB_LOOP_LOW, BENCH_PHASE_TIMEOUT, NULL,
+		bench_timeout_fn, &timeout_timer);
+	qb_loop_job_add (bench_loop, QB_LOOP_LOW, &phase, bench_send_job);
+	qb_loop_run (bench_loop);
+	qb_loop_timer_del (bench_loop, timeout_timer);
+
+	bench_measure_ring = -1;
+	bench_phase = NULL;
+
+	if (bench_timed_out) {
+		fprintf (stderr, "timed out after %u of %u deliveries\n",
+			phase.delivered, phase.expected);
+		return (-1);
+	}
+	return (0);
+}
+
+static void bench_counter_print (unsigned int size, enum bench_counter_type type)
+{
+	struct bench_counter *counter = &bench_counters[type];
+
+	printf ("%7u  %-24s %9llu %10.1f", size, bench_counter_names[type],
+		(unsigned long long)counter->ops,
+		counter->ops ? (double)counter->ns / counter->ops : 0.0);
+#ifdef BENCH_COUNT_ALLOCS
+	printf (" %10.2f\n",
+		counter->ops ? (double)counter->allocs / counter->ops : 0.0);
+#else
+	printf (" %10s\n", "n/a");
+#endif
+}
+
+static void usage (const char *prog)
+{
+	printf ("%s [-n nodes] [-c count] [-s max_size] [-l loss] [-v]\n", prog);
+	printf ("\n");
+	printf ("  -n  number of nodes on each ring, 1-%d (default 3)\n",
+		BENCH_NODES_MAX);
+	printf ("  -c  messages sent for each message size (default 10000)\n");
+	printf ("  -s  largest message size, starting at 64 bytes the size is\n");
+	printf ("      multiplied by 4 (default 65536)\n");
+	printf ("  -l  percentage of multicast messages lost on the srp ring,\n");
+	printf ("      to exercise retransmission (default 0)\n");
+	printf ("  -v  verbose, repeat for more totem logging\n");
+}
+
+int main (int argc, char *argv[])
+{
+	unsigned int count = 10000;
+	unsigned int max_size = 65536;
+	unsigned int srp_max_size;
+	unsigned int pg_count;
+	unsigned int size;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "n:c:s:l:vh")) != -1) {
+		switch (opt) {
+		case 'n':
+			bench_nodes_per_ring = atoi (optarg);
+			break;
+		case 'c':
+			count = strtoul (optarg, NULL, 0);
+			break;
+		case 's':
+			max_size = strtoul (optarg, NULL, 0);
+			break;
+		case 'l':
+			bench_loss_percent = strtoul (optarg, NULL, 0);
+			break;
+		case 'v':
+			bench_verbose++;
+			break;
+		case 'h':
+		default:
+			usage (argv[0]);
+			exit (opt == 'h' ? 0 : 1);
+		}
+	}
+
+	if (bench_nodes_per_ring < 1 || bench_nodes_per_ring > BENCH_NODES_MAX ||
+	    count == 0 || max_size > sizeof (bench_data) ||
+	    bench_loss_percent >= 100) {
+		usage (argv[0]);
+		exit (1);
+	}
+
+	qb_log_init ("totembench", LOG_USER, LOG_EMERG);
+	qb_log_ctl (QB_LOG_SYSLOG, QB_LOG_CONF_ENABLED, QB_FALSE);
+
+	bench_loop = qb_loop_create ();
+	if (bench_loop == NULL) {
+		printf ("qb_loop_create failed\n");
+		exit (1);
+	}
+
+	if (bench_nodes_create () != 0) {
+		printf ("Couldn't create totem instances\n");
+		exit (1);
+	}
+
+	if (bench_rings_form () != 0) {
+		printf ("Rings didn't form\n");
+		exit (1);
+	}
+
+	srp_max_size = bench_srp_sender ()->totem_config.net_mtu;
+
+	printf ("%d nodes per ring, %u messages per size, %u%% loss\n",
+		bench_nodes_per_ring, count, bench_loss_percent);
+	printf ("%7s  %-24s %9s %10s %10s\n",
+		"size", "path", "ops", "ns/op", "allocs/op");
+
+	for (size = 64; size <= max_size; size *= 4) {
+		if (size <= srp_max_size) {
+			if (bench_phase_run (BENCH_PHASE_SRP, size, count) != 0) {
+				exit (1);
+			}
+			bench_counter_print (size, BENCH_SRP_MCAST);
+			bench_counter_print (size, BENCH_SRP_TOKEN);
+			bench_counter_print (size, BENCH_SRP_TOKEN_RTR);
+			bench_counter_print (size, BENCH_SRP_DELIVER);
+		}
+
+		pg_count = count;
+		if ((uint64_t)pg_count * size > BENCH_REPLAY_BYTES_MAX) {
+			pg_count = BENCH_REPLAY_BYTES_MAX / size;
+		}
+
+		if (bench_phase_run (BENCH_PHASE_PG_SEND, size, pg_count) != 0) {
+			exit (1);
+		}
+		bench_counter_print (size, BENCH_PG_MCAST);
+
+		/*
+		 * The totempg node needs a peer to replay its frames
+		 */
+		if (bench_nodes_per_ring > 1) {
+			if (bench_phase_run (BENCH_PHASE_PG_RECV, size, pg_count) != 0) {
+				exit (1);
+			}
+			bench_counter_print (size, BENCH_PG_DELIVER);
+		}
+	}
+
+	return (0);
+}
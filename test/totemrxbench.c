@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the MontaVista Software, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Receive thread microbenchmark
+ *
+ * Compares the two ways totemknet can read frames knet delivers on its
+ * datafd.  A producer thread stands in for the knet receive thread and
+ * writes numbered frames into a datagram socketpair.  They are read either
+ *
+ *   main     by the main loop, recv_batch frames per recvmmsg, as
+ *            data_deliver_fn does
+ *   thread   by a totemrx receive thread and handed to the main loop
+ *
+ * For each frame the main loop checks the sequence number, so frames out
+ * of order are reported, and runs a checksum over the frame -w times as a
+ * stand-in for the protocol work totemsrp does.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/poll.h>
+
+#include <qb/qbdefs.h>
+#include <qb/qbloop.h>
+#include <qb/qbutil.h>
+
+#include "../exec/totemrx.h"
+
+#define RECV_QUEUE_LEN	64
+#define RECV_BATCH_MAX	64
+
+static unsigned int bench_frames = 1000000;
+static unsigned int bench_frame_len = 1024;
+static unsigned int bench_work = 1;
+static unsigned int bench_batch = 8;
+
+static qb_loop_t *loop;
+static int sockets[2];
+
+static uint64_t frames_received;
+static uint64_t frames_misordered;
+static uint32_t checksum;
+
+static void *frame_buffer_alloc (void)
+{
+	return (malloc (bench_frame_len + 1));
+}
+
+static void frame_buffer_release (void *ptr)
+{
+	free (ptr);
+}
+
+static void frame_process (const void *msg, unsigned int msg_len)
+{
+	const unsigned char *data = msg;
+	uint64_t seq;
+	unsigned int i, j;
+
+	memcpy (&seq, msg, sizeof (seq));
+	if (seq != frames_received) {
+		frames_misordered++;
+	}
+
+	for (j = 0; j < bench_work; j++) {
+		for (i = 0; i < msg_len; i++) {
+			checksum = (checksum << 1 | checksum >> 31) ^ data[i];
+		}
+	}
+
+	if (++frames_received == bench_frames) {
+		qb_loop_stop (loop);
+	}
+}
+
+static void *producer_thread (void *data)
+{
+	char *frame;
+	uint64_t seq;
+	ssize_t res;
+
+	frame = malloc (bench_frame_len);
+	if (frame == NULL) {
+		return (NULL);
+	}
+	memset (frame, 0x5a, bench_frame_len);
+
+	for (seq = 0; seq < bench_frames; seq++) {
+		memcpy (frame, &seq, sizeof (seq));
+		do {
+			res = send (sockets[1], frame, bench_frame_len, MSG_NOSIGNAL);
+		} while (res == -1 && errno == EINTR);
+		if (res == -1) {
+			printf ("send failed: %s\n", strerror (errno));
+			break;
+		}
+	}
+
+	free (frame);
+	return (NULL);
+}
+
+static int main_deliver_fn (int fd, int revents, void *data)
+{
+	static struct mmsghdr msgs[RECV_BATCH_MAX];
+	static struct iovec iov[RECV_BATCH_MAX];
+	static struct sockaddr_storage system_from[RECV_BATCH_MAX];
+	static char *buffers[RECV_BATCH_MAX];
+	int received;
+	int i;
+
+	for (i = 0; i < bench_batch; i++) {
+		if (buffers[i] == NULL) {
+			buffers[i] = frame_buffer_alloc ();
+			if (buffers[i] == NULL) {
+				return (-1);
+			}
+		}
+		iov[i].iov_base = buffers[i];
+		iov[i].iov_len = bench_frame_len + 1;
+		memset (&msgs[i], 0, sizeof (msgs[i]));
+		msgs[i].msg_hdr.msg_name = &system_from[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_storage);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	received = recvmmsg (fd, msgs, bench_batch, MSG_NOSIGNAL | MSG_DONTWAIT, NULL);
+	for (i = 0; i < received; i++) {
+		frame_process (buffers[i], msgs[i].msg_len);
+	}
+
+	return (0);
+}
+
+static void thread_deliver_fn (
+	void *context,
+	void *msg,
+	unsigned int msg_len,
+	const struct sockaddr_storage *system_from,
+	void **rx_buffer)
+{
+	frame_process (msg, msg_len);
+}
+
+static int bench_run (int use_thread)
+{
+	struct totemrx *rx = NULL;
+	struct totemrx_stats stats;
+	pthread_t producer;
+	uint64_t ns;
+	double sec;
+	int sndbuf = 4 * 1024 * 1024;
+
+	if (socketpair (AF_UNIX, SOCK_DGRAM, 0, sockets) == -1) {
+		printf ("socketpair failed: %s\n", strerror (errno));
+		return (-1);
+	}
+	(void)setsockopt (sockets[1], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof (sndbuf));
+
+	loop = qb_loop_create ();
+	if (loop == NULL) {
+		printf ("qb_loop_create failed\n");
+		return (-1);
+	}
+
+	frames_received = 0;
+	frames_misordered = 0;
+
+	if (use_thread) {
+		rx = totemrx_create (loop, sockets[0], RECV_QUEUE_LEN, bench_batch,
+			bench_frame_len + 1, frame_buffer_alloc, frame_buffer_release,
+			thread_deliver_fn, NULL, NULL);
+		if (rx == NULL) {
+			printf ("totemrx_create failed: %s\n", strerror (errno));
+			return (-1);
+		}
+	} else {
+		qb_loop_poll_add (loop, QB_LOOP_HIGH, sockets[0], POLLIN, NULL, main_deliver_fn);
+	}
+
+	ns = qb_util_nano_current_get ();
+	if (pthread_create (&producer, NULL, producer_thread, NULL) != 0) {
+		printf ("pthread_create failed\n");
+		return (-1);
+	}
+
+	qb_loop_run (loop);
+	ns = qb_util_nano_current_get () - ns;
+
+	pthread_join (producer, NULL);
+
+	sec = ns / 1000000000.0;
+	printf ("%-8s %10" PRIu64 " frames %8.3f s %12.0f frames/s %9.1f MB/s",
+		use_thread ? "thread" : "main", frames_received, sec,
+		frames_received / sec, frames_received * (double)bench_frame_len / sec / (1024 * 1024));
+
+	if (use_thread) {
+		totemrx_stats_get (rx, &stats);
+		printf (" %6.1f frames/wakeup %" PRIu64 " queue full",
+			stats.handoffs ? (double)stats.frames / stats.handoffs : 0.0,
+			stats.queue_full);
+		totemrx_destroy (rx);
+	} else {
+		qb_loop_poll_del (loop, sockets[0]);
+	}
+	printf ("\n");
+
+	qb_loop_destroy (loop);
+	close (sockets[0]);
+	close (sockets[1]);
+
+	if (frames_misordered) {
+		printf ("%" PRIu64 " frames out of order\n", frames_misordered);
+		return (-1);
+	}
+
+	return (0);
+}
+
+static void usage (const char *prog)
+{
+	printf ("%s [-n frames] [-s size] [-w work] [-b batch]\n", prog);
+	printf ("\n");
+	printf ("  -n  number of frames (default 1000000)\n");
+	printf ("  -s  frame size in bytes (default 1024)\n");
+	printf ("  -w  checksum passes over each frame (default 1)\n");
+	printf ("  -b  frames received with one call, 1-%d (default 8)\n", RECV_BATCH_MAX);
+}
+
+int main (int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt (argc, argv, "n:s:w:b:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			bench_frames = atoi (optarg);
+			break;
+		case 's':
+			bench_frame_len = atoi (optarg);
+			break;
+		case 'w':
+			bench_work = atoi (optarg);
+			break;
+		case 'b':
+			bench_batch = atoi (optarg);
+			break;
+		case 'h':
+		default:
+			usage (argv[0]);
+			exit (0);
+		}
+	}
+	if (bench_frames < 1 || bench_frame_len < sizeof (uint64_t) ||
+	    bench_batch < 1 || bench_batch > RECV_BATCH_MAX) {
+		usage (argv[0]);
+		exit (1);
+	}
+
+	printf ("%u frames of %u bytes, %u checksum passes, batch %u\n",
+		bench_frames, bench_frame_len, bench_work, bench_batch);
+
+	if (bench_run (0) != 0 || bench_run (1) != 0) {
+		exit (1);
+	}
+
+	return (0);
+}
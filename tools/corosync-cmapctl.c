@@ -425,6 +425,18 @@ static int print_iter(cmap_handle_t handle, const char *prefix)
 	cmap_value_types_t type;
 	cs_error_t err;
 	int no_result = 1;
+	struct cmap_bulk_item *items_buffer;
+	struct cmap_bulk_item *item;
+	size_t items_len;
+	size_t items;
+	size_t i;
+	int use_bulk = 1;
+
+	items_buffer = malloc(IPC_RESPONSE_SIZE);
+	if (items_buffer == NULL) {
+		fprintf(stderr, "Can't alloc memory\n");
+		exit(EXIT_FAILURE);
+	}
 
 	err = cmap_iter_init(handle, prefix, &iter_handle);
 	if (err != CS_OK) {
@@ -432,12 +444,42 @@ static int print_iter(cmap_handle_t handle, const char *prefix)
 		exit (EXIT_FAILURE);
 	}
 
-	while ((err = cmap_iter_next(handle, iter_handle, key_name, &value_len, &type)) == CS_OK) {
-		no_result = 0;
-		print_key(handle, key_name, value_len, NULL, type);
-	}
+	do {
+		/*
+		 * Get keys together with values in bulk. Key which doesn't fit
+		 * into the buffer is returned by cmap_iter_next, which is also
+		 * used with corosync not supporting cmap_iter_bulk.
+		 */
+		if (use_bulk) {
+			items_len = IPC_RESPONSE_SIZE;
+			err = cmap_iter_bulk(handle, iter_handle, items_buffer, &items_len, &items);
+			if (err == CS_OK) {
+				item = items_buffer;
+				for (i = 0; i < items; i++) {
+					no_result = 0;
+					print_key(handle, item->key_name, item->value_len,
+					    CMAP_BULK_ITEM_VALUE(item), item->type);
+					item = CMAP_BULK_ITEM_NEXT(item);
+				}
+				continue;
+			}
+			if (err == CS_ERR_NO_SECTIONS) {
+				break;
+			}
+			if (err != CS_ERR_TOO_BIG) {
+				use_bulk = 0;
+			}
+		}
+
+		err = cmap_iter_next(handle, iter_handle, key_name, &value_len, &type);
+		if (err == CS_OK) {
+			no_result = 0;
+			print_key(handle, key_name, value_len, NULL, type);
+		}
+	} while (err == CS_OK);
 
 	cmap_iter_finalize(handle, iter_handle);
+	free(items_buffer);
 	return no_result;
 }
 